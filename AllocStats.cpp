@@ -0,0 +1,222 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// AllocStats.cpp --- Accounting of heap allocations.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "AllocStats.h"
+
+AllocCounter AllocStats::s_sections[PROF_SECTION_COUNT + 1];
+
+// True on tracked threads.  The hooks run before any allocation, so
+// the flag must not need one itself.
+static thread_local bool g_tracked __attribute__((tls_model("initial-exec")));
+
+void AllocStats::trackThread(bool on)
+{
+  g_tracked = on;
+}
+
+bool AllocStats::tracked()
+{
+  return g_tracked;
+}
+
+void AllocStats::reset()
+{
+  memset(s_sections, 0, sizeof(s_sections));
+}
+
+AllocCounter AllocStats::total()
+{
+  AllocCounter sum = { 0, 0 };
+
+  for (const AllocCounter& c : s_sections) {
+    sum.calls += c.calls;
+    sum.bytes += c.bytes;
+  }
+
+  return sum;
+}
+
+const char *AllocStats::sectionName(ProfileSection s)
+{
+  return s == PROF_SECTION_COUNT ? "other" : Profile::name(s);
+}
+
+void AllocStats::printSummary()
+{
+  for (int i = 0; i <= PROF_SECTION_COUNT; ++i) {
+    const AllocCounter& c = s_sections[i];
+    if (c.calls > 0) {
+      fprintf(stderr, "quadcopter: %s: %llu allocations, %llu bytes\n",
+              sectionName((ProfileSection)i),
+              (unsigned long long)c.calls, (unsigned long long)c.bytes);
+    }
+  }
+}
+
+void AllocStats::record(size_t bytes)
+{
+  if (!g_tracked)
+    return;
+
+  AllocCounter& c = s_sections[Profile::current()];
+  ++c.calls;
+  c.bytes += bytes;
+}
+
+#ifdef QUADCOPTER_ALLOC_STATS
+
+//////////////////////////////////////////////////////////////////////
+// Allocation Hooks
+
+#ifdef __GLIBC__
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t align, size_t size);
+
+extern "C" void *malloc(size_t size)
+{
+  AllocStats::record(size);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+  AllocStats::record(n * size);
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+  AllocStats::record(size);
+  return __libc_realloc(p, size);
+}
+
+// The arenas and the frame scratch space are aligned blocks.
+extern "C" int posix_memalign(void **out, size_t align, size_t size)
+{
+  if (align < sizeof(void *) || (align & (align - 1)) != 0)
+    return EINVAL;
+
+  AllocStats::record(size);
+  void *p = __libc_memalign(align, size);
+  if (p == NULL)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+extern "C" void *aligned_alloc(size_t align, size_t size)
+{
+  AllocStats::record(size);
+  return __libc_memalign(align, size);
+}
+
+# define ALLOC_RAW(size) __libc_malloc(size)
+# define ALLOC_ALIGNED(align, size) __libc_memalign(align, size)
+#else
+# define ALLOC_RAW(size) malloc(size)
+# define ALLOC_ALIGNED(align, size) aligned_alloc(align, size)
+#endif   // defined __GLIBC__
+
+void *operator new(size_t size)
+{
+  AllocStats::record(size);
+
+  void *p = ALLOC_RAW(size > 0 ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  AllocStats::record(size);
+  return ALLOC_RAW(size > 0 ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+  free(p);
+}
+
+#ifdef __cpp_aligned_new
+
+void *operator new(size_t size, std::align_val_t align)
+{
+  AllocStats::record(size);
+
+  // aligned_alloc wants a multiple of the alignment.
+  size_t a = (size_t)align;
+  void *p = ALLOC_ALIGNED(a, size > 0 ? (size + a - 1) & ~(a - 1) : a);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+  return operator new(size, align);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept
+{
+  free(p);
+}
+
+#endif   // defined __cpp_aligned_new
+
+#endif   // defined QUADCOPTER_ALLOC_STATS
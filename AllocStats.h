@@ -0,0 +1,80 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// AllocStats.h --- Accounting of heap allocations.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_ALLOC_STATS_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_ALLOC_STATS_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Profile.h"
+
+// Number of heap allocations and the bytes requested.
+struct AllocCounter
+{
+  uint64_t calls;
+  uint64_t bytes;
+};
+
+// Global heap allocation accounting.  Allocations made by tracked
+// threads are charged to the profile section they were made from
+// (PROF_SECTION_COUNT, "other", outside all sections).
+//
+// Counting is compiled in when QUADCOPTER_ALLOC_STATS is defined
+// ("make ALLOC_STATS=1"), which replaces the global "operator new"
+// (and its aligned forms in C++17) and, with glibc, "malloc",
+// "calloc", "realloc", "posix_memalign" and "aligned_alloc" with
+// counting versions.  The replacements only take effect in programs
+// that link the plug-in directly, such as the benchmarks; V-REP's own
+// allocator is bound before the plug-in is loaded.
+class AllocStats
+{
+public:
+  // Return true if counting is compiled in.
+  static bool compiled()
+  {
+#ifdef QUADCOPTER_ALLOC_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Turn counting of the calling thread's allocations on or off.
+  // Sections are only tracked on the simulator thread.
+  static void trackThread(bool on = true);
+  static bool tracked();
+
+  // Clear all counters.
+  static void reset();
+
+  // Return the counters for a section, or PROF_SECTION_COUNT for
+  // allocations outside all sections.
+  static const AllocCounter& section(ProfileSection s)
+  {
+    return s_sections[s];
+  }
+
+  // Return the counters summed over all sections.
+  static AllocCounter total();
+
+  // Return the name of a section, "other" for PROF_SECTION_COUNT.
+  static const char *sectionName(ProfileSection s);
+
+  // Print the sections that allocated to stderr.
+  static void printSummary();
+
+  // Charge an allocation of "bytes" to the current section if the
+  // calling thread is tracked.  Called by the allocation hooks.
+  static void record(size_t bytes);
+
+private:
+  static AllocCounter s_sections[PROF_SECTION_COUNT + 1];
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_ALLOC_STATS_H_INCLUDED
@@ -0,0 +1,126 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// ApiStats.cpp --- Accounting of V-REP API calls.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <algorithm>
+
+#include "ApiStats.h"
+
+ApiCounters                ApiStats::s_sections[PROF_SECTION_COUNT + 1];
+std::map<int, ApiCounters> ApiStats::s_vehicles;
+ApiCounters               *ApiStats::s_vehicle = nullptr;
+
+static const char *g_api_names[API_FUNCTION_COUNT] = {
+  "simCreateBuffer",
+  "simGetIntegerParameter",
+  "simGetObjectChild",
+  "simGetObjectCustomData",
+  "simGetObjectCustomDataLength",
+  "simGetObjectMatrix",
+  "simGetObjectName",
+  "simGetObjectOrientation",
+  "simGetObjectPosition",
+  "simGetObjectUniqueIdentifier",
+  "simGetObjectVelocity",
+  "simGetObjects",
+  "simGetSimulationTime",
+  "simGetSimulationTimeStep",
+  "simGetVisionSensorDepthBuffer",
+  "simGetVisionSensorImage",
+  "simGetVisionSensorResolution",
+  "simLockInterface",
+  "simRegisterCustomLuaFunction",
+  "simReleaseBuffer",
+  "simResetDynamicObject",
+  "simSetIntegerParameter",
+  "simSetLastError",
+  "simSetObjectOrientation",
+  "simSetObjectPosition",
+  "simSetStringSignal",
+  "simTransformVector",
+};
+
+void ApiStats::reset()
+{
+  for (auto& c : s_sections)
+    c.clear();
+
+  // Counters may be in use by an active vehicle scope, so they are
+  // cleared rather than erased.
+  for (auto& v : s_vehicles)
+    v.second.clear();
+}
+
+const ApiCounters *ApiStats::findVehicle(int obj)
+{
+  auto it = s_vehicles.find(obj);
+  return it == s_vehicles.end() ? nullptr : &it->second;
+}
+
+const char *ApiStats::name(ApiFunction f)
+{
+  return g_api_names[f];
+}
+
+const char *ApiStats::sectionName(ProfileSection s)
+{
+  return s == PROF_SECTION_COUNT ? "other" : Profile::name(s);
+}
+
+void ApiStats::writeCSV(FILE *f)
+{
+  fprintf(f, "section,vehicle,function,calls,total_us,mean_ns\n");
+
+  for (int i = 0; i <= PROF_SECTION_COUNT; ++i) {
+    ProfileSection s = (ProfileSection)i;
+    writeCSVLines(f, sectionName(s), -1, s_sections[i]);
+  }
+
+  for (const auto& v : s_vehicles)
+    writeCSVLines(f, "all", v.first, v.second);
+}
+
+void ApiStats::writeCSVLines(FILE *f, const char *section, int vehicle,
+                             const ApiCounters& c)
+{
+  for (int i = 0; i < API_FUNCTION_COUNT; ++i) {
+    const ApiCounter& n = c.fn[i];
+    if (n.calls == 0)
+      continue;
+
+    double ns = Profile::toNanos((double)n.ticks);
+    fprintf(f, "%s,%d,%s,%llu,%.3f,%.1f\n",
+            section, vehicle, g_api_names[i], (unsigned long long)n.calls,
+            ns * 1e-3, ns / n.calls);
+  }
+}
+
+void ApiStats::printSummary()
+{
+  ApiCounters total;
+
+  for (const auto& c : s_sections) {
+    for (int i = 0; i < API_FUNCTION_COUNT; ++i) {
+      total.fn[i].calls += c.fn[i].calls;
+      total.fn[i].ticks += c.fn[i].ticks;
+    }
+  }
+
+  int order[API_FUNCTION_COUNT];
+  for (int i = 0; i < API_FUNCTION_COUNT; ++i)
+    order[i] = i;
+  std::sort(order, order + API_FUNCTION_COUNT, [&](int a, int b) {
+    return total.fn[a].ticks > total.fn[b].ticks;
+  });
+
+  for (int i = 0; i < 5 && total.fn[order[i]].calls > 0; ++i) {
+    const ApiCounter& n = total.fn[order[i]];
+    fprintf(stderr, "quadcopter: %s: %llu calls, %.3f ms\n",
+            g_api_names[order[i]], (unsigned long long)n.calls,
+            Profile::toNanos((double)n.ticks) * 1e-6);
+  }
+}
@@ -0,0 +1,234 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// ApiStats.h --- Accounting of V-REP API calls.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_API_STATS_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_API_STATS_H_INCLUDED
+
+#include <stdio.h>
+
+#include <map>
+
+#include "v_repLib.h"
+#include "Profile.h"
+
+// V-REP API functions called by the plug-in.
+enum ApiFunction
+{
+  API_simCreateBuffer,
+  API_simGetIntegerParameter,
+  API_simGetObjectChild,
+  API_simGetObjectCustomData,
+  API_simGetObjectCustomDataLength,
+  API_simGetObjectMatrix,
+  API_simGetObjectName,
+  API_simGetObjectOrientation,
+  API_simGetObjectPosition,
+  API_simGetObjectUniqueIdentifier,
+  API_simGetObjectVelocity,
+  API_simGetObjects,
+  API_simGetSimulationTime,
+  API_simGetSimulationTimeStep,
+  API_simGetVisionSensorDepthBuffer,
+  API_simGetVisionSensorImage,
+  API_simGetVisionSensorResolution,
+  API_simLockInterface,
+  API_simRegisterCustomLuaFunction,
+  API_simReleaseBuffer,
+  API_simResetDynamicObject,
+  API_simSetIntegerParameter,
+  API_simSetLastError,
+  API_simSetObjectOrientation,
+  API_simSetObjectPosition,
+  API_simSetStringSignal,
+  API_simTransformVector,
+  API_FUNCTION_COUNT
+};
+
+// Number of calls to an API function and the time spent in them.
+struct ApiCounter
+{
+  uint64_t     calls;
+  ProfileTicks ticks;
+};
+
+// Per-function counters for one section or vehicle.
+struct ApiCounters
+{
+  ApiCounters() { clear(); }
+
+  void clear() { memset(fn, 0, sizeof(fn)); }
+
+  ApiCounter fn[API_FUNCTION_COUNT];
+};
+
+// Global API call accounting.  Every call is charged to the profile
+// section it was made from and to the quadcopter it was made for, if
+// any.  API calls are only made from the simulator thread.
+//
+// Accounting is compiled in when QUADCOPTER_API_STATS is defined,
+// which the Makefile does unless building with "RELEASE=1".  In a
+// release build the API is called directly and nothing is recorded.
+class ApiStats
+{
+public:
+  // Return true if accounting is compiled in.
+  static bool compiled()
+  {
+#ifdef QUADCOPTER_API_STATS
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // Clear all counters.  Counters otherwise accumulate for as long
+  // as the plug-in is loaded, across simulations and scene changes.
+  static void reset();
+
+  // Record one call.
+  static void record(ApiFunction f, ProfileTicks t)
+  {
+    ApiCounter& s = s_sections[Profile::current()].fn[f];
+    ++s.calls;
+    s.ticks += t;
+
+    if (s_vehicle != nullptr) {
+      ApiCounter& v = s_vehicle->fn[f];
+      ++v.calls;
+      v.ticks += t;
+    }
+  }
+
+  // Return the counters of a section, or of calls made outside all
+  // sections for PROF_SECTION_COUNT.
+  static const ApiCounters& section(ProfileSection s) { return s_sections[s]; }
+
+  // Return the counters of the quadcopter with object handle "obj",
+  // creating them on first use.
+  static ApiCounters& vehicle(int obj) { return s_vehicles[obj]; }
+
+  // Return the counters of a quadcopter, or NULL if it has made no
+  // calls.
+  static const ApiCounters *findVehicle(int obj);
+
+  // Return the name of an API function or section.  Section
+  // PROF_SECTION_COUNT is "other".
+  static const char *name(ApiFunction f);
+  static const char *sectionName(ProfileSection s);
+
+  // Write all counters as CSV.
+  static void writeCSV(FILE *f);
+
+  // Print a summary of the busiest API functions to stderr.
+  static void printSummary();
+
+private:
+  friend class ApiVehicleScope;
+
+  static void writeCSVLines(FILE *f, const char *section, int vehicle,
+                            const ApiCounters& c);
+
+  static ApiCounters  s_sections[PROF_SECTION_COUNT + 1];
+  static std::map<int, ApiCounters> s_vehicles;
+  static ApiCounters *s_vehicle;
+};
+
+// Charges API calls in the enclosing scope to a vehicle's counters.
+class ApiVehicleScope
+{
+public:
+  explicit ApiVehicleScope(ApiCounters *c)
+    : m_prev(ApiStats::s_vehicle)
+  {
+    ApiStats::s_vehicle = c;
+  }
+
+  ~ApiVehicleScope() { ApiStats::s_vehicle = m_prev; }
+
+  ApiVehicleScope(const ApiVehicleScope&) = delete;
+  ApiVehicleScope& operator=(const ApiVehicleScope&) = delete;
+
+private:
+  ApiCounters *m_prev;
+};
+
+#ifdef QUADCOPTER_API_STATS
+
+// Times one API call.
+class ApiCallTimer
+{
+public:
+  explicit ApiCallTimer(ApiFunction f) : m_fn(f), m_start(profileNow()) {}
+  ~ApiCallTimer() { ApiStats::record(m_fn, profileNow() - m_start); }
+
+private:
+  ApiFunction  m_fn;
+  ProfileTicks m_start;
+};
+
+// Arguments are converted to the function's own parameter types at
+// the call site (so "NULL" still works as a pointer).
+template <typename T>
+struct ApiArg
+{
+  typedef T type;
+};
+
+template <typename R, typename... P>
+static inline R apiCall(ApiFunction f, R (*fn)(P...),
+                        typename ApiArg<P>::type... args)
+{
+  ApiCallTimer timer(f);
+  return fn(args...);
+}
+
+// Charge API calls in the rest of the enclosing scope to the
+// quadcopter with object handle "obj".
+#define API_VEHICLE_SCOPE(obj) \
+  ApiVehicleScope PROFILE_CONCAT(apiScope_, __LINE__)(&ApiStats::vehicle(obj))
+
+// Route every API call made by code after this header through
+// "apiCall".  The name inside each expansion is not expanded again,
+// so it refers to the real function.
+#define API_WRAP(f, ...) apiCall(API_##f, f, __VA_ARGS__)
+
+#define simCreateBuffer(...)               API_WRAP(simCreateBuffer, __VA_ARGS__)
+#define simGetIntegerParameter(...)        API_WRAP(simGetIntegerParameter, __VA_ARGS__)
+#define simGetObjectChild(...)             API_WRAP(simGetObjectChild, __VA_ARGS__)
+#define simGetObjectCustomData(...)        API_WRAP(simGetObjectCustomData, __VA_ARGS__)
+#define simGetObjectCustomDataLength(...)  API_WRAP(simGetObjectCustomDataLength, __VA_ARGS__)
+#define simGetObjectMatrix(...)            API_WRAP(simGetObjectMatrix, __VA_ARGS__)
+#define simGetObjectName(...)              API_WRAP(simGetObjectName, __VA_ARGS__)
+#define simGetObjectOrientation(...)       API_WRAP(simGetObjectOrientation, __VA_ARGS__)
+#define simGetObjectPosition(...)          API_WRAP(simGetObjectPosition, __VA_ARGS__)
+#define simGetObjectUniqueIdentifier(...)  API_WRAP(simGetObjectUniqueIdentifier, __VA_ARGS__)
+#define simGetObjectVelocity(...)          API_WRAP(simGetObjectVelocity, __VA_ARGS__)
+#define simGetObjects(...)                 API_WRAP(simGetObjects, __VA_ARGS__)
+#define simGetSimulationTime()             apiCall(API_simGetSimulationTime, simGetSimulationTime)
+#define simGetSimulationTimeStep()         apiCall(API_simGetSimulationTimeStep, simGetSimulationTimeStep)
+#define simGetVisionSensorDepthBuffer(...) API_WRAP(simGetVisionSensorDepthBuffer, __VA_ARGS__)
+#define simGetVisionSensorImage(...)       API_WRAP(simGetVisionSensorImage, __VA_ARGS__)
+#define simGetVisionSensorResolution(...)  API_WRAP(simGetVisionSensorResolution, __VA_ARGS__)
+#define simLockInterface(...)              API_WRAP(simLockInterface, __VA_ARGS__)
+#define simRegisterCustomLuaFunction(...)  API_WRAP(simRegisterCustomLuaFunction, __VA_ARGS__)
+#define simReleaseBuffer(...)              API_WRAP(simReleaseBuffer, __VA_ARGS__)
+#define simResetDynamicObject(...)         API_WRAP(simResetDynamicObject, __VA_ARGS__)
+#define simSetIntegerParameter(...)        API_WRAP(simSetIntegerParameter, __VA_ARGS__)
+#define simSetLastError(...)               API_WRAP(simSetLastError, __VA_ARGS__)
+#define simSetObjectOrientation(...)       API_WRAP(simSetObjectOrientation, __VA_ARGS__)
+#define simSetObjectPosition(...)          API_WRAP(simSetObjectPosition, __VA_ARGS__)
+#define simSetStringSignal(...)            API_WRAP(simSetStringSignal, __VA_ARGS__)
+#define simTransformVector(...)            API_WRAP(simTransformVector, __VA_ARGS__)
+
+#else
+
+#define API_VEHICLE_SCOPE(obj) do { } while (0)
+
+#endif   // defined QUADCOPTER_API_STATS
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_API_STATS_H_INCLUDED
@@ -0,0 +1,95 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Arena.h --- Contiguous, cache-line aligned storage referenced by index.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_ARENA_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_ARENA_H_INCLUDED
+
+#include <stdlib.h>
+
+#include <new>
+#include <utility>
+
+// Size of a cache line, to which arena storage and the state types
+// stored in arenas are aligned.
+#define ARENA_ALIGN 64
+
+// An array of "T" in one cache-line aligned block, so that walking it
+// touches consecutive cache lines.  Elements are referenced by index
+// because growing the arena moves them.  Storage is kept when the
+// arena is cleared, so refilling it to the same size does not
+// allocate.
+template <class T>
+class Arena
+{
+public:
+  Arena()
+    : m_data(nullptr), m_size(0), m_capacity(0)
+  {
+  }
+
+  ~Arena()
+  {
+    clear();
+    free(m_data);
+  }
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Destroy all elements.
+  void clear()
+  {
+    for (size_t i = 0; i < m_size; ++i)
+      m_data[i].~T();
+    m_size = 0;
+  }
+
+  // Make room for "n" elements.
+  void reserve(size_t n)
+  {
+    if (n <= m_capacity)
+      return;
+
+    void *p = nullptr;
+    if (posix_memalign(&p, ARENA_ALIGN, n * sizeof(T)) != 0)
+      throw std::bad_alloc();
+
+    T *data = (T *)p;
+    for (size_t i = 0; i < m_size; ++i) {
+      new (&data[i]) T(std::move(m_data[i]));
+      m_data[i].~T();
+    }
+
+    free(m_data);
+    m_data     = data;
+    m_capacity = n;
+  }
+
+  // Construct an element at the end, returning its index.
+  template <class... Args>
+  size_t add(Args&&... args)
+  {
+    if (m_size == m_capacity)
+      reserve(m_capacity > 0 ? m_capacity * 2 : 16);
+
+    new (&m_data[m_size]) T(std::forward<Args>(args)...);
+    return m_size++;
+  }
+
+  size_t size() const { return m_size; }
+
+  T& operator[](size_t i) { return m_data[i]; }
+  const T& operator[](size_t i) const { return m_data[i]; }
+
+private:
+  T     *m_data;
+  size_t m_size;
+  size_t m_capacity;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_ARENA_H_INCLUDED
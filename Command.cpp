@@ -0,0 +1,128 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Command.cpp --- Lock-free command queues for quadcopters.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <new>
+
+#include "Command.h"
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+              "command queues need lock-free atomics to be shared");
+
+//////////////////////////////////////////////////////////////////////
+// Command Queue
+
+void CommandQueue::init()
+{
+  head.store(0, std::memory_order_relaxed);
+  tail = 0;
+  for (uint32_t i = 0; i < COMMAND_QUEUE_SIZE; ++i)
+    slots[i].seq.store(i, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+bool CommandQueue::push(const Command& cmd)
+{
+  uint32_t pos = head.load(std::memory_order_relaxed);
+  Slot *slot;
+
+  for (;;) {
+    slot = &slots[pos & (COMMAND_QUEUE_SIZE - 1)];
+    uint32_t seq = slot->seq.load(std::memory_order_acquire);
+    int32_t  diff = (int32_t)(seq - pos);
+
+    if (diff == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1,
+                                     std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->cmd = cmd;
+  slot->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool CommandQueue::pop(Command& cmd)
+{
+  Slot *slot = &slots[tail & (COMMAND_QUEUE_SIZE - 1)];
+  if (slot->seq.load(std::memory_order_acquire) != tail + 1)
+    return false;
+
+  cmd = slot->cmd;
+  slot->seq.store(tail + COMMAND_QUEUE_SIZE, std::memory_order_release);
+  ++tail;
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Command Inbox
+
+static size_t roundUp64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+CommandInbox::CommandInbox()
+  : m_generation(0), m_count(0), m_header(nullptr), m_queues(nullptr)
+{
+}
+
+CommandInbox::~CommandInbox()
+{
+  release();
+}
+
+void CommandInbox::release()
+{
+  if (m_header == nullptr)
+    return;
+
+  // Tell producers the layout is going away.
+  m_header->magic.store(0, std::memory_order_release);
+  m_block.unmap();
+
+  m_header = nullptr;
+  m_queues = nullptr;
+  m_count  = 0;
+}
+
+bool CommandInbox::layout(const int *objects, size_t count)
+{
+  release();
+
+  size_t objectsOffset = roundUp64(sizeof(CommandInboxHeader));
+  size_t queuesOffset  = objectsOffset + roundUp64(count * sizeof(int32_t));
+  bool   ok = m_block.map(queuesOffset + count * sizeof(CommandQueue));
+  uint8_t *base = m_block.data();
+
+  m_count  = count;
+  m_header = new (base) CommandInboxHeader;
+  m_queues = (CommandQueue *)(base + queuesOffset);
+
+  m_header->magic.store(0, std::memory_order_relaxed);
+  m_header->version       = COMMAND_INBOX_VERSION;
+  m_header->count         = (uint32_t)count;
+  m_header->generation    = ++m_generation;
+  m_header->queueSize     = COMMAND_QUEUE_SIZE;
+  m_header->objectsOffset = (uint32_t)objectsOffset;
+  m_header->queuesOffset  = (uint32_t)queuesOffset;
+
+  int32_t *objs = (int32_t *)(base + objectsOffset);
+  for (size_t i = 0; i < count; ++i) {
+    objs[i] = objects[i];
+    new (&m_queues[i]) CommandQueue;
+    m_queues[i].init();
+  }
+
+  m_header->magic.store(COMMAND_INBOX_MAGIC, std::memory_order_release);
+  return ok;
+}
@@ -0,0 +1,162 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Command.h --- Lock-free command queues for quadcopters.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_COMMAND_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_COMMAND_H_INCLUDED
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+
+#include "SharedBlock.h"
+
+// Kinds of command.
+enum CommandType
+{
+  CMD_SETPOINT = 1,             // fly to (x, y, z) m with heading yaw rad
+  CMD_VELOCITY = 2,             // move the setpoint at (vx, vy, vz) m/s
+                                // and turn at yaw rate rad/s
+  CMD_MODE     = 3,             // switch to ControlMode "mode"
+};
+
+// How a quadcopter's setpoint is driven.
+enum ControlMode
+{
+  MODE_TARGET   = 0,            // follow the target object in the scene
+  MODE_VELOCITY = 1,            // move the target at the commanded velocity
+  MODE_IDLE     = 2,            // motors off
+  MODE_COUNT
+};
+
+// A command for one quadcopter.  "issued" is the CLOCK_MONOTONIC time
+// it was sent, which is shared by all processes on the machine, so
+// the latency from sending a command to applying it can be measured.
+struct Command
+{
+  uint32_t type;                // CommandType
+  uint32_t mode;                // ControlMode, for CMD_MODE
+  float    value[4];            // x, y, z, yaw or vx, vy, vz, yaw rate
+  uint64_t issued;              // ns, from "commandNow"
+};
+
+// Return the current CLOCK_MONOTONIC time in nanoseconds.
+static inline uint64_t commandNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Return true if every value of "cmd" is finite.  Commands with NaN
+// or infinite values are never applied.
+static inline bool commandFinite(const Command& cmd)
+{
+  for (float v : cmd.value) {
+    if (!isfinite(v))
+      return false;
+  }
+  return true;
+}
+
+// Number of commands a queue holds.  Must be a power of two.
+#define COMMAND_QUEUE_SIZE 32
+
+// Bounded queue with any number of producers and one consumer, the
+// simulator thread.  Each slot carries a sequence number saying
+// whether it is free for the producer of a given position or full
+// for the consumer, so producers only contend on "head" and never
+// wait for each other.  The queue holds no pointers and its atomics
+// are lock-free, so it works the same in shared memory mapped by
+// several processes.
+struct CommandQueue
+{
+  // Empty the queue.  Not safe while anyone is using it.
+  void init();
+
+  // Add a command.  Returns false if the queue is full.  Safe from
+  // any thread or process.
+  bool push(const Command& cmd);
+
+  // Remove the oldest command.  Returns false if the queue is empty.
+  // Consumer only.
+  bool pop(Command& cmd);
+
+  struct Slot
+  {
+    std::atomic<uint32_t> seq;
+    Command               cmd;
+  };
+
+  alignas(64) std::atomic<uint32_t> head;   // next position to fill
+  alignas(64) uint32_t              tail;   // next position to take
+  alignas(64) Slot                  slots[COMMAND_QUEUE_SIZE];
+};
+
+// Magic number and layout version at the start of an inbox.
+#define COMMAND_INBOX_MAGIC    0x51434d44u      // "QCMD"
+#define COMMAND_INBOX_VERSION  1
+
+// Header of an inbox in memory.  It is followed by the object handle
+// of each quadcopter ("count" int32 values, padded to 64 bytes) and
+// then by one CommandQueue per quadcopter in the same order.  "magic"
+// is zero while the inbox is being laid out, and "generation" changes
+// every time it is, so external producers know to look again.
+struct CommandInboxHeader
+{
+  std::atomic<uint32_t> magic;
+  uint32_t              version;
+  uint32_t              count;
+  uint32_t              generation;
+  uint32_t              queueSize;      // COMMAND_QUEUE_SIZE
+  uint32_t              objectsOffset;  // bytes from the header
+  uint32_t              queuesOffset;   // bytes from the header
+};
+
+// The command queues of every quadcopter in the scene, in one block
+// of memory.  If a name is given, the block is the POSIX shared
+// memory object of that name, so other processes can map it and
+// send commands.
+class CommandInbox
+{
+public:
+  CommandInbox();
+  ~CommandInbox();
+
+  CommandInbox(const CommandInbox&) = delete;
+  CommandInbox& operator=(const CommandInbox&) = delete;
+
+  // Use shared memory object "name" (such as "/quadcopter_commands")
+  // from the next "layout" on, or private memory if empty.
+  void setSharedName(const std::string& name) { m_block.setName(name); }
+
+  // Lay out empty queues for quadcopters with the given object
+  // handles.  Returns false if shared memory could not be set up, in
+  // which case private memory is used.
+  bool layout(const int *objects, size_t count);
+
+  // Return the number of queues.
+  size_t size() const { return m_count; }
+
+  // Return the queue at an index.
+  CommandQueue& queue(size_t i) { return m_queues[i]; }
+
+private:
+  void release();
+
+  SharedBlock         m_block;
+  uint32_t            m_generation;
+  size_t              m_count;
+  CommandInboxHeader *m_header;
+  CommandQueue       *m_queues;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_COMMAND_H_INCLUDED
@@ -15,6 +15,7 @@
 #include <memory>
 
 #include "v_repLib.h"
+#include "ApiStats.h"
 
 // A generic container of scene objects that satisfy some predicate.
 //
@@ -88,12 +89,21 @@ public:
       return i->second;
   }
 
+  // Look up an item by ID without taking a reference to it, returning
+  // NULL if it doesn't exist.  The pointer is valid until the next
+  // "rebuild" or "clear".
+  Item *find(int id) const
+  {
+    auto i = m_items.find(id);
+    return i == m_items.end() ? nullptr : i->second.get();
+  }
+
   // Call a member function of each item in the container.  I'm sure
   // we could use a variadic template here to allow passing arguments
   // to the function, but I don't think we're going to need it.
   void call(ItemMethod func)
   {
-    for (auto e : m_items) {
+    for (auto& e : m_items) {
       (e.second.get()->*func)();
     }
   }
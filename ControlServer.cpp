@@ -0,0 +1,412 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// ControlServer.cpp --- Binary control protocol for out-of-process
+// controllers over a Unix domain socket.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Command.h"
+#include "ControlServer.h"
+
+// Epoll data of the listening socket and the wakeup event.  Clients
+// use their slot index, with the connection serial in the upper half
+// so events left over from a closed connection are ignored.
+#define TAG_LISTEN  0xffffffffu
+#define TAG_EVENT   0xfffffffeu
+
+// Bytes read from a client at a time.
+#define READ_CHUNK  65536
+
+static uint64_t clientTag(uint32_t i, uint32_t serial)
+{
+  return (uint64_t)serial << 32 | i;
+}
+
+ControlServer::ControlServer()
+  : m_listen(-1), m_epoll(-1), m_event(-1), m_quit(false),
+    m_requests(0), m_rejected(0)
+{
+}
+
+ControlServer::~ControlServer()
+{
+  stop();
+}
+
+bool ControlServer::start(const std::string& path)
+{
+  stop();
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "quadcopter: control socket path '%s' is too long\n",
+            path.c_str());
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  m_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  m_epoll  = epoll_create1(EPOLL_CLOEXEC);
+  m_event  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  // A socket file left by a crashed run would make "bind" fail.
+  unlink(path.c_str());
+
+  struct epoll_event ev;
+  bool ok = m_listen >= 0 && m_epoll >= 0 && m_event >= 0 &&
+            bind(m_listen, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+            listen(m_listen, CONTROL_MAX_CLIENTS) == 0;
+  if (ok) {
+    ev.events   = EPOLLIN;
+    ev.data.u64 = TAG_LISTEN;
+    ok = epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_listen, &ev) == 0;
+  }
+  if (ok) {
+    ev.events   = EPOLLIN;
+    ev.data.u64 = TAG_EVENT;
+    ok = epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_event, &ev) == 0;
+  }
+
+  if (!ok) {
+    fprintf(stderr, "quadcopter: control socket '%s': %s\n",
+            path.c_str(), strerror(errno));
+    if (m_listen >= 0)
+      close(m_listen);
+    if (m_epoll >= 0)
+      close(m_epoll);
+    if (m_event >= 0)
+      close(m_event);
+    m_listen = m_epoll = m_event = -1;
+    return false;
+  }
+
+  m_path = path;
+  m_clients.assign(CONTROL_MAX_CLIENTS, Client());
+  for (Client& c : m_clients) {
+    c.fd     = -1;
+    c.serial = 0;
+    c.busy   = false;
+    c.events = 0;
+    c.sent   = 0;
+  }
+
+  m_quit.store(false, std::memory_order_relaxed);
+  m_thread = std::thread(&ControlServer::ioMain, this);
+  return true;
+}
+
+void ControlServer::stop()
+{
+  if (!running())
+    return;
+
+  m_quit.store(true, std::memory_order_release);
+  uint64_t one = 1;
+  if (write(m_event, &one, sizeof(one)) != sizeof(one))
+    perror("quadcopter: control socket");
+  m_thread.join();
+
+  for (uint32_t i = 0; i < m_clients.size(); ++i) {
+    if (m_clients[i].fd >= 0)
+      closeClient(i, false);
+  }
+  close(m_listen);
+  close(m_epoll);
+  close(m_event);
+  m_listen = m_epoll = m_event = -1;
+  unlink(m_path.c_str());
+
+  // Requests are only in the queues between calls, and the pool owns
+  // them all.
+  ControlRequest *r;
+  while (m_incoming.pop(r)) {}
+  while (m_outgoing.pop(r)) {}
+  m_clients.clear();
+  m_free.clear();
+  m_pool.clear();
+}
+
+ControlRequest *ControlServer::take()
+{
+  ControlRequest *r;
+  if (!m_incoming.pop(r))
+    return nullptr;
+
+  ++m_requests;
+  return r;
+}
+
+ControlState *ControlServer::startReply(ControlRequest *r,
+                                        const ControlStep& step)
+{
+  size_t n     = r->commands.size();
+  size_t first = sizeof(ControlHeader) + sizeof(ControlStep);
+  r->reply.assign(first + n * sizeof(ControlState), 0);
+
+  ControlHeader h;
+  h.length  = (uint32_t)r->reply.size();
+  h.type    = CTRL_STATE;
+  h.version = CONTROL_VERSION;
+  h.seq     = r->seq;
+  h.count   = (uint32_t)n;
+  memcpy(&r->reply[0], &h, sizeof(h));
+  memcpy(&r->reply[sizeof(h)], &step, sizeof(step));
+
+  return (ControlState *)&r->reply[first];
+}
+
+void ControlServer::reply(ControlRequest *r)
+{
+  // Every request in flight fits, since each client has at most one.
+  m_outgoing.push(r);
+
+  uint64_t one = 1;
+  if (write(m_event, &one, sizeof(one)) != sizeof(one))
+    perror("quadcopter: control socket");
+}
+
+void ControlServer::resetStats()
+{
+  m_requests = 0;
+  m_rejected.store(0, std::memory_order_relaxed);
+}
+
+void ControlServer::ioMain()
+{
+  struct epoll_event events[CONTROL_MAX_CLIENTS + 2];
+
+  while (!m_quit.load(std::memory_order_acquire)) {
+    int n = epoll_wait(m_epoll, events, CONTROL_MAX_CLIENTS + 2, -1);
+    if (n < 0 && errno != EINTR) {
+      perror("quadcopter: control socket");
+      return;
+    }
+
+    for (int k = 0; k < n; ++k) {
+      uint64_t tag = events[k].data.u64;
+
+      if (tag == TAG_LISTEN) {
+        accept();
+        continue;
+      }
+
+      if (tag == TAG_EVENT) {
+        uint64_t count;
+        if (read(m_event, &count, sizeof(count)) < 0 && errno != EAGAIN)
+          perror("quadcopter: control socket");
+        finishReplies();
+        continue;
+      }
+
+      uint32_t i = (uint32_t)tag;
+      Client&  c = m_clients[i];
+      if (c.fd < 0 || c.serial != (uint32_t)(tag >> 32))
+        continue;
+
+      uint32_t e = events[k].events;
+      if (e & EPOLLOUT)
+        writeClient(i);
+      if (c.fd >= 0 && (e & EPOLLIN))
+        readClient(i);
+      else if (c.fd >= 0 && (e & (EPOLLERR | EPOLLHUP)))
+        closeClient(i, false);
+    }
+  }
+}
+
+void ControlServer::accept()
+{
+  for (;;) {
+    int fd = accept4(m_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+
+    uint32_t i = 0;
+    while (i < m_clients.size() &&
+           (m_clients[i].fd >= 0 || m_clients[i].busy))
+      ++i;
+    if (i == m_clients.size()) {
+      close(fd);
+      continue;
+    }
+
+    Client& c = m_clients[i];
+    c.fd     = fd;
+    c.serial = c.serial + 1;
+    c.events = EPOLLIN;
+    c.sent   = 0;
+    c.in.clear();
+    c.out.clear();
+
+    struct epoll_event ev;
+    ev.events   = c.events;
+    ev.data.u64 = clientTag(i, c.serial);
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0)
+      closeClient(i, false);
+  }
+}
+
+void ControlServer::readClient(uint32_t i)
+{
+  Client& c = m_clients[i];
+
+  size_t  used = c.in.size();
+  c.in.resize(used + READ_CHUNK);
+  ssize_t n = read(c.fd, &c.in[used], READ_CHUNK);
+  c.in.resize(used + (n > 0 ? n : 0));
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    closeClient(i, false);
+    return;
+  }
+
+  parseClient(i);
+}
+
+void ControlServer::parseClient(uint32_t i)
+{
+  Client& c = m_clients[i];
+
+  // Nothing more is parsed until the last reply has been sent.
+  while (!c.busy && c.sent >= c.out.size() &&
+         c.in.size() >= sizeof(ControlHeader)) {
+    ControlHeader h;
+    memcpy(&h, &c.in[0], sizeof(h));
+
+    uint64_t expected = sizeof(h) + (uint64_t)h.count * sizeof(ControlCommand);
+    if (h.version != CONTROL_VERSION || h.type != CTRL_STEP ||
+        h.length != expected || h.length > CONTROL_MAX_MESSAGE) {
+      closeClient(i, true);
+      return;
+    }
+
+    if (c.in.size() < h.length)
+      break;
+
+    ControlRequest *r;
+    if (!m_free.empty()) {
+      r = m_free.back();
+      m_free.pop_back();
+    } else {
+      m_pool.emplace_back(new ControlRequest);
+      r = m_pool.back().get();
+    }
+
+    r->client   = i;
+    r->serial   = c.serial;
+    r->seq      = h.seq;
+    r->received = commandNow();
+    r->commands.resize(h.count);
+    if (h.count > 0) {
+      memcpy(&r->commands[0], &c.in[sizeof(h)],
+             h.count * sizeof(ControlCommand));
+    }
+    c.in.erase(c.in.begin(), c.in.begin() + h.length);
+
+    m_incoming.push(r);
+    c.busy = true;
+  }
+
+  watch(i);
+}
+
+void ControlServer::writeClient(uint32_t i)
+{
+  Client& c = m_clients[i];
+
+  while (c.sent < c.out.size()) {
+    ssize_t n = send(c.fd, &c.out[c.sent], c.out.size() - c.sent,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN)
+        break;
+      closeClient(i, false);
+      return;
+    }
+    c.sent += n;
+  }
+
+  // Requests held back while the reply was sent can go ahead.
+  if (c.sent == c.out.size()) {
+    c.out.clear();
+    c.sent = 0;
+    parseClient(i);
+  } else {
+    watch(i);
+  }
+}
+
+void ControlServer::finishReplies()
+{
+  ControlRequest *r;
+
+  while (m_outgoing.pop(r)) {
+    uint32_t i = r->client;
+    Client&  c = m_clients[i];
+    c.busy = false;
+
+    // Replies to connections that have since closed are dropped.
+    if (c.fd >= 0 && c.serial == r->serial) {
+      c.out.insert(c.out.end(), r->reply.begin(), r->reply.end());
+      writeClient(i);
+    }
+
+    m_free.push_back(r);
+  }
+}
+
+void ControlServer::watch(uint32_t i)
+{
+  Client& c = m_clients[i];
+  if (c.fd < 0)
+    return;
+
+  // A client's next request is not read until the last is answered
+  // and the reply sent, so a client that sends too fast or does not
+  // read its replies blocks instead of growing "in" or "out".
+  bool sending = c.sent < c.out.size();
+  uint32_t events = (c.busy || sending ? 0 : (uint32_t)EPOLLIN) |
+                    (sending ? (uint32_t)EPOLLOUT : 0);
+  if (events == c.events)
+    return;
+
+  struct epoll_event ev;
+  ev.events   = events;
+  ev.data.u64 = clientTag(i, c.serial);
+  if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, c.fd, &ev) == 0)
+    c.events = events;
+}
+
+void ControlServer::closeClient(uint32_t i, bool malformed)
+{
+  Client& c = m_clients[i];
+
+  epoll_ctl(m_epoll, EPOLL_CTL_DEL, c.fd, NULL);
+  close(c.fd);
+  c.fd     = -1;
+  c.events = 0;
+  c.sent   = 0;
+  c.in.clear();
+  c.out.clear();
+
+  if (malformed)
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+}
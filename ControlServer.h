@@ -0,0 +1,211 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// ControlServer.h --- Binary control protocol for out-of-process
+// controllers over a Unix domain socket.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_CONTROL_SERVER_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_CONTROL_SERVER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "SpscQueue.h"
+
+// Protocol version, carried in every message.
+#define CONTROL_VERSION  1
+
+// Largest message a client may send (bytes).
+#define CONTROL_MAX_MESSAGE  (4 << 20)
+
+// Clients served at once.  Each has at most one request in flight, so
+// the queues between the threads never fill up.
+#define CONTROL_MAX_CLIENTS  64
+#define CONTROL_QUEUE_SIZE   64
+
+// Kinds of message.
+enum ControlMessageType
+{
+  CTRL_STEP  = 1,               // client: commands, then ControlCommand[]
+  CTRL_STATE = 2,               // plug-in: ControlStep, then ControlState[]
+};
+
+// Every message starts with this header.  Values are in the byte
+// order of the machine, which both ends share.
+//
+// A client sends a CTRL_STEP request holding "count" commands, and
+// gets back a CTRL_STATE reply with the same "seq" holding the state
+// of the quadcopter named by each command, in the same order.  The
+// reply is sent at the start of the next simulation step: it carries
+// the state as of the end of the previous step, and the commands take
+// effect in the step that is starting.  A client may send its next
+// request before the reply arrives, but requests are taken one at a
+// time.  A malformed message closes the connection.
+struct ControlHeader
+{
+  uint32_t length;              // bytes in the message, with the header
+  uint16_t type;                // ControlMessageType
+  uint16_t version;             // CONTROL_VERSION
+  uint32_t seq;                 // chosen by the client, echoed back
+  uint32_t count;               // entries that follow
+};
+
+// A command in a CTRL_STEP request.  "type" is a CommandType, or 0 to
+// only ask for the quadcopter's state.
+struct ControlCommand
+{
+  int32_t  obj;                 // object handle of the quadcopter
+  uint32_t type;
+  uint32_t mode;                // ControlMode, for CMD_MODE
+  float    value[4];            // as in Command
+};
+
+// Bits of ControlState "status".
+enum ControlStatus
+{
+  CTRL_FOUND  = 1,              // the quadcopter exists
+  CTRL_QUEUED = 2,              // the command was queued
+};
+
+// The step a CTRL_STATE reply describes.
+struct ControlStep
+{
+  uint64_t step;                // step index of the frame
+  double   time;                // simulation time (s)
+};
+
+// State of one quadcopter in a CTRL_STATE reply.  Everything but
+// "obj" and "status" is zero if the quadcopter was not found.
+struct ControlState
+{
+  int32_t  obj;
+  uint16_t status;              // ControlStatus bits
+  uint16_t mode;                // ControlMode
+  double   lat;                 // GPS fix (deg)
+  double   lon;                 // deg
+  double   altitude;            // m
+  float    pose[12];            // 3x4 world transform of the body
+  float    velocity[3];         // world frame (m/s)
+  float    angVel[3];           // world frame (rad/s)
+  float    accel[3];            // m/s^2
+  float    gyro[3];             // rad/s
+  float    pressure;            // Pa
+  float    magField[3];         // uT
+  float    agl;                 // m
+  float    rangeDown;           // m
+};
+
+static_assert(sizeof(ControlHeader) == 16, "ControlHeader must be packed");
+static_assert(sizeof(ControlCommand) == 28, "ControlCommand must be packed");
+static_assert(sizeof(ControlState) == 152, "ControlState must be packed");
+
+// A request handed from the I/O thread to the simulator thread, and
+// back again with its reply.
+struct ControlRequest
+{
+  uint32_t                    client;   // slot of the connection
+  uint32_t                    serial;   // connection in that slot
+  uint32_t                    seq;
+  uint64_t                    received; // CLOCK_MONOTONIC ns
+  std::vector<ControlCommand> commands;
+  std::vector<uint8_t>        reply;    // whole CTRL_STATE message
+};
+
+// Server for controllers in other processes.  An I/O thread accepts
+// connections on a Unix domain socket and reads requests with an
+// epoll loop, and passes them to the simulator thread through a
+// lock-free queue.  The simulator thread answers them once per step
+// and passes them back through another, waking the I/O thread to
+// send the replies, so it never waits on a socket.
+class ControlServer
+{
+public:
+  ControlServer();
+  ~ControlServer();
+
+  ControlServer(const ControlServer&) = delete;
+  ControlServer& operator=(const ControlServer&) = delete;
+
+  // Listen on the socket at "path", replacing any stale socket file,
+  // and start the I/O thread.  Returns false on failure.
+  bool start(const std::string& path);
+
+  // Stop the I/O thread, close every connection and remove the
+  // socket file.
+  void stop();
+
+  bool running() const { return m_thread.joinable(); }
+
+  // Return the next request, or NULL if there is none.  Simulator
+  // thread only.
+  ControlRequest *take();
+
+  // Size "r"'s reply for all of its commands and return its state
+  // entries, zeroed, to be filled in before "reply".
+  static ControlState *startReply(ControlRequest *r, const ControlStep& step);
+
+  // Hand "r" back to be sent.  Simulator thread only.
+  void reply(ControlRequest *r);
+
+  // Return the number of requests taken and the number of connections
+  // closed for malformed messages.
+  uint64_t requests() const { return m_requests; }
+  uint64_t rejected() const
+  {
+    return m_rejected.load(std::memory_order_relaxed);
+  }
+
+  void resetStats();
+
+private:
+  // A connection.  "busy" while its request is with the simulator
+  // thread; the slot is not reused until the request comes back.
+  struct Client
+  {
+    int                  fd;            // -1 if the slot is free
+    uint32_t             serial;
+    bool                 busy;
+    uint32_t             events;        // epoll events watched
+    std::vector<uint8_t> in;            // bytes not yet parsed
+    std::vector<uint8_t> out;           // bytes not yet sent
+    size_t               sent;
+  };
+
+  void ioMain();
+  void accept();
+  void readClient(uint32_t i);
+  void parseClient(uint32_t i);
+  void writeClient(uint32_t i);
+  void finishReplies();
+  void watch(uint32_t i);
+  void closeClient(uint32_t i, bool malformed);
+
+  std::string       m_path;
+  int               m_listen;
+  int               m_epoll;
+  int               m_event;
+  std::atomic<bool> m_quit;
+  std::thread       m_thread;
+
+  // Owned by the I/O thread while it runs.
+  std::vector<Client>                          m_clients;
+  std::vector<std::unique_ptr<ControlRequest>> m_pool;
+  std::vector<ControlRequest *>                m_free;
+
+  SpscQueue<ControlRequest *, CONTROL_QUEUE_SIZE> m_incoming;
+  SpscQueue<ControlRequest *, CONTROL_QUEUE_SIZE> m_outgoing;
+
+  uint64_t              m_requests;
+  std::atomic<uint64_t> m_rejected;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_CONTROL_SERVER_H_INCLUDED
@@ -0,0 +1,143 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// CustomData.cpp --- Reading plug-in fields from object custom data.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdexcept>
+
+#include "v_repLib.h"
+#include "ApiStats.h"
+#include "CustomData.h"
+
+// Read a little endian integer from an iterator.  If the distance
+// between "start" and "end" is too small, this throws an exception.
+// The "start" iterator is modified to point at the next byte
+// following the integer that was read.
+static uint32_t parseUint32(byte_vector::const_iterator& p,
+                            byte_vector::const_iterator end)
+{
+  if (end - p < 4)
+    throw std::runtime_error("custom data format error");
+
+  uint32_t result = (((uint32_t) p[0] << 0)  |
+                     ((uint32_t) p[1] << 8)  |
+                     ((uint32_t) p[2] << 16) |
+                     ((uint32_t) p[3] << 24));
+
+  p += 4;
+  return result;
+}
+
+// Parse a custom data buffer into a list of fields.
+CustomData parseCustomData(const std::vector<uint8_t>& buf)
+{
+  CustomData result;
+  auto p = buf.begin();
+  auto end = buf.end();
+
+  while (p != end) {
+    uint32_t id  = parseUint32(p, end);
+    uint32_t len = parseUint32(p, end);
+    result[id]   = byte_vector(p, p + len);
+    p += len;
+  }
+
+  return result;
+}
+
+// Custom data of the object being read, and the breadth-first search
+// queue.  These are reused so that lookups do not allocate once they
+// have grown to fit the scene.  Custom data is only read from the
+// simulator thread.
+static byte_vector      g_buf;
+static std::vector<int> g_queue;
+
+// Read an object's custom data into "g_buf" and find a field in it.
+// Returns false if the object does not have the field, otherwise sets
+// "first" and "last" to the field's contents.  Throws
+// "std::runtime_error" if the data is malformed.
+static bool findCustomDataField(int obj, uint32_t field,
+                                byte_vector::const_iterator& first,
+                                byte_vector::const_iterator& last)
+{
+  int size = simGetObjectCustomDataLength(obj, DATA_ID);
+  if (size <= 0)
+    return false;
+
+  g_buf.resize(size);
+  simGetObjectCustomData(obj, DATA_ID, (simChar *)&g_buf[0]);
+
+  auto p = g_buf.cbegin();
+  auto end = g_buf.cend();
+
+  // Later fields replace earlier ones with the same ID, as in
+  // "parseCustomData".
+  bool found = false;
+  while (p != end) {
+    uint32_t id  = parseUint32(p, end);
+    uint32_t len = parseUint32(p, end);
+    if ((uint32_t)(end - p) < len)
+      throw std::runtime_error("custom data format error");
+
+    if (id == field) {
+      first = p;
+      last  = p + len;
+      found = true;
+    }
+    p += len;
+  }
+
+  return found;
+}
+
+// Read the contents of a custom data field of an object into "out".
+// Returns false if the object does not have the field.
+bool getCustomDataField(int obj, uint32_t field, byte_vector& out)
+{
+  byte_vector::const_iterator first, last;
+
+  if (!findCustomDataField(obj, field, first, last))
+    return false;
+
+  out.assign(first, last);
+  return true;
+}
+
+// Return true if an object contains a custom data field.
+bool hasCustomDataField(int obj, uint32_t field)
+{
+  byte_vector::const_iterator first, last;
+  return findCustomDataField(obj, field, first, last);
+}
+
+// Search an object tree for an object that has the specified custom
+// data field.  Returns the first matching object ID or -1 if no child
+// object with that field is found.  The search is performed in
+// breadth-first order.
+int searchCustomDataField(int root, uint32_t field)
+{
+  std::vector<int>& q = g_queue;
+  q.clear();
+  q.push_back(root);
+
+  for (size_t head = 0; head < q.size(); ++head) {
+    int obj = q[head];
+
+    if (hasCustomDataField(obj, field))
+      return obj;
+
+    int i = 0;
+    for (;;) {
+      int child = simGetObjectChild(obj, i++);
+      if (child == -1)
+        break;
+
+      q.push_back(child);
+    }
+  }
+
+  return -1;
+}
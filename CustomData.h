@@ -0,0 +1,62 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// CustomData.h --- Reading plug-in fields from object custom data.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_CUSTOM_DATA_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_CUSTOM_DATA_H_INCLUDED
+
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+// Header number for our custom data.
+#define DATA_ID 1000
+
+// Our custom data is stored in the same format as the V-REP plug-in
+// tutorial:
+//
+// 1000,{field_id,field_len,int x field_len}*
+//
+// with each integer stored as 4 little endian bytes.
+
+// Field IDs for our custom data.
+#define FIELD_QUADCOPTER     0
+#define FIELD_MOTOR_0        1
+#define FIELD_MOTOR_1        2
+#define FIELD_MOTOR_2        3
+#define FIELD_MOTOR_3        4
+#define FIELD_CAMERA_DOWN    5
+#define FIELD_CAMERA_FRONT   6
+#define FIELD_BODY           7
+#define FIELD_TARGET         8
+#define FIELD_GPS_CONFIG     9
+
+// Shorthand for a vector of bytes.
+typedef std::vector<uint8_t> byte_vector;
+
+// Mapping of field IDs to their data.
+typedef std::map<uint32_t, byte_vector> CustomData;
+
+// Parse a custom data buffer into a list of fields.  Throws
+// "std::runtime_error" if the buffer is malformed.
+CustomData parseCustomData(const std::vector<uint8_t>& buf);
+
+// Read the contents of a custom data field of an object into "out".
+// Returns false if the object does not have the field.
+bool getCustomDataField(int obj, uint32_t field, byte_vector& out);
+
+// Return true if an object contains a custom data field.
+bool hasCustomDataField(int obj, uint32_t field);
+
+// Search an object tree for an object that has the specified custom
+// data field.  Returns the first matching object ID or -1 if no child
+// object with that field is found.  The search is performed in
+// breadth-first order.
+int searchCustomDataField(int root, uint32_t field);
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_CUSTOM_DATA_H_INCLUDED
@@ -0,0 +1,52 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// FlightControl.cpp --- PID control law of the quadcopter.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include "FlightControl.h"
+
+FlightController::FlightController()
+  : vertPID     ( 2.0f,   0.0f,  0.0f, -1.0f,   1.0f),
+    alphaStabPID( 0.25f,  0.0f,  2.1f, -10.0f, 10.0f),
+    alphaMovePID( 0.005f, 0.0f,  1.0f, -10.0f, 10.0f),
+    betaStabPID (-0.25f,  0.0f, -2.1f, -10.0f, 10.0f),
+    betaMovePID (-0.005f, 0.0f, -1.0f, -10.0f, 10.0f),
+    rotPID      ( 0.1f,   0.0f,  2.0f, -1.0f,   1.0f)
+{
+}
+
+void FlightController::reset()
+{
+  vertPID.reset();
+  alphaStabPID.reset();
+  alphaMovePID.reset();
+  betaStabPID.reset();
+  betaMovePID.reset();
+  rotPID.reset();
+}
+
+void FlightController::run(const FlightControlInput& in, float *motors)
+{
+  // Vertical control:
+  // NOTE: The magic number 5.335f is our estimated hover velocity?
+  float thrust = (5.335f - in.vz) + vertPID.run(in.targetZ, in.z);
+
+  // Horizontal control, stabilization:
+  float alphaCorr = alphaStabPID.run(in.yAxisZ, in.z);
+  float betaCorr  = betaStabPID.run(in.xAxisZ, in.z);
+
+  // move towards target:
+  alphaCorr += alphaMovePID.run(in.targetY, 0.0f);
+  betaCorr  += betaMovePID.run(in.targetX, 0.0f);
+
+  // Rotational control:
+  float rotCorr = rotPID.run(in.yaw, 0.0f);
+
+  motors[0] = thrust * (1.0f - alphaCorr + betaCorr + rotCorr);
+  motors[1] = thrust * (1.0f - alphaCorr - betaCorr - rotCorr);
+  motors[2] = thrust * (1.0f + alphaCorr - betaCorr + rotCorr);
+  motors[3] = thrust * (1.0f + alphaCorr + betaCorr - rotCorr);
+}
@@ -0,0 +1,50 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// FlightControl.h --- PID control law of the quadcopter.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_FLIGHT_CONTROL_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_FLIGHT_CONTROL_H_INCLUDED
+
+#include "PID.h"
+
+// Measurements the control law runs on, as the plug-in reads them
+// from the scene each step.  Nothing here depends on V-REP, so the
+// same controller can fly a standalone model.
+struct FlightControlInput
+{
+  float targetZ;                // target altitude (m)
+  float z;                      // body altitude (m)
+  float vz;                     // vertical velocity (m/s)
+  float xAxisZ;                 // altitude of the points 1 m along the
+  float yAxisZ;                 //   body's X and Y axes (m)
+  float targetX;                // target position in the body frame (m)
+  float targetY;
+  float yaw;                    // heading relative to the target (rad)
+};
+
+// The quadcopter's controllers: thrust from the altitude error,
+// roll and pitch from the tilt and the direction of the target, and
+// yaw from the heading error.  Runs once per simulation step.
+struct FlightController
+{
+  FlightController();
+
+  // Reset the controllers when the simulation is started.
+  void reset();
+
+  // Compute the four motor velocities.
+  void run(const FlightControlInput& in, float *motors);
+
+  PID vertPID;
+  PID alphaStabPID;
+  PID alphaMovePID;
+  PID betaStabPID;
+  PID betaMovePID;
+  PID rotPID;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_FLIGHT_CONTROL_H_INCLUDED
@@ -0,0 +1,254 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// FlightRecorder.cpp --- Ring buffer of recent events and step watchdog.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "v_repLib.h"
+#include "FlightRecorder.h"
+
+// The ring starts out in static storage and moves to "g_ring" when
+// it grows.
+static RecorderEvent              g_initial_ring[RECORDER_MIN_EVENTS];
+static std::vector<RecorderEvent> g_ring;
+
+RecorderEvent *FlightRecorder::s_ring = g_initial_ring;
+uint64_t       FlightRecorder::s_mask = RECORDER_MIN_EVENTS - 1;
+uint64_t       FlightRecorder::s_head = 0;
+
+static const char *g_event_names[REC_EVENT_TYPE_COUNT] = {
+  "message",
+  "rebuild",
+  "readSensors",
+  "pidControl",
+  "logFlush",
+  "overrun",
+};
+
+// Configuration.
+static ProfileTicks g_budget;           // 0 if the watchdog is off
+static ProfileTicks g_history;
+static double       g_history_seconds;
+static std::string  g_dump_prefix = "quadcopter_overrun";
+
+// Ticks per second, from the profile clock calibration.
+static double ticksPerSecond()
+{
+  return 1e9 / Profile::toNanos(1.0);
+}
+
+// State shared with the dump thread.  The snapshot is allocated up
+// front so taking one never allocates; the simulator thread only
+// touches it while no dump is in progress.
+static std::mutex              g_dump_mutex;
+static std::condition_variable g_dump_wake;
+static std::thread             g_dump_thread;
+static std::vector<RecorderEvent> g_snapshot;
+static size_t                  g_snapshot_size;
+static ProfileTicks            g_snapshot_time;
+static bool                    g_snapshot_truncated;
+static bool                    g_dump_pending;
+static bool                    g_dump_quit;
+static unsigned                g_dump_count;
+
+// Earliest time the next dump may be taken, so dumps do not overlap.
+static ProfileTicks g_next_dump;
+
+// Time of an event relative to "at" (ms).
+static double relativeMillis(const RecorderEvent& e, ProfileTicks at)
+{
+  return Profile::toNanos((double)(int64_t)(e.time - at)) * 1e-6;
+}
+
+static void writeDump(const RecorderEvent *events, size_t n,
+                      ProfileTicks at, bool truncated, unsigned seq)
+{
+  char filename[256];
+  snprintf(filename, sizeof(filename), "%s_%u.csv",
+           g_dump_prefix.c_str(), seq);
+
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "quadcopter: cannot write '%s'\n", filename);
+    return;
+  }
+
+  // Times are relative to the overrun; durations are in
+  // microseconds.  A ring too small for the whole history is noted
+  // first.
+  if (truncated && n > 0)
+    fprintf(f, "# truncated: events before %.3f ms were overwritten\n",
+            relativeMillis(events[0], at));
+  fprintf(f, "time_ms,event,id,value\n");
+
+  for (size_t i = 0; i < n; ++i) {
+    const RecorderEvent& e = events[i];
+    double t = relativeMillis(e, at);
+
+    if (e.type == REC_LOG_FLUSH)
+      fprintf(f, "%.3f,%s,%d,%lld\n", t, g_event_names[e.type], e.id,
+              (long long)e.value);
+    else
+      fprintf(f, "%.3f,%s,%d,%.3f\n", t, g_event_names[e.type], e.id,
+              Profile::toNanos((double)e.value) * 1e-3);
+  }
+
+  fclose(f);
+  fprintf(stderr, "quadcopter: step overrun, %zu events%s written to '%s'\n",
+          n, truncated ? " (truncated)" : "", filename);
+}
+
+static void dumpMain()
+{
+  std::unique_lock<std::mutex> lock(g_dump_mutex);
+
+  for (;;) {
+    g_dump_wake.wait(lock, [] { return g_dump_quit || g_dump_pending; });
+    if (!g_dump_pending)
+      return;
+
+    size_t       n         = g_snapshot_size;
+    ProfileTicks at        = g_snapshot_time;
+    bool         truncated = g_snapshot_truncated;
+    unsigned     seq       = g_dump_count;
+
+    // The snapshot is not touched by the simulator thread until
+    // "g_dump_pending" is cleared.
+    lock.unlock();
+    writeDump(&g_snapshot[0], n, at, truncated, seq);
+    lock.lock();
+
+    g_dump_pending = false;
+    g_dump_wake.notify_all();
+  }
+}
+
+void FlightRecorder::init()
+{
+  double budget_ms = 100.0, seconds = 5.0;
+
+  const char *env = getenv("QUADCOPTER_STEP_BUDGET_MS");
+  if (env != NULL && *env != '\0')
+    budget_ms = atof(env);
+
+  env = getenv("QUADCOPTER_RECORDER_SECONDS");
+  if (env != NULL && atof(env) > 0.0)
+    seconds = atof(env);
+
+  env = getenv("QUADCOPTER_RECORDER_FILE");
+  if (env != NULL && *env != '\0')
+    g_dump_prefix = env;
+
+  g_budget    = budget_ms > 0.0 ? (ProfileTicks)(budget_ms * 1e-3 * ticksPerSecond()) : 0;
+  g_history   = (ProfileTicks)(seconds * ticksPerSecond());
+  g_history_seconds = seconds;
+  g_next_dump = 0;
+
+  if (g_budget == 0)
+    return;
+
+  g_snapshot.resize(s_mask + 1);
+  g_dump_pending = false;
+  g_dump_quit    = false;
+  g_dump_thread  = std::thread(dumpMain);
+}
+
+void FlightRecorder::shutdown()
+{
+  if (!g_dump_thread.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(g_dump_mutex);
+    g_dump_quit = true;
+  }
+
+  g_dump_wake.notify_one();
+  g_dump_thread.join();
+}
+
+void FlightRecorder::reserve(size_t vehicles, float stepSeconds)
+{
+  // Without the watchdog nothing is ever dumped.
+  if (g_budget == 0 || stepSeconds <= 0.0f)
+    return;
+
+  double want = (RECORDER_VEHICLE_EVENTS * (double)vehicles +
+                 RECORDER_STEP_EVENTS) * g_history_seconds / stepSeconds;
+  uint64_t size = s_mask + 1;
+  while (size < want && size < RECORDER_MAX_EVENTS)
+    size *= 2;
+  if (size == s_mask + 1)
+    return;
+
+  // The snapshot is in use until a dump in progress is written.
+  std::unique_lock<std::mutex> lock(g_dump_mutex);
+  g_dump_wake.wait(lock, [] { return !g_dump_pending; });
+
+  std::vector<RecorderEvent> ring(size);
+  uint64_t avail = s_head < s_mask + 1 ? s_head : s_mask + 1;
+  for (uint64_t i = s_head - avail; i < s_head; ++i)
+    ring[i & (size - 1)] = s_ring[i & s_mask];
+
+  g_ring.swap(ring);
+  s_ring = &g_ring[0];
+  s_mask = size - 1;
+  g_snapshot.resize(size);
+}
+
+void FlightRecorder::message(int msg, ProfileTicks start)
+{
+  ProfileTicks duration = profileNow() - start;
+  record(REC_MESSAGE, msg, (int64_t)duration);
+
+  if (msg == sim_message_eventcallback_modulehandle &&
+      g_budget != 0 && duration > g_budget)
+    overrun(msg, duration);
+}
+
+void FlightRecorder::overrun(int msg, ProfileTicks duration)
+{
+  record(REC_OVERRUN, msg, (int64_t)duration);
+
+  ProfileTicks now = profileNow();
+  if (now < g_next_dump)
+    return;
+
+  std::unique_lock<std::mutex> lock(g_dump_mutex, std::try_to_lock);
+  if (!lock.owns_lock() || g_dump_pending)
+    return;
+
+  // Copy out events from the history window, oldest first.  If the
+  // oldest event kept is inside the window, older ones were
+  // overwritten.
+  uint64_t avail = s_head < s_mask + 1 ? s_head : s_mask + 1;
+  uint64_t first = s_head - avail;
+
+  while (first < s_head && now - s_ring[first & s_mask].time > g_history)
+    ++first;
+
+  size_t n = 0;
+  for (uint64_t i = first; i < s_head; ++i)
+    g_snapshot[n++] = s_ring[i & s_mask];
+
+  g_snapshot_size      = n;
+  g_snapshot_time      = now;
+  g_snapshot_truncated = first == s_head - avail && s_head > s_mask + 1;
+  g_dump_pending  = true;
+  ++g_dump_count;
+  g_next_dump     = now + g_history;
+
+  lock.unlock();
+  g_dump_wake.notify_one();
+}
@@ -0,0 +1,124 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// FlightRecorder.h --- Ring buffer of recent events and step watchdog.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_FLIGHT_RECORDER_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_FLIGHT_RECORDER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Profile.h"
+
+// Bounds on the number of events kept.  Powers of two.
+#define RECORDER_MIN_EVENTS 65536
+#define RECORDER_MAX_EVENTS (1 << 22)
+
+// Events expected per simulation step: each quadcopter's sensor read
+// and PID run, and the messages of the step.
+#define RECORDER_VEHICLE_EVENTS 2
+#define RECORDER_STEP_EVENTS    8
+
+// Kinds of recorded events.
+enum RecorderEventType
+{
+  REC_MESSAGE,                  // id: message, value: duration (ticks)
+  REC_REBUILD,                  // id: quadcopters, value: duration
+  REC_READ_SENSORS,             // id: quadcopter, value: duration
+  REC_PID_CONTROL,              // id: quadcopter, value: duration
+  REC_LOG_FLUSH,                // id: quadcopter, value: bytes
+  REC_OVERRUN,                  // id: message, value: duration
+  REC_EVENT_TYPE_COUNT
+};
+
+struct RecorderEvent
+{
+  ProfileTicks time;            // when the event ended
+  int64_t      value;
+  int32_t      type;
+  int32_t      id;
+};
+
+// Always-on flight recorder.  The simulator thread records events
+// into a ring buffer, sized for the swarm whenever the scene changes
+// or a simulation starts.  When handling a simulation step takes
+// longer than the step budget, the events of the last few seconds are
+// copied out and written to a file by a background thread, so the
+// simulator is not held up by the disk.
+//
+// Configured from the environment at startup:
+//
+//   QUADCOPTER_STEP_BUDGET_MS   step budget (default 100, 0 disables)
+//   QUADCOPTER_RECORDER_SECONDS seconds of history dumped (default 5)
+//   QUADCOPTER_RECORDER_FILE    dump file prefix
+//                               (default "quadcopter_overrun")
+class FlightRecorder
+{
+public:
+  // Read the configuration and start the dump thread.
+  static void init();
+
+  // Stop the dump thread, finishing any dump in progress.
+  static void shutdown();
+
+  // Grow the ring to hold the configured seconds of history for
+  // "vehicles" quadcopters stepped every "stepSeconds" in real time,
+  // up to RECORDER_MAX_EVENTS.  Events already recorded are kept.
+  // Simulator thread only; waits for a dump in progress.
+  static void reserve(size_t vehicles, float stepSeconds);
+
+  // Record an event.  Simulator thread only.
+  static void record(RecorderEventType type, int id, int64_t value)
+  {
+    RecorderEvent& e = s_ring[s_head & s_mask];
+    e.time  = profileNow();
+    e.value = value;
+    e.type  = type;
+    e.id    = id;
+    ++s_head;
+  }
+
+  // Record a handled message that started at "start", checking
+  // simulation steps against the budget.
+  static void message(int msg, ProfileTicks start);
+
+private:
+  static void overrun(int msg, ProfileTicks duration);
+
+  static RecorderEvent *s_ring;
+  static uint64_t       s_mask;
+  static uint64_t       s_head;
+};
+
+// Records the duration of the enclosing scope as an event.
+class RecorderScope
+{
+public:
+  RecorderScope(RecorderEventType type, int id)
+    : m_type(type), m_id(id), m_start(profileNow())
+  {
+  }
+
+  ~RecorderScope()
+  {
+    FlightRecorder::record(m_type, m_id, (int64_t)(profileNow() - m_start));
+  }
+
+  RecorderScope(const RecorderScope&) = delete;
+  RecorderScope& operator=(const RecorderScope&) = delete;
+
+private:
+  RecorderEventType m_type;
+  int               m_id;
+  ProfileTicks      m_start;
+};
+
+// Record the duration of the rest of the enclosing scope.
+#define RECORDER_SCOPE(type, id) \
+  RecorderScope PROFILE_CONCAT(recorderScope_, __LINE__)(type, id)
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_FLIGHT_RECORDER_H_INCLUDED
@@ -0,0 +1,120 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Frame.cpp --- Values shared by every quadcopter during one step.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "Arena.h"
+#include "Frame.h"
+
+// Size of the first scratch block (bytes).
+#define SCRATCH_MIN_SIZE  4096
+
+//////////////////////////////////////////////////////////////////////
+// Frame Scratch Space
+
+FrameScratch::FrameScratch()
+  : m_data(nullptr), m_used(0), m_capacity(0), m_retiredBytes(0)
+{
+}
+
+FrameScratch::~FrameScratch()
+{
+  reset();
+  free(m_data);
+}
+
+void FrameScratch::reset()
+{
+  for (uint8_t *p : m_retired)
+    free(p);
+  m_retired.clear();
+
+  // Replace the block with one that would have held the whole step.
+  if (m_retiredBytes > 0) {
+    size_t size = m_capacity + m_retiredBytes;
+    free(m_data);
+    m_data     = nullptr;
+    m_capacity = 0;
+
+    void *p = nullptr;
+    if (posix_memalign(&p, ARENA_ALIGN, size) != 0)
+      throw std::bad_alloc();
+    m_data     = (uint8_t *)p;
+    m_capacity = size;
+  }
+
+  m_used         = 0;
+  m_retiredBytes = 0;
+}
+
+void *FrameScratch::allocBytes(size_t size)
+{
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (m_used + size > m_capacity) {
+    size_t capacity = m_capacity > 0 ? m_capacity * 2 : SCRATCH_MIN_SIZE;
+    while (capacity < size)
+      capacity *= 2;
+
+    void *p = nullptr;
+    if (posix_memalign(&p, ARENA_ALIGN, capacity) != 0)
+      throw std::bad_alloc();
+
+    if (m_data != nullptr) {
+      m_retired.push_back(m_data);
+      m_retiredBytes += m_capacity;
+    }
+
+    m_data     = (uint8_t *)p;
+    m_used     = 0;
+    m_capacity = capacity;
+  }
+
+  void *p = m_data + m_used;
+  m_used += size;
+  return p;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Frame
+
+Frame::Frame()
+  : time(0.0f), dt(0.0f), step(0), seed(0), rngKey(0), errorMode(0)
+{
+}
+
+void Frame::start(uint64_t s, float t, float d, int mode)
+{
+  seed      = s;
+  time      = t;
+  dt        = d;
+  step      = 0;
+  rngKey    = frameKey(seed, step);
+  errorMode = mode;
+  scratch.reset();
+}
+
+void Frame::next(float t, float d, int mode)
+{
+  time      = t;
+  dt        = d;
+  rngKey    = frameKey(seed, ++step);
+  errorMode = mode;
+  scratch.reset();
+}
+
+// The "splitmix64" finalizer applied to the seed and step.
+uint64_t frameKey(uint64_t seed, uint64_t step)
+{
+  uint64_t z = seed + (step + 1) * 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
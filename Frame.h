@@ -0,0 +1,85 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Frame.h --- Values shared by every quadcopter during one step.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_FRAME_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_FRAME_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Bump allocator for arrays needed only during one step.  Everything
+// is freed at once by "reset".  Blocks outgrown during a step are kept
+// until then, so earlier allocations stay valid, and the next step
+// gets one block large enough for all of them; steady-state steps do
+// not allocate.
+class FrameScratch
+{
+public:
+  FrameScratch();
+  ~FrameScratch();
+
+  FrameScratch(const FrameScratch&) = delete;
+  FrameScratch& operator=(const FrameScratch&) = delete;
+
+  // Free all allocations.
+  void reset();
+
+  // Return uninitialized, cache-line aligned space for "n" values of
+  // a trivially destructible type.
+  template <class T>
+  T *alloc(size_t n)
+  {
+    return (T *)allocBytes(n * sizeof(T));
+  }
+
+  // Return the size of the current block in bytes.
+  size_t capacity() const { return m_capacity; }
+
+private:
+  void *allocBytes(size_t size);
+
+  uint8_t *m_data;
+  size_t   m_used;
+  size_t   m_capacity;
+  size_t   m_retiredBytes;
+  std::vector<uint8_t *> m_retired;
+};
+
+// Values computed once when V-REP asks the plug-in to handle a
+// simulation step and used by every quadcopter until the next one,
+// including by the Lua functions its child scripts call in between.
+// Everything that needs the time of the step takes it from here, so
+// all subsystems agree on it.
+struct Frame
+{
+  Frame();
+
+  // Start a simulation run.  Step keys are derived from "seed".
+  void start(uint64_t seed, float time, float dt, int errorMode);
+
+  // Advance to the next step.
+  void next(float time, float dt, int errorMode);
+
+  float    time;                // simulation time (s)
+  float    dt;                  // simulation time step (s)
+  uint64_t step;                // steps handled since the start
+  uint64_t seed;                // seed of the simulation run
+  uint64_t rngKey;              // key for random draws in this step
+  int      errorMode;           // V-REP error report mode of the scripts
+
+  // Scratch space, freed when the next step begins.
+  FrameScratch scratch;
+};
+
+// Return a well mixed key for step "step" of a run seeded with
+// "seed", for drawing values that depend only on the run and step.
+uint64_t frameKey(uint64_t seed, uint64_t step);
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_FRAME_H_INCLUDED
@@ -9,28 +9,95 @@
 #ifndef V_REP_EXT_QUADCOPTER_NOISE_H_INCLUDED
 #define V_REP_EXT_QUADCOPTER_NOISE_H_INCLUDED
 
+#include <math.h>
+#include <stdint.h>
+
 #include <random>
 
+#include "Frame.h"
+#include "Snapshot.h"
+
+// Position of a noise generator: the key it was seeded with, the
+// number of values drawn since, and the second value of the last
+// Gaussian pair if it has not been returned yet.
+struct NoiseState
+{
+  uint64_t key;
+  uint64_t draws;
+  double   spare;
+  uint32_t hasSpare;
+  uint32_t reserved;
+};
+
 class GaussianNoise
 {
 public:
   // Construct a noise generator given mean and standard deviation.
   GaussianNoise(double mean, double stddev)
-    : m_gen(), m_dist(mean, stddev)
+    : m_mean(mean), m_stddev(stddev)
   {
     std::random_device rd;
-    m_gen.seed(rd());
+    seed(((uint64_t)rd() << 32) | rd());
   }
 
-  // Return a random noise value from this generator.
+  // Restart the generator from "key", so the values that follow
+  // depend only on it.
+  void seed(uint64_t key)
+  {
+    m_state.key      = key;
+    m_state.draws    = 0;
+    m_state.spare    = 0.0;
+    m_state.hasSpare = 0;
+    m_state.reserved = 0;
+  }
+
+  // Return a random noise value from this generator.  Values are made
+  // in pairs by the Box-Muller transform.
   double get()
   {
-    return m_dist(m_gen);
+    if (m_state.hasSpare) {
+      m_state.hasSpare = 0;
+      return m_mean + m_stddev * m_state.spare;
+    }
+
+    // "u" is in (0, 1] so its logarithm is finite.
+    double u = ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double v = (next() >> 11) * (2.0 * M_PI / 9007199254740992.0);
+    double r = sqrt(-2.0 * log(u));
+
+    m_state.spare    = r * sin(v);
+    m_state.hasSpare = 1;
+    return m_mean + m_stddev * r * cos(v);
+  }
+
+  // Return a uniformly distributed 32-bit value from the underlying
+  // generator.
+  uint32_t draw()
+  {
+    return (uint32_t)(next() >> 32);
+  }
+
+  // Save or restore the position of the generator.
+  void save(SnapshotWriter& w) const
+  {
+    w.put(m_state);
+  }
+
+  bool restore(SnapshotReader& r)
+  {
+    return r.get(m_state);
   }
 
 private:
-  std::mt19937 m_gen;
-  std::normal_distribution<double> m_dist;
+  // The n-th value of the key's splitmix64 sequence.
+  uint64_t next()
+  {
+    return frameKey(m_state.key, m_state.draws++);
+  }
+
+  double     m_mean;
+  double     m_stddev;
+  NoiseState m_state;
 };
 
 #endif   // !defined V_REP_EXT_QUADCOPTER_NOISE_H_INCLUDED
@@ -0,0 +1,128 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// PerfCounters.cpp --- Hardware performance counters of the simulator thread.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux
+# include <linux/perf_event.h>
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+#endif
+
+#include "PerfCounters.h"
+
+int PerfCounters::s_fd = -1;
+
+static const char *g_counter_names[PERF_COUNTER_COUNT] = {
+  "cycles",
+  "instructions",
+  "cacheMisses",
+  "branchMisses",
+};
+
+#ifdef __linux
+
+static const uint64_t g_counter_configs[PERF_COUNTER_COUNT] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static int g_fds[PERF_COUNTER_COUNT];
+
+static int openCounter(uint64_t config, int group)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = config;
+  attr.disabled       = group == -1;
+  attr.exclude_kernel = 1;      // allowed without privileges
+  attr.exclude_hv     = 1;
+  attr.read_format    = PERF_FORMAT_GROUP;
+
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+bool PerfCounters::init()
+{
+  const char *env = getenv("QUADCOPTER_PERF_COUNTERS");
+  if (env == NULL || strcmp(env, "1") != 0)
+    return false;
+
+  for (int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    g_fds[i] = openCounter(g_counter_configs[i], i == 0 ? -1 : g_fds[0]);
+
+    if (g_fds[i] < 0) {
+      fprintf(stderr, "quadcopter: cannot open %s counter (%s), "
+              "using timers only\n", g_counter_names[i], strerror(errno));
+      while (--i >= 0)
+        close(g_fds[i]);
+      return false;
+    }
+  }
+
+  s_fd = g_fds[0];
+  ioctl(s_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(s_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+  fprintf(stderr, "quadcopter: hardware performance counters enabled\n");
+  return true;
+}
+
+void PerfCounters::shutdown()
+{
+  if (s_fd < 0)
+    return;
+
+  for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    close(g_fds[i]);
+  s_fd = -1;
+}
+
+void PerfCounters::read(PerfSample *out)
+{
+  // Group format: the number of counters, then each value.
+  uint64_t buf[1 + PERF_COUNTER_COUNT];
+
+  if (::read(s_fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+
+  memcpy(out->v, &buf[1], sizeof(out->v));
+}
+
+#else
+
+bool PerfCounters::init()
+{
+  return false;
+}
+
+void PerfCounters::shutdown()
+{
+}
+
+void PerfCounters::read(PerfSample *out)
+{
+  memset(out, 0, sizeof(*out));
+}
+
+#endif   // defined __linux
+
+const char *PerfCounters::name(PerfCounter c)
+{
+  return g_counter_names[c];
+}
@@ -0,0 +1,56 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// PerfCounters.h --- Hardware performance counters of the simulator thread.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_PERF_COUNTERS_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_PERF_COUNTERS_H_INCLUDED
+
+#include <stdint.h>
+
+// Counted hardware events.
+enum PerfCounter
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_CACHE_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_COUNTER_COUNT
+};
+
+// A reading (or difference of readings) of every counter.
+struct PerfSample
+{
+  uint64_t v[PERF_COUNTER_COUNT];
+};
+
+// Linux "perf_event_open" counters for the thread that opened them,
+// read as one group so the values are consistent with each other.
+// Counting is off unless the environment variable
+// "QUADCOPTER_PERF_COUNTERS" is "1" and the kernel allows user-space
+// counting; otherwise only timers are used.
+class PerfCounters
+{
+public:
+  // Open the counters on the calling thread if requested.  Returns
+  // true if counting is on.
+  static bool init();
+
+  static void shutdown();
+
+  static bool enabled() { return s_fd >= 0; }
+
+  // Read the current counter values.  The counters must be enabled.
+  static void read(PerfSample *out);
+
+  // Return the name of a counter.
+  static const char *name(PerfCounter c);
+
+private:
+  static int s_fd;              // group leader, or -1
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_PERF_COUNTERS_H_INCLUDED
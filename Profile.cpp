@@ -0,0 +1,161 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Profile.cpp --- Low overhead timing of plug-in sections.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdlib.h>
+#include <strings.h>
+
+#include "Profile.h"
+
+bool           Profile::s_enabled   = true;
+ProfileSection Profile::s_current   = PROF_SECTION_COUNT;
+double         Profile::s_nsPerTick = 1.0;
+TimeHistogram  Profile::s_sections[PROF_SECTION_COUNT];
+PerfSample     Profile::s_perf[PROF_SECTION_COUNT];
+
+static const char *g_section_names[PROF_SECTION_COUNT] = {
+  "message",
+  "rebuild",
+  "step",
+  "sensorBatch",
+  "rangeCast",
+  "flowCapture",
+  "commands",
+  "sitl",
+  "rl",
+  "control",
+  "signal",
+  "lua",
+  "readSensors",
+  "pidControl",
+};
+
+double TimeHistogram::percentile(double q) const
+{
+  if (m_count == 0)
+    return 0.0;
+
+  uint64_t target = (uint64_t)(q * m_count + 0.5);
+  if (target < 1)
+    target = 1;
+
+  uint64_t seen = 0;
+
+  for (unsigned b = 0; b < PROF_HIST_BUCKETS; ++b) {
+    seen += m_counts[b];
+    if (seen < target)
+      continue;
+
+    if (b < PROF_HIST_SUBS)
+      return b;
+
+    // Midpoint of the bucket, but never beyond the largest value.
+    unsigned e   = b / PROF_HIST_SUBS - 1 + PROF_HIST_SUB_BITS;
+    unsigned sub = b % PROF_HIST_SUBS;
+    double   lo  = (double)((uint64_t)(PROF_HIST_SUBS + sub) << (e - PROF_HIST_SUB_BITS));
+    double   mid = lo * (1.0 + 0.5 / (PROF_HIST_SUBS + sub));
+    return mid < (double)m_max ? mid : (double)m_max;
+  }
+
+  return (double)m_max;
+}
+
+static double monotonicNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void Profile::init()
+{
+  const char *env = getenv("QUADCOPTER_PROFILE");
+  s_enabled = !(env != NULL && strcmp(env, "0") == 0);
+
+#ifdef PROFILE_USE_TSC
+  // Measure the TSC rate against the raw monotonic clock.
+  struct timespec delay = { 0, 20000000 };
+  double       n0 = monotonicNanos();
+  ProfileTicks t0 = profileNow();
+  nanosleep(&delay, NULL);
+  double       n1 = monotonicNanos();
+  ProfileTicks t1 = profileNow();
+
+  if (t1 > t0)
+    s_nsPerTick = (n1 - n0) / (double)(t1 - t0);
+#else
+  s_nsPerTick = 1.0;
+#endif
+
+  reset();
+}
+
+void Profile::reset()
+{
+  for (auto& h : s_sections)
+    h.clear();
+
+  memset(s_perf, 0, sizeof(s_perf));
+}
+
+const char *Profile::name(ProfileSection s)
+{
+  return g_section_names[s];
+}
+
+bool Profile::lookup(const char *name, ProfileSection *s)
+{
+  for (int i = 0; i < PROF_SECTION_COUNT; ++i) {
+    if (strcasecmp(name, g_section_names[i]) == 0) {
+      *s = (ProfileSection)i;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Profile::writePerfReport(FILE *f, uint64_t vehicleSteps)
+{
+  if (!PerfCounters::enabled() || vehicleSteps == 0)
+    return;
+
+  fprintf(f, "quadcopter: %-12s %6s %14s %14s %14s\n", "section", "IPC",
+          "cycles/vstep", "cache/vstep", "branch/vstep");
+
+  for (int i = 0; i < PROF_SECTION_COUNT; ++i) {
+    const PerfSample& p = s_perf[i];
+    if (p.v[PERF_CYCLES] == 0)
+      continue;
+
+    fprintf(f, "quadcopter: %-12s %6.2f %14.0f %14.1f %14.1f\n",
+            g_section_names[i],
+            (double)p.v[PERF_INSTRUCTIONS] / p.v[PERF_CYCLES],
+            (double)p.v[PERF_CYCLES] / vehicleSteps,
+            (double)p.v[PERF_CACHE_MISSES] / vehicleSteps,
+            (double)p.v[PERF_BRANCH_MISSES] / vehicleSteps);
+  }
+}
+
+void Profile::writeCSVHeader(FILE *f)
+{
+  fprintf(f, "section,vehicle,count,mean_us,p50_us,p99_us,max_us\n");
+}
+
+void Profile::writeCSVLine(FILE *f, ProfileSection s, int vehicle,
+                           const TimeHistogram& h)
+{
+  if (h.count() == 0)
+    return;
+
+  fprintf(f, "%s,%d,%llu,%.3f,%.3f,%.3f,%.3f\n",
+          name(s), vehicle, (unsigned long long)h.count(),
+          toNanos(h.mean()) * 1e-3,
+          toNanos(h.percentile(0.50)) * 1e-3,
+          toNanos(h.percentile(0.99)) * 1e-3,
+          toNanos((double)h.max()) * 1e-3);
+}
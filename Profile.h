@@ -0,0 +1,236 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Profile.h --- Low overhead timing of plug-in sections.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_PROFILE_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_PROFILE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "PerfCounters.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define PROFILE_USE_TSC 1
+#endif
+
+// Sections of the plug-in that are timed.  Sections from
+// PROF_VEHICLE_FIRST on are also recorded per quadcopter.
+enum ProfileSection
+{
+  PROF_MESSAGE,                 // v_repMessage
+  PROF_REBUILD,                 // rebuilding the quadcopter container
+  PROF_STEP,                    // Quadcopter::stepAll
+  PROF_SENSOR_BATCH,            // batched sensor models
+  PROF_RANGE_CAST,              // range sensor ray casting
+  PROF_FLOW_CAPTURE,            // handing camera frames to optical flow
+  PROF_COMMANDS,                // applying queued commands
+  PROF_SITL,                    // SITL bridge round trip
+  PROF_RL,                      // RL environment resets and observations
+  PROF_CONTROL,                 // answering control socket requests
+  PROF_SIGNAL,                  // packing the swarm state signal
+  PROF_LUA,                     // Lua callbacks
+  PROF_READ_SENSORS,            // Quadcopter::readSensors
+  PROF_PID_CONTROL,             // Quadcopter::pidControl
+  PROF_SECTION_COUNT
+};
+
+#define PROF_VEHICLE_FIRST    PROF_READ_SENSORS
+#define PROF_VEHICLE_SECTIONS (PROF_SECTION_COUNT - PROF_VEHICLE_FIRST)
+
+// Raw timestamps.  On x86 these are TSC ticks; elsewhere they are
+// nanoseconds from the raw monotonic clock.
+typedef uint64_t ProfileTicks;
+
+static inline ProfileTicks profileNow()
+{
+#ifdef PROFILE_USE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// A histogram of durations with log-scale buckets: each power of two
+// is split into PROF_HIST_SUBS linear sub-buckets, so any recorded
+// value is known to within 25%.  Recording is a few instructions and
+// the histogram never allocates.
+#define PROF_HIST_SUB_BITS 2
+#define PROF_HIST_SUBS     (1 << PROF_HIST_SUB_BITS)
+#define PROF_HIST_BUCKETS  (64 * PROF_HIST_SUBS)
+
+class TimeHistogram
+{
+public:
+  TimeHistogram() { clear(); }
+
+  void clear()
+  {
+    memset(m_counts, 0, sizeof(m_counts));
+    m_count = 0;
+    m_sum   = 0;
+    m_max   = 0;
+  }
+
+  // Record a duration in ticks.
+  void record(ProfileTicks t)
+  {
+    ++m_counts[bucket(t)];
+    ++m_count;
+    m_sum += t;
+    if (t > m_max)
+      m_max = t;
+  }
+
+  uint64_t count() const { return m_count; }
+  ProfileTicks max() const { return m_max; }
+  double mean() const { return m_count ? (double)m_sum / m_count : 0.0; }
+
+  // Return the duration (ticks) below which a fraction "q" of the
+  // recorded values fall, estimated from bucket midpoints.
+  double percentile(double q) const;
+
+private:
+  static unsigned bucket(ProfileTicks t)
+  {
+    if (t < PROF_HIST_SUBS)
+      return (unsigned)t;
+
+    unsigned e   = 63 - __builtin_clzll(t);
+    unsigned sub = (unsigned)(t >> (e - PROF_HIST_SUB_BITS)) & (PROF_HIST_SUBS - 1);
+    return (e - PROF_HIST_SUB_BITS + 1) * PROF_HIST_SUBS + sub;
+  }
+
+  uint32_t     m_counts[PROF_HIST_BUCKETS];
+  uint64_t     m_count;
+  uint64_t     m_sum;
+  ProfileTicks m_max;
+};
+
+// Global timing state.  Timers are only used from the simulator
+// thread.
+class Profile
+{
+public:
+  // Calibrate the clock.  Timing is on unless the environment
+  // variable "QUADCOPTER_PROFILE" is set to "0".
+  static void init();
+
+  // Clear all section histograms.
+  static void reset();
+
+  // Return the histogram for a section.
+  static TimeHistogram& section(ProfileSection s) { return s_sections[s]; }
+
+  // Return the name of a section, or look one up by name.
+  static const char *name(ProfileSection s);
+  static bool lookup(const char *name, ProfileSection *s);
+
+  // Convert ticks to nanoseconds.
+  static double toNanos(double ticks) { return ticks * s_nsPerTick; }
+
+  // Return the hardware counter totals for a section.  These are only
+  // gathered on the simulator thread when counters are enabled.
+  static const PerfSample& perf(ProfileSection s) { return s_perf[s]; }
+
+  // Print IPC and per vehicle-step cycles and misses of each section,
+  // given the number of vehicle-steps simulated.
+  static void writePerfReport(FILE *f, uint64_t vehicleSteps);
+
+  // Write one CSV line of statistics for a histogram.  "vehicle" is
+  // -1 for the plug-in wide histograms.
+  static void writeCSVHeader(FILE *f);
+  static void writeCSVLine(FILE *f, ProfileSection s, int vehicle,
+                           const TimeHistogram& h);
+
+  static bool enabled() { return s_enabled; }
+
+  // Return the innermost section being timed, or PROF_SECTION_COUNT
+  // outside of all sections.  API calls and heap allocations are
+  // charged to this section.
+  static ProfileSection current() { return s_current; }
+
+private:
+  friend class ProfileScope;
+
+  static bool          s_enabled;
+  static ProfileSection s_current;
+  static double        s_nsPerTick;
+  static TimeHistogram s_sections[PROF_SECTION_COUNT];
+  static PerfSample    s_perf[PROF_SECTION_COUNT];
+};
+
+// Times the enclosing scope into a section histogram and, optionally,
+// a per-vehicle histogram.  With hardware counters enabled, they are
+// read outside of the timed region and added to the section totals.
+class ProfileScope
+{
+public:
+  explicit ProfileScope(ProfileSection s, TimeHistogram *vehicle = nullptr)
+    : m_section(s), m_vehicle(vehicle), m_enabled(Profile::enabled()),
+      m_counting(m_enabled && PerfCounters::enabled())
+  {
+    if (m_counting)
+      PerfCounters::read(&m_perf);
+    m_start = m_enabled ? profileNow() : 0;
+
+    m_outer = Profile::s_current;
+    Profile::s_current = s;
+  }
+
+  ~ProfileScope()
+  {
+    Profile::s_current = m_outer;
+    if (m_enabled) {
+      ProfileTicks t = profileNow() - m_start;
+      Profile::section(m_section).record(t);
+      if (m_vehicle != nullptr)
+        m_vehicle->record(t);
+    }
+
+    if (m_counting) {
+      PerfSample end;
+      PerfCounters::read(&end);
+
+      PerfSample& total = Profile::s_perf[m_section];
+      for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        total.v[i] += end.v[i] - m_perf.v[i];
+    }
+  }
+
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+  ProfileSection m_section;
+  TimeHistogram *m_vehicle;
+  bool           m_enabled;
+  bool           m_counting;
+  ProfileTicks   m_start;
+  PerfSample     m_perf;
+  ProfileSection m_outer;
+};
+
+#define PROFILE_CONCAT2(a, b) a ## b
+#define PROFILE_CONCAT(a, b)  PROFILE_CONCAT2(a, b)
+
+// Time the rest of the enclosing scope as section "s".
+#define PROFILE_SCOPE(s) \
+  ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(s)
+
+// Time the rest of the enclosing scope as section "s", also recording
+// into the per-vehicle histogram array "hists".
+#define PROFILE_VEHICLE_SCOPE(s, hists) \
+  ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)( \
+    s, &(hists)[(s) - PROF_VEHICLE_FIRST])
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_PROFILE_H_INCLUDED
@@ -6,51 +6,69 @@
 // All Rights Reserved.
 //
 
+#include <limits.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
-#include <deque>
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <random>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "v_repLib.h"
+#include "AllocStats.h"
+#include "ApiStats.h"
+#include "Command.h"
 #include "Container.h"
+#include "ControlServer.h"
+#include "CustomData.h"
+#include "FlightRecorder.h"
+#include "Frame.h"
 #include "PID.h"
+#include "Profile.h"
 #include "Quadcopter.h"
+#include "RlEnv.h"
+#include "SensorLog.h"
+#include "SimBaro.h"
+#include "SimFlow.h"
 #include "SimGPS.h"
-
-// Header number for our custom data.
-#define DATA_ID 1000
-
-// Field IDs for our custom data.
-#define FIELD_QUADCOPTER     0
-#define FIELD_MOTOR_0        1
-#define FIELD_MOTOR_1        2
-#define FIELD_MOTOR_2        3
-#define FIELD_MOTOR_3        4
-#define FIELD_CAMERA_DOWN    5
-#define FIELD_CAMERA_FRONT   6
-#define FIELD_BODY           7
-#define FIELD_TARGET         8
-
-// Our custom data is stored in the same format as the V-REP plug-in
-// tutorial:
+#include "SimMag.h"
+#include "SimRange.h"
+#include "SitlBridge.h"
+#include "SwarmSignal.h"
+#include "Terrain.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+// The field IDs of our custom data are listed in "CustomData.h".
+//
+// The FIELD_GPS_CONFIG field on the quadcopter object holds text of
+// the form "key=value" separated by semicolons or whitespace, for
+// example "noise=0.5; rate=5; bias=0.2,0,0; dropout=0.01".  Keys are:
 //
-// 1000,{field_id,field_len,int x field_len}*
+//   noise=STDDEV          position noise (m)
+//   rate=HZ               fixes per second (0 for every read)
+//   bias=X,Y,Z            constant position error (m)
+//   dropout=P             chance a fix is missed (0 to 1)
+//   origin=X,Y,Z          UTM position of the scene origin (m)
+//   zone=N[N|S]           UTM zone and hemisphere
+//
+// Anything not given keeps the scene-wide default.
 
 //////////////////////////////////////////////////////////////////////
 // Utilities
-//
-// These could potentially move into a separate module.
-
-// Shorthand for a vector of bytes.
-typedef std::vector<uint8_t> byte_vector;
-
-// Mapping of field IDs to their data.
-typedef std::map<uint32_t, byte_vector> CustomData;
 
 // Exception thrown when a Lua argument error occurs.
 struct LuaArgException : public std::exception
@@ -90,83 +108,106 @@ int getInputIntArg(SLuaCallBack *p, int n)
   }
 }
 
-// Read a little endian integer from an iterator.  If the distance
-// between "start" and "end" is too small, this throws an exception.
-// The "start" iterator is modified to point at the next byte
-// following the integer that was read.
-static uint32_t parseUint32(byte_vector::const_iterator& p,
-                            byte_vector::const_iterator end)
+// Retrieve the "n"th float argument to a Lua function.  Throws an
+// exception if the argument is invalid.
+float getInputFloatArg(SLuaCallBack *p, int n)
 {
-  if (end - p < 4)
-    throw std::runtime_error("custom data format error");
-
-  uint32_t result = (((uint32_t) p[0] << 0)  |
-                     ((uint32_t) p[1] << 8)  |
-                     ((uint32_t) p[2] << 16) |
-                     ((uint32_t) p[3] << 24));
-
-  p += 4;
-  return result;
-}
+  int argN, i;
 
-// Parse a custom data buffer into a list of fields.
-static CustomData parseCustomData(const std::vector<uint8_t>& buf)
-{
-  CustomData result;
-  auto p = buf.begin();
-  auto end = buf.end();
+  if (p->inputArgCount <= n)
+    throw LuaArgException("not enough arguments");
 
-  while (p != end) {
-    uint32_t id  = parseUint32(p, end);
-    uint32_t len = parseUint32(p, end);
-    result[id]   = byte_vector(p, p + len);
-    p += len;
+  // Count how many float arguments precede the "n"th argument.
+  for (i = 0, argN = 0; i < n; ++i) {
+    if (p->inputArgTypeAndSize[i * 2] == sim_lua_arg_float) {
+      ++argN;
+    }
   }
 
-  return result;
+  if (p->inputArgTypeAndSize[n * 2] == sim_lua_arg_float) {
+    return p->inputFloat[argN];
+  } else {
+    throw LuaArgException("wrong argument type");
+  }
 }
 
-// Return true if an object contains a custom data field.
-static bool hasCustomDataField(int obj, uint32_t field)
+// Parse up to "n" comma separated numbers from "str" into "out".
+// Returns the number of values parsed.
+static int parseNumberList(const std::string& str, double *out, int n)
 {
-  int size = simGetObjectCustomDataLength(obj, DATA_ID);
-  if (size <= 0)
-    return false;
-
-  std::vector<uint8_t> buf(size);
-  simGetObjectCustomData(obj, DATA_ID, (simChar *)&buf[0]);
-  CustomData data(parseCustomData(buf));
+  const char *p = str.c_str();
+  int count = 0;
+
+  while (count < n) {
+    char *end;
+    out[count] = strtod(p, &end);
+    if (end == p)
+      break;
+
+    ++count;
+    p = end;
+    if (*p != ',')
+      break;
+    ++p;
+  }
 
-  return data.find(field) != data.end();
+  return (*p == '\0') ? count : -1;
 }
 
-// Search an object tree for an object that has the specified custom
-// data field.  Returns the first matching object ID or -1 if no child
-// object with that field is found.  The search is performed in
-// breadth-first order.
-static int searchCustomDataField(int root, uint32_t field)
+// Apply the settings in a FIELD_GPS_CONFIG text to "config".  Bad
+// settings are reported and skipped.
+static void parseGPSConfig(const std::string& text, GPSSimConfig& config)
 {
-  std::deque<int> q;
-  q.push_back(root);
-
-  while (!q.empty()) {
-    int obj = q.front();
-    q.pop_front();
-
-    if (hasCustomDataField(obj, field))
-      return obj;
-
-    int i = 0;
-    for (;;) {
-      int child = simGetObjectChild(obj, i++);
-      if (child == -1)
-        break;
-
-      q.push_back(child);
+  size_t pos = 0;
+
+  while (pos < text.size()) {
+    size_t end = text.find_first_of("; \t\n", pos);
+    if (end == std::string::npos)
+      end = text.size();
+
+    std::string item = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty())
+      continue;
+
+    size_t eq = item.find('=');
+    std::string key   = item.substr(0, eq);
+    std::string value = (eq == std::string::npos) ? "" : item.substr(eq + 1);
+    double v[3];
+    bool ok = true;
+
+    if (key == "noise") {
+      ok = parseNumberList(value, v, 1) == 1 && v[0] >= 0.0;
+      if (ok) config.noiseStddev = v[0];
+    } else if (key == "rate") {
+      ok = parseNumberList(value, v, 1) == 1 && v[0] >= 0.0;
+      if (ok) config.updateRate = v[0];
+    } else if (key == "bias") {
+      ok = parseNumberList(value, v, 3) == 3;
+      if (ok) { config.biasX = v[0]; config.biasY = v[1]; config.biasZ = v[2]; }
+    } else if (key == "dropout") {
+      ok = parseNumberList(value, v, 1) == 1 && v[0] >= 0.0 && v[0] <= 1.0;
+      if (ok) config.dropoutProb = v[0];
+    } else if (key == "origin") {
+      ok = parseNumberList(value, v, 3) == 3;
+      if (ok) { config.originX = v[0]; config.originY = v[1]; config.originZ = v[2]; }
+    } else if (key == "zone") {
+      char *rest;
+      long zone = strtol(value.c_str(), &rest, 10);
+      ok = zone >= 1 && zone <= 60 &&
+           (*rest == '\0' || ((*rest == 'N' || *rest == 'S') && rest[1] == '\0'));
+      if (ok) {
+        config.zone = (int)zone;
+        if (*rest != '\0')
+          config.isNorth = (*rest == 'N');
+      }
+    } else {
+      ok = false;
     }
-  }
 
-  return -1;
+    if (!ok)
+      fprintf(stderr, "quadcopter: ignoring GPS setting '%s'\n", item.c_str());
+  }
 }
 
 // Print an object with a label for debugging.
@@ -225,20 +266,218 @@ static bool writeCameraDepthPPM(const std::string& filename, int obj)
 }
 #endif
 
+//////////////////////////////////////////////////////////////////////
+// Shared State
+
+// GPS simulator configuration.  The UTM origins correspond to the
+// following coordinates:
+//
+//   45d31'15"N 122d40'39"W
+//
+// We generate Gaussian noise with a mean of 0 and a standard
+// deviation of 100cm.
+static const GPSSimConfig g_gps_sim_config = {
+  10,                           // utmZone
+  true,                         // isNorth
+  525187,                       // originX
+  5040862,                      // originY
+  10,                           // originZ
+  0.0,                          // noiseMean
+  0.1,                          // noiseStddev
+  0.0,                          // updateRate (every read)
+  0.0,                          // biasX
+  0.0,                          // biasY
+  0.0,                          // biasZ
+  0.0,                          // dropoutProb
+};
+
+// Barometer with noise similar to a MEMS pressure sensor and a slowly
+// wandering bias.
+static const BaroSimConfig g_baro_sim_config = {
+  1.2,                          // noiseStddev (Pa)
+  0.5,                          // driftStddev (Pa / sqrt(s))
+};
+
+// Magnetometer noise.
+static const MagSimConfig g_mag_sim_config = {
+  0.3,                          // noiseStddev (uT)
+};
+
+// Converts mission waypoints from geodetic to scene coordinates.
+static std::unique_ptr<GPSProjector> g_gpsProjector;
+
+// Terrain elevation model, or NULL if no terrain is loaded.  The
+// tile directory is taken from the "QUADCOPTER_TERRAIN_DIR"
+// environment variable and the tile span (m) from
+// "QUADCOPTER_TERRAIN_TILE_SPAN".
+static std::unique_ptr<TerrainMap> g_terrain;
+
+// Load the terrain model if one is configured.
+static void initTerrain()
+{
+  const char *dir = getenv("QUADCOPTER_TERRAIN_DIR");
+  if (dir == NULL || *dir == '\0')
+    return;
+
+  double span = TERRAIN_DEFAULT_TILE_SPAN;
+  const char *env = getenv("QUADCOPTER_TERRAIN_TILE_SPAN");
+  if (env != NULL && atof(env) > 0.0)
+    span = atof(env);
+
+  g_terrain.reset(new TerrainMap(dir, g_gps_sim_config, span));
+  fprintf(stderr, "quadcopter: terrain tiles from '%s' (%.0f m)\n",
+          dir, span);
+}
+
+// Extent and resolution of the height field that range sensors cast
+// rays against, and the range of the downward rangefinder (m).
+#define RANGE_FIELD_HALF_EXTENT 1000.0f
+#define RANGE_FIELD_CELL        2.0f
+#define RANGE_DOWN_MAX          40.0f
+
+// Most beams a lidar scan pattern may have.
+#define LIDAR_MAX_BEAMS         65536
+
+// Worker threads for batched per-step work.  The number of extra
+// threads can be set with the "QUADCOPTER_WORKERS" environment
+// variable and defaults to one less than the number of CPUs.
+static std::unique_ptr<WorkerPool> g_workers;
+
+// Ground height field and ray batch shared by all range sensors.
+static HeightField g_heightField;
+static std::unique_ptr<RangeCaster> g_rangeCaster;
+
+// Altitude range (m above sea level) and spacing of the atmosphere
+// table, and extent and spacing of the magnetic field table (m).
+#define BARO_TABLE_MIN_ALT      -500.0f
+#define BARO_TABLE_MAX_ALT      12000.0f
+#define BARO_TABLE_STEP         2.0f
+#define MAG_TABLE_HALF_EXTENT   20000.0f
+#define MAG_TABLE_CELL          1000.0f
+
+// Atmosphere and magnetic field models, precomputed into tables when
+// the simulation starts.
+static BaroTable     g_baroTable;
+static MagFieldTable g_magTable;
+
+// Inputs and outputs of the sensor models evaluated for all
+// quadcopters at once each step, in the frame's scratch space.  Each
+// quadcopter whose pose could be read owns one entry.
+struct SensorBatch
+{
+  float  *mats;                 // 3x4 world transform of the body
+  float  *alt;                  // altitude above sea level (m)
+  float  *pressure;             // true pressure (Pa)
+  float  *mag;                  // body frame field, 3 per entry (uT)
+  size_t  count;
+
+  size_t size() const { return count; }
+
+  // Make room for "n" entries in the scratch space of "f".
+  void start(Frame& f, size_t n)
+  {
+    mats     = f.scratch.alloc<float>(n * 12);
+    alt      = f.scratch.alloc<float>(n);
+    pressure = f.scratch.alloc<float>(n);
+    mag      = f.scratch.alloc<float>(n * 3);
+    count    = 0;
+  }
+};
+
+static SensorBatch g_sensorBatch;
+
+// Context of the current simulation step.
+static Frame g_frame;
+
+// Command queues of all quadcopters, in the order of their states,
+// and the time from sending each command to applying it (ns).  The
+// inbox is in shared memory named by "QUADCOPTER_COMMAND_SHM" if set.
+static CommandInbox  g_inbox;
+static TimeHistogram g_commandLatency;
+
+// Bridge to external flight stacks, enabled by naming its shared
+// memory object in "QUADCOPTER_SITL_SHM".  Steps wait up to
+// "QUADCOPTER_SITL_TIMEOUT_MS" (default 1000) for motor commands.
+static SitlBridge g_sitl;
+
+// Vectorized RL environment, enabled by naming its shared memory
+// object in "QUADCOPTER_RL_SHM".  Episodes are truncated after
+// "QUADCOPTER_RL_EPISODE_STEPS" (default 1000) steps.
+static RlEnv g_rl;
+
+// Server for controllers in other processes, listening on the Unix
+// domain socket at "QUADCOPTER_CONTROL_SOCKET" if set.
+static ControlServer g_control;
+
+// State of every quadcopter packed into one buffer, published each
+// step as the string signal named by "QUADCOPTER_SWARM_SIGNAL" if set.
+static std::string          g_swarmSignalName;
+static std::vector<uint8_t> g_swarmSignal;
+
+static_assert(sizeof(SwarmSignalHeader) == 32,
+              "SwarmSignalHeader must be packed");
+static_assert(sizeof(SwarmRecord) == 168, "SwarmRecord must be packed");
+
+// Seed of the next simulation run, from "QUADCOPTER_SEED" if set, or
+// random otherwise.
+static uint64_t runSeed()
+{
+  const char *env = getenv("QUADCOPTER_SEED");
+  if (env != NULL && *env != '\0')
+    return strtoull(env, NULL, 0);
+
+  std::random_device rd;
+  return ((uint64_t)rd() << 32) | rd();
+}
+
+// Bytes of sensor log lines written between explicit flushes.  Each
+// flush is recorded in the flight recorder with its size.
+#define LOG_FLUSH_BYTES  16384
+
+// Field of view assumed for a down camera whose perspective angle
+// cannot be read (rad).
+#define FLOW_CAMERA_FOV  (45.0f * (float)M_PI / 180.0f)
+
+// Background threads matching optical flow frames.  The number of
+// threads can be set with "QUADCOPTER_FLOW_THREADS".
+static std::unique_ptr<FlowProcessor> g_flowProcessor;
+
+// Start the worker threads and range sensor state.
+static void initWorkers()
+{
+  unsigned threads = WorkerPool::defaultThreads();
+  const char *env = getenv("QUADCOPTER_WORKERS");
+  if (env != NULL && *env != '\0')
+    threads = (unsigned)atoi(env);
+
+  g_workers.reset(new WorkerPool(threads));
+  g_rangeCaster.reset(new RangeCaster(*g_workers));
+
+  unsigned flowThreads = threads > 0 ? threads : 1;
+  env = getenv("QUADCOPTER_FLOW_THREADS");
+  if (env != NULL && *env != '\0')
+    flowThreads = (unsigned)atoi(env);
+
+  g_flowProcessor.reset(new FlowProcessor(flowThreads));
+}
+
+
 //////////////////////////////////////////////////////////////////////
 // Lua Functions
 
 // Read sensor state for a quadcopter.
 void simExtQuadcopterReadSensors(SLuaCallBack *p)
 {
+  PROFILE_SCOPE(PROF_LUA);
+
   simLockInterface(1);
 
   try {
     int id = getInputIntArg(p, 0);
-    std::shared_ptr<Quadcopter> qc = Quadcopter::all.get(id);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
     if (qc) {
-      qc->readSensors();
+      qc->readSensors(Quadcopter::frame());
     } else {
       simSetLastError("simExtQuadcopterReadSensors",
                       "quadcopter object not found");
@@ -247,9 +486,10 @@ void simExtQuadcopterReadSensors(SLuaCallBack *p)
     simSetLastError("simExtQuadcopterReadSensors", e.what());
   }
 
-  p->outputArgCount = 1;
-  p->outputArgTypeAndSize = (simInt*)simCreateBuffer(1 * sizeof(simInt));
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
   p->outputArgTypeAndSize[0] = sim_lua_arg_int;
+  p->outputArgTypeAndSize[1] = 1;
 
   p->outputInt = (simInt*)simCreateBuffer(1 * sizeof(simInt));
   p->outputInt[0] = 1;
@@ -260,13 +500,15 @@ void simExtQuadcopterReadSensors(SLuaCallBack *p)
 // Return the four motor velocities for a quadcopter.
 void simExtQuadcopterGetMotorVelocities(SLuaCallBack *p)
 {
+  PROFILE_SCOPE(PROF_LUA);
+
   float motors[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 
   simLockInterface(1);
 
   try {
     int id   = getInputIntArg(p, 0);
-    std::shared_ptr<Quadcopter> qc = Quadcopter::all.get(id);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
     if (qc) {
       qc->pidControl(motors);
@@ -293,6 +535,8 @@ void simExtQuadcopterGetMotorVelocities(SLuaCallBack *p)
 // Set the accelerometer data for a quadcopter.
 void simExtQuadcopterSetAccelData(SLuaCallBack *p)
 {
+  PROFILE_SCOPE(PROF_LUA);
+
   int result = -1;
 
   simLockInterface(1);
@@ -308,7 +552,7 @@ void simExtQuadcopterSetAccelData(SLuaCallBack *p)
       throw LuaArgException("wrong argument table size");
 
     int id = p->inputInt[0];
-    std::shared_ptr<Quadcopter> qc = Quadcopter::all.get(id);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
     if (qc) {
       qc->setAccel(&p->inputFloat[0]);
@@ -335,6 +579,8 @@ void simExtQuadcopterSetAccelData(SLuaCallBack *p)
 // Set the gyro data for a quadcopter.
 void simExtQuadcopterSetGyroData(SLuaCallBack *p)
 {
+  PROFILE_SCOPE(PROF_LUA);
+
   int result = -1;
 
   simLockInterface(1);
@@ -350,7 +596,7 @@ void simExtQuadcopterSetGyroData(SLuaCallBack *p)
       throw LuaArgException("wrong argument table size");
 
     int id = p->inputInt[0];
-    std::shared_ptr<Quadcopter> qc = Quadcopter::all.get(id);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
     if (qc) {
       qc->setGyro(&p->inputFloat[0]);
@@ -374,218 +620,2107 @@ void simExtQuadcopterSetGyroData(SLuaCallBack *p)
   simLockInterface(0);
 }
 
-//////////////////////////////////////////////////////////////////////
-// Quadcopter Methods
-
-GenericContainer<Quadcopter> Quadcopter::all;
-
-bool Quadcopter::query(int obj)
-{
-  return hasCustomDataField(obj, FIELD_QUADCOPTER);
-}
-
-bool Quadcopter::init()
+// Return the altitude above the terrain for a quadcopter.
+void simExtQuadcopterGetAGL(SLuaCallBack *p)
 {
-  int args1[] = { 1, sim_lua_arg_int };
-  simRegisterCustomLuaFunction(
-    "simExtQuadcopterGetMotorVelocities",
-    "table_4 result=simExtQuadcopterGetMotorVelocities("
-    "number quadcopterID)",
-    args1, simExtQuadcopterGetMotorVelocities);
-
-  int args2[] = { 1, sim_lua_arg_int };
-  simRegisterCustomLuaFunction(
-    "simExtQuadcopterReadSensors",
-    "number result=simExtQuadcopterReadSensors("
-    "number quadcopterID)",
-    args2, simExtQuadcopterReadSensors);
-
-  int args3[] = { 2, sim_lua_arg_int, sim_lua_arg_float|sim_lua_arg_table };
-  simRegisterCustomLuaFunction(
-    "simExtQuadcopterSetAccelData",
-    "number result=simExtQuadcopterSetAccelData("
-    "number quadcopterID, table_3 data)",
-    args3, simExtQuadcopterSetAccelData);
+  PROFILE_SCOPE(PROF_LUA);
 
-  int args4[] = { 2, sim_lua_arg_int, sim_lua_arg_float|sim_lua_arg_table };
-  simRegisterCustomLuaFunction(
-    "simExtQuadcopterSetGyroData",
-    "number result=simExtQuadcopterSetGyroData("
-    "number quadcopterID, table_3 data)",
-    args4, simExtQuadcopterSetGyroData);
+  float agl = 0.0f;
 
-  return true;
-}
+  simLockInterface(1);
 
-// GPS simulator configuration.  The UTM origins correspond to the
-// following coordinates:
-//
-//   45d31'15"N 122d40'39"W
-//
-// We generate Gaussian noise with a mean of 0 and a standard
-// deviation of 100cm.
-static const GPSSimConfig g_gps_sim_config = {
-  10,                           // utmZone
-  true,                         // isNorth
-  525187,                       // originX
-  5040862,                      // originY
-  10,                           // originZ
-  0.0,                          // noiseMean
-  0.1,                          // noiseStddev
-};
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
-Quadcopter::Quadcopter(int obj)
-  : m_obj(obj),
-    m_gps(g_gps_sim_config),
-    m_vertPID     ( 2.0f,   0.0f,  0.0f, -1.0f,   1.0f),
-    m_alphaStabPID( 0.25f,  0.0f,  2.1f, -10.0f, 10.0f),
-    m_alphaMovePID( 0.005f, 0.0f,  1.0f, -10.0f, 10.0f),
-    m_betaStabPID (-0.25f,  0.0f, -2.1f, -10.0f, 10.0f),
-    m_betaMovePID (-0.005f, 0.0f, -1.0f, -10.0f, 10.0f),
-    m_rotPID      ( 0.1f,   0.0f,  2.0f, -1.0f,   1.0f)
-{
-  simGetObjectUniqueIdentifier(obj, &m_uniqueID);
+    if (qc) {
+      agl = qc->getAGL();
+    } else {
+      simSetLastError("simExtQuadcopterGetAGL",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetAGL", e.what());
+  }
 
-  m_body        = searchCustomDataField(obj, FIELD_BODY);
-  m_target      = searchCustomDataField(obj, FIELD_TARGET);
-  m_cameraDown  = searchCustomDataField(obj, FIELD_CAMERA_DOWN);
-  m_cameraFront = searchCustomDataField(obj, FIELD_CAMERA_FRONT);
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float;
+  p->outputArgTypeAndSize[1] = 1;
 
-  m_motors[0]   = searchCustomDataField(obj, FIELD_MOTOR_0);
-  m_motors[1]   = searchCustomDataField(obj, FIELD_MOTOR_1);
-  m_motors[2]   = searchCustomDataField(obj, FIELD_MOTOR_2);
-  m_motors[3]   = searchCustomDataField(obj, FIELD_MOTOR_3);
+  p->outputFloat    = (simFloat*)simCreateBuffer(1 * sizeof(simFloat));
+  p->outputFloat[0] = agl;
 
-  fprintf(stderr, "--- Found Quadcopter %d:\n", m_uniqueID);
-  printObjWithLabel("Quadcopter:", m_obj);
-  printObjWithLabel("Body:",       m_body);
-  printObjWithLabel("Target:",     m_target);
-  printObjWithLabel("Motor #1:",   m_motors[0]);
-  printObjWithLabel("Motor #2:",   m_motors[1]);
-  printObjWithLabel("Motor #3:",   m_motors[2]);
-  printObjWithLabel("Motor #4:",   m_motors[3]);
-  printObjWithLabel("Floor Cam:",  m_cameraDown);
-  printObjWithLabel("Front Cam:",  m_cameraFront);
+  simLockInterface(0);
 }
 
-void Quadcopter::simulationStarted()
+// Return the barometric pressure for a quadcopter.
+void simExtQuadcopterGetBaro(SLuaCallBack *p)
 {
-  m_lastSaveTime = 0;
-  m_vertPID.reset();
-  m_alphaStabPID.reset();
-  m_alphaMovePID.reset();
-  m_betaStabPID.reset();
-  m_betaMovePID.reset();
-  m_rotPID.reset();
-
-  m_accel[0] = 0.0f;
-  m_accel[1] = 0.0f;
-  m_accel[2] = 0.0f;
+  PROFILE_SCOPE(PROF_LUA);
 
-  m_gyro[0] = 0.0f;
-  m_gyro[1] = 0.0f;
-  m_gyro[2] = 0.0f;
-
-  char filename[128];
-  snprintf(filename, sizeof(filename),
-           "quadrotor_%d_log.csv", m_obj);
+  float pressure = 0.0f;
 
-  m_csvFile = fopen(filename, "w");
+  simLockInterface(1);
 
-  if (m_csvFile) {
-    fprintf(stderr, "Logging data to '%s'\n", filename);
-    fprintf(m_csvFile,
-            "quadrotorID,time,latitude,longitude,altitude,"
-            "accelX,accelY,accelZ,gyroX,gyroY,gyroZ\n");
-  }
-}
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
-void Quadcopter::simulationStopped()
-{
-  if (m_csvFile != nullptr) {
-    fclose(m_csvFile);
-    m_csvFile = nullptr;
+    if (qc) {
+      pressure = qc->getPressure();
+    } else {
+      simSetLastError("simExtQuadcopterGetBaro",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetBaro", e.what());
   }
-}
 
-// Read sensor data into our internal state.
-void Quadcopter::readSensors()
-{
-  m_gpsPosition = m_gps.getGPSPosition(m_body);
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float;
+  p->outputArgTypeAndSize[1] = 1;
 
-  float now = simGetSimulationTime();
+  p->outputFloat    = (simFloat*)simCreateBuffer(1 * sizeof(simFloat));
+  p->outputFloat[0] = pressure;
 
-  if (m_csvFile) {
-    fprintf(m_csvFile,
-            "%d,%.3f,%.10f,%.10f,%.10f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f\n",
-            m_obj, now,
-            m_gpsPosition.lat, m_gpsPosition.lon,
-            m_gpsPosition.altitude,
-            m_accel[0], m_accel[1], m_accel[2],
-            m_gyro[0],  m_gyro[1],  m_gyro[2]);
-  }
+  simLockInterface(0);
 }
 
-// Error checking macro for "pidControl".  This wraps calls to the
-// V-REP API functions and prints an error message and returns from
-// the current function if an error occurs.
-#define CHECK(expr)                               \
-  do {                                            \
-    if ((expr) == -1) {                           \
-      fprintf(stderr, "%s:%d: %s failed\n",       \
-              __FILE__, __LINE__, # expr);        \
-      return;                                     \
-    }                                             \
-  } while (0)
-
-// Ported PID control from the Lua script.  Follows the quadcopter
-// target object.
-void Quadcopter::pidControl(float *motors_out)
+// Return the body frame magnetometer reading for a quadcopter.
+void simExtQuadcopterGetMag(SLuaCallBack *p)
 {
-  int d = m_body;               // to match lua script
+  PROFILE_SCOPE(PROF_LUA);
 
-  // Vertical control:
-  float targetPos[3], pos[3], vel[3];
-  float thrust;
-
-  CHECK(simGetObjectPosition(m_target, -1, targetPos));
-  CHECK(simGetObjectPosition(d, -1, pos));
-  CHECK(simGetObjectVelocity(m_obj, vel, NULL));
+  float mag[3] = { 0.0f, 0.0f, 0.0f };
 
-  // NOTE: The magic number 5.335f is our estimated hover velocity?
-  thrust = (5.335f - vel[2]) + m_vertPID.run(targetPos[2], pos[2]);
+  simLockInterface(1);
 
-  // Horizontal control:
-  float m[12];
-  float vx[3] = { 1.0f, 0.0f, 0.0f };
-  float vy[3] = { 0.0f, 1.0f, 0.0f };
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
 
-  // stabilization:
-  CHECK(simGetObjectMatrix(d, -1, m));
-  CHECK(simTransformVector(m, vx));
-  CHECK(simTransformVector(m, vy));
-  float alphaCorr = m_alphaStabPID.run(vy[2], m[11]);
-  float betaCorr  = m_betaStabPID.run(vx[2], m[11]);
+    if (qc) {
+      qc->getMag(mag);
+    } else {
+      simSetLastError("simExtQuadcopterGetMag",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetMag", e.what());
+  }
 
-  // move towards target:
-  float sp[3];
-  CHECK(simGetObjectPosition(m_target, d, sp));
-  alphaCorr += m_alphaMovePID.run(sp[1], 0.0f);
-  betaCorr  += m_betaMovePID.run(sp[0], 0.0f);
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = 3;
 
-  // Rotational control:
-  float rotCorr, euler[3];
-  CHECK(simGetObjectOrientation(d, m_target, euler));
-  rotCorr = m_rotPID.run(euler[2], 0.0f);
+  p->outputFloat = (simFloat*)simCreateBuffer(3 * sizeof(simFloat));
+  for (int i = 0; i < 3; ++i)
+    p->outputFloat[i] = mag[i];
 
-  motors_out[0] = thrust * (1.0f - alphaCorr + betaCorr + rotCorr);
-  motors_out[1] = thrust * (1.0f - alphaCorr - betaCorr - rotCorr);
-  motors_out[2] = thrust * (1.0f + alphaCorr - betaCorr + rotCorr);
-  motors_out[3] = thrust * (1.0f + alphaCorr + betaCorr - rotCorr);
+  simLockInterface(0);
 }
 
-#undef CHECK
+// Return the optical flow of a quadcopter's down camera as
+// {flowX, flowY, quality}, with flow in rad/sec.
+void simExtQuadcopterGetOpticalFlow(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  float flow[3] = { 0.0f, 0.0f, -1.0f };
+
+  simLockInterface(1);
+
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
+
+    if (qc) {
+      flow[2] = (float)qc->getOpticalFlow(flow);
+    } else {
+      simSetLastError("simExtQuadcopterGetOpticalFlow",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetOpticalFlow", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = 3;
+
+  p->outputFloat = (simFloat*)simCreateBuffer(3 * sizeof(simFloat));
+  for (int i = 0; i < 3; ++i)
+    p->outputFloat[i] = flow[i];
+
+  simLockInterface(0);
+}
+
+// Convert a list of waypoints from latitude, longitude and altitude
+// to scene coordinates.  The first argument is a flat table of
+// (lat, lon, alt) triples, either as numbers or, to keep full double
+// precision through the Lua interface, as strings.  The optional
+// second argument selects a GPSProjectionMode.  Returns a flat table
+// of (x, y, z) triples.
+void simExtQuadcopterLatLonToLocal(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  std::vector<double> in;
+  std::vector<float>  out;
+
+  simLockInterface(1);
+
+  try {
+    if (p->inputArgCount < 1)
+      throw LuaArgException("not enough arguments");
+
+    int type  = p->inputArgTypeAndSize[0];
+    int count = p->inputArgTypeAndSize[1];
+
+    if (count % 3 != 0)
+      throw LuaArgException("table size must be a multiple of 3");
+
+    if (type == (sim_lua_arg_float|sim_lua_arg_table)) {
+      in.assign(p->inputFloat, p->inputFloat + count);
+    } else if (type == (sim_lua_arg_string|sim_lua_arg_table)) {
+      const char *str = p->inputChar;
+      in.resize(count);
+
+      for (int i = 0; i < count; ++i) {
+        char *end;
+        in[i] = strtod(str, &end);
+        if (end == str || *end != '\0')
+          throw LuaArgException("invalid number in waypoint table");
+        str += strlen(str) + 1;
+      }
+    } else {
+      throw LuaArgException("wrong argument type");
+    }
+
+    GPSProjectionMode mode = GPS_PROJECT_UTM;
+    if (p->inputArgCount > 1 && getInputIntArg(p, 1) == GPS_PROJECT_LOCAL)
+      mode = GPS_PROJECT_LOCAL;
+
+    out.resize(count);
+    if (count > 0)
+      g_gpsProjector->toLocalBatch(&in[0], &out[0], count / 3, mode);
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterLatLonToLocal", e.what());
+    out.clear();
+  }
+
+  int n = (int)out.size();
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = n;
+
+  p->outputFloat = (simFloat*)simCreateBuffer((n > 0 ? n : 1) * sizeof(simFloat));
+  for (int i = 0; i < n; ++i)
+    p->outputFloat[i] = out[i];
+
+  simLockInterface(0);
+}
+
+// Return timing statistics of a plug-in section as {count, p50,
+// p99, max}, with times in microseconds.  If a quadcopter ID is
+// given, per-vehicle sections are reported for that quadcopter only.
+void simExtQuadcopterGetTiming(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  float stats[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  simLockInterface(1);
+
+  try {
+    if (p->inputArgCount < 1 || p->inputArgTypeAndSize[0] != sim_lua_arg_string)
+      throw LuaArgException("wrong argument type");
+
+    ProfileSection section;
+    if (!Profile::lookup(p->inputChar, &section))
+      throw LuaArgException("unknown section");
+
+    const TimeHistogram *h = &Profile::section(section);
+
+    if (p->inputArgCount > 1) {
+      int id = getInputIntArg(p, 1);
+      Quadcopter *qc = Quadcopter::all.find(id);
+
+      if (!qc)
+        throw LuaArgException("quadcopter object not found");
+      if (section < PROF_VEHICLE_FIRST)
+        throw LuaArgException("not a per-vehicle section");
+
+      h = &qc->getProfile(section);
+    }
+
+    stats[0] = (float)h->count();
+    stats[1] = (float)(Profile::toNanos(h->percentile(0.50)) * 1e-3);
+    stats[2] = (float)(Profile::toNanos(h->percentile(0.99)) * 1e-3);
+    stats[3] = (float)(Profile::toNanos((double)h->max()) * 1e-3);
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetTiming", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = 4;
+
+  p->outputFloat = (simFloat*)simCreateBuffer(4 * sizeof(simFloat));
+  for (int i = 0; i < 4; ++i)
+    p->outputFloat[i] = stats[i];
+
+  simLockInterface(0);
+}
+
+// Return V-REP API call statistics as three tables: function names,
+// call counts, and total time in microseconds.  "section" selects the
+// calls made from one plug-in section ("other" for calls outside all
+// sections), or all of them if empty.  If a quadcopter ID is given,
+// the calls made for that quadcopter are returned instead.  The
+// tables are empty unless API accounting is compiled in.
+void simExtQuadcopterGetApiStats(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  ApiCounters sum;
+
+  simLockInterface(1);
+
+  try {
+    if (p->inputArgCount < 1 || p->inputArgTypeAndSize[0] != sim_lua_arg_string)
+      throw LuaArgException("wrong argument type");
+
+    const char *name = p->inputChar;
+
+    if (p->inputArgCount > 1) {
+      if (*name != '\0')
+        throw LuaArgException("per-vehicle calls are not split by section");
+
+      const ApiCounters *c = ApiStats::findVehicle(getInputIntArg(p, 1));
+      if (c != nullptr)
+        sum = *c;
+    } else {
+      ProfileSection section;
+      int first = 0, last = PROF_SECTION_COUNT;
+
+      if (strcasecmp(name, "other") == 0) {
+        first = PROF_SECTION_COUNT;
+      } else if (*name != '\0') {
+        if (!Profile::lookup(name, &section))
+          throw LuaArgException("unknown section");
+        first = last = section;
+      }
+
+      for (int i = first; i <= last; ++i) {
+        const ApiCounters& c = ApiStats::section((ProfileSection)i);
+        for (int f = 0; f < API_FUNCTION_COUNT; ++f) {
+          sum.fn[f].calls += c.fn[f].calls;
+          sum.fn[f].ticks += c.fn[f].ticks;
+        }
+      }
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetApiStats", e.what());
+  }
+
+  std::string names;
+  std::vector<int> calls;
+  std::vector<float> usecs;
+
+  for (int f = 0; f < API_FUNCTION_COUNT; ++f) {
+    const ApiCounter& n = sum.fn[f];
+    if (n.calls == 0)
+      continue;
+
+    names += ApiStats::name((ApiFunction)f);
+    names += '\0';
+    calls.push_back(n.calls < INT_MAX ? (int)n.calls : INT_MAX);
+    usecs.push_back((float)(Profile::toNanos((double)n.ticks) * 1e-3));
+  }
+
+  int count = (int)calls.size();
+
+  p->outputArgCount          = 3;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(6 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_string|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = count;
+  p->outputArgTypeAndSize[2] = sim_lua_arg_int|sim_lua_arg_table;
+  p->outputArgTypeAndSize[3] = count;
+  p->outputArgTypeAndSize[4] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[5] = count;
+
+  p->outputChar  = (simChar*)simCreateBuffer((int)names.size() + 1);
+  p->outputInt   = (simInt*)simCreateBuffer((count + 1) * sizeof(simInt));
+  p->outputFloat = (simFloat*)simCreateBuffer((count + 1) * sizeof(simFloat));
+  memcpy(p->outputChar, names.data(), names.size());
+  for (int i = 0; i < count; ++i) {
+    p->outputInt[i]   = calls[i];
+    p->outputFloat[i] = usecs[i];
+  }
+
+  simLockInterface(0);
+}
+
+// Return the downward rangefinder reading for a quadcopter.
+void simExtQuadcopterGetRangeDown(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  float range = 0.0f;
+
+  simLockInterface(1);
+
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
+
+    if (qc) {
+      range = qc->getRangeDown();
+    } else {
+      simSetLastError("simExtQuadcopterGetRangeDown",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetRangeDown", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float;
+  p->outputArgTypeAndSize[1] = 1;
+
+  p->outputFloat    = (simFloat*)simCreateBuffer(1 * sizeof(simFloat));
+  p->outputFloat[0] = range;
+
+  simLockInterface(0);
+}
+
+// Configure the lidar of a quadcopter.  Angles are in degrees.
+void simExtQuadcopterSetLidar(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  int result = -1;
+
+  simLockInterface(1);
+
+  try {
+    int   id       = getInputIntArg(p, 0);
+    int   hBeams   = getInputIntArg(p, 1);
+    int   vBeams   = getInputIntArg(p, 2);
+    float hFov     = getInputFloatArg(p, 3);
+    float vFov     = getInputFloatArg(p, 4);
+    float maxRange = getInputFloatArg(p, 5);
+    Quadcopter *qc = Quadcopter::all.find(id);
+
+    if (hBeams < 0 || vBeams < 0 || !(maxRange > 0.0f))
+      throw LuaArgException("invalid lidar parameters");
+    if ((int64_t)hBeams * vBeams > LIDAR_MAX_BEAMS)
+      throw LuaArgException("too many lidar beams");
+
+    if (qc) {
+      RangeScanPattern pattern;
+      if (hBeams > 0 && vBeams > 0) {
+        pattern = RangeScanPattern::scan(hBeams, vBeams,
+                                         hFov * (float)M_PI / 180.0f,
+                                         vFov * (float)M_PI / 180.0f);
+      }
+      qc->setLidar(pattern, maxRange);
+      result = 1;
+    } else {
+      simSetLastError("simExtQuadcopterSetLidar",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterSetLidar", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_int;
+  p->outputArgTypeAndSize[1] = 1;
+
+  p->outputInt    = (simInt*)simCreateBuffer(sizeof(result));
+  p->outputInt[0] = result;
+
+  simLockInterface(0);
+}
+
+// Return the latest lidar scan of a quadcopter as a table of ranges.
+void simExtQuadcopterGetLidarScan(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  std::vector<float> scan;
+
+  simLockInterface(1);
+
+  try {
+    int id = getInputIntArg(p, 0);
+    Quadcopter *qc = Quadcopter::all.find(id);
+
+    if (qc) {
+      scan = qc->getLidarScan();
+    } else {
+      simSetLastError("simExtQuadcopterGetLidarScan",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterGetLidarScan", e.what());
+  }
+
+  int n = (int)scan.size();
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = n;
+
+  p->outputFloat = (simFloat*)simCreateBuffer((n > 0 ? n : 1) * sizeof(simFloat));
+  for (int i = 0; i < n; ++i)
+    p->outputFloat[i] = scan[i];
+
+  simLockInterface(0);
+}
+
+// Return range sensor throughput as {rays per second, last cast ms}.
+void simExtQuadcopterGetRangeStats(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  simLockInterface(1);
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_float|sim_lua_arg_table;
+  p->outputArgTypeAndSize[1] = 2;
+
+  p->outputFloat    = (simFloat*)simCreateBuffer(2 * sizeof(simFloat));
+  p->outputFloat[0] = (float)g_rangeCaster->raysPerSecond();
+  p->outputFloat[1] = (float)(g_rangeCaster->lastSeconds() * 1000.0);
+
+  simLockInterface(0);
+}
+
+// Queue a command for a quadcopter.  "type" is a CommandType and
+// "values" holds up to four numbers: the setpoint and heading, the
+// velocity and yaw rate, or the ControlMode.  Returns 1 if the
+// command was queued and 0 if the quadcopter's queue is full.
+void simExtQuadcopterSendCommand(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  int result = -1;
+
+  simLockInterface(1);
+
+  try {
+    int id   = getInputIntArg(p, 0);
+    int type = getInputIntArg(p, 1);
+
+    if (p->inputArgCount < 3)
+      throw LuaArgException("not enough arguments");
+    if (p->inputArgTypeAndSize[2 * 2 + 0] != (sim_lua_arg_float|sim_lua_arg_table))
+      throw LuaArgException("wrong argument type");
+
+    int count = p->inputArgTypeAndSize[2 * 2 + 1];
+    if (count < 0 || count > 4)
+      throw LuaArgException("wrong argument table size");
+
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = (uint32_t)type;
+    for (int i = 0; i < count; ++i) {
+      cmd.value[i] = p->inputFloat[i];
+      if (!isfinite(cmd.value[i]))
+        throw LuaArgException("command values must be finite");
+    }
+
+    if (type == CMD_MODE) {
+      if (count < 1 || !(cmd.value[0] >= 0.0f && cmd.value[0] < MODE_COUNT))
+        throw LuaArgException("invalid control mode");
+      cmd.mode = (uint32_t)cmd.value[0];
+    } else if (type != CMD_SETPOINT && type != CMD_VELOCITY) {
+      throw LuaArgException("invalid command type");
+    }
+
+    if (Quadcopter::all.find(id)) {
+      result = Quadcopter::sendCommand(id, cmd) ? 1 : 0;
+    } else {
+      simSetLastError("simExtQuadcopterSendCommand",
+                      "quadcopter object not found");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterSendCommand", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_int;
+  p->outputArgTypeAndSize[1] = 1;
+
+  p->outputInt    = (simInt*)simCreateBuffer(sizeof(result));
+  p->outputInt[0] = result;
+
+  simLockInterface(0);
+}
+
+// Restart the RL episodes of a table of quadcopters.  The optional
+// second argument is a flat table of (x, y, z, yaw) poses, one per
+// quadcopter; without it they go back to where the simulation
+// started.  Returns the number of quadcopters reset.
+void simExtQuadcopterResetEpisodes(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  int result = -1;
+
+  simLockInterface(1);
+
+  try {
+    if (p->inputArgCount < 1)
+      throw LuaArgException("not enough arguments");
+    if (p->inputArgTypeAndSize[0 * 2 + 0] != (sim_lua_arg_int|sim_lua_arg_table))
+      throw LuaArgException("wrong argument type");
+
+    int count = p->inputArgTypeAndSize[0 * 2 + 1];
+    const float *poses = NULL;
+
+    if (p->inputArgCount > 1) {
+      if (p->inputArgTypeAndSize[1 * 2 + 0] != (sim_lua_arg_float|sim_lua_arg_table))
+        throw LuaArgException("wrong argument type");
+      if (p->inputArgTypeAndSize[1 * 2 + 1] != count * 4)
+        throw LuaArgException("wrong argument table size");
+      poses = p->inputFloat;
+    }
+
+    result = (int)Quadcopter::resetEpisodes(p->inputInt, (size_t)count, poses);
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterResetEpisodes", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_int;
+  p->outputArgTypeAndSize[1] = 1;
+
+  p->outputInt    = (simInt*)simCreateBuffer(sizeof(result));
+  p->outputInt[0] = result;
+
+  simLockInterface(0);
+}
+
+// Snapshot buffer reused between calls of the Lua functions.
+static std::vector<uint8_t> g_snapshot;
+
+// Return a snapshot of the plug-in's state as a buffer, for
+// "simExtQuadcopterRestore".
+void simExtQuadcopterSnapshot(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  simLockInterface(1);
+
+  Quadcopter::snapshot(g_snapshot);
+  int n = (int)g_snapshot.size();
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_charbuff;
+  p->outputArgTypeAndSize[1] = n;
+
+  p->outputCharBuff = simCreateBuffer(n);
+  memcpy(p->outputCharBuff, g_snapshot.data(), n);
+
+  simLockInterface(0);
+}
+
+// Restore a snapshot returned by "simExtQuadcopterSnapshot".  Returns
+// the number of quadcopters restored.
+void simExtQuadcopterRestore(SLuaCallBack *p)
+{
+  PROFILE_SCOPE(PROF_LUA);
+
+  int result = -1;
+
+  simLockInterface(1);
+
+  try {
+    if (p->inputArgCount < 1)
+      throw LuaArgException("not enough arguments");
+    if (p->inputArgTypeAndSize[0 * 2 + 0] != sim_lua_arg_charbuff)
+      throw LuaArgException("wrong argument type");
+
+    int size = p->inputArgTypeAndSize[0 * 2 + 1];
+    result = Quadcopter::restore((const uint8_t *)p->inputCharBuff,
+                                 size > 0 ? (size_t)size : 0);
+    if (result < 0) {
+      simSetLastError("simExtQuadcopterRestore",
+                      "snapshot malformed or from another build");
+    }
+  } catch (LuaArgException& e) {
+    simSetLastError("simExtQuadcopterRestore", e.what());
+  }
+
+  p->outputArgCount          = 1;
+  p->outputArgTypeAndSize    = (simInt*)simCreateBuffer(2 * sizeof(simInt));
+  p->outputArgTypeAndSize[0] = sim_lua_arg_int;
+  p->outputArgTypeAndSize[1] = 1;
+
+  p->outputInt    = (simInt*)simCreateBuffer(sizeof(result));
+  p->outputInt[0] = result;
+
+  simLockInterface(0);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Quadcopter Methods
+
+GenericContainer<Quadcopter> Quadcopter::all;
+Arena<QuadcopterState> Quadcopter::states;
+
+// Quadcopters in the order of their states in "Quadcopter::states",
+// for reaching the rest of a quadcopter from its index.
+static std::vector<Quadcopter *> g_swarm;
+
+// Published state of each quadcopter by object handle.  Entries of
+// quadcopters still in the scene are kept across a rebuild.
+static std::map<int, std::shared_ptr<PublishedState>> g_published;
+
+void Quadcopter::rebuildAll()
+{
+  all.clear();
+  states.clear();
+  g_swarm.clear();
+  all.rebuild();
+
+  for (auto i = g_published.begin(); i != g_published.end();) {
+    if (all.find(i->first) == nullptr)
+      i = g_published.erase(i);
+    else
+      ++i;
+  }
+
+  std::vector<int> objs(states.size());
+  for (size_t i = 0; i < objs.size(); ++i)
+    objs[i] = states[i].obj;
+  g_inbox.layout(objs.data(), objs.size());
+  g_sitl.layout(objs.data(), objs.size());
+  g_rl.layout(objs.data(), objs.size());
+}
+
+bool Quadcopter::query(int obj)
+{
+  return hasCustomDataField(obj, FIELD_QUADCOPTER);
+}
+
+bool Quadcopter::init()
+{
+  int args1[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetMotorVelocities",
+    "table_4 result=simExtQuadcopterGetMotorVelocities("
+    "number quadcopterID)",
+    args1, simExtQuadcopterGetMotorVelocities);
+
+  int args2[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterReadSensors",
+    "number result=simExtQuadcopterReadSensors("
+    "number quadcopterID)",
+    args2, simExtQuadcopterReadSensors);
+
+  int args3[] = { 2, sim_lua_arg_int, sim_lua_arg_float|sim_lua_arg_table };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterSetAccelData",
+    "number result=simExtQuadcopterSetAccelData("
+    "number quadcopterID, table_3 data)",
+    args3, simExtQuadcopterSetAccelData);
+
+  int args4[] = { 2, sim_lua_arg_int, sim_lua_arg_float|sim_lua_arg_table };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterSetGyroData",
+    "number result=simExtQuadcopterSetGyroData("
+    "number quadcopterID, table_3 data)",
+    args4, simExtQuadcopterSetGyroData);
+
+  int args5[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetAGL",
+    "number agl=simExtQuadcopterGetAGL(number quadcopterID)",
+    args5, simExtQuadcopterGetAGL);
+
+  int args6[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetRangeDown",
+    "number range=simExtQuadcopterGetRangeDown(number quadcopterID)",
+    args6, simExtQuadcopterGetRangeDown);
+
+  int args7[] = { 6, sim_lua_arg_int, sim_lua_arg_int, sim_lua_arg_int,
+                  sim_lua_arg_float, sim_lua_arg_float, sim_lua_arg_float };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterSetLidar",
+    "number result=simExtQuadcopterSetLidar(number quadcopterID, "
+    "number hBeams, number vBeams, number hFovDeg, number vFovDeg, "
+    "number maxRange)",
+    args7, simExtQuadcopterSetLidar);
+
+  int args8[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetLidarScan",
+    "table ranges=simExtQuadcopterGetLidarScan(number quadcopterID)",
+    args8, simExtQuadcopterGetLidarScan);
+
+  int args9[] = { 0 };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetRangeStats",
+    "table_2 stats=simExtQuadcopterGetRangeStats()",
+    args9, simExtQuadcopterGetRangeStats);
+
+  int args10[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetBaro",
+    "number pressure=simExtQuadcopterGetBaro(number quadcopterID)",
+    args10, simExtQuadcopterGetBaro);
+
+  int args11[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetMag",
+    "table_3 field=simExtQuadcopterGetMag(number quadcopterID)",
+    args11, simExtQuadcopterGetMag);
+
+  int args12[] = { 1, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetOpticalFlow",
+    "table_3 flow=simExtQuadcopterGetOpticalFlow(number quadcopterID)",
+    args12, simExtQuadcopterGetOpticalFlow);
+
+  int args13[] = { 2, sim_lua_arg_float|sim_lua_arg_table, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterLatLonToLocal",
+    "table positions=simExtQuadcopterLatLonToLocal("
+    "table latLonAlt, number mode=0)",
+    args13, simExtQuadcopterLatLonToLocal);
+
+  int args14[] = { 2, sim_lua_arg_string, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetTiming",
+    "table_4 stats=simExtQuadcopterGetTiming("
+    "string section, number quadcopterID=nil)",
+    args14, simExtQuadcopterGetTiming);
+
+  int args15[] = { 2, sim_lua_arg_string, sim_lua_arg_int };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterGetApiStats",
+    "table names,table calls,table usecs=simExtQuadcopterGetApiStats("
+    "string section, number quadcopterID=nil)",
+    args15, simExtQuadcopterGetApiStats);
+
+  int args16[] = { 3, sim_lua_arg_int, sim_lua_arg_int,
+                   sim_lua_arg_float|sim_lua_arg_table };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterSendCommand",
+    "number queued=simExtQuadcopterSendCommand("
+    "number quadcopterID, number type, table values)",
+    args16, simExtQuadcopterSendCommand);
+
+  int args17[] = { 2, sim_lua_arg_int|sim_lua_arg_table,
+                   sim_lua_arg_float|sim_lua_arg_table };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterResetEpisodes",
+    "number count=simExtQuadcopterResetEpisodes("
+    "table quadcopterIDs, table poses=nil)",
+    args17, simExtQuadcopterResetEpisodes);
+
+  int args18[] = { 0 };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterSnapshot",
+    "charbuff snapshot=simExtQuadcopterSnapshot()",
+    args18, simExtQuadcopterSnapshot);
+
+  int args19[] = { 1, sim_lua_arg_charbuff };
+  simRegisterCustomLuaFunction(
+    "simExtQuadcopterRestore",
+    "number count=simExtQuadcopterRestore(charbuff snapshot)",
+    args19, simExtQuadcopterRestore);
+
+  const char *shm = getenv("QUADCOPTER_COMMAND_SHM");
+  if (shm != NULL && *shm != '\0')
+    g_inbox.setSharedName(shm);
+
+  const char *sitl = getenv("QUADCOPTER_SITL_SHM");
+  if (sitl != NULL && *sitl != '\0') {
+    const char *timeout = getenv("QUADCOPTER_SITL_TIMEOUT_MS");
+    g_sitl.configure(sitl, timeout != NULL && *timeout != '\0' ?
+                     (unsigned)atoi(timeout) : 1000);
+  }
+
+  const char *rl = getenv("QUADCOPTER_RL_SHM");
+  if (rl != NULL && *rl != '\0') {
+    const char *steps = getenv("QUADCOPTER_RL_EPISODE_STEPS");
+    g_rl.configure(rl, steps != NULL && *steps != '\0' ?
+                   (uint32_t)atoi(steps) : 1000);
+  }
+
+  const char *control = getenv("QUADCOPTER_CONTROL_SOCKET");
+  if (control != NULL && *control != '\0')
+    g_control.start(control);
+
+  const char *signal = getenv("QUADCOPTER_SWARM_SIGNAL");
+  if (signal != NULL && *signal != '\0')
+    g_swarmSignalName = signal;
+
+  g_gpsProjector.reset(new GPSProjector(g_gps_sim_config));
+
+  initTerrain();
+  initWorkers();
+  return true;
+}
+
+void Quadcopter::shutdown()
+{
+  if (ApiStats::compiled()) {
+    const char *filename = getenv("QUADCOPTER_API_FILE");
+    if (filename == NULL || *filename == '\0')
+      filename = "quadcopter_api.csv";
+
+    FILE *f = fopen(filename, "w");
+    if (f != NULL) {
+      ApiStats::writeCSV(f);
+      fclose(f);
+      fprintf(stderr, "quadcopter: API calls written to '%s'\n", filename);
+    }
+  }
+
+  g_control.stop();
+
+  states.clear();
+  g_swarm.clear();
+
+  g_flowProcessor.reset();
+  g_gpsProjector.reset();
+  g_rangeCaster.reset();
+  g_workers.reset();
+  g_terrain.reset();
+}
+
+const Frame& Quadcopter::frame()
+{
+  return g_frame;
+}
+
+void Quadcopter::startAll(int errorMode)
+{
+  g_frame.start(runSeed(), simGetSimulationTime(),
+                simGetSimulationTimeStep(), errorMode);
+
+  Profile::reset();
+  AllocStats::reset();
+  g_commandLatency.clear();
+  g_sitl.resetStats();
+  g_control.resetStats();
+  Trace::start();
+
+  g_heightField.build(g_terrain.get(),
+                      RANGE_FIELD_HALF_EXTENT, RANGE_FIELD_CELL);
+  g_rangeCaster->resetStats();
+  g_flowProcessor->resetStats();
+
+  g_baroTable.build(BARO_TABLE_MIN_ALT, BARO_TABLE_MAX_ALT, BARO_TABLE_STEP);
+  g_magTable.build(g_gps_sim_config, MAG_TABLE_HALF_EXTENT, MAG_TABLE_CELL);
+
+  all.call(&Quadcopter::simulationStarted);
+  publishAll(g_frame);
+  if (!g_swarmSignalName.empty())
+    publishSignal(g_frame);
+}
+
+void Quadcopter::stepAll(int errorMode)
+{
+  PROFILE_SCOPE(PROF_STEP);
+
+  // The scripts have finished with the previous step, so its state
+  // is complete.
+  Frame& f = g_frame;
+  publishAll(f);
+  logAll();
+
+  if (!g_swarmSignalName.empty()) {
+    PROFILE_SCOPE(PROF_SIGNAL);
+    publishSignal(f);
+  }
+
+  // Controllers get the same state, and their commands are queued
+  // for this step.
+  if (g_control.running()) {
+    PROFILE_SCOPE(PROF_CONTROL);
+    answerControl(f);
+  }
+
+  if (g_sitl.enabled()) {
+    PROFILE_SCOPE(PROF_SITL);
+    exchangeSitl(f);
+  }
+  f.next(simGetSimulationTime(), simGetSimulationTimeStep(), errorMode);
+
+  all.call(&Quadcopter::simulationStepped);
+
+  size_t n = states.size();
+
+  // Episodes the trainer asked to restart start over before anything
+  // looks at their poses.
+  if (g_rl.size() > 0) {
+    PROFILE_SCOPE(PROF_RL);
+    uint32_t *resets = g_rl.resets();
+    for (size_t i = 0; i < n && i < g_rl.size(); ++i) {
+      if (resets[i] == RL_RESET_NONE)
+        continue;
+      resetEpisode(f, i, resets[i] == RL_RESET_POSE ?
+                   g_rl.poses() + i * 4 : nullptr);
+      resets[i] = RL_RESET_NONE;
+    }
+  }
+
+  // Commands take effect before this step's control runs.
+  {
+    PROFILE_SCOPE(PROF_COMMANDS);
+    for (size_t i = 0; i < n; ++i)
+      applyCommands(f, i);
+  }
+
+  // Gather every quadcopter's pose and range sensor rays, evaluate
+  // the sensor models for all of them at once, then hand the results
+  // back.
+  {
+    PROFILE_SCOPE(PROF_SENSOR_BATCH);
+
+    SensorBatch& b = g_sensorBatch;
+    b.start(f, n);
+    g_rangeCaster->clear();
+    for (size_t i = 0; i < n; ++i)
+      addToSensorBatch(f, i);
+
+    if (b.size() > 0) {
+      g_baroTable.pressureBatch(b.alt, b.pressure, b.size());
+      g_magTable.bodyFieldBatch(b.mats, b.mag, b.size());
+    }
+
+    {
+      PROFILE_SCOPE(PROF_RANGE_CAST);
+      g_rangeCaster->cast(g_heightField);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+      storeSensorBatch(f, i);
+  }
+
+  // Optical flow is matched in the background and picked up by
+  // readers whenever it is ready.
+  {
+    PROFILE_SCOPE(PROF_FLOW_CAPTURE);
+    for (size_t i = 0; i < n; ++i)
+      captureFlowFrame(f, i);
+  }
+
+  if (g_rl.size() > 0) {
+    PROFILE_SCOPE(PROF_RL);
+    observeAll(f);
+  }
+}
+
+// Timing statistics file written when the simulation stops, while
+// it is being written.
+static FILE *g_profileFile;
+
+void Quadcopter::stopAll()
+{
+  publishAll(g_frame);
+  logAll();
+  all.call(&Quadcopter::simulationStopped);
+  Trace::write();
+
+  if (Profile::enabled()) {
+    const char *filename = getenv("QUADCOPTER_PROFILE_FILE");
+    if (filename == NULL || *filename == '\0')
+      filename = "quadcopter_profile.csv";
+
+    g_profileFile = fopen(filename, "w");
+    if (g_profileFile != NULL) {
+      Profile::writeCSVHeader(g_profileFile);
+      for (int i = 0; i < PROF_SECTION_COUNT; ++i) {
+        ProfileSection s = (ProfileSection)i;
+        Profile::writeCSVLine(g_profileFile, s, -1, Profile::section(s));
+      }
+      all.call(&Quadcopter::writeProfile);
+
+      fclose(g_profileFile);
+      g_profileFile = NULL;
+      fprintf(stderr, "quadcopter: timing written to '%s'\n", filename);
+    }
+  }
+
+  fprintf(stderr, "quadcopter: range sensors %.0f rays/s on %u threads\n",
+          g_rangeCaster->raysPerSecond(), g_workers->size());
+  fprintf(stderr, "quadcopter: optical flow %.0f frames/s per thread "
+          "on %u threads\n",
+          g_flowProcessor->framesPerSecondPerThread(),
+          g_flowProcessor->size());
+
+  Profile::writePerfReport(
+    stderr, Profile::section(PROF_STEP).count() * all.size());
+
+  const TimeHistogram& rt = Profile::section(PROF_SITL);
+  if (rt.count() > 0) {
+    fprintf(stderr, "quadcopter: SITL round trip mean %.1f us, "
+            "p99 %.1f us, max %.1f us, %llu timeouts\n",
+            Profile::toNanos(rt.mean()) / 1e3,
+            Profile::toNanos(rt.percentile(0.99)) / 1e3,
+            Profile::toNanos((double)rt.max()) / 1e3,
+            (unsigned long long)g_sitl.timeouts());
+  }
+
+  const TimeHistogram& ct = Profile::section(PROF_CONTROL);
+  if (g_control.requests() > 0) {
+    fprintf(stderr, "quadcopter: %llu control requests, mean %.1f us "
+            "per step, %llu connections rejected\n",
+            (unsigned long long)g_control.requests(),
+            Profile::toNanos(ct.mean()) / 1e3,
+            (unsigned long long)g_control.rejected());
+  }
+
+  const TimeHistogram& h = g_commandLatency;
+  if (h.count() > 0) {
+    fprintf(stderr, "quadcopter: %llu commands, latency mean %.1f us, "
+            "p99 %.1f us, max %.1f us\n", (unsigned long long)h.count(),
+            h.mean() / 1e3, h.percentile(0.99) / 1e3, h.max() / 1e3);
+  }
+
+  if (ApiStats::compiled())
+    ApiStats::printSummary();
+  if (AllocStats::compiled())
+    AllocStats::printSummary();
+}
+
+// Return the GPS configuration of a quadcopter: the scene-wide
+// defaults with any overrides from its FIELD_GPS_CONFIG field.  An
+// overridden origin or zone moves the quadcopter's GPS fixes and
+// barometer only; the magnetic field, terrain height and range
+// sensors are still evaluated around the scene-wide origin.
+static GPSSimConfig readGPSConfig(int obj)
+{
+  GPSSimConfig config = g_gps_sim_config;
+  byte_vector  field;
+
+  if (getCustomDataField(obj, FIELD_GPS_CONFIG, field) && !field.empty())
+    parseGPSConfig(std::string(field.begin(), field.end()), config);
+
+  return config;
+}
+
+QuadcopterState::QuadcopterState(int obj, int body, int target, bool hasFlow,
+                                 float originZ)
+  : obj(obj),
+    body(body),
+    target(target),
+    hasFlow(hasFlow),
+    originZ(originZ),
+    lidarRange(0.0f),
+    lidarBeams(0),
+    rangeDownFirst(0),
+    lidarFirst(0)
+{
+  reset(0.0f);
+}
+
+void QuadcopterState::reset(float p)
+{
+  control.reset();
+
+  accel[0] = 0.0f;
+  accel[1] = 0.0f;
+  accel[2] = 0.0f;
+
+  gyro[0] = 0.0f;
+  gyro[1] = 0.0f;
+  gyro[2] = 0.0f;
+
+  agl = 0.0f;
+
+  rangeDown  = RANGE_DOWN_MAX;
+  batchIndex = -1;
+
+  mode        = MODE_TARGET;
+  velocity[0] = 0.0f;
+  velocity[1] = 0.0f;
+  velocity[2] = 0.0f;
+  velocity[3] = 0.0f;
+
+  sitl = 0;
+  memset(sitlMotors, 0, sizeof(sitlMotors));
+
+  episodeStep = 0;
+
+  pressure    = p;
+  magField[0] = 0.0f;
+  magField[1] = 0.0f;
+  magField[2] = 0.0f;
+}
+
+Quadcopter::Quadcopter(int obj)
+  : m_obj(obj),
+    m_csvFile(nullptr),
+    m_logPending(0),
+    m_gpsConfig(readGPSConfig(obj)),
+    m_gps(m_gpsConfig),
+    m_baro(g_baro_sim_config),
+    m_mag(g_mag_sim_config)
+{
+  API_VEHICLE_SCOPE(obj);
+
+  simGetObjectUniqueIdentifier(obj, &m_uniqueID);
+
+  int body      = searchCustomDataField(obj, FIELD_BODY);
+  int target    = searchCustomDataField(obj, FIELD_TARGET);
+  m_cameraDown  = searchCustomDataField(obj, FIELD_CAMERA_DOWN);
+  m_cameraFront = searchCustomDataField(obj, FIELD_CAMERA_FRONT);
+
+  m_motors[0]   = searchCustomDataField(obj, FIELD_MOTOR_0);
+  m_motors[1]   = searchCustomDataField(obj, FIELD_MOTOR_1);
+  m_motors[2]   = searchCustomDataField(obj, FIELD_MOTOR_2);
+  m_motors[3]   = searchCustomDataField(obj, FIELD_MOTOR_3);
+
+  m_flowFov = FLOW_CAMERA_FOV;
+  if (m_cameraDown != -1) {
+    m_flow = std::make_shared<OpticalFlowSensor>();
+
+    float fov;
+    if (simGetObjectFloatParameter(m_cameraDown,
+                                   sim_visionfloatparam_perspective_angle,
+                                   &fov) == 1 && fov > 0.0f)
+      m_flowFov = fov;
+  }
+
+  // The barometer and the RL GPS observation follow this quadcopter's
+  // GPS origin; the magnetic field and terrain do not.
+  const GPSSimConfig& gps = g_gps_sim_config;
+  if (m_gpsConfig.zone != gps.zone || m_gpsConfig.isNorth != gps.isNorth ||
+      m_gpsConfig.originX != gps.originX ||
+      m_gpsConfig.originY != gps.originY ||
+      m_gpsConfig.originZ != gps.originZ)
+    m_gpsProjector.reset(new GPSProjector(m_gpsConfig, 16));
+
+  m_index = states.add(obj, body, target, m_cameraDown != -1,
+                       (float)m_gpsConfig.originZ);
+  g_swarm.push_back(this);
+
+  std::shared_ptr<PublishedState>& published = g_published[obj];
+  if (!published)
+    published = std::make_shared<PublishedState>();
+  m_published = published;
+
+  fprintf(stderr, "--- Found Quadcopter %d:\n", m_uniqueID);
+  printObjWithLabel("Quadcopter:", m_obj);
+  printObjWithLabel("Body:",       body);
+  printObjWithLabel("Target:",     target);
+  printObjWithLabel("Motor #1:",   m_motors[0]);
+  printObjWithLabel("Motor #2:",   m_motors[1]);
+  printObjWithLabel("Motor #3:",   m_motors[2]);
+  printObjWithLabel("Motor #4:",   m_motors[3]);
+  printObjWithLabel("Floor Cam:",  m_cameraDown);
+  printObjWithLabel("Front Cam:",  m_cameraFront);
+}
+
+void Quadcopter::simulationStarted()
+{
+  QuadcopterState& s = state();
+
+  m_lastSaveTime = 0;
+  s.reset(g_baroTable.pressure(s.originZ));
+
+  float euler[3];
+  memset(m_home, 0, sizeof(m_home));
+  memset(m_targetHome, 0, sizeof(m_targetHome));
+  if (simGetObjectPosition(m_obj, -1, m_home) != -1 &&
+      simGetObjectOrientation(m_obj, -1, euler) != -1)
+    m_home[3] = euler[2];
+  if (simGetObjectPosition(s.target, -1, m_targetHome) != -1 &&
+      simGetObjectOrientation(s.target, -1, euler) != -1)
+    m_targetHome[3] = euler[2];
+  m_lidarScan.assign(s.lidarBeams, s.lidarRange);
+
+  // The noise of each run follows from the run seed.
+  m_gps.reset();
+  m_baro.reset();
+  seedSensors(frameKey(g_frame.seed, (uint64_t)(uint32_t)m_obj));
+
+  for (auto& h : m_profile)
+    h.clear();
+
+  if (m_flow)
+    m_flow->reset();
+
+  char filename[128];
+  snprintf(filename, sizeof(filename),
+           "quadrotor_%d_log.csv", m_obj);
+
+  m_csvFile = fopen(filename, "w");
+
+  if (m_csvFile) {
+    fprintf(stderr, "Logging data to '%s'\n", filename);
+    fputs(SENSOR_LOG_HEADER, m_csvFile);
+    m_logPending = strlen(SENSOR_LOG_HEADER);
+  }
+}
+
+void Quadcopter::simulationStopped()
+{
+  if (m_csvFile != nullptr) {
+    flushLog();
+    fclose(m_csvFile);
+    m_csvFile = nullptr;
+  }
+}
+
+void Quadcopter::flushLog() const
+{
+  TRACE_SCOPE_ARG("logFlush", "vehicle", m_obj);
+  fflush(m_csvFile);
+  FlightRecorder::record(REC_LOG_FLUSH, m_obj, (int64_t)m_logPending);
+  m_logPending = 0;
+}
+
+// Read sensor data into our internal state.
+void Quadcopter::readSensors(const Frame& f)
+{
+  PROFILE_VEHICLE_SCOPE(PROF_READ_SENSORS, m_profile);
+  TRACE_SCOPE_ARG("readSensors", "vehicle", m_obj);
+  RECORDER_SCOPE(REC_READ_SENSORS, m_obj);
+  API_VEHICLE_SCOPE(m_obj);
+
+  QuadcopterState& s = state();
+  float now = f.time;
+
+  s.gpsPosition = m_gps.getGPSPosition(s.body, now);
+
+  // Altitude above ground uses the true position; without a terrain
+  // model the ground is the flat plane at the scene origin.
+  float pos[3];
+  if (simGetObjectPosition(s.body, -1, pos) != -1) {
+    s.agl = pos[2];
+    if (g_terrain)
+      s.agl -= g_terrain->groundLocal(pos[0], pos[1]);
+  }
+}
+
+// Error checking macro for "pidControl".  This wraps calls to the
+// V-REP API functions and prints an error message and returns from
+// the current function if an error occurs.
+#define CHECK(expr)                               \
+  do {                                            \
+    if ((expr) == -1) {                           \
+      fprintf(stderr, "%s:%d: %s failed\n",       \
+              __FILE__, __LINE__, # expr);        \
+      return;                                     \
+    }                                             \
+  } while (0)
+
+// Ported PID control from the Lua script.  Follows the quadcopter
+// target object.
+void Quadcopter::pidControl(float *motors_out)
+{
+  PROFILE_VEHICLE_SCOPE(PROF_PID_CONTROL, m_profile);
+  TRACE_SCOPE_ARG("pidControl", "vehicle", m_obj);
+  RECORDER_SCOPE(REC_PID_CONTROL, m_obj);
+  API_VEHICLE_SCOPE(m_obj);
+
+  QuadcopterState& s = state();
+  int d = s.body;               // to match lua script
+
+  if (s.mode == MODE_IDLE) {
+    for (int i = 0; i < 4; ++i)
+      motors_out[i] = 0.0f;
+    return;
+  }
+
+  if (s.sitl) {
+    memcpy(motors_out, s.sitlMotors, sizeof(s.sitlMotors));
+    return;
+  }
+
+  if (m_index < g_rl.size()) {
+    memcpy(motors_out, g_rl.actions() + m_index * RL_ACT_DIM,
+           RL_ACT_DIM * sizeof(float));
+    return;
+  }
+
+  FlightControlInput in;
+  float targetPos[3], pos[3], vel[3];
+
+  CHECK(simGetObjectPosition(s.target, -1, targetPos));
+  CHECK(simGetObjectPosition(d, -1, pos));
+  CHECK(simGetObjectVelocity(s.obj, vel, NULL));
+  in.targetZ = targetPos[2];
+  in.z       = pos[2];
+  in.vz      = vel[2];
+
+  // Tilt of the body, from where its X and Y axes point:
+  float m[12];
+  float vx[3] = { 1.0f, 0.0f, 0.0f };
+  float vy[3] = { 0.0f, 1.0f, 0.0f };
+
+  CHECK(simGetObjectMatrix(d, -1, m));
+  CHECK(simTransformVector(m, vx));
+  CHECK(simTransformVector(m, vy));
+  in.xAxisZ = vx[2];
+  in.yAxisZ = vy[2];
+
+  // Direction and heading of the target:
+  float sp[3], euler[3];
+  CHECK(simGetObjectPosition(s.target, d, sp));
+  CHECK(simGetObjectOrientation(d, s.target, euler));
+  in.targetX = sp[0];
+  in.targetY = sp[1];
+  in.yaw     = euler[2];
+
+  s.control.run(in, motors_out);
+}
+
+#undef CHECK
 
 void Quadcopter::simulationStepped()
 {
 }
+
+// Add a quadcopter's pose and range sensor rays to the sensor batch.
+// Range sensors are mounted at the body origin.  Only the lidar
+// pattern lives outside the quadcopter's state.
+void Quadcopter::addToSensorBatch(const Frame& f, size_t i)
+{
+  static const RangeScanPattern down = RangeScanPattern::down();
+  QuadcopterState& s = states[i];
+  float m[12];
+
+  API_VEHICLE_SCOPE(s.obj);
+
+  s.batchIndex = -1;
+  if (simGetObjectMatrix(s.body, -1, m) == -1)
+    return;
+
+  SensorBatch& b = g_sensorBatch;
+  s.batchIndex = (int)b.count++;
+  memcpy(&b.mats[s.batchIndex * 12], m, sizeof(m));
+  b.alt[s.batchIndex] = s.originZ + m[11];
+
+  s.rangeDownFirst = g_rangeCaster->add(m, down, RANGE_DOWN_MAX);
+  if (s.lidarBeams > 0) {
+    s.lidarFirst = g_rangeCaster->add(m, g_swarm[i]->m_lidarPattern,
+                                      s.lidarRange);
+  }
+}
+
+void Quadcopter::storeSensorBatch(const Frame& f, size_t i)
+{
+  QuadcopterState& s = states[i];
+  if (s.batchIndex < 0)
+    return;
+
+  const SensorBatch& b = g_sensorBatch;
+  Quadcopter *qc = g_swarm[i];
+
+  s.pressure = qc->m_baro.measure(b.pressure[s.batchIndex], f.dt);
+
+  s.magField[0] = b.mag[s.batchIndex * 3 + 0];
+  s.magField[1] = b.mag[s.batchIndex * 3 + 1];
+  s.magField[2] = b.mag[s.batchIndex * 3 + 2];
+  qc->m_mag.measure(s.magField);
+
+  s.rangeDown = g_rangeCaster->result(s.rangeDownFirst);
+
+  for (uint32_t j = 0; j < s.lidarBeams; ++j)
+    qc->m_lidarScan[j] = g_rangeCaster->result(s.lidarFirst + j);
+}
+
+void Quadcopter::captureFlowFrame(const Frame& f, size_t i)
+{
+  const QuadcopterState& s = states[i];
+  if (!s.hasFlow)
+    return;
+
+  Quadcopter *qc = g_swarm[i];
+
+  API_VEHICLE_SCOPE(s.obj);
+
+  simInt res[2];
+  if (simGetVisionSensorResolution(qc->m_cameraDown, res) == -1)
+    return;
+
+  simFloat *image = simGetVisionSensorImage(qc->m_cameraDown);
+  if (image == NULL)
+    return;
+
+  if (qc->m_flow->submit(image, res[0], res[1], f.time))
+    g_flowProcessor->submit(qc->m_flow);
+
+  simReleaseBuffer((simChar *)image);
+}
+
+bool Quadcopter::sendCommand(int obj, Command cmd)
+{
+  Quadcopter *qc = all.find(obj);
+  if (qc == nullptr || qc->m_index >= g_inbox.size())
+    return false;
+
+  if (!commandFinite(cmd))
+    return false;
+
+  if (cmd.issued == 0)
+    cmd.issued = commandNow();
+  return g_inbox.queue(qc->m_index).push(cmd);
+}
+
+void Quadcopter::applyCommands(const Frame& f, size_t i)
+{
+  QuadcopterState& s = states[i];
+  Command cmd;
+
+  if (i < g_inbox.size()) {
+    CommandQueue& q = g_inbox.queue(i);
+    uint64_t now = 0;
+
+    while (q.pop(cmd)) {
+      if (now == 0)
+        now = commandNow();
+      if (cmd.issued != 0 && cmd.issued <= now)
+        g_commandLatency.record(now - cmd.issued);
+      if (!commandFinite(cmd))
+        continue;               // pushed directly into shared memory
+
+      API_VEHICLE_SCOPE(s.obj);
+
+      switch (cmd.type) {
+      case CMD_SETPOINT: {
+        float euler[3] = { 0.0f, 0.0f, cmd.value[3] };
+        simSetObjectPosition(s.target, -1, cmd.value);
+        simSetObjectOrientation(s.target, -1, euler);
+        s.mode = MODE_TARGET;
+        break;
+      }
+      case CMD_VELOCITY:
+        memcpy(s.velocity, cmd.value, sizeof(s.velocity));
+        s.mode = MODE_VELOCITY;
+        break;
+      case CMD_MODE:
+        if (cmd.mode < MODE_COUNT)
+          s.mode = cmd.mode;
+        break;
+      }
+    }
+  }
+
+  if (s.mode != MODE_VELOCITY)
+    return;
+
+  API_VEHICLE_SCOPE(s.obj);
+
+  float pos[3], euler[3];
+  if (simGetObjectPosition(s.target, -1, pos) == -1 ||
+      simGetObjectOrientation(s.target, -1, euler) == -1)
+    return;
+
+  for (int k = 0; k < 3; ++k)
+    pos[k] += s.velocity[k] * f.dt;
+  euler[2] += s.velocity[3] * f.dt;
+
+  simSetObjectPosition(s.target, -1, pos);
+  simSetObjectOrientation(s.target, -1, euler);
+}
+
+void Quadcopter::exchangeSitl(const Frame& f)
+{
+  size_t n = states.size();
+
+  for (size_t i = 0; i < n; ++i) {
+    SitlSlot *slot = g_sitl.slot(i);
+    if (slot == nullptr)
+      break;
+
+    const QuadcopterState& s = states[i];
+    SitlSensors& p = slot->sensors;
+
+    p.step     = f.step;
+    p.time     = f.time;
+    p.lat      = s.gpsPosition.lat;
+    p.lon      = s.gpsPosition.lon;
+    p.altitude = s.gpsPosition.altitude;
+    memcpy(p.accel, s.accel, sizeof(p.accel));
+    memcpy(p.gyro, s.gyro, sizeof(p.gyro));
+    p.pressure = s.pressure;
+    memcpy(p.magField, s.magField, sizeof(p.magField));
+    p.agl       = s.agl;
+    p.rangeDown = s.rangeDown;
+  }
+
+  g_sitl.exchange();
+
+  // Vehicles whose flight stack missed the step hold their last
+  // commands; detached ones go back to the built-in controller.
+  for (size_t i = 0; i < n; ++i) {
+    SitlSlot *slot = g_sitl.slot(i);
+    if (slot == nullptr)
+      break;
+
+    QuadcopterState& s = states[i];
+    if (g_sitl.motors(i, s.sitlMotors))
+      s.sitl = 1;
+    else if (slot->attached.load(std::memory_order_relaxed) == 0)
+      s.sitl = 0;
+  }
+}
+
+void Quadcopter::answerControl(const Frame& f)
+{
+  ControlStep step = { f.step, f.time };
+  ControlRequest *r;
+
+  while ((r = g_control.take()) != nullptr) {
+    ControlState *out = ControlServer::startReply(r, step);
+
+    for (size_t k = 0; k < r->commands.size(); ++k) {
+      const ControlCommand& c = r->commands[k];
+      ControlState&         o = out[k];
+
+      o.obj = c.obj;
+      Quadcopter *qc = all.find(c.obj);
+      if (qc == nullptr)
+        continue;
+
+      const QuadcopterState& s = qc->state();
+      o.status   = CTRL_FOUND;
+      o.mode     = (uint16_t)s.mode;
+      o.lat      = s.gpsPosition.lat;
+      o.lon      = s.gpsPosition.lon;
+      o.altitude = s.gpsPosition.altitude;
+      memcpy(o.accel, s.accel, sizeof(o.accel));
+      memcpy(o.gyro, s.gyro, sizeof(o.gyro));
+      o.pressure = s.pressure;
+      memcpy(o.magField, s.magField, sizeof(o.magField));
+      o.agl       = s.agl;
+      o.rangeDown = s.rangeDown;
+
+      {
+        API_VEHICLE_SCOPE(s.obj);
+        simGetObjectMatrix(s.body, -1, o.pose);
+        simGetObjectVelocity(s.obj, o.velocity, o.angVel);
+      }
+
+      if (c.type != 0) {
+        Command cmd;
+        cmd.type   = c.type;
+        cmd.mode   = c.mode;
+        cmd.issued = r->received;
+        memcpy(cmd.value, c.value, sizeof(cmd.value));
+        if (sendCommand(c.obj, cmd))
+          o.status |= CTRL_QUEUED;
+      }
+    }
+
+    g_control.reply(r);
+  }
+}
+
+void Quadcopter::publishAll(const Frame& f)
+{
+  size_t n = states.size();
+
+  for (size_t i = 0; i < n; ++i) {
+    const QuadcopterState& s = states[i];
+    QuadcopterSnapshot p;
+
+    p.step = f.step;
+    p.time = f.time;
+    memcpy(p.accel, s.accel, sizeof(p.accel));
+    memcpy(p.gyro, s.gyro, sizeof(p.gyro));
+    p.gpsPosition = s.gpsPosition;
+    p.agl         = s.agl;
+    p.pressure    = s.pressure;
+    memcpy(p.magField, s.magField, sizeof(p.magField));
+    p.rangeDown   = s.rangeDown;
+
+    g_swarm[i]->m_published->store(p);
+  }
+}
+
+// The logs are written from the published state, not the live state,
+// so they need neither the simulator thread nor the interface lock.
+void Quadcopter::logAll()
+{
+  char line[SENSOR_LOG_LINE_MAX];
+
+  for (Quadcopter *qc : g_swarm) {
+    if (qc->m_csvFile == nullptr)
+      continue;
+
+    QuadcopterSnapshot p = qc->m_published->load();
+    SensorLogLine l = {
+      qc->m_obj, p.time,
+      p.gpsPosition.lat, p.gpsPosition.lon, p.gpsPosition.altitude,
+      { p.accel[0], p.accel[1], p.accel[2] },
+      { p.gyro[0],  p.gyro[1],  p.gyro[2] },
+      p.agl, p.pressure,
+      { p.magField[0], p.magField[1], p.magField[2] }
+    };
+
+    int len = formatSensorLogLine(line, sizeof(line), l);
+    fwrite(line, 1, (size_t)len, qc->m_csvFile);
+
+    qc->m_logPending += (size_t)len;
+    if (qc->m_logPending >= LOG_FLUSH_BYTES)
+      qc->flushLog();
+  }
+}
+
+std::shared_ptr<const PublishedState> Quadcopter::published(int obj)
+{
+  auto i = g_published.find(obj);
+  return i != g_published.end() ? i->second : nullptr;
+}
+
+void Quadcopter::publishSignal(const Frame& f)
+{
+  size_t n = states.size();
+  g_swarmSignal.resize(sizeof(SwarmSignalHeader) + n * sizeof(SwarmRecord));
+
+  SwarmSignalHeader h;
+  h.magic      = SWARM_SIGNAL_MAGIC;
+  h.version    = SWARM_SIGNAL_VERSION;
+  h.headerSize = sizeof(SwarmSignalHeader);
+  h.recordSize = sizeof(SwarmRecord);
+  h.count      = (uint32_t)n;
+  h.step       = f.step;
+  h.time       = f.time;
+  memcpy(&g_swarmSignal[0], &h, sizeof(h));
+
+  SwarmRecord *records = (SwarmRecord *)&g_swarmSignal[sizeof(h)];
+  memset(records, 0, n * sizeof(SwarmRecord));
+
+  for (size_t i = 0; i < n; ++i) {
+    const QuadcopterState& s = states[i];
+    SwarmRecord&           r = records[i];
+
+    r.obj      = s.obj;
+    r.mode     = s.mode;
+    r.lat      = s.gpsPosition.lat;
+    r.lon      = s.gpsPosition.lon;
+    r.altitude = s.gpsPosition.altitude;
+    memcpy(r.accel, s.accel, sizeof(r.accel));
+    memcpy(r.gyro, s.gyro, sizeof(r.gyro));
+    r.pressure = s.pressure;
+    memcpy(r.magField, s.magField, sizeof(r.magField));
+    r.agl       = s.agl;
+    r.rangeDown = s.rangeDown;
+
+    API_VEHICLE_SCOPE(s.obj);
+
+    float t[12];
+    simGetObjectMatrix(s.body, -1, r.pose);
+    simGetObjectVelocity(s.obj, r.velocity, r.angVel);
+    if (simGetObjectMatrix(s.target, -1, t) != -1) {
+      r.target[0] = t[3];
+      r.target[1] = t[7];
+      r.target[2] = t[11];
+      r.target[3] = atan2f(t[4], t[0]);
+    }
+  }
+
+  simSetStringSignal(g_swarmSignalName.c_str(),
+                     (const simChar *)&g_swarmSignal[0],
+                     (simInt)g_swarmSignal.size());
+}
+
+size_t Quadcopter::resetEpisodes(const int *objs, size_t n, const float *poses)
+{
+  size_t found = 0;
+
+  for (size_t k = 0; k < n; ++k) {
+    Quadcopter *qc = all.find(objs[k]);
+    if (qc == nullptr)
+      continue;
+
+    resetEpisode(g_frame, qc->m_index, poses != nullptr ? poses + k * 4
+                                                        : nullptr);
+    ++found;
+  }
+
+  return found;
+}
+
+void Quadcopter::resetEpisode(const Frame& f, size_t i, const float *pose)
+{
+  QuadcopterState& s = states[i];
+  Quadcopter *qc = g_swarm[i];
+
+  API_VEHICLE_SCOPE(s.obj);
+
+  // The target keeps its starting offset from the quadcopter.
+  const float *home = qc->m_home;
+  if (pose == nullptr)
+    pose = home;
+
+  float pos[3]   = { pose[0], pose[1], pose[2] };
+  float euler[3] = { 0.0f, 0.0f, pose[3] };
+  simSetObjectPosition(s.obj, -1, pos);
+  simSetObjectOrientation(s.obj, -1, euler);
+  simResetDynamicObject(s.obj);
+  if (s.body != s.obj)
+    simResetDynamicObject(s.body);
+
+  for (int k = 0; k < 3; ++k)
+    pos[k] += qc->m_targetHome[k] - home[k];
+  euler[2] += qc->m_targetHome[3] - home[3];
+  simSetObjectPosition(s.target, -1, pos);
+  simSetObjectOrientation(s.target, -1, euler);
+
+  s.reset(g_baroTable.pressure(s.originZ));
+  qc->m_lidarScan.assign(s.lidarBeams, s.lidarRange);
+
+  qc->m_gps.reset();
+  qc->m_baro.reset();
+  qc->seedSensors(frameKey(f.rngKey, (uint64_t)(uint32_t)s.obj));
+
+  if (qc->m_flow)
+    qc->m_flow->reset();
+}
+
+// Store four floats at a 16-byte aligned "out".
+static inline void store4(float *out, float a, float b, float c, float d)
+{
+#ifdef __SSE__
+  _mm_store_ps(out, _mm_setr_ps(a, b, c, d));
+#else
+  out[0] = a;
+  out[1] = b;
+  out[2] = c;
+  out[3] = d;
+#endif
+}
+
+// Copy four floats to a 16-byte aligned "out".
+static inline void copy4(float *out, const float *in)
+{
+#ifdef __SSE__
+  _mm_store_ps(out, _mm_loadu_ps(in));
+#else
+  memcpy(out, in, 4 * sizeof(float));
+#endif
+}
+
+// Pack each quadcopter's observation row from its state and the pose
+// read for this step's sensor batch, gathering the reward inputs by
+// axis on the way, then score all of them at once.
+void Quadcopter::observeAll(Frame& f)
+{
+  size_t n = std::min(states.size(), g_rl.size());
+  if (n == 0)
+    return;
+
+  float    *err[3], *angVel[3];
+  float    *upright = f.scratch.alloc<float>(n);
+  uint32_t *steps   = f.scratch.alloc<uint32_t>(n);
+  for (int k = 0; k < 3; ++k) {
+    err[k]    = f.scratch.alloc<float>(n);
+    angVel[k] = f.scratch.alloc<float>(n);
+  }
+
+  // GPS fixes are turned back into scene coordinates in one batch,
+  // then those of quadcopters with their own origin are redone.
+  double *fixes = f.scratch.alloc<double>(n * 3);
+  float  *local = f.scratch.alloc<float>(n * 3);
+  for (size_t i = 0; i < n; ++i) {
+    const GPSPosition& g = states[i].gpsPosition;
+    fixes[i * 3 + 0] = g.lat;
+    fixes[i * 3 + 1] = g.lon;
+    fixes[i * 3 + 2] = g.altitude;
+  }
+  g_gpsProjector->toLocalBatch(fixes, local, n, GPS_PROJECT_LOCAL);
+  for (size_t i = 0; i < n; ++i) {
+    GPSProjector *own = g_swarm[i]->m_gpsProjector.get();
+    if (own != nullptr)
+      own->toLocal(fixes[i * 3 + 0], fixes[i * 3 + 1], fixes[i * 3 + 2],
+                   &local[i * 3], GPS_PROJECT_LOCAL);
+  }
+
+  const SensorBatch& b = g_sensorBatch;
+  const float *actions = g_rl.actions();
+  float *obs = g_rl.obs();
+
+  for (size_t i = 0; i < n; ++i) {
+    QuadcopterState& s = states[i];
+    float *row = obs + i * RL_OBS_DIM;
+
+    API_VEHICLE_SCOPE(s.obj);
+
+    // Quadcopters whose pose could not be read report a level pose at
+    // the origin.  Those and quadcopters whose velocity or target could
+    // not be read report zero velocities and zero target error, so
+    // they are not scored as failing.
+    static const float level[12] = {
+      1.0f, 0.0f, 0.0f, 0.0f,
+      0.0f, 1.0f, 0.0f, 0.0f,
+      0.0f, 0.0f, 1.0f, 0.0f,
+    };
+    const float *m = s.batchIndex >= 0 ? &b.mats[s.batchIndex * 12] : level;
+    float vel[3] = { 0.0f, 0.0f, 0.0f }, ang[3] = { 0.0f, 0.0f, 0.0f };
+    float t[12];
+
+    if (s.batchIndex < 0 || simGetObjectVelocity(s.obj, vel, ang) == -1 ||
+        simGetObjectMatrix(s.target, -1, t) == -1)
+      memcpy(t, m, sizeof(t));
+
+    float heading = remainderf(atan2f(t[4], t[0]) - atan2f(m[4], m[0]),
+                               2.0f * (float)M_PI);
+    float ex = t[3] - m[3], ey = t[7] - m[7], ez = t[11] - m[11];
+
+    // Zero until the first fix.
+    static const float noFix[3] = { 0.0f, 0.0f, 0.0f };
+    const GPSPosition& g = s.gpsPosition;
+    const float *fix = (g.lat != 0.0 || g.lon != 0.0) ? &local[i * 3] : noFix;
+
+    copy4(row + RL_OBS_POSE + 0, m + 0);
+    copy4(row + RL_OBS_POSE + 4, m + 4);
+    copy4(row + RL_OBS_POSE + 8, m + 8);
+    store4(row + RL_OBS_VEL, vel[0], vel[1], vel[2], s.agl);
+    store4(row + RL_OBS_ANGVEL, ang[0], ang[1], ang[2], s.rangeDown);
+    store4(row + RL_OBS_ACCEL, s.accel[0], s.accel[1], s.accel[2], 0.0f);
+    store4(row + RL_OBS_GYRO, s.gyro[0], s.gyro[1], s.gyro[2], 0.0f);
+    store4(row + RL_OBS_GPS, fix[0], fix[1], fix[2], 0.0f);
+    store4(row + RL_OBS_TARGET, ex, ey, ez, heading);
+    copy4(row + RL_OBS_ACTION, actions + i * RL_ACT_DIM);
+
+    err[0][i]    = ex;
+    err[1][i]    = ey;
+    err[2][i]    = ez;
+    angVel[0][i] = ang[0];
+    angVel[1][i] = ang[1];
+    angVel[2][i] = ang[2];
+    upright[i]   = m[10];
+    steps[i]     = ++s.episodeStep;
+  }
+
+  RlRewardInputs in = {
+    { err[0], err[1], err[2] }, upright,
+    { angVel[0], angVel[1], angVel[2] }, steps
+  };
+  rlRewardBatch(in, g_rl.rewards(), g_rl.dones(), n, g_rl.episodeSteps());
+  g_rl.publish();
+}
+
+void Quadcopter::seedSensors(uint64_t key)
+{
+  m_gps.seed(frameKey(key, 0));
+  m_baro.seed(frameKey(key, 1));
+  m_mag.seed(frameKey(key, 2));
+}
+
+void Quadcopter::snapshot(std::vector<uint8_t>& out)
+{
+  out.clear();
+  SnapshotWriter w(out);
+
+  SnapshotHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic     = SNAPSHOT_MAGIC;
+  h.version   = SNAPSHOT_VERSION;
+  h.stateSize = sizeof(QuadcopterState);
+  h.noiseSize = sizeof(NoiseState);
+  h.count     = (uint32_t)states.size();
+  h.time      = g_frame.time;
+  h.step      = g_frame.step;
+  h.seed      = g_frame.seed;
+  h.rngKey    = g_frame.rngKey;
+  w.put(h);
+
+  // Record sizes are filled in once each record is written.
+  for (size_t i = 0; i < states.size(); ++i) {
+    const Quadcopter *qc = g_swarm[i];
+    size_t start = w.size();
+
+    SnapshotRecord rec;
+    rec.obj   = states[i].obj;
+    rec.size  = 0;
+    rec.beams = (uint32_t)qc->m_lidarScan.size();
+    w.put(rec);
+    qc->saveState(w);
+
+    rec.size = (uint32_t)(w.size() - start - sizeof(rec));
+    memcpy(w.at(start), &rec, sizeof(rec));
+  }
+
+  h.size = w.size();
+  memcpy(w.at(0), &h, sizeof(h));
+}
+
+int Quadcopter::restore(const uint8_t *data, size_t size)
+{
+  SnapshotHeader h;
+  int found = 0;
+
+  // The first pass only checks the records, so a bad snapshot is
+  // turned away before anything has changed.
+  for (int pass = 0; pass < 2; ++pass) {
+    bool applying = pass == 1;
+    SnapshotReader r(data, size, true);
+
+    if (!r.get(h) || h.magic != SNAPSHOT_MAGIC ||
+        h.version != SNAPSHOT_VERSION || h.size != size ||
+        h.stateSize != sizeof(QuadcopterState) ||
+        h.noiseSize != sizeof(NoiseState))
+      return -1;
+
+    found = 0;
+    for (uint32_t k = 0; k < h.count; ++k) {
+      SnapshotRecord rec;
+      if (!r.get(rec) || rec.size > r.left())
+        return -1;
+
+      SnapshotReader body = r.sub(rec.size, applying);
+      Quadcopter *qc = all.find(rec.obj);
+      if (qc == nullptr)
+        continue;
+      if (!qc->restoreState(body, rec.beams))
+        return -1;
+
+      if (applying && qc->m_index < g_inbox.size()) {
+        CommandQueue& q = g_inbox.queue(qc->m_index);
+        Command cmd;
+        while (q.pop(cmd)) {}
+      }
+      ++found;
+    }
+
+    if (r.left() != 0)
+      return -1;
+  }
+
+  // Noise keys of later steps follow from the step and seed.
+  g_frame.time   = h.time;
+  g_frame.step   = h.step;
+  g_frame.seed   = h.seed;
+  g_frame.rngKey = h.rngKey;
+
+  publishAll(g_frame);
+  return found;
+}
+
+void Quadcopter::saveState(SnapshotWriter& w) const
+{
+  w.put(state());
+  w.put(m_lastSaveTime);
+  w.put(m_home);
+  w.put(m_targetHome);
+  w.putBytes(m_lidarScan.data(), m_lidarScan.size() * sizeof(float));
+
+  m_gps.save(w);
+  m_baro.save(w);
+  m_mag.save(w);
+
+  FlowResult flow;
+  if (m_flow)
+    flow = m_flow->latest();
+  w.put(flow);
+
+  int64_t logOffset = -1;
+  if (m_csvFile != nullptr) {
+    flushLog();
+    logOffset = ftell(m_csvFile);
+  }
+  w.put(logOffset);
+}
+
+bool Quadcopter::restoreState(SnapshotReader& r, uint32_t beams)
+{
+  QuadcopterState& s = state();
+  QuadcopterState  saved(s);
+
+  if (!r.get(saved) || !r.get(m_lastSaveTime) || !r.get(m_home) ||
+      !r.get(m_targetHome))
+    return false;
+
+  // A scan from a different lidar pattern is left out.
+  size_t scanBytes = beams * sizeof(float);
+  if (beams == m_lidarScan.size() && beams > 0) {
+    if (!r.getBytes(m_lidarScan.data(), scanBytes))
+      return false;
+  } else if (!r.skip(scanBytes)) {
+    return false;
+  }
+
+  FlowResult flow;
+  int64_t    logOffset;
+  if (!m_gps.restore(r) || !m_baro.restore(r) || !m_mag.restore(r) ||
+      !r.get(flow) || !r.get(logOffset) || r.left() != 0)
+    return false;
+
+  if (!r.applying())
+    return true;
+
+  // The scene objects and the lidar and sensor batch layout are those
+  // of the scene as it is now.
+  saved.obj            = s.obj;
+  saved.body           = s.body;
+  saved.target         = s.target;
+  saved.hasFlow        = s.hasFlow;
+  saved.originZ        = s.originZ;
+  saved.lidarRange     = s.lidarRange;
+  saved.lidarBeams     = s.lidarBeams;
+  saved.batchIndex     = s.batchIndex;
+  saved.rangeDownFirst = s.rangeDownFirst;
+  saved.lidarFirst     = s.lidarFirst;
+  s = saved;
+
+  if (m_flow)
+    m_flow->reset(flow);
+
+  // Lines logged after the snapshot are dropped.
+  if (m_csvFile != nullptr && logOffset >= 0 &&
+      logOffset < ftell(m_csvFile)) {
+    flushLog();
+    if (ftruncate(fileno(m_csvFile), (off_t)logOffset) == 0)
+      fseek(m_csvFile, (long)logOffset, SEEK_SET);
+  }
+
+  return true;
+}
+
+int Quadcopter::getOpticalFlow(float *out)
+{
+  out[0] = 0.0f;
+  out[1] = 0.0f;
+
+  if (!m_flow)
+    return -1;
+
+  FlowResult r = m_flow->latest();
+  if (r.dt > 0.0f) {
+    float radPerPixel = m_flowFov / FLOW_RES;
+    out[0] = r.flowX * radPerPixel / r.dt;
+    out[1] = r.flowY * radPerPixel / r.dt;
+  }
+
+  return r.quality;
+}
+
+void Quadcopter::writeProfile()
+{
+  for (int i = PROF_VEHICLE_FIRST; i < PROF_SECTION_COUNT; ++i) {
+    ProfileSection s = (ProfileSection)i;
+    Profile::writeCSVLine(g_profileFile, s, m_obj, getProfile(s));
+  }
+}
@@ -9,9 +9,98 @@
 #ifndef V_REP_EXT_QUADCOPTER_QUADCOPTER_H_INCLUDED
 #define V_REP_EXT_QUADCOPTER_QUADCOPTER_H_INCLUDED
 
+#include <memory>
+#include <vector>
+
+#include "Arena.h"
+#include "Command.h"
 #include "Container.h"
+#include "FlightControl.h"
+#include "Frame.h"
 #include "PID.h"
+#include "Profile.h"
+#include "SimBaro.h"
+#include "SimFlow.h"
 #include "SimGPS.h"
+#include "SimMag.h"
+#include "SimRange.h"
+#include "SeqLock.h"
+#include "Snapshot.h"
+
+// State of a quadcopter used on every step.  The states of the swarm
+// are packed into "Quadcopter::states" in swarm order, so the step
+// loop walks consecutive cache lines; everything used less often,
+// including the simulated sensors and their random number
+// generators, stays in the "Quadcopter".
+struct alignas(ARENA_ALIGN) QuadcopterState
+{
+  QuadcopterState(int obj, int body, int target, bool hasFlow,
+                  float originZ);
+
+  // Reset the state when the simulation is started.
+  void reset(float pressure);
+
+  // Scene objects.
+  int  obj;
+  int  body;
+  int  target;
+  bool hasFlow;                 // has a down camera
+
+  // Altitude of the scene's Z = 0 from the quadcopter's GPS origin.
+  float originZ;
+
+  // Latest sensor readings.
+  float       accel[3];
+  float       gyro[3];
+  GPSPosition gpsPosition;
+  float       agl;
+  float       pressure;
+  float       magField[3];
+  float       rangeDown;
+
+  // Lidar range and number of beams (0 if the lidar is off).
+  float    lidarRange;
+  uint32_t lidarBeams;
+
+  // ControlMode, and the commanded velocity and yaw rate in
+  // MODE_VELOCITY.
+  uint32_t mode;
+  float    velocity[4];
+
+  // Set while an external flight stack drives the motors through the
+  // SITL bridge, and its latest motor commands.
+  uint32_t sitl;
+  float    sitlMotors[4];
+
+  // Steps since the quadcopter's RL episode started.
+  uint32_t episodeStep;
+
+  // Index of the quadcopter in the sensor batch for the current
+  // step, or -1 if its pose could not be read, and the index of its
+  // first range sensor ray in the ray batch.
+  int    batchIndex;
+  size_t rangeDownFirst;
+  size_t lidarFirst;
+
+  FlightController control;
+};
+
+// Sensor readings of a quadcopter as of the end of a step, published
+// for readers on other threads.
+struct QuadcopterSnapshot
+{
+  uint64_t    step;             // step index of the frame
+  float       time;             // simulation time of the frame (s)
+  float       accel[3];
+  float       gyro[3];
+  GPSPosition gpsPosition;
+  float       agl;
+  float       pressure;
+  float       magField[3];
+  float       rangeDown;
+};
+
+typedef SeqLock<QuadcopterSnapshot> PublishedState;
 
 class Quadcopter
 {
@@ -19,6 +108,12 @@ public:
   // Container of all quadcopters in the simulation.
   static GenericContainer<Quadcopter> all;
 
+  // Per-step state of all quadcopters, indexed by "index()".
+  static Arena<QuadcopterState> states;
+
+  // Rebuild "all" and "states" when the scene changes.
+  static void rebuildAll();
+
   // Return true if a scene object is a quadcopter.
   static bool query(int obj);
 
@@ -27,6 +122,27 @@ public:
   // success, false on failure.
   static bool init();
 
+  // Release resources shared by all quadcopters.  Called when the
+  // plug-in is unloaded.
+  static void shutdown();
+
+  // Called when the simulation is started, stepped and stopped to
+  // update every quadcopter and the state they share.  "errorMode"
+  // is the error report mode V-REP had before the plug-in was called.
+  static void startAll(int errorMode);
+  static void stepAll(int errorMode);
+  static void stopAll();
+
+  // Return the context of the current simulation step.
+  static const Frame& frame();
+
+  // Queue a command for the quadcopter with object handle "obj",
+  // stamping it with the current time if "issued" is zero.  Returns
+  // false if there is no such quadcopter, a value is not finite or its
+  // queue is full.  Safe from any thread, except while the scene is
+  // being rebuilt.
+  static bool sendCommand(int obj, Command cmd);
+
   // Construct a quadcopter from its object ID.
   explicit Quadcopter(int obj);
 
@@ -39,64 +155,206 @@ public:
   // Called when the simulation is stepped.
   void simulationStepped();
 
-  // Read sensor data from the quadcopter.
-  void readSensors();
+  // Read sensor data from the quadcopter at the time of step "f".
+  void readSensors(const Frame& f);
+
+  // Add the pose and range sensor rays of the quadcopter at an index
+  // to the shared per-step sensor batch, and copy its results back
+  // out once the batch has been evaluated.
+  static void addToSensorBatch(const Frame& f, size_t i);
+  static void storeSensorBatch(const Frame& f, size_t i);
+
+  // Hand the latest down camera image of the quadcopter at an index
+  // to the optical flow sensor.
+  static void captureFlowFrame(const Frame& f, size_t i);
+
+  // Apply the commands queued for the quadcopter at an index, and
+  // move its target in MODE_VELOCITY.
+  static void applyCommands(const Frame& f, size_t i);
+
+  // Send every quadcopter's state as of the end of step "f" to the
+  // flight stacks attached to the SITL bridge and collect their motor
+  // commands.
+  static void exchangeSitl(const Frame& f);
+
+  // Answer the requests of controllers on the control socket with
+  // every quadcopter's state as of the end of step "f", and queue
+  // their commands.
+  static void answerControl(const Frame& f);
+
+  // Publish the state of every quadcopter as of the end of step "f".
+  static void publishAll(const Frame& f);
+
+  // Append the published state of every quadcopter to its sensor log.
+  static void logAll();
+
+  // Pack the state of every quadcopter as of the end of step "f" into
+  // one buffer in the "SwarmSignal.h" layout and set it as the swarm
+  // state string signal.
+  static void publishSignal(const Frame& f);
+
+  // Restart the RL episodes of the quadcopters with object handles
+  // "objs": move each to its (x, y, z, yaw) in "poses", or to where
+  // the simulation started if "poses" is NULL, and reset its
+  // controllers, sensor noise and episode step count.  Returns the
+  // number of quadcopters found.
+  static size_t resetEpisodes(const int *objs, size_t n, const float *poses);
+
+  // Restart the RL episode of the quadcopter at an index, as
+  // "resetEpisodes".  The noise that follows depends only on the run
+  // seed, the step and the quadcopter.
+  static void resetEpisode(const Frame& f, size_t i, const float *pose);
+
+  // Write the RL observations, rewards and dones of every quadcopter
+  // for step "f".
+  static void observeAll(Frame& f);
+
+  // Replace "out" with a snapshot of the plug-in's state: the step
+  // counter and seed, and for every quadcopter its controllers,
+  // sensor readings and noise generators, lidar scan, optical flow
+  // and log file offset.  Scene objects and the physics engine are
+  // not included; restore their state through V-REP.
+  static void snapshot(std::vector<uint8_t>& out);
+
+  // Restore a snapshot taken by "snapshot" in the same scene.
+  // Quadcopters are matched by object handle, and commands still
+  // queued for them are dropped; those the snapshot does not list are
+  // left alone.  Returns the number of quadcopters restored, or -1 if
+  // the snapshot is malformed or was taken by another build, in which
+  // case nothing is changed.
+  static int restore(const uint8_t *data, size_t size);
+
+  // Return the published state of the quadcopter with object handle
+  // "obj", or null if there is none.  Call on the simulator thread;
+  // the state returned can then be read from any thread without the
+  // V-REP interface lock.  It is shared rather than owned by the
+  // quadcopter, so it survives "rebuildAll" and keeps being published
+  // to while the quadcopter is in the scene, and keeps its last value
+  // once the quadcopter is gone.
+  static std::shared_ptr<const PublishedState> published(int obj);
+
+  // Return the index of this quadcopter's state in "states".
+  size_t index() const { return m_index; }
+
+  QuadcopterState& state() { return states[m_index]; }
+  const QuadcopterState& state() const { return states[m_index]; }
 
   // Place the (x, y, z) values (in m/sec^2 XXX verify) of the latest
   // accelerometer reading into "out".
   void getAccel(float *out) const
   {
-    out[0] = m_accel[0];
-    out[1] = m_accel[1];
-    out[2] = m_accel[2];
+    const QuadcopterState& s = state();
+    out[0] = s.accel[0];
+    out[1] = s.accel[1];
+    out[2] = s.accel[2];
   }
 
   // Set the accelerometer data.  Called by the simulator from a Lua
   // function.
   void setAccel(float *accel)
   {
-    m_accel[0] = accel[0];
-    m_accel[1] = accel[1];
-    m_accel[2] = accel[2];
+    QuadcopterState& s = state();
+    s.accel[0] = accel[0];
+    s.accel[1] = accel[1];
+    s.accel[2] = accel[2];
   }
 
   // Place the (x, y, z) values (in rad/sec XXX verify) of the latest
   // gyro reading into "out".
   void getGyro(float *out) const
   {
-    out[0] = m_gyro[0];
-    out[1] = m_gyro[1];
-    out[2] = m_gyro[2];
+    const QuadcopterState& s = state();
+    out[0] = s.gyro[0];
+    out[1] = s.gyro[1];
+    out[2] = s.gyro[2];
   }
 
   // Set the gyro data.  Called by the simulator from a Lua function.
   void setGyro(float *gyro)
   {
-    m_gyro[0] = gyro[0];
-    m_gyro[1] = gyro[1];
-    m_gyro[2] = gyro[2];
+    QuadcopterState& s = state();
+    s.gyro[0] = gyro[0];
+    s.gyro[1] = gyro[1];
+    s.gyro[2] = gyro[2];
   }
 
   // Return the latest GPS position.
-  GPSPosition getGPSPosition() const { return m_gpsPosition; }
+  GPSPosition getGPSPosition() const { return state().gpsPosition; }
+
+  // Return the latest altitude above the terrain (m).
+  float getAGL() const { return state().agl; }
+
+  // Return the latest barometric pressure (Pa).
+  float getPressure() const { return state().pressure; }
+
+  // Place the (x, y, z) values (in uT) of the latest magnetometer
+  // reading into "out".
+  void getMag(float *out) const
+  {
+    const QuadcopterState& s = state();
+    out[0] = s.magField[0];
+    out[1] = s.magField[1];
+    out[2] = s.magField[2];
+  }
+
+  // Place the latest optical flow rates (rad/sec) about the camera X
+  // and Y axes into "out" and return the flow quality (0 to 255).
+  // Returns -1 if the quadcopter has no down camera.
+  int getOpticalFlow(float *out);
+
+  // Return the latest reading of the downward rangefinder (m).
+  float getRangeDown() const { return state().rangeDown; }
+
+  // Return the latest lidar scan, one range (m) per beam.
+  const std::vector<float>& getLidarScan() const { return m_lidarScan; }
+
+  // Configure the lidar scan pattern.  A pattern with no beams turns
+  // the lidar off.
+  void setLidar(const RangeScanPattern& pattern, float maxRange)
+  {
+    QuadcopterState& s = state();
+    s.lidarRange = maxRange;
+    s.lidarBeams = (uint32_t)pattern.size();
+    m_lidarPattern = pattern;
+    m_lidarScan.assign(pattern.size(), maxRange);
+  }
 
   // Run the PID controller and get the 4 motor velocities.
   void pidControl(float *motors_out);
 
+  // Return this quadcopter's timing histogram for a per-vehicle
+  // section (PROF_VEHICLE_FIRST or later).
+  const TimeHistogram& getProfile(ProfileSection s) const
+  {
+    return m_profile[s - PROF_VEHICLE_FIRST];
+  }
+
+  // Write this quadcopter's timing statistics to the profile file.
+  void writeProfile();
+
 private:
+  // Save or restore this quadcopter's part of a snapshot.  "beams" is
+  // the number of lidar ranges in the record.
+  void saveState(SnapshotWriter& w) const;
+  bool restoreState(SnapshotReader& r, uint32_t beams);
+
+  // Restart the sensor noise generators from "key", so the noise that
+  // follows depends only on it.
+  void seedSensors(uint64_t key);
+
+  // Flush the sensor log, recording the bytes written since the last
+  // flush.  Const so snapshots, which flush the log, can use it.
+  void flushLog() const;
+
   // The associated quadcopter object in the scene.
   int m_obj;
 
+  // Index of the quadcopter's per-step state in "states".
+  size_t m_index;
+
   // Unique ID for the quadcopter's base object.
   int m_uniqueID;
 
-  // The quadcopter body object.
-  int m_body;
-
-  // The quadcopter target object.  This may not be used in the
-  // future.
-  int m_target;
-
   // Object IDs of the quadcopter's four motors.
   int m_motors[4];
 
@@ -107,23 +365,44 @@ private:
   // Timestamp of the last camera image save.
   float m_lastSaveTime;
 
-  // Latest sensor readings, recorded in "readSensors".
-  float m_accel[3];
-  float m_gyro[3];
-  GPSPosition m_gpsPosition;
+  // Pose (x, y, z, yaw) of the quadcopter and its target when the
+  // simulation started, where RL episodes restart.
+  float m_home[4];
+  float m_targetHome[4];
+
+  // Lidar scan pattern and latest scan.
+  RangeScanPattern   m_lidarPattern;
+  std::vector<float> m_lidarScan;
+
+  // Optical flow sensor on the down camera, or NULL if there is no
+  // down camera.  Shared with the flow processor threads.
+  std::shared_ptr<OpticalFlowSensor> m_flow;
+
+  // Field of view of the down camera (rad), from its perspective
+  // angle, turning optical flow in pixels into angular rates.
+  float m_flowFov;
+
+  // Log file containing sensor information in CSV format, and the
+  // bytes written to it since it was last flushed.
+  FILE           *m_csvFile;
+  mutable size_t  m_logPending;
+
+  // GPS configuration with the quadcopter's own overrides, and a
+  // projection back to scene coordinates if its origin or zone is not
+  // the scene's (NULL otherwise).
+  GPSSimConfig                  m_gpsConfig;
+  std::unique_ptr<GPSProjector> m_gpsProjector;
 
-  // Log file containing sensor information in CSV format.
-  FILE *m_csvFile;
+  // Simulated sensors.
+  GPSSimSensor  m_gps;
+  BaroSimSensor m_baro;
+  MagSimSensor  m_mag;
 
-  // Simulated GPS sensor.
-  GPSSimSensor m_gps;
+  // Timing of per-vehicle sections.
+  TimeHistogram m_profile[PROF_VEHICLE_SECTIONS];
 
-  PID m_vertPID;
-  PID m_alphaStabPID;
-  PID m_alphaMovePID;
-  PID m_betaStabPID;
-  PID m_betaMovePID;
-  PID m_rotPID;
+  // State published at the end of each step.
+  std::shared_ptr<PublishedState> m_published;
 };
 
 #endif   // !defined V_REP_EXT_QUADCOPTER_QUADCOPTER_H_INCLUDED
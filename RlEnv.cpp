@@ -0,0 +1,204 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// RlEnv.cpp --- Vectorized reinforcement learning environment over
+// shared memory.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE__
+# include <xmmintrin.h>
+#endif
+
+#include <new>
+
+#include "RlEnv.h"
+#include "SitlBridge.h"
+
+//////////////////////////////////////////////////////////////////////
+// Rewards
+
+// Reward and done bits of one quadcopter.  Computed in the same order
+// as the vector version, so both give identical results.
+static inline void rewardOne(const RlRewardInputs& in, float *rewards,
+                             uint8_t *dones, size_t i, uint32_t episodeSteps)
+{
+  float ex = in.err[0][i], ey = in.err[1][i], ez = in.err[2][i];
+  float wx = in.angVel[0][i], wy = in.angVel[1][i], wz = in.angVel[2][i];
+  float up = in.upright[i];
+
+  float d2 = ex * ex + ey * ey + ez * ez;
+  float r2 = wx * wx + wy * wy + wz * wz;
+  float r  = RL_REWARD_ALIVE - RL_COST_DIST * sqrtf(d2)
+                             - RL_COST_TILT * (1.0f - up)
+                             - RL_COST_RATE * r2;
+
+  bool terminal = d2 > RL_MAX_DIST * RL_MAX_DIST || up < RL_MIN_UPRIGHT;
+
+  rewards[i] = terminal ? RL_REWARD_TERMINAL : r;
+  dones[i]   = (terminal ? RL_DONE_TERMINAL : 0) |
+               (in.steps[i] >= episodeSteps ? RL_DONE_TRUNCATED : 0);
+}
+
+void rlRewardBatch(const RlRewardInputs& in, float *rewards, uint8_t *dones,
+                   size_t n, uint32_t episodeSteps)
+{
+  size_t i = 0;
+
+#ifdef __SSE__
+  const __m128 alive    = _mm_set1_ps(RL_REWARD_ALIVE);
+  const __m128 terminal = _mm_set1_ps(RL_REWARD_TERMINAL);
+  const __m128 costDist = _mm_set1_ps(RL_COST_DIST);
+  const __m128 costTilt = _mm_set1_ps(RL_COST_TILT);
+  const __m128 costRate = _mm_set1_ps(RL_COST_RATE);
+  const __m128 maxDist2 = _mm_set1_ps(RL_MAX_DIST * RL_MAX_DIST);
+  const __m128 minUp    = _mm_set1_ps(RL_MIN_UPRIGHT);
+  const __m128 one      = _mm_set1_ps(1.0f);
+
+  for (; i + 4 <= n; i += 4) {
+    __m128 ex = _mm_loadu_ps(in.err[0] + i);
+    __m128 ey = _mm_loadu_ps(in.err[1] + i);
+    __m128 ez = _mm_loadu_ps(in.err[2] + i);
+    __m128 wx = _mm_loadu_ps(in.angVel[0] + i);
+    __m128 wy = _mm_loadu_ps(in.angVel[1] + i);
+    __m128 wz = _mm_loadu_ps(in.angVel[2] + i);
+    __m128 up = _mm_loadu_ps(in.upright + i);
+
+    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)),
+                           _mm_mul_ps(ez, ez));
+    __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy)),
+                           _mm_mul_ps(wz, wz));
+
+    __m128 r = _mm_sub_ps(alive, _mm_mul_ps(costDist, _mm_sqrt_ps(d2)));
+    r = _mm_sub_ps(r, _mm_mul_ps(costTilt, _mm_sub_ps(one, up)));
+    r = _mm_sub_ps(r, _mm_mul_ps(costRate, r2));
+
+    __m128 t = _mm_or_ps(_mm_cmpgt_ps(d2, maxDist2), _mm_cmplt_ps(up, minUp));
+    _mm_storeu_ps(rewards + i,
+                  _mm_or_ps(_mm_and_ps(t, terminal), _mm_andnot_ps(t, r)));
+
+    int mask = _mm_movemask_ps(t);
+    for (int k = 0; k < 4; ++k) {
+      dones[i + k] = ((mask >> k) & 1 ? RL_DONE_TERMINAL : 0) |
+                     (in.steps[i + k] >= episodeSteps ? RL_DONE_TRUNCATED : 0);
+    }
+  }
+#endif
+
+  for (; i < n; ++i)
+    rewardOne(in, rewards, dones, i, episodeSteps);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Environment
+
+static size_t roundUp64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+RlEnv::RlEnv()
+  : m_episodeSteps(1000), m_generation(0), m_count(0), m_header(nullptr),
+    m_actions(nullptr), m_resets(nullptr), m_poses(nullptr), m_obs(nullptr),
+    m_rewards(nullptr), m_dones(nullptr)
+{
+}
+
+RlEnv::~RlEnv()
+{
+  release();
+}
+
+void RlEnv::configure(const std::string& name, uint32_t episodeSteps)
+{
+  m_block.setName(name);
+  m_episodeSteps = episodeSteps;
+}
+
+void RlEnv::release()
+{
+  if (m_header == nullptr)
+    return;
+
+  // Tell trainers the layout is going away, and wake any that are
+  // waiting for a step.
+  m_header->magic.store(0, std::memory_order_release);
+  m_header->step.fetch_add(1, std::memory_order_release);
+  sitlWake(&m_header->step);
+  m_block.unmap();
+
+  m_header  = nullptr;
+  m_actions = nullptr;
+  m_resets  = nullptr;
+  m_poses   = nullptr;
+  m_obs     = nullptr;
+  m_rewards = nullptr;
+  m_dones   = nullptr;
+  m_count   = 0;
+}
+
+void RlEnv::layout(const int *objects, size_t count)
+{
+  release();
+  if (!enabled())
+    return;
+
+  size_t objectsOffset = roundUp64(sizeof(RlEnvHeader));
+  size_t actionsOffset = objectsOffset + roundUp64(count * sizeof(int32_t));
+  size_t resetsOffset  = actionsOffset +
+                         roundUp64(count * RL_ACT_DIM * sizeof(float));
+  size_t posesOffset   = resetsOffset + roundUp64(count * sizeof(uint32_t));
+  size_t obsOffset     = posesOffset + roundUp64(count * 4 * sizeof(float));
+  size_t rewardsOffset = obsOffset +
+                         roundUp64(count * RL_OBS_DIM * sizeof(float));
+  size_t donesOffset   = rewardsOffset + roundUp64(count * sizeof(float));
+  size_t bytes         = donesOffset + roundUp64(count);
+
+  if (!m_block.map(bytes) || !m_block.shared())
+    return;
+
+  uint8_t *base = m_block.data();
+
+  m_count   = count;
+  m_header  = new (base) RlEnvHeader;
+  m_actions = (float *)(base + actionsOffset);
+  m_resets  = (uint32_t *)(base + resetsOffset);
+  m_poses   = (float *)(base + posesOffset);
+  m_obs     = (float *)(base + obsOffset);
+  m_rewards = (float *)(base + rewardsOffset);
+  m_dones   = base + donesOffset;
+
+  m_header->magic.store(0, std::memory_order_relaxed);
+  m_header->version       = RL_VERSION;
+  m_header->count         = (uint32_t)count;
+  m_header->generation    = ++m_generation;
+  m_header->obsDim        = RL_OBS_DIM;
+  m_header->actDim        = RL_ACT_DIM;
+  m_header->episodeSteps  = m_episodeSteps;
+  m_header->objectsOffset = (uint32_t)objectsOffset;
+  m_header->actionsOffset = (uint32_t)actionsOffset;
+  m_header->resetsOffset  = (uint32_t)resetsOffset;
+  m_header->posesOffset   = (uint32_t)posesOffset;
+  m_header->obsOffset     = (uint32_t)obsOffset;
+  m_header->rewardsOffset = (uint32_t)rewardsOffset;
+  m_header->donesOffset   = (uint32_t)donesOffset;
+  m_header->step.store(0, std::memory_order_relaxed);
+
+  // The rest of the block is already zero.
+  memcpy(base + objectsOffset, objects, count * sizeof(int32_t));
+
+  m_header->magic.store(RL_MAGIC, std::memory_order_release);
+}
+
+void RlEnv::publish()
+{
+  if (m_header == nullptr)
+    return;
+
+  m_header->step.fetch_add(1, std::memory_order_release);
+  sitlWake(&m_header->step);
+}
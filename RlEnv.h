@@ -0,0 +1,187 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// RlEnv.h --- Vectorized reinforcement learning environment over
+// shared memory.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_RL_ENV_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_RL_ENV_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "SharedBlock.h"
+
+// Magic number and layout version at the start of the environment.
+#define RL_MAGIC    0x51454e56u         // "QENV"
+#define RL_VERSION  1
+
+// Floats per observation and per action.  Observations are padded to
+// a multiple of four so every group below is one 16-byte vector.
+#define RL_OBS_DIM  40
+#define RL_ACT_DIM  4
+
+// Observation of one quadcopter, as float offsets into its row.
+// Positions and velocities are in the world frame.
+enum RlObservation
+{
+  RL_OBS_POSE    = 0,           // 3x4 world transform of the body
+  RL_OBS_VEL     = 12,          // linear velocity (m/s), then AGL (m)
+  RL_OBS_ANGVEL  = 16,          // angular velocity (rad/s), then the
+                                // downward range (m)
+  RL_OBS_ACCEL   = 20,          // accelerometer (m/s^2), then 0
+  RL_OBS_GYRO    = 24,          // gyro (rad/s), then 0
+  RL_OBS_GPS     = 28,          // GPS fix in scene coordinates (m), then 0
+  RL_OBS_TARGET  = 32,          // target minus body position (m), then
+                                // heading error (rad)
+  RL_OBS_ACTION  = 36,          // action of the last step
+};
+
+// Values a trainer writes to a quadcopter's "resets" entry to have
+// its episode restarted at the start of the next step.  The plug-in
+// sets the entry back to RL_RESET_NONE once it has.
+enum RlReset
+{
+  RL_RESET_NONE = 0,
+  RL_RESET_HOME = 1,            // back where the simulation started
+  RL_RESET_POSE = 2,            // to (x, y, z, yaw) in "poses"
+};
+
+// Bits of a quadcopter's "dones" entry.
+enum RlDone
+{
+  RL_DONE_TERMINAL  = 1,        // tipped over or strayed too far
+  RL_DONE_TRUNCATED = 2,        // reached the episode length
+};
+
+// Reward shaping.  Each step a quadcopter earns
+//
+//   RL_REWARD_ALIVE - RL_COST_DIST * |target - position|
+//                   - RL_COST_TILT * (1 - cos tilt)
+//                   - RL_COST_RATE * |angular velocity|^2
+//
+// or RL_REWARD_TERMINAL on the step its episode ends early.
+#define RL_REWARD_ALIVE     1.0f
+#define RL_REWARD_TERMINAL  -10.0f
+#define RL_COST_DIST        0.1f
+#define RL_COST_TILT        1.0f
+#define RL_COST_RATE        0.01f
+#define RL_MAX_DIST         20.0f       // m from the target
+#define RL_MIN_UPRIGHT      0.5f        // cos of the largest tilt
+
+// Header of the environment in memory.  It is followed by arrays of
+// "count" entries, each starting on a cache line at the given offset
+// from the header:
+//
+//   objects  int32                  object handles, in quadcopter order
+//   actions  float[RL_ACT_DIM]      motor velocities, by the trainer
+//   resets   uint32                 RlReset requests, by the trainer
+//   poses    float[4]               (x, y, z, yaw) for RL_RESET_POSE
+//   obs      float[RL_OBS_DIM]      RlObservation rows
+//   rewards  float
+//   dones    uint8                  RlDone bits
+//
+// While the environment is enabled the actions drive every
+// quadcopter's motors.  The plug-in applies the requested resets at
+// the start of each step, then writes the observations, rewards and
+// dones and increments "step", waking futex waiters on it.  A trainer
+// steps the simulation (with V-REP in synchronous mode), waits for
+// "step" to change, reads the results and writes the next actions.
+// "magic" is zero while the environment is being laid out, and
+// "generation" changes every time it is.
+struct RlEnvHeader
+{
+  std::atomic<uint32_t> magic;
+  uint32_t              version;
+  uint32_t              count;
+  uint32_t              generation;
+  uint32_t              obsDim;         // RL_OBS_DIM
+  uint32_t              actDim;         // RL_ACT_DIM
+  uint32_t              episodeSteps;   // episode length
+  uint32_t              objectsOffset;  // bytes from the header
+  uint32_t              actionsOffset;
+  uint32_t              resetsOffset;
+  uint32_t              posesOffset;
+  uint32_t              obsOffset;
+  uint32_t              rewardsOffset;
+  uint32_t              donesOffset;
+
+  alignas(64) std::atomic<uint32_t> step;
+};
+
+// Per-step inputs of the reward of a batch of quadcopters, one array
+// entry per quadcopter.  Vectors are split by axis so four
+// quadcopters fit in one SIMD register.
+struct RlRewardInputs
+{
+  const float    *err[3];       // target minus position (m)
+  const float    *upright;      // cos of the tilt
+  const float    *angVel[3];    // angular velocity (rad/s)
+  const uint32_t *steps;        // steps since the episode started
+};
+
+// Compute the rewards and done bits of "n" quadcopters.  Episodes
+// are truncated after "episodeSteps" steps.
+void rlRewardBatch(const RlRewardInputs& in, float *rewards, uint8_t *dones,
+                   size_t n, uint32_t episodeSteps);
+
+// The plug-in side of the environment.  The environment is only
+// enabled if a shared memory name is given, since nothing else can
+// drive it.
+class RlEnv
+{
+public:
+  RlEnv();
+  ~RlEnv();
+
+  RlEnv(const RlEnv&) = delete;
+  RlEnv& operator=(const RlEnv&) = delete;
+
+  // Use shared memory object "name" from the next "layout" on, with
+  // episodes of "episodeSteps" steps.
+  void configure(const std::string& name, uint32_t episodeSteps);
+
+  bool enabled() const { return !m_block.name().empty(); }
+
+  // Lay out the arrays for quadcopters with the given object handles.
+  void layout(const int *objects, size_t count);
+
+  // Return the number of quadcopters laid out.
+  size_t size() const { return m_count; }
+
+  uint32_t episodeSteps() const { return m_episodeSteps; }
+
+  // The arrays, or NULL if the environment is off.
+  const float *actions() const { return m_actions; }
+  uint32_t *resets() { return m_resets; }
+  const float *poses() const { return m_poses; }
+  float *obs() { return m_obs; }
+  float *rewards() { return m_rewards; }
+  uint8_t *dones() { return m_dones; }
+
+  // Announce that a step's results are written.
+  void publish();
+
+private:
+  void release();
+
+  SharedBlock  m_block;
+  uint32_t     m_episodeSteps;
+  uint32_t     m_generation;
+  size_t       m_count;
+  RlEnvHeader *m_header;
+  float       *m_actions;
+  uint32_t    *m_resets;
+  float       *m_poses;
+  float       *m_obs;
+  float       *m_rewards;
+  uint8_t     *m_dones;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_RL_ENV_H_INCLUDED
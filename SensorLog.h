@@ -0,0 +1,54 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SensorLog.h --- Lines of the per-quadcopter sensor log.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SENSOR_LOG_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SENSOR_LOG_H_INCLUDED
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Column names, written as the first line of each log.
+#define SENSOR_LOG_HEADER                               \
+  "quadrotorID,time,latitude,longitude,altitude,"       \
+  "accelX,accelY,accelZ,gyroX,gyroY,gyroZ,agl,"         \
+  "pressure,magX,magY,magZ\n"
+
+// Size of a line buffer.  Lines of absurd values are truncated.
+#define SENSOR_LOG_LINE_MAX 512
+
+// The values of one log line.
+struct SensorLogLine
+{
+  int    id;
+  float  time;
+  double lat, lon, altitude;
+  float  accel[3];
+  float  gyro[3];
+  float  agl;
+  float  pressure;
+  float  mag[3];
+};
+
+// Format a log line into "buf", returning the length written.
+static inline int formatSensorLogLine(char *buf, size_t size,
+                                      const SensorLogLine& l)
+{
+  int n = snprintf(buf, size,
+                   "%d,%.3f,%.10f,%.10f,%.10f,%.8f,%.8f,%.8f,%.8f,%.8f,%.8f,"
+                   "%.4f,%.2f,%.4f,%.4f,%.4f\n",
+                   l.id, l.time, l.lat, l.lon, l.altitude,
+                   l.accel[0], l.accel[1], l.accel[2],
+                   l.gyro[0],  l.gyro[1],  l.gyro[2],
+                   l.agl, l.pressure, l.mag[0], l.mag[1], l.mag[2]);
+
+  if (n < 0)
+    return 0;
+  return (size_t)n < size ? n : (int)size - 1;
+}
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SENSOR_LOG_H_INCLUDED
@@ -0,0 +1,91 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SeqLock.h --- Single-writer value readable from any thread.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SEQ_LOCK_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SEQ_LOCK_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+// A value written by one thread and read by any number of others
+// without locks.  The writer makes the sequence number odd while it
+// stores and even again when it is done; a reader that saw an odd
+// number, or a different number after copying, tries again, so it
+// always gets a value as stored by a single "store".  The value is
+// kept as relaxed atomic words so that racing copies are well
+// defined.
+template <class T>
+class SeqLock
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SeqLock values must be trivially copyable");
+
+public:
+  // The value reads as all zero bytes until the first store.
+  SeqLock()
+    : m_seq(0)
+  {
+    for (size_t i = 0; i < WORDS; ++i)
+      m_words[i].store(0, std::memory_order_relaxed);
+  }
+
+  SeqLock(const SeqLock&) = delete;
+  SeqLock& operator=(const SeqLock&) = delete;
+
+  // Publish a new value.  Called by the writer thread only.
+  void store(const T& value)
+  {
+    uint32_t words[WORDS] = {};
+    memcpy(words, &value, sizeof(T));
+
+    uint32_t seq = m_seq.load(std::memory_order_relaxed);
+    m_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (size_t i = 0; i < WORDS; ++i)
+      m_words[i].store(words[i], std::memory_order_relaxed);
+
+    m_seq.store(seq + 2, std::memory_order_release);
+  }
+
+  // Return the latest value.  Spins while a store is in progress.
+  T load() const
+  {
+    uint32_t words[WORDS];
+    uint32_t seq0, seq1;
+
+    do {
+      seq0 = m_seq.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; ++i)
+        words[i] = m_words[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq1 = m_seq.load(std::memory_order_relaxed);
+    } while ((seq0 & 1) != 0 || seq0 != seq1);
+
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  }
+
+  // Return the number of stores made so far.
+  uint32_t version() const
+  {
+    return m_seq.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  static const size_t WORDS = (sizeof(T) + 3) / 4;
+
+  std::atomic<uint32_t> m_seq;
+  std::atomic<uint32_t> m_words[WORDS];
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SEQ_LOCK_H_INCLUDED
@@ -0,0 +1,82 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SharedBlock.cpp --- Memory optionally shared with other processes.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <new>
+
+#include "SharedBlock.h"
+
+SharedBlock::SharedBlock()
+  : m_data(nullptr), m_size(0), m_shared(false)
+{
+}
+
+SharedBlock::~SharedBlock()
+{
+  unmap();
+  if (!m_name.empty())
+    shm_unlink(m_name.c_str());
+}
+
+void SharedBlock::unmap()
+{
+  if (m_data != nullptr)
+    munmap(m_data, m_size);
+
+  m_data   = nullptr;
+  m_size   = 0;
+  m_shared = false;
+}
+
+bool SharedBlock::map(size_t bytes)
+{
+  void *p  = MAP_FAILED;
+  bool  ok = true;
+
+  unmap();
+
+  if (!m_name.empty()) {
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR, 0600);
+    struct stat st;
+
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        ((size_t)st.st_size >= bytes || ftruncate(fd, (off_t)bytes) == 0)) {
+      p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (p == MAP_FAILED) {
+      fprintf(stderr, "quadcopter: cannot use shared memory '%s': %s\n",
+              m_name.c_str(), strerror(errno));
+      ok = false;
+    }
+
+    if (fd >= 0)
+      close(fd);
+  }
+
+  m_shared = p != MAP_FAILED;
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+  }
+
+  m_data = (uint8_t *)p;
+  m_size = bytes;
+  if (m_shared)
+    memset(m_data, 0, m_size);
+  return ok;
+}
@@ -0,0 +1,54 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SharedBlock.h --- Memory optionally shared with other processes.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SHARED_BLOCK_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SHARED_BLOCK_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// A zeroed block of memory that is the POSIX shared memory object of
+// a given name, so other processes can map it, or private memory if
+// no name is set.  The object is never shrunk, so processes that
+// still have an older, larger layout mapped do not fault, and it is
+// removed when the block is destroyed.
+class SharedBlock
+{
+public:
+  SharedBlock();
+  ~SharedBlock();
+
+  SharedBlock(const SharedBlock&) = delete;
+  SharedBlock& operator=(const SharedBlock&) = delete;
+
+  // Use shared memory object "name" (such as "/quadcopter") from the
+  // next "map" on, or private memory if empty.
+  void setName(const std::string& name) { m_name = name; }
+  const std::string& name() const { return m_name; }
+
+  // Map "bytes" of zeroed memory, replacing any previous mapping.
+  // Returns false if the shared memory object could not be used, in
+  // which case private memory is used.
+  bool map(size_t bytes);
+
+  void unmap();
+
+  uint8_t *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  bool shared() const { return m_shared; }
+
+private:
+  std::string m_name;
+  uint8_t    *m_data;
+  size_t      m_size;
+  bool        m_shared;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SHARED_BLOCK_H_INCLUDED
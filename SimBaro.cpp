@@ -0,0 +1,69 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimBaro.cpp --- Simulated barometric pressure sensor.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <math.h>
+
+#include "SimBaro.h"
+
+// International Standard Atmosphere constants.
+#define ISA_P0      101325.0    // sea level pressure (Pa)
+#define ISA_T0      288.15      // sea level temperature (K)
+#define ISA_LAPSE   0.0065      // troposphere lapse rate (K/m)
+#define ISA_G       9.80665     // gravity (m/s^2)
+#define ISA_M       0.0289644   // molar mass of air (kg/mol)
+#define ISA_R       8.3144598   // gas constant (J/(mol K))
+#define ISA_H11     11000.0     // tropopause altitude (m)
+
+BaroTable::BaroTable()
+  : m_minAlt(0.0f), m_invStep(1.0f), m_limit(0.0f)
+{
+  m_table.assign(2, (float)ISA_P0);
+}
+
+void BaroTable::build(float minAlt, float maxAlt, float step)
+{
+  int n = (int)ceilf((maxAlt - minAlt) / step) + 1;
+  if (n < 2)
+    n = 2;
+
+  m_minAlt  = minAlt;
+  m_invStep = 1.0f / step;
+  m_limit   = (float)(n - 1) - 1e-3f;
+  m_table.resize(n);
+
+  for (int i = 0; i < n; ++i)
+    m_table[i] = (float)isaPressure(minAlt + (double)i * step);
+}
+
+double BaroTable::isaPressure(double alt)
+{
+  const double k = ISA_G * ISA_M / ISA_R;
+
+  if (alt <= ISA_H11)
+    return ISA_P0 * pow(1.0 - ISA_LAPSE * alt / ISA_T0, k / ISA_LAPSE);
+
+  // Isothermal lower stratosphere.
+  double t11 = ISA_T0 - ISA_LAPSE * ISA_H11;
+  double p11 = ISA_P0 * pow(t11 / ISA_T0, k / ISA_LAPSE);
+  return p11 * exp(-k * (alt - ISA_H11) / t11);
+}
+
+BaroSimSensor::BaroSimSensor(const BaroSimConfig& config)
+  : m_noise(0.0, config.noiseStddev),
+    m_drift(0.0, config.driftStddev),
+    m_bias(0.0f)
+{
+}
+
+float BaroSimSensor::measure(float pressure, float dt)
+{
+  if (dt > 0.0f)
+    m_bias += (float)m_drift.get() * sqrtf(dt);
+
+  return pressure + m_bias + (float)m_noise.get();
+}
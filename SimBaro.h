@@ -0,0 +1,107 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimBaro.h --- Simulated barometric pressure sensor.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SIM_BARO_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SIM_BARO_H_INCLUDED
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "Noise.h"
+
+// Configuration information for the simulated barometer.
+struct BaroSimConfig
+{
+  double noiseStddev;           // white noise (Pa)
+  double driftStddev;           // bias random walk (Pa / sqrt(s))
+};
+
+// Pressure of the International Standard Atmosphere as a function of
+// altitude, precomputed into a table at a fixed altitude spacing and
+// linearly interpolated.
+class BaroTable
+{
+public:
+  BaroTable();
+
+  // Fill the table from "minAlt" to "maxAlt" meters above sea level
+  // every "step" meters.
+  void build(float minAlt, float maxAlt, float step);
+
+  // Return the pressure (Pa) at an altitude (m), clamped to the
+  // range of the table.
+  float pressure(float alt) const
+  {
+    float f = (alt - m_minAlt) * m_invStep;
+    f = f < 0.0f ? 0.0f : (f > m_limit ? m_limit : f);
+
+    int   i = (int)f;
+    float a = f - i;
+    return m_table[i] + (m_table[i + 1] - m_table[i]) * a;
+  }
+
+  // Look up the pressure for "n" altitudes at once.
+  void pressureBatch(const float *alt, float *out, size_t n) const
+  {
+    for (size_t i = 0; i < n; ++i)
+      out[i] = pressure(alt[i]);
+  }
+
+  // Evaluate the atmosphere model directly.  This is what the table
+  // is built from and is too slow to call every step.
+  static double isaPressure(double alt);
+
+private:
+  std::vector<float> m_table;
+  float m_minAlt;
+  float m_invStep;
+  float m_limit;                // last cell index
+};
+
+// Barometer simulator object.  Adds white noise and a slowly
+// drifting bias to the true pressure.
+class BaroSimSensor
+{
+public:
+  explicit BaroSimSensor(const BaroSimConfig& config);
+
+  // Reset the drift at the start of a simulation.
+  void reset() { m_bias = 0.0f; }
+
+  // Restart the noise and drift from "key".
+  void seed(uint64_t key)
+  {
+    m_noise.seed(key);
+    m_drift.seed(~key);
+  }
+
+  // Save or restore the noise and drift.
+  void save(SnapshotWriter& w) const
+  {
+    m_noise.save(w);
+    m_drift.save(w);
+    w.put(m_bias);
+  }
+
+  bool restore(SnapshotReader& r)
+  {
+    return m_noise.restore(r) && m_drift.restore(r) && r.get(m_bias);
+  }
+
+  // Return the measured pressure given the true pressure (Pa) and
+  // the time since the last measurement (s).
+  float measure(float pressure, float dt);
+
+private:
+  GaussianNoise m_noise;
+  GaussianNoise m_drift;
+  float m_bias;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SIM_BARO_H_INCLUDED
@@ -0,0 +1,335 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimFlow.cpp --- Simulated optical flow sensor.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#include "SimFlow.h"
+#include "Trace.h"
+
+// Matching parameters.
+#define FLOW_BLOCK        8     // block size (pixels)
+#define FLOW_SEARCH       4     // search radius (pixels)
+#define FLOW_STEP         8     // spacing of blocks on the grid
+#define FLOW_MIN_TEXTURE  200   // minimum block gradient sum
+#define FLOW_MAX_SAD      (FLOW_BLOCK * FLOW_BLOCK * 12)
+
+//////////////////////////////////////////////////////////////////////
+// Matching
+
+// Sum of absolute differences between two 8x8 blocks in frames with
+// a row stride of FLOW_RES.
+static inline unsigned blockSAD(const uint8_t *a, const uint8_t *b)
+{
+#ifdef __SSE2__
+  __m128i sum = _mm_setzero_si128();
+
+  for (int y = 0; y < FLOW_BLOCK; y += 2) {
+    __m128i ra = _mm_unpacklo_epi64(
+      _mm_loadl_epi64((const __m128i *)(a + y * FLOW_RES)),
+      _mm_loadl_epi64((const __m128i *)(a + (y + 1) * FLOW_RES)));
+    __m128i rb = _mm_unpacklo_epi64(
+      _mm_loadl_epi64((const __m128i *)(b + y * FLOW_RES)),
+      _mm_loadl_epi64((const __m128i *)(b + (y + 1) * FLOW_RES)));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(ra, rb));
+  }
+
+  return (unsigned)(_mm_cvtsi128_si32(sum) +
+                    _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+#else
+  unsigned sum = 0;
+
+  for (int y = 0; y < FLOW_BLOCK; ++y)
+    for (int x = 0; x < FLOW_BLOCK; ++x)
+      sum += abs(a[y * FLOW_RES + x] - b[y * FLOW_RES + x]);
+
+  return sum;
+#endif
+}
+
+// Sum of horizontal and vertical gradients in a block, used to skip
+// featureless blocks that would match anywhere.
+static unsigned blockTexture(const uint8_t *a)
+{
+  unsigned sum = 0;
+
+  for (int y = 0; y < FLOW_BLOCK - 1; ++y) {
+    for (int x = 0; x < FLOW_BLOCK - 1; ++x) {
+      const uint8_t *p = a + y * FLOW_RES + x;
+      sum += abs(p[0] - p[1]) + abs(p[0] - p[FLOW_RES]);
+    }
+  }
+
+  return sum;
+}
+
+// Sub-pixel offset of a minimum from two lines of equal and opposite
+// slope through three samples around it.  SAD grows linearly away
+// from a match, so this is less biased than a parabola between whole
+// pixels.
+static float lineFitPeak(float left, float mid, float right)
+{
+  float d = std::max(left, right) - mid;
+  return d > 0.0f ? 0.5f * (left - right) / d : 0.0f;
+}
+
+FlowResult computeOpticalFlow(const uint8_t *prev, const uint8_t *cur)
+{
+  const int lo = FLOW_SEARCH;
+  const int hi = FLOW_RES - FLOW_SEARCH - FLOW_BLOCK;
+  const int n  = 2 * FLOW_SEARCH + 1;
+
+  FlowResult result;
+  float sumX = 0.0f, sumY = 0.0f;
+  int   total = 0, valid = 0;
+
+  for (int by = lo; by <= hi; by += FLOW_STEP) {
+    for (int bx = lo; bx <= hi; bx += FLOW_STEP) {
+      const uint8_t *ref = prev + by * FLOW_RES + bx;
+      ++total;
+
+      if (blockTexture(ref) < FLOW_MIN_TEXTURE)
+        continue;
+
+      unsigned sad[2 * FLOW_SEARCH + 1][2 * FLOW_SEARCH + 1];
+      unsigned best = ~0u;
+      int      bestX = 0, bestY = 0;
+
+      for (int dy = -FLOW_SEARCH; dy <= FLOW_SEARCH; ++dy) {
+        for (int dx = -FLOW_SEARCH; dx <= FLOW_SEARCH; ++dx) {
+          unsigned s = blockSAD(ref, cur + (by + dy) * FLOW_RES + bx + dx);
+          sad[dy + FLOW_SEARCH][dx + FLOW_SEARCH] = s;
+
+          if (s < best) {
+            best  = s;
+            bestX = dx;
+            bestY = dy;
+          }
+        }
+      }
+
+      if (best > FLOW_MAX_SAD)
+        continue;
+
+      int   ix = bestX + FLOW_SEARCH;
+      int   iy = bestY + FLOW_SEARCH;
+      float fx = (float)bestX;
+      float fy = (float)bestY;
+
+      if (ix > 0 && ix < n - 1)
+        fx += lineFitPeak(sad[iy][ix - 1], sad[iy][ix], sad[iy][ix + 1]);
+      if (iy > 0 && iy < n - 1)
+        fy += lineFitPeak(sad[iy - 1][ix], sad[iy][ix], sad[iy + 1][ix]);
+
+      sumX += fx;
+      sumY += fy;
+      ++valid;
+    }
+  }
+
+  if (valid > 0) {
+    result.flowX   = sumX / valid;
+    result.flowY   = sumY / valid;
+    result.quality = valid * 255 / total;
+  }
+
+  return result;
+}
+
+void downsampleFlowFrame(const float *rgb, int width, int height,
+                         uint8_t *out)
+{
+  for (int y = 0; y < FLOW_RES; ++y) {
+    int y0 = y * height / FLOW_RES;
+    int y1 = (y + 1) * height / FLOW_RES;
+    if (y1 <= y0)
+      y1 = y0 + 1;
+
+    for (int x = 0; x < FLOW_RES; ++x) {
+      int x0 = x * width / FLOW_RES;
+      int x1 = (x + 1) * width / FLOW_RES;
+      if (x1 <= x0)
+        x1 = x0 + 1;
+
+      float sum = 0.0f;
+      for (int sy = y0; sy < y1; ++sy) {
+        const float *p = rgb + ((size_t)sy * width + x0) * 3;
+        for (int sx = x0; sx < x1; ++sx, p += 3)
+          sum += p[0] + p[1] + p[2];
+      }
+
+      float v = sum * (255.0f / 3.0f) / ((y1 - y0) * (x1 - x0));
+      out[y * FLOW_RES + x] = (uint8_t)(v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sensor
+
+OpticalFlowSensor::OpticalFlowSensor()
+  : m_capture(FLOW_RES * FLOW_RES),
+    m_pending(FLOW_RES * FLOW_RES),
+    m_pendingTime(0.0f), m_pendingEpoch(0),
+    m_hasPending(false), m_queued(false), m_epoch(0),
+    m_work(FLOW_RES * FLOW_RES),
+    m_prev(FLOW_RES * FLOW_RES),
+    m_prevTime(0.0f), m_prevEpoch(0), m_hasPrev(false)
+{
+}
+
+void OpticalFlowSensor::reset(const FlowResult& result)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  ++m_epoch;
+  m_hasPending = false;
+  m_result     = result;
+}
+
+bool OpticalFlowSensor::submit(const float *rgb, int width, int height,
+                               float time)
+{
+  // Reduce the image outside the lock; it is the expensive part.
+  downsampleFlowFrame(rgb, width, height, &m_capture[0]);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_capture.swap(m_pending);
+  m_pendingTime  = time;
+  m_pendingEpoch = m_epoch;
+  m_hasPending   = true;
+
+  bool queue = !m_queued;
+  m_queued = true;
+  return queue;
+}
+
+int OpticalFlowSensor::process()
+{
+  int frames = 0;
+
+  for (;;) {
+    float    time;
+    unsigned epoch;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (!m_hasPending) {
+        m_queued = false;
+        return frames;
+      }
+
+      m_pending.swap(m_work);
+      time         = m_pendingTime;
+      epoch        = m_pendingEpoch;
+      m_hasPending = false;
+    }
+
+    if (m_hasPrev && m_prevEpoch == epoch) {
+      FlowResult r = computeOpticalFlow(&m_prev[0], &m_work[0]);
+      r.dt = time - m_prevTime;
+      ++frames;
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_epoch == epoch)
+        m_result = r;
+    }
+
+    m_prev.swap(m_work);
+    m_prevTime  = time;
+    m_prevEpoch = epoch;
+    m_hasPrev   = true;
+  }
+}
+
+FlowResult OpticalFlowSensor::latest()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_result;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Processor
+
+// Return the CPU time of the calling thread, so time spent preempted
+// is not counted as matching.
+static uint64_t threadNanos()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+FlowProcessor::FlowProcessor(unsigned threads)
+  : m_quit(false), m_frames(0), m_busyNanos(0)
+{
+  if (threads < 1)
+    threads = 1;
+
+  for (unsigned i = 0; i < threads; ++i)
+    m_threads.emplace_back(&FlowProcessor::workerMain, this);
+}
+
+FlowProcessor::~FlowProcessor()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+
+  m_wake.notify_all();
+  for (auto& t : m_threads)
+    t.join();
+}
+
+void FlowProcessor::submit(const std::shared_ptr<OpticalFlowSensor>& sensor)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(sensor);
+  }
+
+  m_wake.notify_one();
+}
+
+double FlowProcessor::framesPerSecondPerThread() const
+{
+  uint64_t busy = m_busyNanos.load();
+  return busy > 0 ? m_frames.load() * 1e9 / busy : 0.0;
+}
+
+void FlowProcessor::workerMain()
+{
+  Trace::setThreadName("opticalFlow");
+
+  for (;;) {
+    std::shared_ptr<OpticalFlowSensor> sensor;
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+      if (m_quit)
+        return;
+
+      sensor = m_queue.front();
+      m_queue.pop_front();
+    }
+
+    TRACE_SCOPE("opticalFlow");
+
+    uint64_t t0 = threadNanos();
+    int frames = sensor->process();
+    m_busyNanos += threadNanos() - t0;
+    m_frames    += frames;
+  }
+}
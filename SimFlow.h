@@ -0,0 +1,138 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimFlow.h --- Simulated optical flow sensor.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SIM_FLOW_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SIM_FLOW_H_INCLUDED
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Camera frames are reduced to FLOW_RES x FLOW_RES grayscale pixels
+// before matching, like the 64x64 binned image of a PX4Flow.
+#define FLOW_RES 64
+
+// Result of comparing two frames.
+struct FlowResult
+{
+  FlowResult() : flowX(0.0f), flowY(0.0f), quality(0), dt(0.0f) {}
+
+  float flowX;                  // image motion along X (pixels)
+  float flowY;                  // image motion along Y (pixels)
+  int   quality;                // 0 (no valid matches) to 255
+  float dt;                     // time between the frames (s)
+};
+
+// Estimate the motion between two FLOW_RES x FLOW_RES frames by SAD
+// block matching.  8x8 blocks on a regular grid of "prev" are
+// searched for in "cur" within a few pixels, refined to sub-pixel
+// accuracy, and the displacements of textured, well matched blocks
+// are averaged.  Uses SSE2 when available.
+FlowResult computeOpticalFlow(const uint8_t *prev, const uint8_t *cur);
+
+// Reduce an RGB float image (as returned by "simGetVisionSensorImage")
+// to a FLOW_RES x FLOW_RES grayscale frame by averaging boxes of
+// pixels.
+void downsampleFlowFrame(const float *rgb, int width, int height,
+                         uint8_t *out);
+
+// An optical flow sensor attached to a camera.  The simulator thread
+// hands it frames with "submit" and a flow processor thread matches
+// them with "process".  Frames are double buffered: the simulator
+// thread only ever swaps a buffer under a short lock, and if the
+// processor falls behind, older unprocessed frames are dropped.
+class OpticalFlowSensor
+{
+public:
+  OpticalFlowSensor();
+
+  // Forget previous frames at the start of a simulation, or when a
+  // snapshot is restored, making "result" the latest measurement.
+  void reset(const FlowResult& result = FlowResult());
+
+  // Pass in a new camera image taken at "time".  Returns true if the
+  // sensor must be queued for processing.
+  bool submit(const float *rgb, int width, int height, float time);
+
+  // Match any pending frames against the previous frame, returning
+  // the number of frames matched.  Called on a processor thread.
+  int process();
+
+  // Return the most recent flow measurement.
+  FlowResult latest();
+
+private:
+  std::mutex m_mutex;
+
+  // Simulator thread only.
+  std::vector<uint8_t> m_capture;
+
+  // Shared, under m_mutex.  "m_epoch" is bumped by "reset" so frames
+  // from different simulations are never matched with each other.
+  std::vector<uint8_t> m_pending;
+  float                m_pendingTime;
+  unsigned             m_pendingEpoch;
+  bool                 m_hasPending;
+  bool                 m_queued;
+  unsigned             m_epoch;
+  FlowResult           m_result;
+
+  // Processor thread only.
+  std::vector<uint8_t> m_work;
+  std::vector<uint8_t> m_prev;
+  float                m_prevTime;
+  unsigned             m_prevEpoch;
+  bool                 m_hasPrev;
+};
+
+// Threads that run optical flow matching in the background.
+class FlowProcessor
+{
+public:
+  explicit FlowProcessor(unsigned threads);
+  ~FlowProcessor();
+
+  FlowProcessor(const FlowProcessor&) = delete;
+  FlowProcessor& operator=(const FlowProcessor&) = delete;
+
+  // Queue a sensor that has a pending frame.
+  void submit(const std::shared_ptr<OpticalFlowSensor>& sensor);
+
+  // Return the number of processor threads.
+  unsigned size() const { return (unsigned)m_threads.size(); }
+
+  // Return the number of frames matched per second of processor
+  // thread CPU time.
+  double framesPerSecondPerThread() const;
+
+  void resetStats()
+  {
+    m_frames.store(0);
+    m_busyNanos.store(0);
+  }
+
+private:
+  void workerMain();
+
+  std::vector<std::thread> m_threads;
+  std::mutex               m_mutex;
+  std::condition_variable  m_wake;
+  std::deque<std::shared_ptr<OpticalFlowSensor>> m_queue;
+  bool                     m_quit;
+
+  std::atomic<uint64_t>    m_frames;
+  std::atomic<uint64_t>    m_busyNanos;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SIM_FLOW_H_INCLUDED
@@ -6,37 +6,191 @@
 // All Rights Reserved.
 //
 
+#include <string.h>
+
 #include <GeographicLib/UTMUPS.hpp>
 #include "v_repLib.h"
+#include "ApiStats.h"
 #include "SimGPS.h"
 
 using GeographicLib::UTMUPS;
 
 GPSSimSensor::GPSSimSensor(const GPSSimConfig& config)
-  : m_config(config),
+  : m_offsetX(config.originX + config.biasX),
+    m_offsetY(config.originY + config.biasY),
+    m_offsetZ(config.originZ + config.biasZ),
+    m_zone(config.zone),
+    m_isNorth(config.isNorth),
+    m_period(config.updateRate > 0.0 ? (float)(1.0 / config.updateRate)
+                                     : 0.0f),
+    m_nextFix(0.0f),
     m_noise(config.noiseMean, config.noiseStddev)
 {
+  double p = config.dropoutProb;
+  p = p < 0.0 ? 0.0 : (p > 1.0 ? 1.0 : p);
+  m_dropThreshold = (uint32_t)(p * 4294967295.0);
+}
+
+void GPSSimSensor::reset()
+{
+  m_nextFix = 0.0f;
+  m_last    = GPSPosition();
+}
+
+void GPSSimSensor::save(SnapshotWriter& w) const
+{
+  w.put(m_nextFix);
+  w.put(m_last);
+  m_noise.save(w);
+}
+
+bool GPSSimSensor::restore(SnapshotReader& r)
+{
+  return r.get(m_nextFix) && r.get(m_last) && m_noise.restore(r);
 }
 
-GPSPosition GPSSimSensor::getGPSPosition(int obj)
+GPSPosition GPSSimSensor::getGPSPosition(int obj, float now)
 {
-  GPSPosition result;
+  if (now < m_nextFix)
+    return m_last;
+
+  // Fixes stay on a fixed schedule, so the rate holds whatever the
+  // step size.  One missed by a whole period restarts it from now.
+  m_nextFix += m_period;
+  if (m_nextFix <= now)
+    m_nextFix = now + m_period;
+
+  if (m_noise.draw() < m_dropThreshold)
+    return m_last;
+
   float pos[3];
 
   if (simGetObjectPosition(obj, -1, pos) == -1)
-    return result;
+    return m_last;
 
   // Apply noise to the position before converting to lat/lon.
   pos[0] += m_noise.get();
   pos[1] += m_noise.get();
   pos[2] += m_noise.get();
 
-  UTMUPS::Reverse(m_config.zone, m_config.isNorth,
-                  m_config.originX + pos[0],
-                  m_config.originY + pos[1],
-                  result.lat, result.lon);
+  UTMUPS::Reverse(m_zone, m_isNorth,
+                  m_offsetX + pos[0],
+                  m_offsetY + pos[1],
+                  m_last.lat, m_last.lon);
+
+  m_last.altitude = m_offsetZ + pos[2];
+
+  return m_last;
+}
+
+// Step (degrees) used to estimate the projection expansion by
+// central differences, about 1 km.
+#define GPS_EXPANSION_STEP 0.01
+
+GPSProjector::GPSProjector(const GPSSimConfig& config, size_t cacheSize)
+  : m_config(config),
+    m_cacheSize(cacheSize < 1 ? 1 : cacheSize),
+    m_hits(0), m_misses(0)
+{
+  UTMUPS::Reverse(config.zone, config.isNorth,
+                  config.originX, config.originY, m_lat0, m_lon0);
+
+  // Sample the exact projection on a 3x3 stencil around the origin
+  // and take central differences for the first and second
+  // derivatives.
+  const double h = GPS_EXPANSION_STEP;
+  double x[3][3], y[3][3];
+
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      int  zone;
+      bool isNorth;
+      UTMUPS::Forward(m_lat0 + (i - 1) * h, m_lon0 + (j - 1) * h,
+                      zone, isNorth, x[i][j], y[i][j], config.zone);
+      x[i][j] -= config.originX;
+      y[i][j] -= config.originY;
+    }
+  }
+
+  double (*f[2])[3] = { x, y };
+  double *c[2]      = { m_cx, m_cy };
+
+  for (int k = 0; k < 2; ++k) {
+    double (*v)[3] = f[k];
+    c[k][0] = (v[2][1] - v[0][1]) / (2.0 * h);
+    c[k][1] = (v[1][2] - v[1][0]) / (2.0 * h);
+    c[k][2] = (v[2][1] - 2.0 * v[1][1] + v[0][1]) / (2.0 * h * h);
+    c[k][3] = (v[2][2] - v[2][0] - v[0][2] + v[0][0]) / (4.0 * h * h);
+    c[k][4] = (v[1][2] - 2.0 * v[1][1] + v[1][0]) / (2.0 * h * h);
+  }
+}
+
+size_t GPSProjector::KeyHash::operator()(const Key& k) const
+{
+  uint64_t a, b;
+  memcpy(&a, &k.lat, sizeof(a));
+  memcpy(&b, &k.lon, sizeof(b));
+  return (size_t)(a * 0x9e3779b97f4a7c15ull ^ (b + (a >> 29)));
+}
+
+void GPSProjector::toLocal(double lat, double lon, double alt, float *out,
+                           GPSProjectionMode mode)
+{
+  if (mode == GPS_PROJECT_LOCAL) {
+    double a = lat - m_lat0;
+    double b = lon - m_lon0;
+    double t[5] = { a, b, a * a, a * b, b * b };
+
+    double x = 0.0, y = 0.0;
+    for (int i = 0; i < 5; ++i) {
+      x += m_cx[i] * t[i];
+      y += m_cy[i] * t[i];
+    }
+
+    out[0] = (float)x;
+    out[1] = (float)y;
+  } else {
+    projectUTM(lat, lon, out);
+  }
+
+  out[2] = (float)(alt - m_config.originZ);
+}
+
+void GPSProjector::toLocalBatch(const double *in, float *out, size_t n,
+                                GPSProjectionMode mode)
+{
+  for (size_t i = 0; i < n; ++i)
+    toLocal(in[i * 3 + 0], in[i * 3 + 1], in[i * 3 + 2], &out[i * 3], mode);
+}
+
+void GPSProjector::projectUTM(double lat, double lon, float *out)
+{
+  Key key = { lat, lon };
+  auto i = m_index.find(key);
+
+  if (i != m_index.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, i->second);
+    out[0] = i->second->x;
+    out[1] = i->second->y;
+    ++m_hits;
+    return;
+  }
+
+  int    zone;
+  bool   isNorth;
+  double x, y;
+
+  UTMUPS::Forward(lat, lon, zone, isNorth, x, y, m_config.zone);
+  out[0] = (float)(x - m_config.originX);
+  out[1] = (float)(y - m_config.originY);
+  ++m_misses;
 
-  result.altitude = m_config.originZ + pos[2];
+  if (m_lru.size() >= m_cacheSize) {
+    m_index.erase(m_lru.back().key);
+    m_lru.pop_back();
+  }
 
-  return result;
+  Entry e = { key, out[0], out[1] };
+  m_lru.push_front(e);
+  m_index[key] = m_lru.begin();
 }
@@ -9,6 +9,12 @@
 #ifndef V_REP_EXT_QUADCOPTER_SIM_GPS_H_INCLUDED
 #define V_REP_EXT_QUADCOPTER_SIM_GPS_H_INCLUDED
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <unordered_map>
+
 #include "Noise.h"
 
 // Position information returned by the simulated GPS.
@@ -23,7 +29,9 @@ struct GPSPosition
 
 // Configuration information for the simulated GPS.  We set the UTM
 // zone and origin coordinates for position (0, 0, 0) in our world,
-// and the characteristics of any simulated noise.
+// and the characteristics of the simulated receiver.  Fields after
+// "noiseStddev" may be left out of an initializer to get a receiver
+// that updates on every read and never drops out.
 struct GPSSimConfig
 {
   int    zone;                  // UTM zone number
@@ -33,24 +41,128 @@ struct GPSSimConfig
   double originZ;               // origin Z position (m)
   double noiseMean;             // mean noise value
   double noiseStddev;           // standard deviation of noise
+  double updateRate;            // fixes per second, 0 for every read
+  double biasX;                 // constant position error (m)
+  double biasY;
+  double biasZ;
+  double dropoutProb;           // chance a fix is missed, 0 to 1
 };
 
-// GPS simulator object.  Requires a constant configuration object at
-// construction time.
+// GPS simulator object.  The configuration is copied at construction
+// and reduced to the constants used on every read.
 class GPSSimSensor
 {
 public:
   // Construct a simulated sensor.
   explicit GPSSimSensor(const GPSSimConfig& config);
 
-  // Return the simulated GPS position of a simulator object given a
-  // UTM zone and simulator configuration.
-  GPSPosition getGPSPosition(int obj);
+  // Reset the receiver at the start of a simulation.
+  void reset();
+
+  // Restart the noise from "key".
+  void seed(uint64_t key) { m_noise.seed(key); }
+
+  // Save or restore the receiver's fix and noise.
+  void save(SnapshotWriter& w) const;
+  bool restore(SnapshotReader& r);
+
+  // Return the simulated GPS position of a simulator object at
+  // simulation time "now".  Between fixes, or when a fix is dropped,
+  // the previous fix is returned.
+  GPSPosition getGPSPosition(int obj, float now);
 
 private:
-  const GPSSimConfig& m_config;
+  // UTM position of scene position (0, 0, 0) including the bias.
+  double   m_offsetX;
+  double   m_offsetY;
+  double   m_offsetZ;
+  int      m_zone;
+  bool     m_isNorth;
+
+  float    m_period;            // time between fixes (s)
+  uint32_t m_dropThreshold;     // fix dropped if a draw is below this
+
+  float    m_nextFix;           // time of the next fix
+  GPSPosition m_last;           // most recent fix
+
   GaussianNoise m_noise;
 };
 
+// Ways of converting a geodetic position into scene coordinates.
+enum GPSProjectionMode
+{
+  // Exact inverse of the simulated GPS, through the UTM projection.
+  GPS_PROJECT_UTM   = 0,
+
+  // A quadratic expansion of the UTM projection about the origin.
+  // Within 10 km of the origin it agrees with the exact projection
+  // to a few centimeters at a fraction of the cost.
+  GPS_PROJECT_LOCAL = 1,
+};
+
+// Converts latitude, longitude and altitude into local scene
+// coordinates using the same zone and origin as "GPSSimSensor", so a
+// position reported by the GPS maps back to where it was measured.
+// Exact conversions are kept in an LRU cache, since missions visit
+// the same waypoints over and over.
+class GPSProjector
+{
+public:
+  explicit GPSProjector(const GPSSimConfig& config, size_t cacheSize = 1024);
+
+  // Convert a position in degrees and meters to scene coordinates,
+  // placing (x, y, z) in "out".
+  void toLocal(double lat, double lon, double alt, float *out,
+               GPSProjectionMode mode = GPS_PROJECT_UTM);
+
+  // Convert "n" (lat, lon, alt) triples at once.
+  void toLocalBatch(const double *in, float *out, size_t n,
+                    GPSProjectionMode mode = GPS_PROJECT_UTM);
+
+  // Cache statistics.
+  uint64_t cacheHits()   const { return m_hits; }
+  uint64_t cacheMisses() const { return m_misses; }
+
+private:
+  struct Key
+  {
+    double lat, lon;
+
+    bool operator==(const Key& k) const
+    {
+      return lat == k.lat && lon == k.lon;
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& k) const;
+  };
+
+  struct Entry
+  {
+    Key   key;
+    float x, y;
+  };
+
+  typedef std::list<Entry> EntryList;
+
+  // Exact horizontal projection, through the cache.
+  void projectUTM(double lat, double lon, float *out);
+
+  GPSSimConfig m_config;
+
+  // Origin in geodetic coordinates and the expansion coefficients
+  // of x and y in terms of offsets from it.  "c[0..4]" multiply
+  // dlat, dlon, dlat^2, dlat*dlon and dlon^2 (degrees).
+  double m_lat0, m_lon0;
+  double m_cx[5], m_cy[5];
+
+  size_t    m_cacheSize;
+  EntryList m_lru;              // most recently used first
+  std::unordered_map<Key, EntryList::iterator, KeyHash> m_index;
+  uint64_t  m_hits;
+  uint64_t  m_misses;
+};
 
 #endif   // !defined V_REP_EXT_QUADCOPTER_SIM_GPS_H_INCLUDED
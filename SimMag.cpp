@@ -0,0 +1,194 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimMag.cpp --- Simulated magnetometer.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <math.h>
+
+#include <GeographicLib/UTMUPS.hpp>
+#include "SimMag.h"
+
+using GeographicLib::UTMUPS;
+
+// World Magnetic Model 2020 main field coefficients (nT), truncated
+// to degree 4.  This keeps the direction of the field within a few
+// degrees of the full model, which is plenty for a simulated sensor.
+#define MAG_DEGREE 4
+#define MAG_RADIUS 6371200.0    // geomagnetic reference radius (m)
+
+struct MagCoeff
+{
+  int    n, m;
+  double g, h;
+};
+
+static const MagCoeff g_wmm_coeffs[] = {
+  { 1, 0, -29404.5,      0.0 },
+  { 1, 1,  -1450.7,   4652.9 },
+  { 2, 0,  -2500.0,      0.0 },
+  { 2, 1,   2982.0,  -2991.6 },
+  { 2, 2,   1676.8,   -734.8 },
+  { 3, 0,   1363.9,      0.0 },
+  { 3, 1,  -2381.0,    -82.2 },
+  { 3, 2,   1236.2,    241.8 },
+  { 3, 3,    525.7,   -542.9 },
+  { 4, 0,    903.1,      0.0 },
+  { 4, 1,    809.4,    282.0 },
+  { 4, 2,     86.2,   -158.4 },
+  { 4, 3,   -309.4,    199.8 },
+  { 4, 4,     47.9,   -350.1 },
+};
+
+MagFieldTable::MagFieldTable()
+  : m_n(0), m_x0(0.0f), m_y0(0.0f), m_invCell(1.0f), m_limit(0.0f)
+{
+}
+
+void MagFieldTable::build(const GPSSimConfig& config,
+                          float halfExtent, float cellSize)
+{
+  m_n       = (int)ceilf(2.0f * halfExtent / cellSize) + 1;
+  m_x0      = -halfExtent;
+  m_y0      = -halfExtent;
+  m_invCell = 1.0f / cellSize;
+  m_limit   = (float)(m_n - 1) - 1e-3f;
+  m_field.resize((size_t)m_n * m_n * 3);
+
+  for (int iy = 0; iy < m_n; ++iy) {
+    for (int ix = 0; ix < m_n; ++ix) {
+      double lat, lon, ned[3];
+
+      UTMUPS::Reverse(config.zone, config.isNorth,
+                      config.originX + m_x0 + ix * cellSize,
+                      config.originY + m_y0 + iy * cellSize,
+                      lat, lon);
+      modelField(lat, lon, config.originZ, ned);
+
+      // NED (nT) to east/north/up (uT).
+      float *p = &m_field[((size_t)iy * m_n + ix) * 3];
+      p[0] = (float)(ned[1] * 1e-3);
+      p[1] = (float)(ned[0] * 1e-3);
+      p[2] = (float)(-ned[2] * 1e-3);
+    }
+  }
+}
+
+void MagFieldTable::fieldAt(float x, float y, float *out) const
+{
+  if (m_field.empty()) {
+    out[0] = out[1] = out[2] = 0.0f;
+    return;
+  }
+
+  float fx = (x - m_x0) * m_invCell;
+  float fy = (y - m_y0) * m_invCell;
+  fx = fx < 0.0f ? 0.0f : (fx > m_limit ? m_limit : fx);
+  fy = fy < 0.0f ? 0.0f : (fy > m_limit ? m_limit : fy);
+
+  int   ix = (int)fx;
+  int   iy = (int)fy;
+  float ax = fx - ix;
+  float ay = fy - iy;
+
+  const float *p0 = &m_field[((size_t)iy * m_n + ix) * 3];
+  const float *p1 = p0 + (size_t)m_n * 3;
+
+  for (int k = 0; k < 3; ++k) {
+    float h0 = p0[k] + (p0[k + 3] - p0[k]) * ax;
+    float h1 = p1[k] + (p1[k + 3] - p1[k]) * ax;
+    out[k] = h0 + (h1 - h0) * ay;
+  }
+}
+
+void MagFieldTable::bodyFieldBatch(const float *mats, float *out,
+                                   size_t n) const
+{
+  for (size_t i = 0; i < n; ++i) {
+    const float *m = &mats[i * 12];
+    float w[3];
+
+    fieldAt(m[3], m[7], w);
+
+    // The body frame is the transpose of the rotation part.
+    float *b = &out[i * 3];
+    b[0] = m[0] * w[0] + m[4] * w[1] + m[8]  * w[2];
+    b[1] = m[1] * w[0] + m[5] * w[1] + m[9]  * w[2];
+    b[2] = m[2] * w[0] + m[6] * w[1] + m[10] * w[2];
+  }
+}
+
+// Synthesize the field from the spherical harmonic expansion, using
+// a spherical Earth.  Associated Legendre functions are computed with
+// Gauss normalization and the coefficients rescaled by the Schmidt
+// semi-normalization factors.
+void MagFieldTable::modelField(double lat, double lon, double alt,
+                               double *ned)
+{
+  double P[MAG_DEGREE + 1][MAG_DEGREE + 1]  = {{ 0.0 }};
+  double dP[MAG_DEGREE + 1][MAG_DEGREE + 1] = {{ 0.0 }};
+  double S[MAG_DEGREE + 1][MAG_DEGREE + 1]  = {{ 0.0 }};
+
+  double theta = (90.0 - lat) * M_PI / 180.0;
+  double phi   = lon * M_PI / 180.0;
+  double ct    = cos(theta);
+  double st    = sin(theta);
+  double ratio = MAG_RADIUS / (MAG_RADIUS + alt);
+
+  // Avoid dividing by zero at the poles.
+  if (fabs(st) < 1e-9)
+    st = 1e-9;
+
+  P[0][0] = 1.0;
+  S[0][0] = 1.0;
+
+  for (int n = 1; n <= MAG_DEGREE; ++n) {
+    for (int m = 0; m <= n; ++m) {
+      if (n == m) {
+        P[n][m]  = st * P[n-1][m-1];
+        dP[n][m] = st * dP[n-1][m-1] + ct * P[n-1][m-1];
+      } else if (n == 1) {
+        P[n][m]  = ct * P[0][0];
+        dP[n][m] = ct * dP[0][0] - st * P[0][0];
+      } else {
+        double k = (double)((n-1) * (n-1) - m * m) /
+                   (double)((2*n - 1) * (2*n - 3));
+        double p2  = (n - 2 >= m) ? P[n-2][m]  : 0.0;
+        double dp2 = (n - 2 >= m) ? dP[n-2][m] : 0.0;
+        P[n][m]  = ct * P[n-1][m] - k * p2;
+        dP[n][m] = ct * dP[n-1][m] - st * P[n-1][m] - k * dp2;
+      }
+
+      if (m == 0)
+        S[n][0] = S[n-1][0] * (2*n - 1) / n;
+      else
+        S[n][m] = S[n][m-1] * sqrt((double)((n - m + 1) * (m == 1 ? 2 : 1)) /
+                                   (double)(n + m));
+    }
+  }
+
+  double br = 0.0, bt = 0.0, bp = 0.0;
+
+  for (const MagCoeff& c : g_wmm_coeffs) {
+    double f = pow(ratio, c.n + 2);
+    double g = c.g * S[c.n][c.m];
+    double h = c.h * S[c.n][c.m];
+    double cm = cos(c.m * phi);
+    double sm = sin(c.m * phi);
+
+    br += f * (c.n + 1) * (g * cm + h * sm) * P[c.n][c.m];
+    bt -= f * (g * cm + h * sm) * dP[c.n][c.m];
+    bp += f * c.m * (g * sm - h * cm) * P[c.n][c.m] / st;
+  }
+
+  ned[0] = -bt;
+  ned[1] = bp;
+  ned[2] = -br;
+}
+
+MagSimSensor::MagSimSensor(const MagSimConfig& config)
+  : m_noise(0.0, config.noiseStddev)
+{
+}
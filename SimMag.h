@@ -0,0 +1,85 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimMag.h --- Simulated magnetometer.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SIM_MAG_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SIM_MAG_H_INCLUDED
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "Noise.h"
+#include "SimGPS.h"
+
+// Configuration information for the simulated magnetometer.
+struct MagSimConfig
+{
+  double noiseStddev;           // white noise per axis (uT)
+};
+
+// The Earth's magnetic field around the scene origin, evaluated from
+// spherical harmonic coefficients and precomputed into a grid of
+// world frame vectors.  The world frame is the scene frame: X east,
+// Y north, Z up, matching the UTM projection used by the GPS.
+class MagFieldTable
+{
+public:
+  MagFieldTable();
+
+  // Evaluate the field on a grid of "halfExtent" meters around the
+  // GPS origin every "cellSize" meters.
+  void build(const GPSSimConfig& config, float halfExtent, float cellSize);
+
+  // Return the world frame field (uT) at a local scene position.
+  void fieldAt(float x, float y, float *out) const;
+
+  // Rotate the field at each of "n" bodies into the body frame.
+  // "mats" holds a 3x4 world transform per body as returned by
+  // "simGetObjectMatrix" and "out" receives three values per body.
+  void bodyFieldBatch(const float *mats, float *out, size_t n) const;
+
+  // Evaluate the field model directly, returning the north, east and
+  // down components (nT) at a geodetic position.  This is what the
+  // table is built from and is too slow to call every step.
+  static void modelField(double lat, double lon, double alt, double *ned);
+
+private:
+  std::vector<float> m_field;   // (x, y, z) per post, row-major
+  int   m_n;
+  float m_x0, m_y0;
+  float m_invCell;
+  float m_limit;
+};
+
+// Magnetometer simulator object.  Adds white noise to the body frame
+// field.
+class MagSimSensor
+{
+public:
+  explicit MagSimSensor(const MagSimConfig& config);
+
+  // Restart the noise from "key".
+  void seed(uint64_t key) { m_noise.seed(key); }
+
+  // Save or restore the noise.
+  void save(SnapshotWriter& w) const { m_noise.save(w); }
+  bool restore(SnapshotReader& r) { return m_noise.restore(r); }
+
+  // Add noise to a body frame field vector in place.
+  void measure(float *field)
+  {
+    field[0] += (float)m_noise.get();
+    field[1] += (float)m_noise.get();
+    field[2] += (float)m_noise.get();
+  }
+
+private:
+  GaussianNoise m_noise;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SIM_MAG_H_INCLUDED
@@ -0,0 +1,263 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimRange.cpp --- Simulated rangefinders and lidars.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <math.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "SimRange.h"
+#include "Terrain.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+// Number of rays marched in lockstep.
+#define RANGE_BLOCK 8
+
+// Number of rays handed to a worker at a time.
+#define RANGE_GRAIN 256
+
+//////////////////////////////////////////////////////////////////////
+// Height Field
+
+HeightField::HeightField()
+  : m_n(0), m_x0(0.0f), m_y0(0.0f),
+    m_cell(1.0f), m_invCell(1.0f), m_limit(0.0f), m_maxHeight(0.0f)
+{
+}
+
+void HeightField::build(TerrainMap *terrain, float halfExtent, float cellSize)
+{
+  if (terrain == nullptr) {
+    m_heights.clear();
+    m_cell      = cellSize;
+    m_invCell   = 1.0f / cellSize;
+    m_maxHeight = 0.0f;
+    return;
+  }
+
+  build([terrain](float x, float y) { return terrain->groundLocal(x, y); },
+        halfExtent, cellSize);
+}
+
+void HeightField::build(const std::function<float(float, float)>& ground,
+                        float halfExtent, float cellSize)
+{
+  m_heights.clear();
+  m_cell      = cellSize;
+  m_invCell   = 1.0f / cellSize;
+  m_maxHeight = 0.0f;
+
+  m_n     = (int)ceilf(2.0f * halfExtent / cellSize) + 1;
+  m_x0    = -halfExtent;
+  m_y0    = -halfExtent;
+  m_limit = (float)(m_n - 1);
+  m_heights.resize((size_t)m_n * m_n);
+
+  // Rows are sampled in order so the terrain cache sees queries walk
+  // across each tile.
+  for (int iy = 0; iy < m_n; ++iy) {
+    for (int ix = 0; ix < m_n; ++ix) {
+      float h = ground(m_x0 + ix * cellSize, m_y0 + iy * cellSize);
+      m_heights[(size_t)iy * m_n + ix] = h;
+      m_maxHeight = std::max(m_maxHeight, h);
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+// Scan Patterns
+
+RangeScanPattern RangeScanPattern::down()
+{
+  RangeScanPattern p;
+  p.dirs = { 0.0f, 0.0f, -1.0f };
+  return p;
+}
+
+RangeScanPattern RangeScanPattern::scan(int hBeams, int vBeams,
+                                        float hFov, float vFov)
+{
+  RangeScanPattern p;
+
+  hBeams = std::max(hBeams, 1);
+  vBeams = std::max(vBeams, 1);
+
+  // A full circle has as many gaps as beams; a sector has one less.
+  bool  wrap  = hFov >= 2.0f * (float)M_PI - 1e-4f;
+  float hStep = hBeams > 1 ? hFov / (wrap ? hBeams : hBeams - 1) : 0.0f;
+  float vStep = vBeams > 1 ? vFov / (vBeams - 1) : 0.0f;
+  float az0   = wrap ? 0.0f : -0.5f * hFov;
+  float el0   = vBeams > 1 ? -0.5f * vFov : 0.0f;
+
+  p.dirs.reserve((size_t)hBeams * vBeams * 3);
+
+  for (int v = 0; v < vBeams; ++v) {
+    float el = el0 + v * vStep;
+
+    for (int h = 0; h < hBeams; ++h) {
+      float az = az0 + h * hStep;
+      p.dirs.push_back(cosf(el) * cosf(az));
+      p.dirs.push_back(cosf(el) * sinf(az));
+      p.dirs.push_back(sinf(el));
+    }
+  }
+
+  return p;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Ray Caster
+
+static double monotonicSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+RangeCaster::RangeCaster(WorkerPool& pool)
+  : m_pool(pool), m_rays(0.0), m_seconds(0.0), m_lastSeconds(0.0)
+{
+}
+
+void RangeCaster::clear()
+{
+  m_ox.clear(); m_oy.clear(); m_oz.clear();
+  m_dx.clear(); m_dy.clear(); m_dz.clear();
+  m_maxRange.clear();
+  m_out.clear();
+}
+
+size_t RangeCaster::add(const float *m, const RangeScanPattern& pattern,
+                        float maxRange)
+{
+  size_t first = m_out.size();
+  size_t n     = pattern.size();
+
+  for (size_t i = 0; i < n; ++i) {
+    const float *d = &pattern.dirs[i * 3];
+
+    // Rotate the beam into the world frame.
+    m_dx.push_back(m[0] * d[0] + m[1] * d[1] + m[2]  * d[2]);
+    m_dy.push_back(m[4] * d[0] + m[5] * d[1] + m[6]  * d[2]);
+    m_dz.push_back(m[8] * d[0] + m[9] * d[1] + m[10] * d[2]);
+
+    m_ox.push_back(m[3]);
+    m_oy.push_back(m[7]);
+    m_oz.push_back(m[11]);
+    m_maxRange.push_back(maxRange);
+  }
+
+  m_out.resize(first + n);
+  return first;
+}
+
+void RangeCaster::cast(const HeightField& field)
+{
+  size_t n = m_out.size();
+  double t0 = monotonicSeconds();
+
+  m_pool.parallelFor(n, RANGE_GRAIN, [&](size_t begin, size_t end) {
+    TRACE_SCOPE_ARG("rangeCast", "rays", (int)(end - begin));
+    castRange(field, begin, end);
+  });
+
+  m_lastSeconds = monotonicSeconds() - t0;
+  m_seconds    += m_lastSeconds;
+  m_rays       += n;
+}
+
+// March a block of rays forward one grid cell at a time until each
+// one passes below the ground or runs out of range.  The crossing is
+// then refined by interpolating between the last two samples.  Rays
+// starting above the highest terrain first jump straight down to
+// that height, which makes the common downward beam nearly free.
+void RangeCaster::castRange(const HeightField& field, size_t begin, size_t end)
+{
+  const float step = field.cellSize();
+  const float top  = field.maxHeight();
+
+  for (size_t b = begin; b < end; b += RANGE_BLOCK) {
+    const size_t n = std::min((size_t)RANGE_BLOCK, end - b);
+
+    const float *ox = &m_ox[b], *oy = &m_oy[b], *oz = &m_oz[b];
+    const float *dx = &m_dx[b], *dy = &m_dy[b], *dz = &m_dz[b];
+    const float *mr = &m_maxRange[b];
+    float       *out = &m_out[b];
+
+    float t[RANGE_BLOCK] = { 0.0f }, f[RANGE_BLOCK] = { 0.0f };
+    float px[RANGE_BLOCK], py[RANGE_BLOCK], pz[RANGE_BLOCK];
+    bool  active[RANGE_BLOCK];
+    size_t left = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+      float skip = 0.0f;
+
+      if (oz[i] > top) {
+        if (dz[i] >= 0.0f) {
+          out[i]    = mr[i];    // pointing away from all terrain
+          active[i] = false;
+          continue;
+        }
+        skip = (top - oz[i]) / dz[i];
+      }
+
+      if (skip >= mr[i]) {
+        out[i]    = mr[i];
+        active[i] = false;
+        continue;
+      }
+
+      t[i] = skip;
+      f[i] = oz[i] + dz[i] * skip -
+             field.at(ox[i] + dx[i] * skip, oy[i] + dy[i] * skip);
+
+      if (f[i] <= 0.0f) {
+        out[i]    = skip;
+        active[i] = false;
+      } else {
+        active[i] = true;
+        ++left;
+      }
+    }
+
+    while (left > 0) {
+      // Advance every lane; inactive lanes are computed and ignored
+      // so this loop has no branches.
+      float tn[RANGE_BLOCK];
+      for (size_t i = 0; i < RANGE_BLOCK; ++i) {
+        size_t j = i < n ? i : 0;
+        tn[i] = std::min(t[j] + step, mr[j]);
+        px[i] = ox[j] + dx[j] * tn[i];
+        py[i] = oy[j] + dy[j] * tn[i];
+        pz[i] = oz[j] + dz[j] * tn[i];
+      }
+
+      for (size_t i = 0; i < n; ++i) {
+        if (!active[i])
+          continue;
+
+        float fn = pz[i] - field.at(px[i], py[i]);
+
+        if (fn <= 0.0f) {
+          out[i] = t[i] + (tn[i] - t[i]) * f[i] / (f[i] - fn);
+          active[i] = false;
+          --left;
+        } else if (tn[i] >= mr[i]) {
+          out[i] = mr[i];
+          active[i] = false;
+          --left;
+        } else {
+          t[i] = tn[i];
+          f[i] = fn;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,156 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimRange.h --- Simulated rangefinders and lidars.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SIM_RANGE_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SIM_RANGE_H_INCLUDED
+
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+class TerrainMap;
+class WorkerPool;
+
+// A regular grid of ground heights in local scene coordinates that
+// rays are marched against.  Heights are relative to the scene
+// origin.  Outside the grid the ground is flat at height zero.
+class HeightField
+{
+public:
+  // Create a flat, empty height field.
+  HeightField();
+
+  // Sample the ground in the square of "halfExtent" meters around the
+  // scene origin at "cellSize" meter spacing.  With no terrain the
+  // field is flat.
+  void build(TerrainMap *terrain, float halfExtent, float cellSize);
+
+  // Sample the field from a function returning the ground height at
+  // a local (x, y) position.
+  void build(const std::function<float(float, float)>& ground,
+             float halfExtent, float cellSize);
+
+  // Return the bilinearly interpolated ground height at (x, y).
+  float at(float x, float y) const
+  {
+    if (m_heights.empty())
+      return 0.0f;
+
+    float fx = (x - m_x0) * m_invCell;
+    float fy = (y - m_y0) * m_invCell;
+
+    if (!(fx >= 0.0f && fy >= 0.0f && fx < m_limit && fy < m_limit))
+      return 0.0f;
+
+    int   ix = (int)fx;
+    int   iy = (int)fy;
+    float ax = fx - ix;
+    float ay = fy - iy;
+
+    const float *p = &m_heights[(size_t)iy * m_n + ix];
+    float h0 = p[0]   + (p[1]       - p[0])   * ax;
+    float h1 = p[m_n] + (p[m_n + 1] - p[m_n]) * ax;
+    return h0 + (h1 - h0) * ay;
+  }
+
+  // Return the highest ground point anywhere in the field.
+  float maxHeight() const { return m_maxHeight; }
+
+  // Return the distance between grid posts.
+  float cellSize() const { return m_cell; }
+
+private:
+  std::vector<float> m_heights; // row-major, m_n x m_n posts
+  int   m_n;
+  float m_x0, m_y0;             // position of the first post
+  float m_cell;
+  float m_invCell;
+  float m_limit;                // last valid cell coordinate
+  float m_maxHeight;
+};
+
+// Beam directions of a range sensor as unit vectors in the body
+// frame of the vehicle.
+struct RangeScanPattern
+{
+  std::vector<float> dirs;      // (x, y, z) per beam
+
+  size_t size() const { return dirs.size() / 3; }
+
+  // A single beam pointing straight down.
+  static RangeScanPattern down();
+
+  // A scan of "hBeams" azimuths across "hFov" radians by "vBeams"
+  // elevations across "vFov" radians.  One vertical beam gives a
+  // planar (2D) scan.  A horizontal field of view of 2*pi or more
+  // wraps around without repeating the first beam.
+  static RangeScanPattern scan(int hBeams, int vBeams, float hFov, float vFov);
+};
+
+// Batched ray caster.  Each step, rays from every sensor on every
+// vehicle are added to one batch and then marched through the
+// height field together, split between the threads of a worker
+// pool.  Rays are laid out as structure-of-arrays so each block of
+// rays can be stepped in lockstep.
+class RangeCaster
+{
+public:
+  explicit RangeCaster(WorkerPool& pool);
+
+  // Start a new batch, forgetting the previous results.
+  void clear();
+
+  // Add the rays of a sensor at the origin of a body with 3x4 world
+  // transform "m" (as returned by "simGetObjectMatrix").  Returns the
+  // index of the first ray's result.
+  size_t add(const float *m, const RangeScanPattern& pattern, float maxRange);
+
+  // Cast every ray in the batch.
+  void cast(const HeightField& field);
+
+  // Return the distance to the ground along a ray, or its maximum
+  // range if nothing was hit.
+  float result(size_t i) const { return m_out[i]; }
+
+  // Return the number of rays in the current batch.
+  size_t size() const { return m_out.size(); }
+
+  // Throughput since the last "resetStats".
+  double raysPerSecond() const
+  {
+    return m_seconds > 0.0 ? m_rays / m_seconds : 0.0;
+  }
+
+  // Duration of the last "cast" (s).
+  double lastSeconds() const { return m_lastSeconds; }
+
+  void resetStats()
+  {
+    m_rays        = 0.0;
+    m_seconds     = 0.0;
+    m_lastSeconds = 0.0;
+  }
+
+private:
+  // March rays [begin, end).
+  void castRange(const HeightField& field, size_t begin, size_t end);
+
+  WorkerPool& m_pool;
+
+  std::vector<float> m_ox, m_oy, m_oz;
+  std::vector<float> m_dx, m_dy, m_dz;
+  std::vector<float> m_maxRange;
+  std::vector<float> m_out;
+
+  double m_rays;
+  double m_seconds;
+  double m_lastSeconds;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SIM_RANGE_H_INCLUDED
@@ -0,0 +1,174 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SitlBridge.cpp --- Lockstep software-in-the-loop bridge to external
+// flight stacks over shared memory.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <string.h>
+
+#include <new>
+#include <thread>
+
+#include "Command.h"
+#include "SitlBridge.h"
+
+// How long to spin waiting for motor commands before sleeping on the
+// futex (ns).  A flight stack on another core usually answers within
+// this, and spinning avoids the cost of sleeping and being woken.
+#define SITL_SPIN_NS  50000
+
+static size_t roundUp64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+SitlBridge::SitlBridge()
+  : m_timeoutMs(1000), m_generation(0), m_count(0), m_header(nullptr),
+    m_slots(nullptr), m_timeouts(0)
+{
+}
+
+SitlBridge::~SitlBridge()
+{
+  release();
+}
+
+void SitlBridge::configure(const std::string& name, unsigned timeoutMs)
+{
+  m_block.setName(name);
+  m_timeoutMs = timeoutMs;
+}
+
+void SitlBridge::release()
+{
+  if (m_header == nullptr)
+    return;
+
+  // Tell flight stacks the layout is going away, and wake any that
+  // are waiting for a step.
+  m_header->magic.store(0, std::memory_order_release);
+  m_header->step.fetch_add(1, std::memory_order_release);
+  sitlWake(&m_header->step);
+  m_block.unmap();
+
+  m_header = nullptr;
+  m_slots  = nullptr;
+  m_count  = 0;
+}
+
+void SitlBridge::layout(const int *objects, size_t count)
+{
+  release();
+  if (!enabled())
+    return;
+
+  size_t slotsOffset = roundUp64(sizeof(SitlHeader));
+  if (!m_block.map(slotsOffset + count * sizeof(SitlSlot)) ||
+      !m_block.shared())
+    return;
+
+  uint8_t *base = m_block.data();
+
+  m_count  = count;
+  m_header = new (base) SitlHeader;
+  m_slots  = (SitlSlot *)(base + slotsOffset);
+
+  m_header->magic.store(0, std::memory_order_relaxed);
+  m_header->version     = SITL_VERSION;
+  m_header->count       = (uint32_t)count;
+  m_header->generation  = ++m_generation;
+  m_header->slotSize    = (uint32_t)sizeof(SitlSlot);
+  m_header->slotsOffset = (uint32_t)slotsOffset;
+  m_header->step.store(0, std::memory_order_relaxed);
+  m_header->answers.store(0, std::memory_order_relaxed);
+
+  for (size_t i = 0; i < count; ++i) {
+    SitlSlot *s = new (&m_slots[i]) SitlSlot;
+    s->obj = objects[i];
+    memset(&s->sensors, 0, sizeof(s->sensors));
+    s->request.store(0, std::memory_order_relaxed);
+    s->attached.store(0, std::memory_order_relaxed);
+    s->ack.store(0, std::memory_order_relaxed);
+    memset(s->motors, 0, sizeof(s->motors));
+  }
+
+  m_header->magic.store(SITL_MAGIC, std::memory_order_release);
+}
+
+size_t SitlBridge::exchange()
+{
+  if (m_header == nullptr)
+    return 0;
+
+  uint32_t step = m_header->step.load(std::memory_order_relaxed) + 1;
+  uint64_t now  = commandNow();
+  uint32_t n    = 0;
+
+  for (size_t i = 0; i < m_count; ++i) {
+    SitlSlot& s = m_slots[i];
+    if (s.attached.load(std::memory_order_acquire) != 0) {
+      s.sensors.sent = now;
+      s.request.store(step, std::memory_order_relaxed);
+      ++n;
+    } else {
+      s.request.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  if (n == 0)
+    return 0;
+
+  std::atomic<uint32_t>& answers = m_header->answers;
+  m_header->step.store(step, std::memory_order_release);
+  sitlWake(&m_header->step);
+
+  // Spinning only helps if the flight stack can run at the same time.
+  static const bool spin = std::thread::hardware_concurrency() > 1;
+  uint64_t deadline = now + (uint64_t)m_timeoutMs * 1000000ull;
+
+  // Slots before "next" have answered this step.  "answers" is read
+  // before the acks it covers, so a wait on it cannot miss one.
+  size_t next = 0;
+  for (;;) {
+    uint32_t seen = answers.load(std::memory_order_acquire);
+    while (next < m_count &&
+           (m_slots[next].request.load(std::memory_order_relaxed) != step ||
+            m_slots[next].ack.load(std::memory_order_acquire) == step))
+      ++next;
+    if (next == m_count)
+      break;
+
+    uint64_t t = commandNow();
+    if (t >= deadline) {
+      ++m_timeouts;
+      break;
+    }
+
+    if (spin && t - now < SITL_SPIN_NS)
+      continue;
+
+    uint64_t wait = deadline - t;
+    struct timespec ts = { (time_t)(wait / 1000000000ull),
+                           (long)(wait % 1000000000ull) };
+    sitlWait(&answers, seen, &ts);
+  }
+
+  return n;
+}
+
+bool SitlBridge::motors(size_t i, float *out) const
+{
+  if (i >= m_count)
+    return false;
+
+  const SitlSlot& s = m_slots[i];
+  uint32_t request = s.request.load(std::memory_order_relaxed);
+  if (request == 0 || s.ack.load(std::memory_order_acquire) != request)
+    return false;
+
+  memcpy(out, s.motors, sizeof(s.motors));
+  return true;
+}
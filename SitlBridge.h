@@ -0,0 +1,156 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SitlBridge.h --- Lockstep software-in-the-loop bridge to external
+// flight stacks over shared memory.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SITL_BRIDGE_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SITL_BRIDGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+#include "SharedBlock.h"
+
+// Magic number and layout version at the start of the bridge.
+#define SITL_MAGIC    0x5153494cu       // "QSIL"
+#define SITL_VERSION  2
+
+// Header of the bridge in memory, followed by one SitlSlot per
+// quadcopter at "slotsOffset".
+//
+// Each step, the plug-in writes the sensor packet of every attached
+// slot and sets its "request" to the new step number, then stores
+// the step number in "step" and wakes any futex waiters on it.  A
+// flight stack waits for "step" to change; for each vehicle it flies
+// whose "request" is the new step, it reads the packet, writes the
+// motor commands and sets "ack" to the step.  It then adds the number
+// of vehicles it answered to "answers" and wakes the futex on it.
+// The plug-in waits until every requested slot's "ack" is the step,
+// or for the timeout, before it continues the simulation; "answers"
+// only tells it when to look again, so an answer to an earlier step
+// arriving late cannot complete a later one.  Slots attached during
+// a step are first requested on the next one.
+//
+// "magic" is zero while the bridge is being laid out, and
+// "generation" changes every time it is, so flight stacks know to
+// look again.
+struct SitlHeader
+{
+  std::atomic<uint32_t> magic;
+  uint32_t              version;
+  uint32_t              count;
+  uint32_t              generation;
+  uint32_t              slotSize;       // sizeof(SitlSlot)
+  uint32_t              slotsOffset;    // bytes from the header
+
+  alignas(64) std::atomic<uint32_t> step;
+  alignas(64) std::atomic<uint32_t> answers;
+};
+
+// Sensor packet of one quadcopter, written by the plug-in.
+struct SitlSensors
+{
+  uint64_t step;                // step index of the frame
+  uint64_t sent;                // CLOCK_MONOTONIC ns
+  double   time;                // simulation time (s)
+  double   lat;                 // deg
+  double   lon;                 // deg
+  double   altitude;            // m
+  float    accel[3];            // m/s^2
+  float    gyro[3];             // rad/s
+  float    pressure;            // Pa
+  float    magField[3];         // uT
+  float    agl;                 // m
+  float    rangeDown;           // m
+};
+
+// The exchange area of one quadcopter.
+struct SitlSlot
+{
+  int32_t     obj;              // object handle, set by the plug-in
+  SitlSensors sensors;
+  std::atomic<uint32_t> request;        // step awaiting motor commands
+
+  // Written by the flight stack.  It sets "attached" to 1 to take
+  // over the quadcopter's motors, and back to 0 to hand them back.
+  alignas(64) std::atomic<uint32_t> attached;
+  std::atomic<uint32_t> ack;
+  float                 motors[4];
+};
+
+// Wait while "*word" equals "value", for at most "timeout" (or
+// forever if NULL).  Works on words in shared memory.  May return
+// early.
+static inline void sitlWait(std::atomic<uint32_t> *word, uint32_t value,
+                            const struct timespec *timeout)
+{
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+// Wake every process waiting on "*word".
+static inline void sitlWake(std::atomic<uint32_t> *word)
+{
+  syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+// The plug-in side of the bridge.  The bridge is only enabled if a
+// shared memory name is given, since nothing else can attach.
+class SitlBridge
+{
+public:
+  SitlBridge();
+  ~SitlBridge();
+
+  SitlBridge(const SitlBridge&) = delete;
+  SitlBridge& operator=(const SitlBridge&) = delete;
+
+  // Use shared memory object "name" from the next "layout" on.
+  // "timeoutMs" is how long a step waits for motor commands.
+  void configure(const std::string& name, unsigned timeoutMs);
+
+  bool enabled() const { return !m_block.name().empty(); }
+
+  // Lay out one slot for each quadcopter with the given object
+  // handles.
+  void layout(const int *objects, size_t count);
+
+  // Return the slot at an index, or NULL if the bridge is off.
+  SitlSlot *slot(size_t i) { return i < m_count ? &m_slots[i] : nullptr; }
+
+  // Send the sensor packets filled into the attached slots, then wait
+  // for their motor commands.  Returns the number of attached slots.
+  size_t exchange();
+
+  // Copy the motor commands of the slot at an index into "out" and
+  // return true if its flight stack answered the last exchange.
+  bool motors(size_t i, float *out) const;
+
+  // Return the number of exchanges the flight stacks did not finish
+  // answering in time.
+  uint64_t timeouts() const { return m_timeouts; }
+
+  void resetStats() { m_timeouts = 0; }
+
+private:
+  void release();
+
+  SharedBlock  m_block;
+  unsigned     m_timeoutMs;
+  uint32_t     m_generation;
+  size_t       m_count;
+  SitlHeader  *m_header;
+  SitlSlot    *m_slots;
+  uint64_t     m_timeouts;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SITL_BRIDGE_H_INCLUDED
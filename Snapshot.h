@@ -0,0 +1,141 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Snapshot.h --- Binary snapshots of the plug-in's state.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SNAPSHOT_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SNAPSHOT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <type_traits>
+#include <vector>
+
+// Magic number and format version at the start of a snapshot.
+#define SNAPSHOT_MAGIC    0x51534e50u   // "QSNP"
+#define SNAPSHOT_VERSION  2
+
+// Header of a snapshot.  It is followed by "count" records, each a
+// SnapshotRecord and "size" bytes of the quadcopter's state.  State
+// is stored as the plug-in holds it in memory, so a snapshot can
+// only be restored by the same build of the plug-in; "stateSize" and
+// "noiseSize" catch most mismatches.
+struct SnapshotHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;                // bytes in the snapshot, with the header
+  uint32_t stateSize;           // sizeof(QuadcopterState)
+  uint32_t noiseSize;           // sizeof(NoiseState)
+  uint32_t count;               // records that follow
+  float    time;                // Frame of the step it was taken in
+  uint64_t step;
+  uint64_t seed;
+  uint64_t rngKey;
+};
+
+// Start of the record of one quadcopter.
+struct SnapshotRecord
+{
+  int32_t  obj;                 // object handle of the quadcopter
+  uint32_t size;                // bytes that follow
+  uint32_t beams;               // lidar ranges in the record
+};
+
+// Appends values to a snapshot.
+class SnapshotWriter
+{
+public:
+  explicit SnapshotWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+  template <class T>
+  void put(const T& value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "snapshot values must be trivially copyable");
+    putBytes(&value, sizeof(T));
+  }
+
+  void putBytes(const void *data, size_t size)
+  {
+    const uint8_t *p = (const uint8_t *)data;
+    m_out.insert(m_out.end(), p, p + size);
+  }
+
+  // Return the bytes written so far, and a pointer to an offset, for
+  // filling in sizes once they are known.
+  size_t size() const { return m_out.size(); }
+  uint8_t *at(size_t offset) { return &m_out[offset]; }
+
+private:
+  std::vector<uint8_t>& m_out;
+};
+
+// Reads values back from a snapshot.  Restoring is done twice: first
+// with "applying" false, where values are checked but not stored, so
+// a malformed snapshot is found before anything has changed, then
+// for real.  Code that restores state must therefore store values
+// only through "get", and only have other effects when "applying".
+class SnapshotReader
+{
+public:
+  SnapshotReader(const uint8_t *data, size_t size, bool applying)
+    : m_p(data), m_end(data + size), m_applying(applying)
+  {
+  }
+
+  bool applying() const { return m_applying; }
+
+  // Return the number of bytes not read yet.
+  size_t left() const { return m_end - m_p; }
+
+  template <class T>
+  bool get(T& value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "snapshot values must be trivially copyable");
+    return getBytes(&value, sizeof(T));
+  }
+
+  bool getBytes(void *data, size_t size)
+  {
+    if (size > left())
+      return false;
+    if (m_applying)
+      memcpy(data, m_p, size);
+    m_p += size;
+    return true;
+  }
+
+  // Skip "size" bytes.
+  bool skip(size_t size)
+  {
+    if (size > left())
+      return false;
+    m_p += size;
+    return true;
+  }
+
+  // Return a reader over the next "size" bytes, or over none if there
+  // are fewer, and skip them.
+  SnapshotReader sub(size_t size, bool applying)
+  {
+    if (size > left())
+      size = 0;
+    SnapshotReader r(m_p, size, applying);
+    m_p += size;
+    return r;
+  }
+
+private:
+  const uint8_t *m_p;
+  const uint8_t *m_end;
+  bool           m_applying;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SNAPSHOT_H_INCLUDED
@@ -0,0 +1,69 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SpscQueue.h --- Bounded queue between two threads.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SPSC_QUEUE_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SPSC_QUEUE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <type_traits>
+
+// A fixed ring of "N" values passed from one producer thread to one
+// consumer thread without locks.  Each side owns one index and only
+// reads the other's, so neither ever waits for the other.  "N" must
+// be a power of two.
+template <class T, size_t N>
+class SpscQueue
+{
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value,
+                "SpscQueue values must be trivially copyable");
+
+public:
+  SpscQueue()
+    : m_head(0), m_tail(0)
+  {
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  // Add a value.  Returns false if the queue is full.  Producer only.
+  bool push(const T& value)
+  {
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == N)
+      return false;
+
+    m_slots[head & (N - 1)] = value;
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Remove the oldest value.  Returns false if the queue is empty.
+  // Consumer only.
+  bool pop(T& value)
+  {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire))
+      return false;
+
+    value = m_slots[tail & (N - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  alignas(64) std::atomic<uint32_t> m_head;     // next position to fill
+  alignas(64) std::atomic<uint32_t> m_tail;     // next position to take
+  alignas(64) T                     m_slots[N];
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SPSC_QUEUE_H_INCLUDED
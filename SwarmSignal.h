@@ -0,0 +1,102 @@
+/* -*- Mode: C; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/*
+ * SwarmSignal.h --- Packed state of every quadcopter, published as a
+ * V-REP string signal.
+ *
+ * Copyright (C) 2013, Galois, Inc.
+ * All Rights Reserved.
+ *
+ * This header is plain C so remote API clients can include it to
+ * decode the signal; "swarm_signal.py" decodes it from Python.
+ */
+
+#ifndef V_REP_EXT_QUADCOPTER_SWARM_SIGNAL_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SWARM_SIGNAL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Magic number and layout version at the start of the signal. */
+#define SWARM_SIGNAL_MAGIC    0x5153574du       /* "QSWM" */
+#define SWARM_SIGNAL_VERSION  1
+
+/*
+ * The signal is a SwarmSignalHeader followed by "count" records of
+ * "recordSize" bytes each, one per quadcopter in the order the plug-in
+ * steps them.  Values are little-endian, as on every machine V-REP
+ * runs on.  Later versions only append fields to the header and the
+ * records, so a decoder that skips by "headerSize" and "recordSize"
+ * can read any version with the same magic number.
+ */
+typedef struct SwarmSignalHeader
+{
+  uint32_t magic;               /* SWARM_SIGNAL_MAGIC */
+  uint16_t version;             /* SWARM_SIGNAL_VERSION */
+  uint16_t headerSize;          /* bytes in the header */
+  uint32_t recordSize;          /* bytes in each record */
+  uint32_t count;               /* records that follow */
+  uint64_t step;                /* step index of the frame */
+  double   time;                /* simulation time (s) */
+} SwarmSignalHeader;
+
+/* State of one quadcopter as of the end of the step. */
+typedef struct SwarmRecord
+{
+  int32_t  obj;                 /* object handle of the quadcopter */
+  uint32_t mode;                /* ControlMode */
+  double   lat;                 /* GPS fix (deg) */
+  double   lon;                 /* deg */
+  double   altitude;            /* m */
+  float    pose[12];            /* 3x4 world transform of the body */
+  float    velocity[3];         /* world frame (m/s) */
+  float    angVel[3];           /* world frame (rad/s) */
+  float    target[4];           /* target position (m) and heading (rad) */
+  float    accel[3];            /* m/s^2 */
+  float    gyro[3];             /* rad/s */
+  float    pressure;            /* Pa */
+  float    magField[3];         /* uT */
+  float    agl;                 /* m */
+  float    rangeDown;           /* m */
+} SwarmRecord;
+
+/*
+ * Check that "data" holds "size" bytes of a swarm signal and copy its
+ * header into "header".  Returns the number of records, or -1 if the
+ * data is not a complete signal.
+ */
+static inline int swarmSignalCheck(const void *data, size_t size,
+                                   SwarmSignalHeader *header)
+{
+  SwarmSignalHeader h;
+
+  if (size < sizeof(h))
+    return -1;
+  memcpy(&h, data, sizeof(h));
+
+  if (h.magic != SWARM_SIGNAL_MAGIC || h.headerSize < sizeof(h) ||
+      (uint64_t)h.headerSize + (uint64_t)h.count * h.recordSize > size)
+    return -1;
+
+  *header = h;
+  return (int)h.count;
+}
+
+/*
+ * Copy record "i" of a signal checked by "swarmSignalCheck" into
+ * "out".  Fields the signal's version does not have read as zero.
+ */
+static inline void swarmSignalRecord(const void *data,
+                                     const SwarmSignalHeader *header,
+                                     uint32_t i, SwarmRecord *out)
+{
+  const uint8_t *p = (const uint8_t *)data + header->headerSize +
+                     (size_t)i * header->recordSize;
+  size_t n = header->recordSize < sizeof(*out) ?
+             header->recordSize : sizeof(*out);
+
+  memset(out, 0, sizeof(*out));
+  memcpy(out, p, n);
+}
+
+#endif   /* !defined V_REP_EXT_QUADCOPTER_SWARM_SIGNAL_H_INCLUDED */
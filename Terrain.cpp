@@ -0,0 +1,212 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Terrain.cpp --- Terrain elevation model from memory-mapped tiles.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GeographicLib/UTMUPS.hpp>
+#include "Terrain.h"
+
+using GeographicLib::UTMUPS;
+
+static_assert(sizeof(TerrainTileHeader) == 48,
+              "terrain tile header must match the file format");
+
+TerrainMap::TerrainMap(const std::string& dir, const GPSSimConfig& config,
+                       double tileSpan, size_t cacheSize)
+  : m_dir(dir), m_config(config),
+    m_span(tileSpan), m_invSpan(1.0 / tileSpan),
+    m_cacheSize(cacheSize < 1 ? 1 : cacheSize),
+    m_last(nullptr)
+{
+}
+
+TerrainMap::~TerrainMap()
+{
+  clear();
+}
+
+void TerrainMap::clear()
+{
+  for (auto& tile : m_lru)
+    unloadTile(tile);
+
+  m_lru.clear();
+  m_index.clear();
+  m_last = nullptr;
+}
+
+bool TerrainMap::heightAtUTM(double easting, double northing, float *height)
+{
+  int64_t tx = (int64_t)floor(easting  * m_invSpan);
+  int64_t ty = (int64_t)floor(northing * m_invSpan);
+  const Tile *t = findTile(tx, ty);
+
+  if (t->data == nullptr)
+    return false;
+
+  // Position in post units within the tile, clamped so the 2x2 cell
+  // we interpolate over stays inside the grid.
+  double fx = (easting  - t->easting)  * t->invSpacing;
+  double fy = (northing - t->northing) * t->invSpacing;
+  int    n  = t->samples;
+  int    ix = constrainCell(fx, n);
+  int    iy = constrainCell(fy, n);
+  float  ax = (float)(fx - ix);
+  float  ay = (float)(fy - iy);
+
+  const float *p = t->data + (size_t)iy * n + ix;
+  float h0 = p[0] + (p[1]     - p[0]) * ax;
+  float h1 = p[n] + (p[n + 1] - p[n]) * ax;
+
+  *height = h0 + (h1 - h0) * ay;
+  return true;
+}
+
+bool TerrainMap::heightAtLatLon(double lat, double lon, float *height)
+{
+  int    zone;
+  bool   isNorth;
+  double x, y;
+
+  UTMUPS::Forward(lat, lon, zone, isNorth, x, y, m_config.zone);
+  return heightAtUTM(x, y, height);
+}
+
+int TerrainMap::constrainCell(double f, int samples)
+{
+  if (!(f > 0.0))
+    return 0;
+  if (f >= (double)(samples - 1))
+    return samples - 2;
+  return (int)f;
+}
+
+const TerrainMap::Tile *TerrainMap::findTile(int64_t tx, int64_t ty)
+{
+  uint64_t key = tileKey(tx, ty);
+
+  if (m_last != nullptr && m_last->key == key)
+    return m_last;
+
+  auto i = m_index.find(key);
+
+  if (i != m_index.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, i->second);
+  } else {
+    if (m_lru.size() >= m_cacheSize) {
+      Tile& victim = m_lru.back();
+      m_index.erase(victim.key);
+      unloadTile(victim);
+      m_lru.pop_back();
+    }
+
+    m_lru.emplace_front();
+    loadTile(tx, ty, m_lru.front());
+    m_index[key] = m_lru.begin();
+  }
+
+  m_last = &m_lru.front();
+  return m_last;
+}
+
+void TerrainMap::loadTile(int64_t tx, int64_t ty, Tile& tile)
+{
+  tile.key        = tileKey(tx, ty);
+  tile.map        = nullptr;
+  tile.mapLen     = 0;
+  tile.data       = nullptr;
+  tile.samples    = 0;
+  tile.easting    = 0.0;
+  tile.northing   = 0.0;
+  tile.invSpacing = 0.0;
+
+  char name[64];
+  snprintf(name, sizeof(name), "/%lld_%lld.qdem",
+           (long long)tx, (long long)ty);
+  std::string filename = m_dir + name;
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;                     // no terrain here, not an error
+
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(TerrainTileHeader)) {
+    fprintf(stderr, "terrain: %s: truncated tile\n", filename.c_str());
+    close(fd);
+    return;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "terrain: %s: mmap failed\n", filename.c_str());
+    return;
+  }
+
+  tile.map    = map;
+  tile.mapLen = st.st_size;
+
+  TerrainTileHeader hdr;
+  memcpy(&hdr, map, sizeof(hdr));
+
+  size_t sampleSize = (hdr.sampleType == TERRAIN_SAMPLE_INT16 ? 2 : 4);
+  size_t count      = (size_t)hdr.samples * hdr.samples;
+
+  // Divide rather than multiply so a hostile "samples" cannot wrap.
+  if (memcmp(hdr.magic, "QDEM", 4) != 0 ||
+      hdr.version != TERRAIN_TILE_VERSION ||
+      hdr.sampleType > TERRAIN_SAMPLE_INT16 ||
+      hdr.samples < 2 || hdr.samples > TERRAIN_MAX_TILE_SAMPLES ||
+      !(hdr.spacing > 0.0) ||
+      (tile.mapLen - sizeof(hdr)) / sampleSize / hdr.samples < hdr.samples) {
+    fprintf(stderr, "terrain: %s: bad tile header\n", filename.c_str());
+    unloadTile(tile);
+    return;
+  }
+
+  const uint8_t *body = (const uint8_t *)map + sizeof(hdr);
+
+  if (hdr.sampleType == TERRAIN_SAMPLE_FLOAT32) {
+    tile.data = (const float *)body;
+  } else {
+    const int16_t *src = (const int16_t *)body;
+    tile.decoded.resize(count);
+
+    for (size_t i = 0; i < count; ++i)
+      tile.decoded[i] = src[i] * hdr.scale + hdr.offset;
+
+    // The raw samples are no longer needed once decoded.
+    munmap(tile.map, tile.mapLen);
+    tile.map    = nullptr;
+    tile.mapLen = 0;
+    tile.data   = &tile.decoded[0];
+  }
+
+  tile.samples    = hdr.samples;
+  tile.easting    = hdr.easting;
+  tile.northing   = hdr.northing;
+  tile.invSpacing = 1.0 / hdr.spacing;
+}
+
+void TerrainMap::unloadTile(Tile& tile)
+{
+  if (tile.map != nullptr)
+    munmap(tile.map, tile.mapLen);
+
+  tile.map    = nullptr;
+  tile.mapLen = 0;
+  tile.data   = nullptr;
+  tile.decoded.clear();
+}
@@ -0,0 +1,161 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Terrain.h --- Terrain elevation model from memory-mapped tiles.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_TERRAIN_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_TERRAIN_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SimGPS.h"
+
+// Default extent of a single terrain tile in meters.
+#define TERRAIN_DEFAULT_TILE_SPAN 1000.0
+
+// Default number of tiles kept mapped at once.
+#define TERRAIN_DEFAULT_CACHE_SIZE 16
+
+// Sample encodings supported in a tile file.
+enum TerrainSampleType
+{
+  TERRAIN_SAMPLE_FLOAT32 = 0,   // native float, mapped directly
+  TERRAIN_SAMPLE_INT16   = 1,   // SRTM-style, decoded with scale/offset
+};
+
+// Header of a terrain tile file.  Tiles are square grids of "samples"
+// by "samples" elevation posts in little endian byte order, stored in
+// rows from south to north, each row from west to east.  The first
+// post lies at UTM coordinates ("easting", "northing") and posts are
+// "spacing" meters apart.
+//
+// A tile covering the UTM square starting at (tx * span, ty * span)
+// is stored in a file named "<tx>_<ty>.qdem" in the terrain
+// directory, where "span" is the tile span of the map.
+struct TerrainTileHeader
+{
+  char     magic[4];            // "QDEM"
+  uint32_t version;             // TERRAIN_TILE_VERSION
+  uint32_t sampleType;          // a TerrainSampleType
+  uint32_t samples;             // posts per side
+  double   easting;             // UTM X of the first post (m)
+  double   northing;            // UTM Y of the first post (m)
+  double   spacing;             // distance between posts (m)
+  float    scale;               // int16 samples: height = s * scale + offset
+  float    offset;
+};
+
+#define TERRAIN_TILE_VERSION 1
+
+// Largest number of posts per side accepted in a tile.
+#define TERRAIN_MAX_TILE_SAMPLES 16384
+
+// A digital elevation model made of tiles loaded on demand from a
+// directory.  Tiles are mapped into memory with "mmap" and a small
+// LRU of recently used tiles is kept open.  Queries are bilinearly
+// interpolated between posts.
+//
+// This is not thread-safe; it is only used from the simulator thread.
+class TerrainMap
+{
+public:
+  // Create a terrain map reading tiles from "dir".  The GPS
+  // configuration supplies the UTM zone and the origin used to
+  // convert local scene coordinates.
+  TerrainMap(const std::string& dir, const GPSSimConfig& config,
+             double tileSpan = TERRAIN_DEFAULT_TILE_SPAN,
+             size_t cacheSize = TERRAIN_DEFAULT_CACHE_SIZE);
+  ~TerrainMap();
+
+  TerrainMap(const TerrainMap&) = delete;
+  TerrainMap& operator=(const TerrainMap&) = delete;
+
+  // Look up the terrain height (m above the UTM datum) at a UTM
+  // position.  Returns false if no tile covers the position.
+  bool heightAtUTM(double easting, double northing, float *height);
+
+  // Look up the terrain height below a local scene position.
+  bool heightAtLocal(float x, float y, float *height)
+  {
+    return heightAtUTM(m_config.originX + x, m_config.originY + y, height);
+  }
+
+  // Look up the terrain height at a latitude and longitude (deg).
+  bool heightAtLatLon(double lat, double lon, float *height);
+
+  // Return the height of the ground below a local scene position
+  // relative to the scene origin.  Positions without terrain are
+  // treated as flat ground at the origin altitude.
+  float groundLocal(float x, float y)
+  {
+    float h;
+    if (heightAtLocal(x, y, &h))
+      return h - (float)m_config.originZ;
+    return 0.0f;
+  }
+
+  // Return the number of tiles currently mapped.
+  size_t tilesLoaded() const { return m_lru.size(); }
+
+  // Unmap all tiles.
+  void clear();
+
+private:
+  struct Tile
+  {
+    uint64_t     key;
+    void        *map;           // mapping of the whole file, or NULL
+    size_t       mapLen;
+    const float *data;          // NULL if the tile is missing
+    std::vector<float> decoded; // storage for non-float tiles
+    int          samples;
+    double       easting;
+    double       northing;
+    double       invSpacing;
+  };
+
+  typedef std::list<Tile> TileList;
+
+  static uint64_t tileKey(int64_t tx, int64_t ty)
+  {
+    return ((uint64_t)(uint32_t)tx << 32) | (uint32_t)ty;
+  }
+
+  // Return the index of the grid cell containing post coordinate "f",
+  // clamped to the cells of a tile with "samples" posts per side.
+  static int constrainCell(double f, int samples);
+
+  // Return the tile for a tile index, loading it if needed.
+  const Tile *findTile(int64_t tx, int64_t ty);
+
+  // Load a tile from disk into "tile".  Missing or malformed tiles
+  // leave "tile.data" NULL.
+  void loadTile(int64_t tx, int64_t ty, Tile& tile);
+
+  static void unloadTile(Tile& tile);
+
+  std::string  m_dir;
+  GPSSimConfig m_config;
+  double       m_span;
+  double       m_invSpan;
+  size_t       m_cacheSize;
+
+  // Most recently used tile first.
+  TileList m_lru;
+  std::unordered_map<uint64_t, TileList::iterator> m_index;
+
+  // The last tile returned, to skip the hash lookup for queries that
+  // stay within one tile.
+  const Tile *m_last;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_TERRAIN_H_INCLUDED
@@ -0,0 +1,158 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Trace.cpp --- Chrome trace-event recording of plug-in activity.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <string>
+
+#include "Trace.h"
+
+// Default number of events kept per thread.
+#define TRACE_DEFAULT_EVENTS 262144
+
+bool                      Trace::s_enabled = false;
+std::atomic<unsigned>     Trace::s_generation(0);
+thread_local TraceBuffer *Trace::t_buffer = nullptr;
+
+static std::string  g_trace_file;
+static size_t       g_trace_events = TRACE_DEFAULT_EVENTS;
+static ProfileTicks g_trace_start;
+
+// Every thread's buffer, guarded by "g_trace_mutex".  Buffers live
+// until the plug-in is unloaded, so threads never see theirs go away.
+static std::mutex g_trace_mutex;
+static std::vector<std::unique_ptr<TraceBuffer>> g_trace_buffers;
+
+void Trace::init()
+{
+  const char *file = getenv("QUADCOPTER_TRACE");
+  s_enabled = file != NULL && *file != '\0';
+  if (!s_enabled)
+    return;
+
+  g_trace_file = file;
+
+  const char *events = getenv("QUADCOPTER_TRACE_EVENTS");
+  if (events != NULL && atol(events) > 0)
+    g_trace_events = (size_t)atol(events);
+
+  fprintf(stderr, "quadcopter: tracing to '%s'\n", file);
+  start();
+}
+
+void Trace::start()
+{
+  g_trace_start = profileNow();
+  s_generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
+TraceBuffer *Trace::addBuffer()
+{
+  std::unique_ptr<TraceBuffer> b(new TraceBuffer);
+  b->events.resize(g_trace_events);
+  b->count.store(0);
+  b->dropped.store(0);
+  b->generation.store(s_generation.load());
+  b->threadName.store(nullptr);
+
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+  b->tid   = (int)g_trace_buffers.size();
+  t_buffer = b.get();
+  g_trace_buffers.push_back(std::move(b));
+  return t_buffer;
+}
+
+void Trace::setThreadName(const char *name)
+{
+  if (s_enabled)
+    buffer()->threadName.store(name, std::memory_order_release);
+}
+
+// Write a JSON string, escaping as needed.
+static void writeJSONString(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s != '\0'; ++s) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+void Trace::write()
+{
+  if (!s_enabled)
+    return;
+
+  FILE *f = fopen(g_trace_file.c_str(), "w");
+  if (f == NULL) {
+    fprintf(stderr, "quadcopter: cannot write trace '%s'\n",
+            g_trace_file.c_str());
+    return;
+  }
+
+  unsigned gen     = s_generation.load(std::memory_order_acquire);
+  size_t   total   = 0;
+  size_t   dropped = 0;
+  bool     first   = true;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  std::lock_guard<std::mutex> lock(g_trace_mutex);
+
+  for (const auto& b : g_trace_buffers) {
+    const char *threadName = b->threadName.load(std::memory_order_acquire);
+    if (threadName == nullptr)
+      threadName = "thread";
+
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", b->tid);
+    writeJSONString(f, threadName);
+    fprintf(f, "}}");
+    first = false;
+
+    // A thread that has not recorded anything since the trace
+    // started still holds events from an earlier one.
+    if (b->generation.load(std::memory_order_acquire) != gen)
+      continue;
+
+    size_t n = b->count.load(std::memory_order_acquire);
+
+    for (size_t i = 0; i < n; ++i) {
+      const TraceEvent& e = b->events[i];
+      double ts  = Profile::toNanos((double)(int64_t)(e.start - g_trace_start)) * 1e-3;
+      double dur = Profile::toNanos((double)(e.end - e.start)) * 1e-3;
+
+      fprintf(f, ",\n{\"name\":");
+      writeJSONString(f, e.name);
+      fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+              b->tid, ts, dur);
+      if (e.argName != nullptr) {
+        fprintf(f, ",\"args\":{");
+        writeJSONString(f, e.argName);
+        fprintf(f, ":%d}", e.arg);
+      }
+      fprintf(f, "}");
+    }
+
+    total   += n;
+    dropped += b->dropped.load(std::memory_order_relaxed);
+  }
+
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  fprintf(stderr, "quadcopter: wrote %zu trace events to '%s'",
+          total, g_trace_file.c_str());
+  if (dropped > 0)
+    fprintf(stderr, " (%zu dropped)", dropped);
+  fprintf(stderr, "\n");
+}
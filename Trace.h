@@ -0,0 +1,154 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Trace.h --- Chrome trace-event recording of plug-in activity.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_TRACE_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_TRACE_H_INCLUDED
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "Profile.h"
+
+// One timed span of activity.  "name" and "argName" must be string
+// literals.
+struct TraceEvent
+{
+  const char  *name;
+  const char  *argName;         // NULL if the event has no argument
+  ProfileTicks start;
+  ProfileTicks end;
+  int          arg;
+};
+
+// Events recorded by one thread.  Only the owning thread writes; it
+// publishes each event by bumping "count", so the buffer can be read
+// from another thread without locking.  When the buffer is full
+// further events are dropped.
+struct TraceBuffer
+{
+  std::vector<TraceEvent>   events;
+  std::atomic<size_t>       count;
+  std::atomic<size_t>       dropped;
+  std::atomic<unsigned>     generation;
+  std::atomic<const char *> threadName;
+  int                       tid;
+};
+
+// Optional tracer writing Chrome/Perfetto JSON traces.  Tracing is on
+// when the environment variable "QUADCOPTER_TRACE" names an output
+// file; the trace of each simulation is written to it when the
+// simulation stops.  "QUADCOPTER_TRACE_EVENTS" sets the number of
+// events kept per thread.
+class Trace
+{
+public:
+  // Read the configuration from the environment.
+  static void init();
+
+  // Start a new trace, dropping events from the previous one.
+  static void start();
+
+  // Write the current trace to the output file.
+  static void write();
+
+  static bool enabled() { return s_enabled; }
+
+  // Record a span on the calling thread.
+  static void record(const char *name, ProfileTicks start, ProfileTicks end,
+                     const char *argName, int arg)
+  {
+    TraceBuffer *b = buffer();
+    size_t n = b->count.load(std::memory_order_relaxed);
+
+    if (n == b->events.size()) {
+      b->dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    TraceEvent& e = b->events[n];
+    e.name    = name;
+    e.argName = argName;
+    e.start   = start;
+    e.end     = end;
+    e.arg     = arg;
+    b->count.store(n + 1, std::memory_order_release);
+  }
+
+  // Name the calling thread in traces.  "name" must be a string
+  // literal.
+  static void setThreadName(const char *name);
+
+private:
+  // Return the calling thread's buffer for the current trace.
+  static TraceBuffer *buffer()
+  {
+    TraceBuffer *b = t_buffer;
+    if (b == nullptr)
+      b = addBuffer();
+
+    // The owning thread empties its own buffer when a new trace
+    // starts, so readers never race with a reset.  The generation is
+    // published last: a reader that sees the new generation also
+    // sees the emptied buffer.
+    unsigned gen = s_generation.load(std::memory_order_acquire);
+    if (b->generation.load(std::memory_order_relaxed) != gen) {
+      b->count.store(0, std::memory_order_relaxed);
+      b->dropped.store(0, std::memory_order_relaxed);
+      b->generation.store(gen, std::memory_order_release);
+    }
+
+    return b;
+  }
+
+  static TraceBuffer *addBuffer();
+
+  static bool                  s_enabled;
+  static std::atomic<unsigned> s_generation;
+  static thread_local TraceBuffer *t_buffer;
+};
+
+// Records the enclosing scope as a trace span when tracing is on.
+class TraceScope
+{
+public:
+  explicit TraceScope(const char *name, const char *argName = nullptr,
+                      int arg = 0)
+    : m_name(name), m_argName(argName), m_arg(arg),
+      m_start(Trace::enabled() ? profileNow() : 0)
+  {
+  }
+
+  ~TraceScope()
+  {
+    if (Trace::enabled())
+      Trace::record(m_name, m_start, profileNow(), m_argName, m_arg);
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  const char  *m_name;
+  const char  *m_argName;
+  int          m_arg;
+  ProfileTicks m_start;
+};
+
+// Trace the rest of the enclosing scope as "name".
+#define TRACE_SCOPE(name) \
+  TraceScope PROFILE_CONCAT(traceScope_, __LINE__)(name)
+
+// Trace the rest of the enclosing scope as "name" with an integer
+// argument shown in the trace viewer.
+#define TRACE_SCOPE_ARG(name, argName, arg) \
+  TraceScope PROFILE_CONCAT(traceScope_, __LINE__)(name, argName, arg)
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_TRACE_H_INCLUDED
@@ -0,0 +1,160 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// WorkerPool.h --- Fixed pool of worker threads for batched work.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_WORKER_POOL_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_WORKER_POOL_H_INCLUDED
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Trace.h"
+
+// A pool of threads that split a range of work items between them.
+// The calling thread takes part in the work, so a pool created with
+// zero extra threads simply runs everything inline.
+//
+// Only one "parallelFor" may be running at a time; it is meant to be
+// called from the simulator thread.
+class WorkerPool
+{
+public:
+  // A function run over the half-open item range [begin, end).
+  typedef std::function<void(size_t begin, size_t end)> RangeFunc;
+
+  // Create a pool with "threads" threads in addition to the caller.
+  explicit WorkerPool(unsigned threads)
+    : m_func(nullptr), m_count(0), m_grain(1),
+      m_next(0), m_busy(0), m_generation(0), m_quit(false)
+  {
+    for (unsigned i = 0; i < threads; ++i)
+      m_threads.emplace_back(&WorkerPool::workerMain, this);
+  }
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_quit = true;
+    }
+
+    m_wake.notify_all();
+    for (auto& t : m_threads)
+      t.join();
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Return the number of threads doing work, including the caller.
+  unsigned size() const { return (unsigned)m_threads.size() + 1; }
+
+  // Return a sensible number of extra threads for this machine.
+  static unsigned defaultThreads()
+  {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 1 ? n - 1 : 0;
+  }
+
+  // Run "func" over [0, count) in chunks of at most "grain" items and
+  // return when every chunk is done.
+  void parallelFor(size_t count, size_t grain, const RangeFunc& func)
+  {
+    if (count == 0)
+      return;
+
+    if (grain == 0)
+      grain = 1;
+
+    if (m_threads.empty() || count <= grain) {
+      func(0, count);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_func  = &func;
+      m_count = count;
+      m_grain = grain;
+      m_next.store(0);
+      m_busy  = (unsigned)m_threads.size();
+      ++m_generation;
+    }
+
+    m_wake.notify_all();
+    runChunks(func, count, grain);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busy == 0; });
+    m_func = nullptr;
+  }
+
+private:
+  // Claim and run chunks until the range is exhausted.
+  void runChunks(const RangeFunc& func, size_t count, size_t grain)
+  {
+    for (;;) {
+      size_t begin = m_next.fetch_add(grain);
+      if (begin >= count)
+        break;
+
+      size_t end = begin + grain;
+      func(begin, end < count ? end : count);
+    }
+  }
+
+  void workerMain()
+  {
+    unsigned seen = 0;
+
+    Trace::setThreadName("worker");
+
+    for (;;) {
+      const RangeFunc *func;
+      size_t count, grain;
+
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+        if (m_quit)
+          return;
+
+        seen  = m_generation;
+        func  = m_func;
+        count = m_count;
+        grain = m_grain;
+      }
+
+      runChunks(*func, count, grain);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_busy == 0)
+        m_done.notify_one();
+    }
+  }
+
+  std::vector<std::thread> m_threads;
+  std::mutex               m_mutex;
+  std::condition_variable  m_wake;   // new work or shutdown
+  std::condition_variable  m_done;   // all workers finished
+
+  const RangeFunc    *m_func;        // current work, under m_mutex
+  size_t              m_count;
+  size_t              m_grain;
+  std::atomic<size_t> m_next;        // next unclaimed item
+  unsigned            m_busy;        // workers still running
+  unsigned            m_generation;  // bumped for each parallelFor
+  bool                m_quit;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_WORKER_POOL_H_INCLUDED
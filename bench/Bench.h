@@ -0,0 +1,157 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// Bench.h --- Minimal microbenchmark harness.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_BENCH_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_BENCH_H_INCLUDED
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Keep the compiler from optimizing away a value.
+template <class T>
+static inline void benchKeep(const T& v)
+{
+  asm volatile("" : : "g"(&v) : "memory");
+}
+
+static inline double benchNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Statistics of one benchmark over all samples.
+struct BenchResult
+{
+  std::string name;
+  double      mean;             // ns/op
+  double      stddev;           // ns/op, between samples
+  double      min;              // ns/op, fastest sample
+  double      median;           // ns/op
+  uint64_t    iterations;       // per sample
+  int         samples;
+};
+
+// Runs benchmarks and collects their results.  Each benchmark is
+// calibrated to take about SAMPLE_SECONDS per sample and is then run
+// for a number of samples, so run-to-run variation shows up as the
+// standard deviation.
+class BenchSuite
+{
+public:
+  explicit BenchSuite(const char *name, int samples = 15,
+                      double sampleSeconds = 0.02)
+    : m_name(name), m_samples(samples), m_sampleSeconds(sampleSeconds)
+  {
+  }
+
+  // Benchmark "op", which performs one operation per call.
+  template <class F>
+  const BenchResult& run(const char *name, F op)
+  {
+    // Find an iteration count that fills a sample.
+    uint64_t iters = 1;
+    for (;;) {
+      double t0 = benchNow();
+      for (uint64_t i = 0; i < iters; ++i)
+        op();
+      double t = benchNow() - t0;
+
+      if (t >= m_sampleSeconds * 0.5 || iters >= (1ull << 32))
+        break;
+      iters *= t > 0.0 ? std::min(16.0, std::max(2.0, m_sampleSeconds / t)) : 16;
+    }
+
+    std::vector<double> ns;
+    for (int s = 0; s < m_samples; ++s) {
+      double t0 = benchNow();
+      for (uint64_t i = 0; i < iters; ++i)
+        op();
+      ns.push_back((benchNow() - t0) * 1e9 / iters);
+    }
+
+    return add(name, ns, iters);
+  }
+
+  // Record a result measured by the caller, as nanoseconds per
+  // operation for each sample.
+  const BenchResult& add(const char *name, std::vector<double> ns,
+                         uint64_t iterations)
+  {
+    BenchResult r;
+    r.name       = name;
+    r.iterations = iterations;
+    r.samples    = (int)ns.size();
+
+    double sum = 0.0;
+    for (double v : ns)
+      sum += v;
+    r.mean = sum / ns.size();
+
+    double var = 0.0;
+    for (double v : ns)
+      var += (v - r.mean) * (v - r.mean);
+    r.stddev = ns.size() > 1 ? sqrt(var / (ns.size() - 1)) : 0.0;
+
+    std::sort(ns.begin(), ns.end());
+    r.min    = ns.front();
+    r.median = ns[ns.size() / 2];
+
+    printf("%s: %-32s %11.1f ns/op  +/- %5.1f%%  (min %.1f)\n",
+           m_name.c_str(), name, r.mean,
+           r.mean > 0.0 ? 100.0 * r.stddev / r.mean : 0.0, r.min);
+    fflush(stdout);
+
+    m_results.push_back(r);
+    return m_results.back();
+  }
+
+  const std::vector<BenchResult>& results() const { return m_results; }
+
+  // Write all results to a JSON file.  Returns false on error.
+  bool writeJSON(const char *filename) const
+  {
+    FILE *f = fopen(filename, "w");
+    if (f == NULL) {
+      fprintf(stderr, "%s: cannot write '%s'\n", m_name.c_str(), filename);
+      return false;
+    }
+
+    fprintf(f, "{\n  \"suite\": \"%s\",\n  \"time\": %ld,\n"
+            "  \"results\": [\n", m_name.c_str(), (long)time(NULL));
+
+    for (size_t i = 0; i < m_results.size(); ++i) {
+      const BenchResult& r = m_results[i];
+      fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, "
+              "\"stddev_ns\": %.3f, \"min_ns\": %.3f, \"median_ns\": %.3f, "
+              "\"iterations\": %llu, \"samples\": %d}%s\n",
+              r.name.c_str(), r.mean, r.stddev, r.min, r.median,
+              (unsigned long long)r.iterations, r.samples,
+              i + 1 < m_results.size() ? "," : "");
+    }
+
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return true;
+  }
+
+private:
+  std::string              m_name;
+  int                      m_samples;
+  double                   m_sampleSeconds;
+  std::vector<BenchResult> m_results;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_BENCH_H_INCLUDED
@@ -0,0 +1,336 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// ControlBench.cpp --- Round trip through the control socket.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Acts as an out-of-process controller on the control socket: each
+// step it sends one request with a setpoint for every quadcopter and
+// reads back their state.  For swarms of 1 to 1,000 quadcopters it
+// reports the time from sending a request to having the whole
+// reply, and the time the simulator thread spends answering it.  It
+// checks the replies against the scene, that setpoints move the
+// targets, that unknown quadcopters are reported as such and that a
+// malformed message closes the connection.  Results go to a JSON
+// file (default "control_bench.json", or the first argument).  Exits
+// with status 1 if any check fails.
+//
+
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Command.h"
+#include "ControlServer.h"
+#include "Profile.h"
+#include "Quadcopter.h"
+
+// Samples per scene size and round trips per sample.
+#define SAMPLES  15
+#define ROUNDS   20
+
+// Steps to wait for a reply before giving up.
+#define MAX_STEPS  1000
+
+// An object handle no quadcopter has.
+#define BAD_VEHICLE  999999
+
+static int connectTo(const char *path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static bool sendAll(int fd, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    p    += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool recvAll(int fd, void *data, size_t size)
+{
+  uint8_t *p = (uint8_t *)data;
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n <= 0)
+      return false;
+    p    += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Step the simulation until "fd" has something to read, letting the
+// server's I/O thread run in between.  Returns the number of steps,
+// or -1 if nothing arrived.
+static int stepUntilReadable(int fd)
+{
+  struct pollfd p = { fd, POLLIN, 0 };
+
+  for (int steps = 0; steps < MAX_STEPS; ) {
+    sched_yield();
+    stepScene();
+    ++steps;
+    if (poll(&p, 1, 1) == 1)
+      return steps;
+  }
+  return -1;
+}
+
+// A request, and room for its reply.
+struct Exchange
+{
+  std::vector<uint8_t> request;
+  std::vector<uint8_t> reply;
+  uint32_t             seq;
+
+  ControlCommand *commands()
+  {
+    return (ControlCommand *)&request[sizeof(ControlHeader)];
+  }
+
+  const ControlHeader& header() const
+  {
+    return *(const ControlHeader *)&reply[0];
+  }
+
+  const ControlStep& stepInfo() const
+  {
+    return *(const ControlStep *)&reply[sizeof(ControlHeader)];
+  }
+
+  const ControlState *states() const
+  {
+    return (const ControlState *)&reply[sizeof(ControlHeader) +
+                                        sizeof(ControlStep)];
+  }
+};
+
+// Size "x" for "n" commands.
+static void prepare(Exchange& x, size_t n)
+{
+  x.request.assign(sizeof(ControlHeader) + n * sizeof(ControlCommand), 0);
+  x.reply.assign(sizeof(ControlHeader) + sizeof(ControlStep) +
+                 n * sizeof(ControlState), 0);
+  x.seq = 0;
+
+  ControlHeader h;
+  h.length  = (uint32_t)x.request.size();
+  h.type    = CTRL_STEP;
+  h.version = CONTROL_VERSION;
+  h.seq     = 0;
+  h.count   = (uint32_t)n;
+  memcpy(&x.request[0], &h, sizeof(h));
+}
+
+// Send "x"'s request, step until the reply arrives and read it.
+// Returns the number of steps taken, or -1 on failure.
+static int roundTrip(int fd, Exchange& x)
+{
+  ControlHeader *h = (ControlHeader *)&x.request[0];
+  h->seq = ++x.seq;
+
+  if (!sendAll(fd, &x.request[0], x.request.size()))
+    return -1;
+
+  int steps = stepUntilReadable(fd);
+  if (steps < 0 || !recvAll(fd, &x.reply[0], x.reply.size()))
+    return -1;
+
+  return steps;
+}
+
+// The setpoint sent to a quadcopter.
+static void setpoint(ControlCommand& c, int obj, float x, float y)
+{
+  c.obj      = obj;
+  c.type     = CMD_SETPOINT;
+  c.mode     = 0;
+  c.value[0] = x;
+  c.value[1] = y;
+  c.value[2] = 2.0f;
+  c.value[3] = 0.0f;
+}
+
+// Check a round trip that sent setpoints to "models" and asked about
+// BAD_VEHICLE last.
+static bool checkReply(int fd, Exchange& x, const std::vector<int>& models)
+{
+  int    n     = (int)models.size();
+  size_t count = models.size() + 1;
+
+  prepare(x, count);
+  for (int i = 0; i < n; ++i)
+    setpoint(x.commands()[i], models[i], 10.0f * i, -3.0f);
+  x.commands()[n].obj  = BAD_VEHICLE;
+  x.commands()[n].type = 0;
+
+  if (roundTrip(fd, x) < 0)
+    return sceneFailed(n, "no reply");
+
+  const ControlHeader& h = x.header();
+  if (h.type != CTRL_STATE || h.version != CONTROL_VERSION ||
+      h.seq != x.seq || h.count != count || h.length != x.reply.size())
+    return sceneFailed(n, "malformed reply header");
+  if (x.stepInfo().step + 1 != Quadcopter::frame().step)
+    return sceneFailed(n, "reply not from the previous step");
+
+  for (int i = 0; i < n; ++i) {
+    const ControlState& s = x.states()[i];
+    if (s.obj != models[i] || s.status != (CTRL_FOUND | CTRL_QUEUED))
+      return sceneFailed(n, "quadcopter not found or command not queued");
+    if (memcmp(s.pose, g_mockScene.object(models[i] + 1).matrix,
+               sizeof(s.pose)) != 0)
+      return sceneFailed(n, "pose does not match the scene");
+  }
+
+  const ControlState& bad = x.states()[n];
+  if (bad.obj != BAD_VEHICLE || bad.status != 0)
+    return sceneFailed(n, "unknown quadcopter reported as found");
+
+  // The setpoints took effect in the step that answered.
+  for (int i = 0; i < n; ++i) {
+    const float *m = g_mockScene.object(models[i] + 2).matrix;
+    if (m[3] != 10.0f * i || m[7] != -3.0f || m[11] != 2.0f)
+      return sceneFailed(n, "setpoint did not move the target");
+  }
+
+  return true;
+}
+
+// Return true if the server closes the connection after a message
+// with the wrong version.
+static bool checkMalformed(const char *path, int n)
+{
+  int fd = connectTo(path);
+  if (fd < 0)
+    return sceneFailed(n, "could not connect");
+
+  ControlHeader h = { sizeof(ControlHeader), CTRL_STEP,
+                      CONTROL_VERSION + 1, 1, 0 };
+  bool ok = sendAll(fd, &h, sizeof(h));
+
+  struct pollfd p = { fd, POLLIN, 0 };
+  char c;
+  ok = ok && poll(&p, 1, 1000) == 1 && recv(fd, &c, 1, 0) == 0;
+  close(fd);
+
+  return ok || sceneFailed(n, "malformed message did not close the connection");
+}
+
+// Measure one scene size.  Returns false if a check failed.
+static bool runScene(BenchSuite& suite, const char *path, int n)
+{
+  g_mockScene.clear();
+  std::vector<int> models = g_mockScene.addGrid(n);
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+  stepScene();
+
+  int fd = connectTo(path);
+  Exchange x;
+  bool ok = fd >= 0 || sceneFailed(n, "could not connect");
+  ok = ok && checkReply(fd, x, models) && checkMalformed(path, n);
+
+  // Time round trips that send every quadcopter a setpoint.
+  prepare(x, models.size());
+  for (int i = 0; ok && i < n; ++i)
+    setpoint(x.commands()[i], models[i], 0.0f, 0.0f);
+
+  const TimeHistogram& ct = Profile::section(PROF_CONTROL);
+  uint64_t count0 = ct.count();
+  double   sum0   = ct.mean() * count0;
+  uint64_t steps  = 0;
+  std::vector<double> ns;
+
+  for (int s = 0; ok && s < SAMPLES; ++s) {
+    double t0 = benchNow();
+    for (int r = 0; ok && r < ROUNDS; ++r) {
+      int k = roundTrip(fd, x);
+      if (k < 0)
+        ok = sceneFailed(n, "no reply");
+      steps += k;
+    }
+    ns.push_back((benchNow() - t0) * 1e9 / ROUNDS);
+  }
+
+  double answerNs = Profile::toNanos(ct.mean() * ct.count() - sum0) /
+                    (ct.count() > count0 ? ct.count() - count0 : 1);
+
+  if (fd >= 0)
+    close(fd);
+  sendMessage(sim_message_eventcallback_moduleclose);
+
+  if (!ok)
+    return false;
+
+  char name[64];
+  snprintf(name, sizeof(name), "roundTrip/%d", n);
+  const BenchResult& r = suite.add(name, ns, ROUNDS);
+  printf("control_bench: %d quadcopters: %.1f us per round trip, "
+         "%.2f steps, answering %.1f ns per quadcopter\n",
+         n, r.mean / 1e3, (double)steps / (SAMPLES * ROUNDS), answerNs / n);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "control_bench.json";
+
+  if (out[0] != '/') {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+      out = std::string(cwd) + "/" + out;
+  }
+
+  // The socket is made in the plug-in's temporary directory.
+  const char *path = "control.sock";
+  setenv("QUADCOPTER_CONTROL_SOCKET", path, 1);
+
+  MockPlugin plugin("control_bench");
+
+  BenchSuite suite("control_bench", SAMPLES);
+  bool ok = true;
+  for (int n : g_sceneSizes) {
+    if (!runScene(suite, path, n)) {
+      ok = false;
+      break;
+    }
+  }
+
+  plugin.stop();
+
+  if (!suite.writeJSON(out.c_str()) || !ok)
+    return 1;
+
+  printf("control_bench: wrote %s\n", out.c_str());
+  return 0;
+}
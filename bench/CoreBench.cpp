@@ -0,0 +1,365 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// CoreBench.cpp --- Microbenchmarks of the plug-in's core kernels.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Times the small pieces of code run for every quadcopter on every
+// simulation step against a mock scene, so it runs without V-REP.
+// Results are printed as ns/op and written to a JSON file (default
+// "core_bench.json", or the first argument) for comparing releases.
+// Fails if a published state is ever read torn, a queued command is
+// lost or reordered, or the vector RL rewards differ from the scalar
+// ones.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+#include <GeographicLib/UTMUPS.hpp>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Command.h"
+#include "Container.h"
+#include "CustomData.h"
+#include "Noise.h"
+#include "PID.h"
+#include "Profile.h"
+#include "RlEnv.h"
+#include "SensorLog.h"
+#include "SeqLock.h"
+
+using GeographicLib::UTMUPS;
+
+// Quadcopters in the scene for the container benchmarks.
+#define VEHICLES 100
+
+// A container item matching quadcopter models, as "Quadcopter" does,
+// without constructing any sensors.
+class BenchItem
+{
+public:
+  explicit BenchItem(int obj)
+    : m_obj(obj), m_steps(0)
+  {
+  }
+
+  static bool query(int obj)
+  {
+    return hasCustomDataField(obj, FIELD_QUADCOPTER);
+  }
+
+  void step()
+  {
+    ++m_steps;
+  }
+
+private:
+  int      m_obj;
+  unsigned m_steps;
+};
+
+static void benchPID(BenchSuite& suite)
+{
+  PID pid(0.5f, 0.1f, 0.05f, -1.0f, 1.0f);
+  float input = 0.0f;
+
+  suite.run("PID::run", [&] {
+    input = pid.run(1.0f, input * 0.5f);
+    benchKeep(input);
+  });
+}
+
+static void benchCustomData(BenchSuite& suite)
+{
+  // A model object's custom data: the quadcopter field and a GPS
+  // configuration string.
+  std::vector<uint8_t> buf;
+  const char *gps = "zone=10N origin=525187,5040862,10 noise=0.1";
+  uint32_t header[4] = { FIELD_QUADCOPTER, 0, FIELD_GPS_CONFIG,
+                         (uint32_t)strlen(gps) };
+
+  for (uint32_t h : header) {
+    for (int i = 0; i < 4; ++i)
+      buf.push_back((uint8_t)(h >> (i * 8)));
+  }
+  buf.insert(buf.end(), gps, gps + strlen(gps));
+
+  suite.run("parseCustomData", [&] {
+    CustomData cd = parseCustomData(buf);
+    benchKeep(cd);
+  });
+}
+
+static void benchContainer(BenchSuite& suite)
+{
+  g_mockScene.clear();
+  for (int i = 0; i < VEHICLES; ++i)
+    g_mockScene.addQuadcopter(i * 2.0f, 0.0f, 1.0f);
+
+  GenericContainer<BenchItem> all;
+
+  suite.run("GenericContainer::rebuild/100", [&] {
+    all.rebuild();
+  });
+
+  int id = 0;
+  suite.run("GenericContainer::get", [&] {
+    std::shared_ptr<BenchItem> q = all.get(id);
+    benchKeep(q);
+    id = (id + 7) % g_mockScene.size();
+  });
+
+  suite.run("GenericContainer::call/100", [&] {
+    all.call(&BenchItem::step);
+  });
+}
+
+static void benchNoise(BenchSuite& suite)
+{
+  GaussianNoise noise(0.0, 0.01);
+
+  suite.run("GaussianNoise::get", [&] {
+    double x = noise.get();
+    benchKeep(x);
+  });
+}
+
+static void benchGPS(BenchSuite& suite)
+{
+  double x = 525187.0;
+
+  suite.run("UTMUPS::Reverse", [&] {
+    double lat, lon;
+    UTMUPS::Reverse(10, true, x, 5040862.0, lat, lon);
+    benchKeep(lat);
+    benchKeep(lon);
+    x += 0.01;
+  });
+}
+
+static void benchSensorLog(BenchSuite& suite)
+{
+  SensorLogLine l = {
+    1, 12.35f, 45.5231, -122.6765, 50.25,
+    { 0.01f, -0.02f, 9.81f }, { 0.001f, 0.002f, -0.003f },
+    1.5f, 101325.0f, { 0.2f, 0.05f, -0.4f },
+  };
+  char buf[SENSOR_LOG_LINE_MAX];
+
+  suite.run("formatSensorLogLine", [&] {
+    int n = formatSensorLogLine(buf, sizeof(buf), l);
+    benchKeep(n);
+    benchKeep(buf);
+    l.time += 0.05f;
+  });
+}
+
+// A published value the size of a quadcopter's state, every field of
+// which is stored with the same value.
+struct PublishedValue
+{
+  uint64_t step;
+  float    v[22];
+};
+
+// Time publishing and reading a value, then reading it while another
+// thread publishes continuously.  Returns false if a read was torn.
+static bool benchSeqLock(BenchSuite& suite)
+{
+  SeqLock<PublishedValue> lock;
+  PublishedValue value;
+  uint64_t torn = 0;
+
+  value.step = 0;
+  suite.run("SeqLock::store", [&] {
+    ++value.step;
+    for (float& x : value.v)
+      x = (float)value.step;
+    lock.store(value);
+  });
+
+  auto check = [&] {
+    PublishedValue p = lock.load();
+    for (float x : p.v) {
+      if (x != (float)p.step)
+        ++torn;
+    }
+    benchKeep(p);
+  };
+
+  suite.run("SeqLock::load", check);
+
+  std::atomic<bool> stop(false);
+  std::thread writer([&] {
+    PublishedValue w = value;
+    while (!stop.load(std::memory_order_relaxed)) {
+      ++w.step;
+      for (float& x : w.v)
+        x = (float)w.step;
+      lock.store(w);
+    }
+  });
+
+  suite.run("SeqLock::load/writer", check);
+  stop = true;
+  writer.join();
+
+  if (torn > 0)
+    fprintf(stderr, "core_bench: %llu torn SeqLock reads\n",
+            (unsigned long long)torn);
+  return torn == 0;
+}
+
+// Producer threads for the command queue check.
+#define COMMAND_PRODUCERS 4
+
+// Time sending and applying one command, then check that commands
+// from several producer threads all arrive, each producer's in order.
+// Returns false if one was lost or reordered.
+static bool benchCommandQueue(BenchSuite& suite)
+{
+  CommandQueue q;
+  Command cmd;
+  Command out;
+
+  q.init();
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = CMD_SETPOINT;
+
+  suite.run("CommandQueue::push+pop", [&] {
+    cmd.issued = commandNow();
+    q.push(cmd);
+    q.pop(out);
+    benchKeep(out);
+  });
+
+  const uint32_t perProducer = 100000;
+  uint32_t next[COMMAND_PRODUCERS] = {};
+  std::vector<std::thread> producers;
+  bool ok = true;
+
+  for (uint32_t p = 0; p < COMMAND_PRODUCERS; ++p) {
+    producers.emplace_back([&q, p, perProducer] {
+      Command c;
+      memset(&c, 0, sizeof(c));
+      c.mode = p;
+      for (uint32_t i = 0; i < perProducer; ++i) {
+        c.issued = i;
+        while (!q.push(c))
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  for (uint32_t got = 0; got < COMMAND_PRODUCERS * perProducer; ) {
+    if (!q.pop(out)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (out.mode >= COMMAND_PRODUCERS || out.issued != next[out.mode]) {
+      ok = false;
+    } else {
+      ++next[out.mode];
+    }
+    ++got;
+  }
+
+  for (std::thread& t : producers)
+    t.join();
+
+  if (!ok)
+    fprintf(stderr, "core_bench: commands lost or out of order\n");
+  return ok;
+}
+
+// Quadcopters scored per batch by the RL reward benchmark.  Not a
+// multiple of four, so the scalar tail runs too.
+#define RL_VEHICLES 1003
+
+// Time scoring a swarm's RL rewards, then check that the vector code
+// agrees exactly with scoring each quadcopter alone, which takes the
+// scalar path.  Returns false if they differ.
+static bool benchRlReward(BenchSuite& suite)
+{
+  std::vector<float> axes[7];
+  std::vector<uint32_t> steps(RL_VEHICLES);
+  GaussianNoise noise(0.0, 8.0);
+
+  for (auto& a : axes) {
+    a.resize(RL_VEHICLES);
+    for (float& x : a)
+      x = (float)noise.get();
+  }
+
+  // Some quadcopters upright, some tipped over, some upside down.
+  for (size_t i = 0; i < RL_VEHICLES; ++i) {
+    axes[3][i] = cosf(axes[3][i] * 0.2f);
+    steps[i]   = (uint32_t)i;
+  }
+
+  RlRewardInputs in = {
+    { axes[0].data(), axes[1].data(), axes[2].data() }, axes[3].data(),
+    { axes[4].data(), axes[5].data(), axes[6].data() }, steps.data()
+  };
+  std::vector<float>   rewards(RL_VEHICLES), one(RL_VEHICLES);
+  std::vector<uint8_t> dones(RL_VEHICLES), oneDone(RL_VEHICLES);
+
+  suite.run("rlRewardBatch/1003", [&] {
+    rlRewardBatch(in, rewards.data(), dones.data(), RL_VEHICLES, 500);
+    benchKeep(rewards[0]);
+  });
+
+  for (size_t i = 0; i < RL_VEHICLES; ++i) {
+    RlRewardInputs a = {
+      { &axes[0][i], &axes[1][i], &axes[2][i] }, &axes[3][i],
+      { &axes[4][i], &axes[5][i], &axes[6][i] }, &steps[i]
+    };
+    rlRewardBatch(a, &one[i], &oneDone[i], 1, 500);
+  }
+
+  if (memcmp(rewards.data(), one.data(), RL_VEHICLES * sizeof(float)) != 0 ||
+      dones != oneDone) {
+    fprintf(stderr, "core_bench: vector and scalar RL rewards differ\n");
+    return false;
+  }
+  return true;
+}
+
+static void benchProfileScope(BenchSuite& suite)
+{
+  suite.run("PROFILE_SCOPE", [&] {
+    PROFILE_SCOPE(PROF_PID_CONTROL);
+  });
+}
+
+int main(int argc, char **argv)
+{
+  const char *out = argc > 1 ? argv[1] : "core_bench.json";
+
+  installSimStubs();
+  Profile::init();
+
+  BenchSuite suite("core_bench");
+  benchPID(suite);
+  benchCustomData(suite);
+  benchContainer(suite);
+  benchNoise(suite);
+  benchGPS(suite);
+  benchSensorLog(suite);
+  benchProfileScope(suite);
+  bool ok = benchSeqLock(suite);
+  ok = benchCommandQueue(suite) && ok;
+  ok = benchRlReward(suite) && ok;
+
+  if (!suite.writeJSON(out) || !ok)
+    return 1;
+
+  printf("core_bench: wrote %s\n", out);
+  return 0;
+}
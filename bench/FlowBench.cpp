@@ -0,0 +1,213 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// FlowBench.cpp --- Optical flow matching benchmark.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Matches frames cut from a random texture at known whole, half and
+// fractional pixel offsets, checks the recovered flow against an
+// error tolerance, and reports frames per second per core for the
+// matcher alone and per thread of CPU time for the background
+// processor.  Exits with status 1 if the flow is out of tolerance.
+// Runs without V-REP.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "SimFlow.h"
+
+#define TEXTURE     512
+#define CAMERA_RES  128
+#define FRAMES      20000
+#define SENSORS     64
+
+// Largest mean and single-axis flow errors accepted (binned pixels).
+#define MAX_MEAN_ERROR  0.05
+#define MAX_ERROR       0.1
+
+static double nowSec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A blotchy random texture, smoothed so blocks have structure at a
+// few pixels scale.
+static std::vector<float> makeTexture()
+{
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<float> u(0.0f, 1.0f);
+  std::vector<float> raw(TEXTURE * TEXTURE), tex(TEXTURE * TEXTURE);
+
+  for (auto& v : raw)
+    v = u(gen);
+
+  for (int y = 0; y < TEXTURE; ++y) {
+    for (int x = 0; x < TEXTURE; ++x) {
+      float sum = 0.0f;
+      for (int k = -2; k <= 2; ++k)
+        sum += raw[y * TEXTURE + (x + k + TEXTURE) % TEXTURE] +
+               raw[((y + k + TEXTURE) % TEXTURE) * TEXTURE + x];
+      tex[y * TEXTURE + x] = sum / 10.0f;
+    }
+  }
+
+  return tex;
+}
+
+// Cut a CAMERA_RES square RGB image out of the texture at (ox, oy),
+// interpolating between texels for fractional offsets.
+static void cameraImage(const std::vector<float>& tex, float ox, float oy,
+                        std::vector<float>& rgb)
+{
+  rgb.resize(CAMERA_RES * CAMERA_RES * 3);
+
+  int   ix = (int)floorf(ox), iy = (int)floorf(oy);
+  float fx = ox - ix, fy = oy - iy;
+
+  auto texel = [&](int x, int y) {
+    return tex[((y % TEXTURE + TEXTURE) % TEXTURE) * TEXTURE +
+               (x % TEXTURE + TEXTURE) % TEXTURE];
+  };
+
+  for (int y = 0; y < CAMERA_RES; ++y) {
+    for (int x = 0; x < CAMERA_RES; ++x) {
+      int   tx = ix + x, ty = iy + y;
+      float v  = (1.0f - fy) * ((1.0f - fx) * texel(tx, ty) +
+                                fx * texel(tx + 1, ty)) +
+                 fy * ((1.0f - fx) * texel(tx, ty + 1) +
+                       fx * texel(tx + 1, ty + 1));
+      float *p = &rgb[(y * CAMERA_RES + x) * 3];
+      p[0] = p[1] = p[2] = v;
+    }
+  }
+}
+
+// Match frames before and after a camera shift of (sx, sy) camera
+// pixels, returning the absolute error of the recovered flow in each
+// axis.  A shift of 2 camera pixels is 1 pixel after binning, and
+// moving the camera by +s moves the image content by -s.
+static void flowError(const std::vector<float>& tex, float sx, float sy,
+                      float *ex, float *ey)
+{
+  std::vector<float> rgb;
+  std::vector<uint8_t> a(FLOW_RES * FLOW_RES), b(FLOW_RES * FLOW_RES);
+
+  cameraImage(tex, 100.0f, 100.0f, rgb);
+  downsampleFlowFrame(&rgb[0], CAMERA_RES, CAMERA_RES, &a[0]);
+  cameraImage(tex, 100.0f + sx, 100.0f + sy, rgb);
+  downsampleFlowFrame(&rgb[0], CAMERA_RES, CAMERA_RES, &b[0]);
+
+  FlowResult r = computeOpticalFlow(&a[0], &b[0]);
+  *ex = fabsf(r.flowX + sx / 2.0f);
+  *ey = fabsf(r.flowY + sy / 2.0f);
+}
+
+// Check the flow for whole, odd (half pixel after binning) and
+// fractional camera shifts, printing the mean and worst error of each
+// kind.  Returns false if any is over tolerance.
+static bool checkAccuracy(const std::vector<float>& tex)
+{
+  static const struct
+  {
+    const char *name;
+    float       first;
+    float       step;
+  } kinds[] = {
+    { "even",       -6.0f, 2.0f  },
+    { "odd",        -5.0f, 2.0f  },
+    { "fractional", -5.7f, 1.35f },
+  };
+  bool ok = true;
+
+  for (const auto& k : kinds) {
+    double sum = 0.0, worst = 0.0;
+    int    checks = 0;
+
+    for (float sy = k.first; sy <= 6.0f; sy += k.step) {
+      for (float sx = k.first; sx <= 6.0f; sx += k.step) {
+        float ex, ey;
+        flowError(tex, sx, sy, &ex, &ey);
+        sum  += ex + ey;
+        worst = std::max(worst, (double)std::max(ex, ey));
+        ++checks;
+      }
+    }
+
+    double mean = sum / (2 * checks);
+    bool   pass = mean <= MAX_MEAN_ERROR && worst <= MAX_ERROR;
+    printf("flow: %-10s shifts: mean abs error %.3f px, worst %.3f px "
+           "over %d shifts%s\n", k.name, mean, worst, checks,
+           pass ? "" : "  FAILED");
+    ok &= pass;
+  }
+
+  return ok;
+}
+
+int main()
+{
+  std::vector<float> tex = makeTexture();
+  std::vector<float> rgb;
+  std::vector<uint8_t> a(FLOW_RES * FLOW_RES), b(FLOW_RES * FLOW_RES);
+
+  bool ok = checkAccuracy(tex);
+
+  // Frames one binned pixel apart for the throughput runs.
+  cameraImage(tex, 100.0f, 100.0f, rgb);
+  downsampleFlowFrame(&rgb[0], CAMERA_RES, CAMERA_RES, &a[0]);
+  cameraImage(tex, 102.0f, 100.0f, rgb);
+  downsampleFlowFrame(&rgb[0], CAMERA_RES, CAMERA_RES, &b[0]);
+
+  // Matcher throughput on one core.
+  double t0 = nowSec();
+  volatile float sink = 0.0f;
+  for (int i = 0; i < FRAMES; ++i) {
+    FlowResult r = computeOpticalFlow(i & 1 ? &a[0] : &b[0],
+                                      i & 1 ? &b[0] : &a[0]);
+    sink = sink + r.flowX;
+  }
+  double match = nowSec() - t0;
+
+  t0 = nowSec();
+  for (int i = 0; i < FRAMES / 10; ++i)
+    downsampleFlowFrame(&rgb[0], CAMERA_RES, CAMERA_RES, &a[0]);
+  double reduce = nowSec() - t0;
+
+  printf("flow: match     %9.0f frames/s/core (%.2f us/frame)\n",
+         FRAMES / match, match * 1e6 / FRAMES);
+  printf("flow: downsample %8.0f frames/s (%dx%d RGB, %.2f us/frame)\n",
+         FRAMES / 10 / reduce, CAMERA_RES, CAMERA_RES,
+         reduce * 1e6 / (FRAMES / 10));
+
+  // Background processing of many sensors, as in the plug-in.
+  FlowProcessor processor(1);
+  std::vector<std::shared_ptr<OpticalFlowSensor>> sensors;
+  for (int i = 0; i < SENSORS; ++i)
+    sensors.push_back(std::make_shared<OpticalFlowSensor>());
+
+  t0 = nowSec();
+  for (int step = 0; step < FRAMES / SENSORS; ++step) {
+    cameraImage(tex, step * 2.0f, (float)step, rgb);
+    for (auto& s : sensors)
+      if (s->submit(&rgb[0], CAMERA_RES, CAMERA_RES, step * 0.01f))
+        processor.submit(s);
+  }
+  double submit = nowSec() - t0;
+
+  printf("flow: processor %9.0f frames/s/thread CPU, submit %.2f us/frame\n",
+         processor.framesPerSecondPerThread(),
+         submit * 1e6 / (FRAMES / SENSORS * SENSORS));
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,509 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// LuaBench.cpp --- Overhead of the plug-in's Lua functions.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Calls every Lua function the plug-in registers with synthetic call
+// frames, built from the argument types it registered, on three paths:
+//
+// - "ok":        valid arguments for a quadcopter in the scene,
+// - "noVehicle": a quadcopter ID that is not in the scene,
+// - "noArgs":    no arguments at all.
+//
+// For each it reports the time per call and the heap allocations and
+// "simCreateBuffer" calls made per call, and checks that the function
+// raised an error exactly when it should have, returned well-formed
+// outputs and did not leak buffers.  New entry points are covered as
+// soon as they are registered; an argument named "quadcopterID" in the
+// calling syntax is taken to be a quadcopter handle, and one named
+// "quadcopterIDs" a table of them.
+//
+// It then runs steady-state control steps of a small swarm and checks
+// that they make no heap allocations at all.  The swarm is then grown
+// between two steps: the steps that follow must be seen growing the
+// frame scratch space, and then settle back to no allocations.
+// Allocations, aligned ones included, are counted by the hooks in
+// "AllocStats.cpp", which this program is linked with.
+//
+// Results are written to a JSON file (default "lua_bench.json", or
+// the first argument).  Exits with status 1 if any check fails.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "AllocStats.h"
+#include "Quadcopter.h"
+
+// A handle that is not in the scene.
+#define BAD_VEHICLE    999999
+
+// Calls made to count allocations.
+#define COUNT_CALLS    1000
+
+// Steady-state steps checked for allocations, after warming up.
+#define STEP_VEHICLES  8
+#define GROWN_VEHICLES 256
+#define WARMUP_STEPS   10
+#define CHECK_STEPS    100
+
+enum LuaPath
+{
+  PATH_OK,
+  PATH_NO_VEHICLE,
+  PATH_NO_ARGS,
+  PATH_COUNT
+};
+
+static const char *g_path_names[PATH_COUNT] = {
+  "ok",
+  "noVehicle",
+  "noArgs",
+};
+
+// String arguments for functions that do not accept the empty string.
+static const struct
+{
+  const char *function;
+  const char *value;
+} g_string_args[] = {
+  { "simExtQuadcopterGetTiming", "pidControl" },
+};
+
+// Integer arguments other than the quadcopter for functions that do
+// not accept the default.
+static const struct
+{
+  const char *function;
+  int         value;
+} g_int_args[] = {
+  { "simExtQuadcopterSendCommand", CMD_SETPOINT },
+};
+
+// Sizes of float table arguments for functions that do not accept
+// three values.
+static const struct
+{
+  const char *function;
+  int         size;
+} g_table_sizes[] = {
+  { "simExtQuadcopterResetEpisodes", 4 },
+};
+
+// Results of one function on one path.
+struct LuaResult
+{
+  std::string name;
+  double      ns;
+  double      allocs;           // per call
+  double      buffers;          // per call
+  bool        error;            // set an error
+  const char *failure;          // NULL if the checks passed
+};
+
+// Return the names of the arguments in a calling syntax such as
+// "number r=f(number quadcopterID, table_3 data)".
+static std::vector<std::string> argNames(const std::string& tip)
+{
+  std::vector<std::string> names;
+  size_t pos = tip.find('(');
+
+  while (pos != std::string::npos && pos + 1 < tip.size()) {
+    size_t end = tip.find_first_of(",)", pos + 1);
+    std::string arg = tip.substr(pos + 1, end - pos - 1);
+
+    size_t eq = arg.find('=');
+    if (eq != std::string::npos)
+      arg.erase(eq);
+    size_t last = arg.find_last_not_of(' ');
+    size_t first = arg.find_last_of(' ', last);
+    if (last != std::string::npos)
+      names.push_back(arg.substr(first + 1, last - first));
+
+    pos = (end != std::string::npos && tip[end] == ',') ? end : std::string::npos;
+  }
+
+  return names;
+}
+
+static int intArg(const std::string& function)
+{
+  for (const auto& a : g_int_args) {
+    if (function == a.function)
+      return a.value;
+  }
+  return 4;
+}
+
+static int tableSize(const std::string& function)
+{
+  for (const auto& t : g_table_sizes) {
+    if (function == t.function)
+      return t.size;
+  }
+  return 3;
+}
+
+static const char *stringArg(const std::string& function)
+{
+  for (const auto& s : g_string_args) {
+    if (function == s.function)
+      return s.value;
+  }
+  return "";
+}
+
+// Fill "call" with arguments for "f" on a path.  Returns false if the
+// path does not apply to the function.
+static bool buildFrame(MockLuaCall& call, const MockLuaFunction& f,
+                       LuaPath path, int vehicle)
+{
+  static const float table[4] = { 45.5f, -122.6f, 10.0f, 0.0f };
+  std::vector<std::string> names = argNames(f.tip);
+  bool hasVehicle = false;
+
+  call.clear();
+  if (path == PATH_NO_ARGS)
+    return !f.args.empty();
+
+  for (size_t i = 0; i < f.args.size(); ++i) {
+    bool isVehicle  = i < names.size() && names[i] == "quadcopterID";
+    bool isVehicles = i < names.size() && names[i] == "quadcopterIDs";
+    int  id = path == PATH_NO_VEHICLE ? BAD_VEHICLE : vehicle;
+
+    switch (f.args[i]) {
+    case sim_lua_arg_int:
+      if (isVehicle) {
+        call.addInt(id);
+        hasVehicle = true;
+      } else {
+        call.addInt(intArg(f.name));
+      }
+      break;
+    case sim_lua_arg_int | sim_lua_arg_table:
+      if (isVehicles) {
+        call.addIntTable(&id, 1);
+        hasVehicle = true;
+      } else {
+        int x = intArg(f.name);
+        call.addIntTable(&x, 1);
+      }
+      break;
+    case sim_lua_arg_float:
+      call.addFloat(10.0f);
+      break;
+    case sim_lua_arg_float | sim_lua_arg_table:
+      call.addFloatTable(table, tableSize(f.name));
+      break;
+    case sim_lua_arg_string:
+      call.addString(stringArg(f.name));
+      break;
+    case sim_lua_arg_charbuff: {
+      // The only buffer argument is a snapshot; take one of the scene.
+      std::vector<uint8_t> snapshot;
+      Quadcopter::snapshot(snapshot);
+      call.addCharBuff(snapshot.data(), (int)snapshot.size());
+      break;
+    }
+    default:
+      fprintf(stderr, "lua_bench: %s: unsupported argument type %d\n",
+              f.name.c_str(), f.args[i]);
+      return false;
+    }
+  }
+
+  return path == PATH_OK || hasVehicle;
+}
+
+// Check the outputs of a call against the buffers they were returned
+// in.  Returns NULL if they are well formed.
+static const char *checkOutput(const SLuaCallBack& p)
+{
+  size_t ints = 0, floats = 0, bools = 0, strings = 0, chars = 0;
+
+  if (p.outputArgCount < 0)
+    return "negative output count";
+  if (p.outputArgCount == 0)
+    return NULL;
+
+  if (p.outputArgTypeAndSize == NULL ||
+      mockBufferSize(p.outputArgTypeAndSize) <
+        2 * p.outputArgCount * sizeof(simInt))
+    return "output types buffer too small";
+
+  for (int i = 0; i < p.outputArgCount; ++i) {
+    int type = p.outputArgTypeAndSize[i * 2];
+    int size = p.outputArgTypeAndSize[i * 2 + 1];
+    size_t n = (type & sim_lua_arg_table) ? (size_t)size : 1;
+
+    if ((type & sim_lua_arg_table) && size < 0)
+      return "negative table size";
+
+    switch (type & ~sim_lua_arg_table) {
+    case sim_lua_arg_nil:      break;
+    case sim_lua_arg_bool:     bools   += n; break;
+    case sim_lua_arg_int:      ints    += n; break;
+    case sim_lua_arg_float:    floats  += n; break;
+    case sim_lua_arg_string:   strings += n; break;
+    case sim_lua_arg_charbuff: chars   += size; break;
+    default:                   return "unknown output type";
+    }
+  }
+
+  if (ints > 0 && (p.outputInt == NULL ||
+                   mockBufferSize(p.outputInt) < ints * sizeof(simInt)))
+    return "int output buffer too small";
+  if (floats > 0 && (p.outputFloat == NULL ||
+                     mockBufferSize(p.outputFloat) < floats * sizeof(simFloat)))
+    return "float output buffer too small";
+  if (bools > 0 && (p.outputBool == NULL ||
+                    mockBufferSize(p.outputBool) < bools * sizeof(simBool)))
+    return "bool output buffer too small";
+  if (chars > 0 && (p.outputCharBuff == NULL ||
+                    mockBufferSize(p.outputCharBuff) < chars))
+    return "char buffer output too small";
+
+  if (strings > 0) {
+    if (p.outputChar == NULL)
+      return "missing string output buffer";
+
+    size_t size = mockBufferSize(p.outputChar), found = 0;
+    for (size_t i = 0; i < size && found < strings; ++i) {
+      if (p.outputChar[i] == '\0')
+        ++found;
+    }
+    if (found < strings)
+      return "string output buffer too small";
+  }
+
+  return NULL;
+}
+
+static bool runFunction(BenchSuite& suite, const MockLuaFunction& f,
+                        LuaPath path, int vehicle,
+                        std::vector<LuaResult>& results)
+{
+  MockLuaCall call;
+
+  if (!buildFrame(call, f, path, vehicle))
+    return true;
+
+  LuaResult r;
+  r.name    = f.name + "/" + g_path_names[path];
+  r.failure = NULL;
+
+  // Check one call.
+  int errors = g_mockScene.errors;
+  call.call(f.callback);
+  r.error   = g_mockScene.errors != errors;
+  r.failure = checkOutput(call.frame());
+  call.releaseOutput();
+
+  if (r.failure == NULL && path == PATH_OK && r.error)
+    r.failure = "error on valid arguments";
+  if (r.failure == NULL && g_mockScene.liveBuffers != 0)
+    r.failure = "output buffers leaked";
+
+  // Count allocations over a batch of calls.
+  uint64_t allocs  = AllocStats::total().calls;
+  uint64_t buffers = g_mockScene.buffersCreated;
+  for (int i = 0; i < COUNT_CALLS; ++i)
+    call.call(f.callback);
+  r.allocs  = (double)(AllocStats::total().calls - allocs) / COUNT_CALLS;
+  r.buffers = (double)(g_mockScene.buffersCreated - buffers) / COUNT_CALLS;
+
+  r.ns = suite.run(r.name.c_str(), [&] { call.call(f.callback); }).mean;
+  call.releaseOutput();
+
+  results.push_back(r);
+  return r.failure == NULL;
+}
+
+// Print the allocations of the control steps checked, and each
+// section that allocated.  Returns true if there were none.
+static bool reportStepAllocations(const char *what, int vehicles)
+{
+  // Copied before printing, which may allocate.
+  AllocCounter total = AllocStats::total();
+  AllocCounter sections[PROF_SECTION_COUNT + 1];
+  for (int i = 0; i <= PROF_SECTION_COUNT; ++i)
+    sections[i] = AllocStats::section((ProfileSection)i);
+
+  printf("\n%s, %d quadcopters, %d steps: %llu allocations, %llu bytes\n",
+         what, vehicles, CHECK_STEPS, (unsigned long long)total.calls,
+         (unsigned long long)total.bytes);
+
+  for (int i = 0; i <= PROF_SECTION_COUNT; ++i) {
+    const AllocCounter& c = sections[i];
+    if (c.calls > 0) {
+      printf("  FAILED: %s: %llu allocations, %llu bytes\n",
+             AllocStats::sectionName((ProfileSection)i),
+             (unsigned long long)c.calls, (unsigned long long)c.bytes);
+    }
+  }
+
+  return total.calls == 0;
+}
+
+// Check that aligned blocks, which the arenas and the frame scratch
+// space are made of, are counted like any other allocation.
+static bool checkAlignedAllocations()
+{
+  // Volatile so the compiler cannot drop the unused blocks.
+  void *volatile a = NULL;
+  void *volatile b = NULL;
+
+  AllocStats::reset();
+  void *p = NULL;
+  if (posix_memalign(&p, 64, 4096) == 0)
+    a = p;
+  b = aligned_alloc(64, 4096);
+  AllocCounter total = AllocStats::total();
+  free(a);
+  free(b);
+
+  printf("\naligned allocations: %llu counted, %llu bytes\n",
+         (unsigned long long)total.calls, (unsigned long long)total.bytes);
+  if (total.calls != 2 || total.bytes != 2 * 4096) {
+    printf("  FAILED: expected 2 allocations, 8192 bytes\n");
+    return false;
+  }
+  return true;
+}
+
+// Run steady-state control steps of a small swarm, each the step
+// message followed by every quadcopter's script calls, and check that
+// the plug-in makes no heap allocations.  Then grow the swarm between
+// steps and check that the growth of the frame scratch space is
+// counted and that the steps settle back to none.  Prints the
+// sections that did allocate and returns false otherwise.
+static bool checkStepAllocations()
+{
+  static const float a[3] = { 0.0f, 0.0f, 9.81f };
+  static const float g[3] = { 0.0f, 0.0f, 0.0f };
+
+  MockLuaCallback setAccel =
+    g_mockScene.luaFunction("simExtQuadcopterSetAccelData");
+  MockLuaCallback setGyro =
+    g_mockScene.luaFunction("simExtQuadcopterSetGyroData");
+  MockLuaCallback readSensors =
+    g_mockScene.luaFunction("simExtQuadcopterReadSensors");
+  MockLuaCallback getMotors =
+    g_mockScene.luaFunction("simExtQuadcopterGetMotorVelocities");
+
+  std::vector<int> models;
+  for (int i = 0; i < STEP_VEHICLES; ++i)
+    models.push_back(g_mockScene.addQuadcopter(i * 5.0f, 10.0f, 1.0f));
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  MockLuaCall accel, gyro, id;
+  auto step = [&] {
+    stepScene();
+
+    for (int obj : models) {
+      accel.clear().addInt(obj).addFloatTable(a, 3);
+      accel.call(setAccel);
+      gyro.clear().addInt(obj).addFloatTable(g, 3);
+      gyro.call(setGyro);
+      id.clear().addInt(obj);
+      id.call(readSensors);
+      id.call(getMotors);
+    }
+  };
+
+  for (int i = 0; i < WARMUP_STEPS; ++i)
+    step();
+
+  AllocStats::reset();
+  for (int i = 0; i < CHECK_STEPS; ++i)
+    step();
+  bool ok = reportStepAllocations("steady-state step", STEP_VEHICLES);
+
+  // Quadcopters added during the simulation.  The rebuild may
+  // allocate; the step after it has to grow the scratch space for
+  // the sensor batch, which takes aligned blocks.
+  for (int i = STEP_VEHICLES; i < GROWN_VEHICLES; ++i)
+    models.push_back(g_mockScene.addQuadcopter(i * 5.0f, 10.0f, 1.0f));
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+
+  AllocStats::reset();
+  step();
+  AllocCounter grown = AllocStats::section(PROF_SENSOR_BATCH);
+  printf("\nfirst step after growing to %d quadcopters: %llu allocations, "
+         "%llu bytes in %s\n", GROWN_VEHICLES,
+         (unsigned long long)grown.calls, (unsigned long long)grown.bytes,
+         AllocStats::sectionName(PROF_SENSOR_BATCH));
+  if (grown.calls == 0) {
+    printf("  FAILED: growing the frame scratch space was not counted\n");
+    ok = false;
+  }
+
+  for (int i = 0; i < WARMUP_STEPS; ++i)
+    step();
+
+  AllocStats::reset();
+  for (int i = 0; i < CHECK_STEPS; ++i)
+    step();
+  ok &= reportStepAllocations("step after growing", GROWN_VEHICLES);
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "lua_bench.json";
+  char cwd[4096];
+
+  if (out[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+    out = std::string(cwd) + "/" + out;
+
+  MockPlugin plugin("lua_bench");
+  AllocStats::trackThread();
+
+  int vehicle = g_mockScene.addQuadcopter(0.0f, 0.0f, 1.0f);
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  BenchSuite suite("lua_bench", 7, 0.01);
+  std::vector<LuaResult> results;
+  bool ok = true;
+
+  for (const auto& e : g_mockScene.luaFunctions) {
+    for (int path = 0; path < PATH_COUNT; ++path)
+      ok &= runFunction(suite, e.second, (LuaPath)path, vehicle, results);
+  }
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+  ok &= checkAlignedAllocations();
+  ok &= checkStepAllocations();
+
+  plugin.stop();
+
+  printf("\n%-48s %9s %7s %8s %6s\n", "function/path", "ns/call",
+         "allocs", "buffers", "error");
+  for (const LuaResult& r : results) {
+    printf("%-48s %9.1f %7.2f %8.2f %6s", r.name.c_str(), r.ns, r.allocs,
+           r.buffers, r.error ? "yes" : "no");
+    if (r.failure != NULL)
+      printf("  FAILED: %s", r.failure);
+    printf("\n");
+  }
+
+  if (!suite.writeJSON(out.c_str()))
+    return 1;
+
+  printf("lua_bench: wrote %s\n", out.c_str());
+  return ok ? 0 : 1;
+}
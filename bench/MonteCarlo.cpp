@@ -0,0 +1,426 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// MonteCarlo.cpp --- Robustness runs of the controller over many seeds.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Flies the plug-in's controller ("FlightControl.h") against the
+// standalone model in "QuadModel.h" along a fixed mission, once per
+// seed, on every core.  Each seed draws its own disturbances: mass
+// and motor thrust errors, a starting tilt and offset, a steady wind
+// and gusts.  A run depends only on its seed, so any run can be
+// replayed exactly with "-s SEED -n 1", optionally writing its
+// trajectory with "-t".
+//
+//   monte_carlo [-n RUNS] [-s FIRST_SEED] [-j THREADS]
+//               [-o REPORT.json] [-r RUNS.csv] [-t TRACE.csv]
+//
+// Each run reports the RMS distance from the target, the largest tilt
+// and whether it crashed: hit the ground, tipped past CRASH_TILT or
+// diverged.  The per-run results go to a CSV file (default
+// "monte_carlo_runs.csv") and their summary to a JSON report (default
+// "monte_carlo.json").  Exits with status 1 on error.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "bench/QuadModel.h"
+#include "FlightControl.h"
+#include "Frame.h"
+#include "Noise.h"
+#include "WorkerPool.h"
+
+// Control step, as in the V-REP scene, and model steps per control
+// step.
+#define CONTROL_DT  0.05f
+#define SUBSTEPS    10
+
+// Target speed and turn rate between waypoints.
+#define TARGET_SPEED     0.5f   // m/s
+#define TARGET_YAW_RATE  0.3f   // rad/s
+
+// Tilt beyond which a run counts as crashed.
+#define CRASH_TILT  (80.0f * (float)M_PI / 180.0f)
+
+// Standard deviations of the disturbances drawn for each seed.
+#define MASS_ERROR      0.05f   // fraction
+#define THRUST_ERROR    0.03f   // fraction, per motor
+#define START_TILT      0.05f   // rad
+#define START_OFFSET    0.1f    // m
+#define WIND_MEAN       0.5f    // m/s, horizontal
+#define WIND_GUST       0.3f    // m/s
+#define GUST_TIME       2.0f    // s, correlation time of gusts
+
+// Number of crashed and worst seeds listed in the report.
+#define REPORT_SEEDS  20
+
+// A point of the mission: the target's pose (x, y, z, yaw) and how
+// long it is held once reached (s).
+struct Waypoint
+{
+  float pose[4];
+  float hold;
+};
+
+static const Waypoint g_mission[] = {
+  { { 0.0f, 0.0f, 1.0f, 0.0f },              5.0f },
+  { { 4.0f, 0.0f, 1.5f, 0.0f },              3.0f },
+  { { 4.0f, 4.0f, 1.5f, (float)M_PI / 2.0f }, 3.0f },
+  { { 0.0f, 4.0f, 1.0f, (float)M_PI / 2.0f }, 3.0f },
+  { { 0.0f, 0.0f, 1.0f, 0.0f },              5.0f },
+};
+
+#define MISSION_POINTS  (sizeof(g_mission) / sizeof(g_mission[0]))
+
+// Outcome of one run.
+struct RunResult
+{
+  uint64_t seed;
+  float    rmsError;            // m
+  float    maxTilt;             // rad
+  bool     crashed;
+  float    crashTime;           // s, or -1
+};
+
+// Moves the target along the mission at a steady speed and turn rate.
+class MissionTarget
+{
+public:
+  MissionTarget() : m_next(1), m_holding(g_mission[0].hold)
+  {
+    memcpy(m_pose, g_mission[0].pose, sizeof(m_pose));
+  }
+
+  const float *pose() const { return m_pose; }
+
+  // Return false once the mission is over.
+  bool done() const { return m_next >= MISSION_POINTS && m_holding <= 0.0f; }
+
+  void advance(float dt)
+  {
+    if (m_holding > 0.0f) {
+      m_holding -= dt;
+      return;
+    }
+    if (m_next >= MISSION_POINTS)
+      return;
+
+    const float *goal = g_mission[m_next].pose;
+    float d[3], dist = 0.0f;
+    for (int k = 0; k < 3; ++k) {
+      d[k]  = goal[k] - m_pose[k];
+      dist += d[k] * d[k];
+    }
+    dist = sqrtf(dist);
+
+    float step = TARGET_SPEED * dt, turn = TARGET_YAW_RATE * dt;
+    float dyaw = goal[3] - m_pose[3];
+    bool  there = dist <= step && fabsf(dyaw) <= turn;
+
+    for (int k = 0; k < 3; ++k)
+      m_pose[k] = dist <= step ? goal[k] : m_pose[k] + d[k] * step / dist;
+    m_pose[3] = fabsf(dyaw) <= turn ? goal[3]
+                                    : m_pose[3] + (dyaw > 0 ? turn : -turn);
+
+    if (there)
+      m_holding = g_mission[m_next++].hold;
+  }
+
+private:
+  float  m_pose[4];
+  size_t m_next;
+  float  m_holding;
+};
+
+// Fly the mission with the disturbances of "seed".  If "trace" is not
+// NULL, write the trajectory there.
+static RunResult runSeed(uint64_t seed, FILE *trace)
+{
+  // Every disturbance has its own stream of draws from the seed.
+  GaussianNoise draw(0.0, 1.0);
+  draw.seed(frameKey(seed, 0));
+
+  QuadParams params;
+  params.mass *= 1.0f + MASS_ERROR * (float)draw.get();
+  for (int i = 0; i < 4; ++i)
+    params.thrustGain[i] *= 1.0f + THRUST_ERROR * (float)draw.get();
+
+  float start[3];
+  for (int k = 0; k < 3; ++k)
+    start[k] = g_mission[0].pose[k] + START_OFFSET * (float)draw.get();
+  float roll  = START_TILT * (float)draw.get();
+  float pitch = START_TILT * (float)draw.get();
+
+  float wind[3] = {
+    WIND_MEAN * (float)draw.get(), WIND_MEAN * (float)draw.get(), 0.0f
+  };
+  float gust[3] = { 0.0f, 0.0f, 0.0f };
+
+  GaussianNoise gustNoise(0.0, 1.0);
+  gustNoise.seed(frameKey(seed, 1));
+
+  QuadModel model(params);
+  model.reset(start, g_mission[0].pose[3], roll, pitch);
+
+  FlightController   controller;
+  MissionTarget      target;
+  FlightControlInput in;
+  float motors[4];
+
+  RunResult r = { seed, 0.0f, 0.0f, false, -1.0f };
+  double    sumSq = 0.0;
+  uint64_t  steps = 0;
+  float     h     = CONTROL_DT / SUBSTEPS;
+  float     gustScale = WIND_GUST * sqrtf(2.0f * h / GUST_TIME);
+
+  if (trace != NULL) {
+    fprintf(trace, "time,x,y,z,target_x,target_y,target_z,target_yaw,"
+            "tilt_deg,motor_0,motor_1,motor_2,motor_3\n");
+  }
+
+  for (float t = 0.0f; !target.done(); t += CONTROL_DT) {
+    model.controlInput(target.pose(), target.pose()[3], in);
+    controller.run(in, motors);
+
+    for (int k = 0; k < SUBSTEPS; ++k) {
+      float air[3];
+      for (int j = 0; j < 3; ++j) {
+        if (j < 2)
+          gust[j] += -gust[j] * h / GUST_TIME + gustScale * (float)gustNoise.get();
+        air[j] = wind[j] + gust[j];
+      }
+      model.step(motors, air, h);
+    }
+    target.advance(CONTROL_DT);
+
+    const QuadModelState& s = model.state();
+    const float *goal = target.pose();
+    float err = 0.0f;
+    for (int k = 0; k < 3; ++k)
+      err += (s.pos[k] - goal[k]) * (s.pos[k] - goal[k]);
+    sumSq += err;
+    ++steps;
+
+    float tilt = model.tilt();
+    r.maxTilt = std::max(r.maxTilt, tilt);
+
+    if (trace != NULL) {
+      fprintf(trace, "%.2f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f,"
+              "%.4f,%.4f,%.4f,%.4f\n", t + CONTROL_DT,
+              s.pos[0], s.pos[1], s.pos[2],
+              goal[0], goal[1], goal[2], goal[3],
+              tilt * 180.0f / (float)M_PI,
+              motors[0], motors[1], motors[2], motors[3]);
+    }
+
+    if (s.pos[2] <= 0.0f || tilt > CRASH_TILT || !(err < 1e6f)) {
+      r.crashed   = true;
+      r.crashTime = t + CONTROL_DT;
+      break;
+    }
+  }
+
+  r.rmsError = (float)sqrt(sumSq / (steps > 0 ? steps : 1));
+  return r;
+}
+
+// Value at fraction "p" of a sorted list.
+static float percentile(const std::vector<float>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0.0f;
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+// Write the summary of one metric as a JSON object.
+static void writeMetric(FILE *f, const char *name,
+                        const std::vector<RunResult>& runs,
+                        float RunResult::*field, float scale, bool last)
+{
+  std::vector<float> v;
+  double   sum   = 0.0;
+  uint64_t worst = runs.empty() ? 0 : runs[0].seed;
+  float    max   = -1.0f;
+
+  for (const RunResult& r : runs) {
+    float x = r.*field * scale;
+    v.push_back(x);
+    sum += x;
+    if (x > max) {
+      max   = x;
+      worst = r.seed;
+    }
+  }
+  std::sort(v.begin(), v.end());
+
+  fprintf(f, "  \"%s\": {\"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, "
+          "\"max\": %.4f, \"worst_seed\": %llu}%s\n", name,
+          runs.empty() ? 0.0 : sum / runs.size(),
+          percentile(v, 0.5), percentile(v, 0.95), max,
+          (unsigned long long)worst, last ? "" : ",");
+}
+
+static bool writeReport(const char *filename,
+                        const std::vector<RunResult>& runs,
+                        uint64_t firstSeed, unsigned threads, double seconds)
+{
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "monte_carlo: cannot write '%s'\n", filename);
+    return false;
+  }
+
+  std::vector<uint64_t> crashed;
+  for (const RunResult& r : runs) {
+    if (r.crashed)
+      crashed.push_back(r.seed);
+  }
+
+  // Seeds with the largest tracking error first.
+  std::vector<RunResult> worst(runs);
+  std::sort(worst.begin(), worst.end(),
+            [](const RunResult& a, const RunResult& b) {
+              return a.rmsError > b.rmsError ||
+                     (a.rmsError == b.rmsError && a.seed < b.seed);
+            });
+
+  fprintf(f, "{\n  \"suite\": \"monte_carlo\",\n  \"time\": %ld,\n"
+          "  \"runs\": %zu,\n  \"first_seed\": %llu,\n  \"threads\": %u,\n"
+          "  \"seconds\": %.3f,\n  \"crashes\": %zu,\n"
+          "  \"crash_rate\": %.6f,\n", (long)time(NULL), runs.size(),
+          (unsigned long long)firstSeed, threads, seconds, crashed.size(),
+          runs.empty() ? 0.0 : (double)crashed.size() / runs.size());
+
+  writeMetric(f, "rms_error_m", runs, &RunResult::rmsError, 1.0f, false);
+  writeMetric(f, "max_tilt_deg", runs, &RunResult::maxTilt,
+              180.0f / (float)M_PI, false);
+
+  fprintf(f, "  \"crashed_seeds\": [");
+  for (size_t i = 0; i < crashed.size() && i < REPORT_SEEDS; ++i)
+    fprintf(f, "%s%llu", i > 0 ? ", " : "", (unsigned long long)crashed[i]);
+  fprintf(f, "],\n  \"worst_seeds\": [");
+  for (size_t i = 0; i < worst.size() && i < REPORT_SEEDS; ++i)
+    fprintf(f, "%s%llu", i > 0 ? ", " : "", (unsigned long long)worst[i].seed);
+  fprintf(f, "]\n}\n");
+
+  fclose(f);
+  return true;
+}
+
+static bool writeRuns(const char *filename, const std::vector<RunResult>& runs)
+{
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "monte_carlo: cannot write '%s'\n", filename);
+    return false;
+  }
+
+  fprintf(f, "seed,rms_error_m,max_tilt_deg,crashed,crash_time_s\n");
+  for (const RunResult& r : runs) {
+    fprintf(f, "%llu,%.6f,%.4f,%d,%.2f\n", (unsigned long long)r.seed,
+            r.rmsError, r.maxTilt * 180.0f / (float)M_PI, r.crashed ? 1 : 0,
+            r.crashTime);
+  }
+
+  fclose(f);
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: monte_carlo [-n RUNS] [-s FIRST_SEED] "
+          "[-j THREADS] [-o REPORT.json] [-r RUNS.csv] [-t TRACE.csv]\n");
+}
+
+int main(int argc, char **argv)
+{
+  size_t      runs      = 1000;
+  uint64_t    firstSeed = 1;
+  unsigned    threads   = WorkerPool::defaultThreads() + 1;
+  std::string report    = "monte_carlo.json";
+  std::string runsFile  = "monte_carlo_runs.csv";
+  std::string traceFile;
+
+  int c;
+  while ((c = getopt(argc, argv, "n:s:j:o:r:t:h")) != -1) {
+    switch (c) {
+    case 'n': runs      = (size_t)strtoull(optarg, NULL, 10); break;
+    case 's': firstSeed = strtoull(optarg, NULL, 10); break;
+    case 'j': threads   = (unsigned)atoi(optarg); break;
+    case 'o': report    = optarg; break;
+    case 'r': runsFile  = optarg; break;
+    case 't': traceFile = optarg; break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (optind != argc || runs == 0 || threads == 0) {
+    usage();
+    return 1;
+  }
+
+  // A trace follows the first seed, on this thread.
+  FILE *trace = NULL;
+  if (!traceFile.empty()) {
+    trace = fopen(traceFile.c_str(), "w");
+    if (trace == NULL) {
+      fprintf(stderr, "monte_carlo: cannot write '%s'\n", traceFile.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<RunResult> results(runs);
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  size_t first = 0;
+  if (trace != NULL) {
+    results[0] = runSeed(firstSeed, trace);
+    fclose(trace);
+    first = 1;
+  }
+
+  WorkerPool pool(threads - 1);
+  pool.parallelFor(runs - first, 16, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i)
+      results[first + i] = runSeed(firstSeed + first + i, NULL);
+  });
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  size_t crashes = 0;
+  double sumRms  = 0.0;
+  float  maxTilt = 0.0f;
+  for (const RunResult& r : results) {
+    crashes += r.crashed ? 1 : 0;
+    sumRms  += r.rmsError;
+    maxTilt  = std::max(maxTilt, r.maxTilt);
+  }
+
+  printf("monte_carlo: %zu runs from seed %llu on %u threads in %.2f s "
+         "(%.0f runs/s)\n", runs, (unsigned long long)firstSeed,
+         pool.size(), seconds, runs / seconds);
+  printf("monte_carlo: %zu crashed, mean RMS error %.3f m, "
+         "max tilt %.1f deg\n", crashes, sumRms / runs,
+         maxTilt * 180.0f / (float)M_PI);
+
+  if (!writeRuns(runsFile.c_str(), results) ||
+      !writeReport(report.c_str(), results, firstSeed, pool.size(), seconds))
+    return 1;
+
+  printf("monte_carlo: wrote %s and %s\n", report.c_str(), runsFile.c_str());
+  return 0;
+}
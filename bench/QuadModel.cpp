@@ -0,0 +1,168 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// QuadModel.cpp --- Standalone rigid body model of a quadcopter.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <math.h>
+#include <string.h>
+
+#include "bench/QuadModel.h"
+
+#define GRAVITY      9.81f
+#define HOVER_MOTOR  5.335f
+
+QuadParams::QuadParams()
+  : mass(0.5f),
+    arm(0.13f),
+    torqueRatio(0.02f),
+    motorLag(0.02f),
+    drag(0.1f),
+    angularDrag(0.002f)
+{
+  inertia[0] = 0.010f;
+  inertia[1] = 0.010f;
+  inertia[2] = 0.018f;
+
+  for (int i = 0; i < 4; ++i)
+    thrustGain[i] = mass * GRAVITY / (4.0f * HOVER_MOTOR);
+}
+
+QuadModel::QuadModel(const QuadParams& params)
+  : m_params(params)
+{
+  float origin[3] = { 0.0f, 0.0f, 0.0f };
+  reset(origin, 0.0f, 0.0f, 0.0f);
+}
+
+void QuadModel::reset(const float *pos, float yaw, float roll, float pitch)
+{
+  QuadModelState& s = m_state;
+  memset(&s, 0, sizeof(s));
+  memcpy(s.pos, pos, sizeof(s.pos));
+
+  float cy = cosf(yaw * 0.5f),   sy = sinf(yaw * 0.5f);
+  float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+  float cr = cosf(roll * 0.5f),  sr = sinf(roll * 0.5f);
+  s.quat[0] = cr * cp * cy + sr * sp * sy;
+  s.quat[1] = sr * cp * cy - cr * sp * sy;
+  s.quat[2] = cr * sp * cy + sr * cp * sy;
+  s.quat[3] = cr * cp * sy - sr * sp * cy;
+
+  for (int i = 0; i < 4; ++i)
+    s.motors[i] = HOVER_MOTOR;
+}
+
+void QuadModel::rotation(float *r) const
+{
+  float w = m_state.quat[0], x = m_state.quat[1];
+  float y = m_state.quat[2], z = m_state.quat[3];
+
+  r[0] = 1.0f - 2.0f * (y * y + z * z);
+  r[1] = 2.0f * (x * y - w * z);
+  r[2] = 2.0f * (x * z + w * y);
+  r[3] = 2.0f * (x * y + w * z);
+  r[4] = 1.0f - 2.0f * (x * x + z * z);
+  r[5] = 2.0f * (y * z - w * x);
+  r[6] = 2.0f * (x * z - w * y);
+  r[7] = 2.0f * (y * z + w * x);
+  r[8] = 1.0f - 2.0f * (x * x + y * y);
+}
+
+float QuadModel::tilt() const
+{
+  float r[9];
+  rotation(r);
+  return acosf(r[8] > 1.0f ? 1.0f : (r[8] < -1.0f ? -1.0f : r[8]));
+}
+
+void QuadModel::step(const float *motors, const float *wind, float dt)
+{
+  const QuadParams& p = m_params;
+  QuadModelState&   s = m_state;
+
+  float lag = dt < p.motorLag ? dt / p.motorLag : 1.0f;
+  float f[4];
+  for (int i = 0; i < 4; ++i) {
+    float cmd = motors[i] > 0.0f ? motors[i] : 0.0f;
+    s.motors[i] += (cmd - s.motors[i]) * lag;
+    f[i] = p.thrustGain[i] * s.motors[i];
+  }
+
+  // Thrust along the body Z axis, gravity and drag against the air.
+  float r[9];
+  rotation(r);
+  float thrust = f[0] + f[1] + f[2] + f[3];
+  for (int k = 0; k < 3; ++k) {
+    float a = (thrust * r[k * 3 + 2] - p.drag * (s.vel[k] - wind[k])) /
+              p.mass;
+    if (k == 2)
+      a -= GRAVITY;
+    s.vel[k] += a * dt;
+    s.pos[k] += s.vel[k] * dt;
+  }
+
+  // Body torques from the thrust differences and rotor drag.
+  float torque[3] = {
+    p.arm * (f[0] + f[1] - f[2] - f[3]),
+    p.arm * (f[1] + f[2] - f[0] - f[3]),
+    p.torqueRatio * (f[1] + f[3] - f[0] - f[2]),
+  };
+
+  const float *I = p.inertia;
+  float *w = s.angVel;
+  float gyro[3] = {
+    w[1] * I[2] * w[2] - w[2] * I[1] * w[1],
+    w[2] * I[0] * w[0] - w[0] * I[2] * w[2],
+    w[0] * I[1] * w[1] - w[1] * I[0] * w[0],
+  };
+  for (int k = 0; k < 3; ++k)
+    w[k] += (torque[k] - gyro[k] - p.angularDrag * w[k]) / I[k] * dt;
+
+  // q += q * (0, w) * dt / 2, then renormalize.
+  float *q = s.quat;
+  float dq[4] = {
+    -q[1] * w[0] - q[2] * w[1] - q[3] * w[2],
+     q[0] * w[0] + q[2] * w[2] - q[3] * w[1],
+     q[0] * w[1] - q[1] * w[2] + q[3] * w[0],
+     q[0] * w[2] + q[1] * w[1] - q[2] * w[0],
+  };
+  float norm = 0.0f;
+  for (int k = 0; k < 4; ++k) {
+    q[k] += 0.5f * dq[k] * dt;
+    norm += q[k] * q[k];
+  }
+  norm = 1.0f / sqrtf(norm);
+  for (int k = 0; k < 4; ++k)
+    q[k] *= norm;
+}
+
+void QuadModel::controlInput(const float *target, float targetYaw,
+                             FlightControlInput& in) const
+{
+  const QuadModelState& s = m_state;
+  float r[9];
+  rotation(r);
+
+  in.targetZ = target[2];
+  in.z       = s.pos[2];
+  in.vz      = s.vel[2];
+
+  // "simTransformVector" applies the whole transform, so the unit
+  // axes come back as points.
+  in.xAxisZ = r[6] + s.pos[2];
+  in.yAxisZ = r[7] + s.pos[2];
+
+  float d[3] = {
+    target[0] - s.pos[0], target[1] - s.pos[1], target[2] - s.pos[2]
+  };
+  in.targetX = r[0] * d[0] + r[3] * d[1] + r[6] * d[2];
+  in.targetY = r[1] * d[0] + r[4] * d[1] + r[7] * d[2];
+
+  // Third of V-REP's X-Y-Z Euler angles of the body relative to the
+  // target, whose frame is only turned about Z.
+  float c = cosf(targetYaw), sn = sinf(targetYaw);
+  in.yaw = atan2f(-(c * r[1] + sn * r[4]), c * r[0] + sn * r[3]);
+}
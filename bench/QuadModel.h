@@ -0,0 +1,74 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// QuadModel.h --- Standalone rigid body model of a quadcopter.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_QUAD_MODEL_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_QUAD_MODEL_H_INCLUDED
+
+#include "FlightControl.h"
+
+// Physical parameters of the model.  The defaults approximate the
+// quadcopter in "quadcopter.ttt": it hovers when every motor is
+// commanded at the controller's hover velocity of 5.335.
+struct QuadParams
+{
+  QuadParams();
+
+  float mass;                   // kg
+  float inertia[3];             // about the body axes (kg m^2)
+  float arm;                    // motor offset along X and Y (m)
+  float thrustGain[4];          // N per unit of motor velocity
+  float torqueRatio;            // yaw torque per N of thrust (m)
+  float motorLag;               // motor time constant (s)
+  float drag;                   // linear drag (N s / m)
+  float angularDrag;            // N m s / rad
+};
+
+// State of the model.  Motors sit at (+X, +Y), (-X, +Y), (-X, -Y)
+// and (+X, -Y), in the order of the controller's outputs, and the
+// first and third spin the other way from the second and fourth.
+struct QuadModelState
+{
+  float pos[3];                 // world position (m)
+  float vel[3];                 // world velocity (m/s)
+  float quat[4];                // body to world rotation (w, x, y, z)
+  float angVel[3];              // body frame angular velocity (rad/s)
+  float motors[4];              // motor velocities after the lag
+};
+
+class QuadModel
+{
+public:
+  explicit QuadModel(const QuadParams& params);
+
+  // Place the model at rest at a position with a heading and a small
+  // tilt (rad) about the X and Y axes.
+  void reset(const float *pos, float yaw, float roll, float pitch);
+
+  // Advance by "dt" seconds with the motors commanded at "motors" and
+  // the air moving at "wind" (m/s, world frame).
+  void step(const float *motors, const float *wind, float dt);
+
+  // Fill in what the plug-in reads from the scene for the controller,
+  // given the target's position and heading.
+  void controlInput(const float *target, float targetYaw,
+                    FlightControlInput& in) const;
+
+  // Return the 3x3 body to world rotation, row-major.
+  void rotation(float *r) const;
+
+  // Return the angle between the body Z axis and the vertical (rad).
+  float tilt() const;
+
+  const QuadModelState& state() const { return m_state; }
+
+private:
+  QuadParams     m_params;
+  QuadModelState m_state;
+};
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_QUAD_MODEL_H_INCLUDED
@@ -0,0 +1,100 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// RangeBench.cpp --- Range sensor ray casting benchmark.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Casts a downward rangefinder and a 32-beam lidar for 200 vehicles
+// over hilly terrain and checks the cost per step, gathering the rays
+// and casting them, against a 5 ms budget at the 99th percentile.
+// Exits with status 1 when over budget.  Runs without V-REP.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "SimRange.h"
+#include "WorkerPool.h"
+
+#define VEHICLES     200
+#define LIDAR_BEAMS  32
+#define LIDAR_RANGE  100.0f
+#define DOWN_RANGE   40.0f
+#define STEPS        200
+#define BUDGET_MS    5.0
+
+int main(int argc, char **argv)
+{
+  unsigned threads = WorkerPool::defaultThreads();
+  if (argc > 1)
+    threads = (unsigned)atoi(argv[1]);
+
+  WorkerPool  pool(threads);
+  RangeCaster caster(pool);
+  HeightField field;
+
+  field.build([](float x, float y) {
+                return 15.0f + 15.0f * sinf(x * 0.01f) * cosf(y * 0.013f);
+              }, 1000.0f, 2.0f);
+
+  RangeScanPattern down  = RangeScanPattern::down();
+  RangeScanPattern lidar = RangeScanPattern::scan(LIDAR_BEAMS, 1,
+                                                  2.0f * (float)M_PI, 0.0f);
+
+  // Vehicles scattered over the field at various heights and
+  // headings, given as 3x4 world transforms.
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> pos(-800.0f, 800.0f);
+  std::uniform_real_distribution<float> alt(10.0f, 60.0f);
+  std::uniform_real_distribution<float> yaw(0.0f, 2.0f * (float)M_PI);
+  std::vector<float> poses(VEHICLES * 12);
+
+  for (int v = 0; v < VEHICLES; ++v) {
+    float *m = &poses[v * 12];
+    float  a = yaw(gen);
+    float  c = cosf(a), s = sinf(a);
+    float  m0[12] = { c, -s, 0.0f, pos(gen),
+                      s,  c, 0.0f, pos(gen),
+                      0.0f, 0.0f, 1.0f, alt(gen) };
+    for (int i = 0; i < 12; ++i)
+      m[i] = m0[i];
+  }
+
+  std::vector<double> ms(STEPS);
+  double total = 0.0;
+
+  for (int step = 0; step < STEPS; ++step) {
+    double t0 = benchNow();
+    caster.clear();
+    for (int v = 0; v < VEHICLES; ++v) {
+      caster.add(&poses[v * 12], down, DOWN_RANGE);
+      caster.add(&poses[v * 12], lidar, LIDAR_RANGE);
+    }
+    caster.cast(field);
+
+    ms[step] = (benchNow() - t0) * 1000.0;
+    total += ms[step];
+  }
+
+  std::sort(ms.begin(), ms.end());
+  double mean  = total / STEPS;
+  double p99   = ms[(STEPS * 99) / 100];
+  double worst = ms.back();
+  bool   ok    = p99 <= BUDGET_MS;
+
+  printf("range: %d vehicles x %d rays on %u threads\n",
+         VEHICLES, LIDAR_BEAMS + 1, pool.size());
+  printf("range: %.3f ms/step mean, %.3f ms/step p99, %.3f ms/step worst, "
+         "%.3g rays/s\n", mean, p99, worst, caster.raysPerSecond());
+  printf("range: p99 %s the %.1f ms step budget\n",
+         ok ? "within" : "OVER", BUDGET_MS);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// RlBench.cpp --- Throughput of the vectorized RL environment.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Maps the RL environment's shared memory the way a trainer would
+// and, for swarms of 10 to 1,000 quadcopters, times a whole step, the
+// part of it spent packing observations and scoring rewards, and a
+// batched reset of every episode.  It checks that the observations
+// match the scene, that the actions drive the motors, that episodes
+// are truncated on time and that resets put every quadcopter back.
+// Results go to a JSON file (default "rl_bench.json", or the first
+// argument).  Exits with status 1 if any check fails.
+//
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Profile.h"
+#include "Quadcopter.h"
+#include "RlEnv.h"
+
+// Scene sizes to measure.
+static const int g_sizes[] = { 10, 100, 1000 };
+
+// Episode length, shorter than the steps each scene size runs.
+#define EPISODE_STEPS 20
+
+// The trainer's view of the environment.
+struct Trainer
+{
+  uint8_t     *base;
+  size_t       size;
+  RlEnvHeader *h;
+
+  const int32_t *objects() const
+  {
+    return (const int32_t *)(base + h->objectsOffset);
+  }
+  float *actions() { return (float *)(base + h->actionsOffset); }
+  uint32_t *resets() { return (uint32_t *)(base + h->resetsOffset); }
+  float *poses() { return (float *)(base + h->posesOffset); }
+  const float *obs() const { return (const float *)(base + h->obsOffset); }
+  const float *rewards() const
+  {
+    return (const float *)(base + h->rewardsOffset);
+  }
+  const uint8_t *dones() const { return base + h->donesOffset; }
+};
+
+static bool attach(Trainer& t, const char *name)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    return false;
+
+  void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return false;
+
+  t.base = (uint8_t *)p;
+  t.size = st.st_size;
+  t.h    = (RlEnvHeader *)p;
+  return t.h->magic.load(std::memory_order_acquire) == RL_MAGIC &&
+         t.h->obsDim == RL_OBS_DIM && t.h->actDim == RL_ACT_DIM;
+}
+
+// The action the trainer sends a quadcopter.
+static float trainerAction(int obj, int motor)
+{
+  return 5.0f + 0.001f * obj + 0.25f * motor;
+}
+
+// Return true if every observation matches its quadcopter in the
+// mock scene, where targets sit 1 m above the bodies.
+static bool checkObservations(const Trainer& t, const std::vector<int>& models,
+                              int n)
+{
+  for (size_t i = 0; i < models.size(); ++i) {
+    const float *row  = t.obs() + i * RL_OBS_DIM;
+    const float *body = g_mockScene.object(models[i] + 1).matrix;
+
+    if (t.objects()[i] != models[i])
+      return sceneFailed(n, "object handles out of order");
+    if (memcmp(row + RL_OBS_POSE, body, 12 * sizeof(float)) != 0)
+      return sceneFailed(n, "pose does not match the scene");
+    if (fabsf(row[RL_OBS_TARGET + 0]) > 1e-4f ||
+        fabsf(row[RL_OBS_TARGET + 1]) > 1e-4f ||
+        fabsf(row[RL_OBS_TARGET + 2] - 1.0f) > 1e-4f ||
+        fabsf(row[RL_OBS_TARGET + 3]) > 1e-4f)
+      return sceneFailed(n, "target error does not match the scene");
+    for (int m = 0; m < RL_ACT_DIM; ++m) {
+      if (row[RL_OBS_ACTION + m] != trainerAction(models[i], m))
+        return sceneFailed(n, "observed action is not the one sent");
+    }
+  }
+
+  return true;
+}
+
+// Measure one scene size.  Returns false if a check failed.
+static bool runScene(BenchSuite& suite, const char *shmName, int n)
+{
+  g_mockScene.clear();
+  std::vector<int> models = g_mockScene.addGrid(n);
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  Trainer t;
+  bool ok = attach(t, shmName);
+  if (!ok) {
+    sendMessage(sim_message_eventcallback_moduleclose);
+    return sceneFailed(n, "could not map the environment");
+  }
+  if (t.h->count != (uint32_t)n)
+    ok = sceneFailed(n, "wrong quadcopter count");
+
+  for (int i = 0; ok && i < n; ++i) {
+    for (int m = 0; m < RL_ACT_DIM; ++m)
+      t.actions()[i * RL_ACT_DIM + m] = trainerAction(models[i], m);
+  }
+
+  // Every step publishes results.
+  uint32_t step0 = t.h->step.load(std::memory_order_acquire);
+  stepScene();
+  if (ok && t.h->step.load(std::memory_order_acquire) != step0 + 1)
+    ok = sceneFailed(n, "step not published");
+  if (ok && t.dones()[0] != 0)
+    ok = sceneFailed(n, "episode over after one step");
+
+  char name[64];
+  const TimeHistogram& rl = Profile::section(PROF_RL);
+  uint64_t count0 = rl.count();
+  double   sum0   = rl.mean() * count0;
+
+  snprintf(name, sizeof(name), "step/%d", n);
+  double stepNs = 0.0;
+  if (ok) {
+    stepNs = suite.run(name, stepScene).mean;
+  }
+
+  double rlNs = Profile::toNanos(rl.mean() * rl.count() - sum0) /
+                (rl.count() > count0 ? rl.count() - count0 : 1);
+
+  if (ok)
+    ok = checkObservations(t, models, n) &&
+         checkMotors(models, trainerAction,
+                     "motors do not follow the actions");
+
+  // Well past the episode length every episode is truncated, and the
+  // quadcopters sit still 1 m below their targets.  The timed steps
+  // alone may not have got that far.
+  for (int s = 0; ok && s < EPISODE_STEPS; ++s)
+    stepScene();
+
+  float expected = RL_REWARD_ALIVE - RL_COST_DIST * 1.0f;
+  for (int i = 0; ok && i < n; ++i) {
+    if (t.dones()[i] != RL_DONE_TRUNCATED)
+      ok = sceneFailed(n, "episode not truncated");
+    else if (fabsf(t.rewards()[i] - expected) > 1e-5f)
+      ok = sceneFailed(n, "unexpected reward");
+  }
+
+  // Scatter the swarm, then have the trainer restart every episode
+  // and one at a given pose.
+  for (int i = 0; ok && i < n; ++i) {
+    float pos[3] = { 1000.0f + i, -500.0f, 30.0f };
+    simSetObjectPosition(models[i], -1, pos);
+    t.resets()[i] = RL_RESET_HOME;
+  }
+
+  static const float pose[4] = { 3.0f, 4.0f, 5.0f, 0.0f };
+  if (ok) {
+    memcpy(t.poses(), pose, sizeof(pose));
+    t.resets()[0] = RL_RESET_POSE;
+
+    stepScene();
+  }
+
+  for (int i = 0; ok && i < n; ++i) {
+    const float *row = t.obs() + i * RL_OBS_DIM;
+    float x = pose[0], y = pose[1], z = pose[2];
+    if (i > 0) {
+      MockScene::gridPosition(i, n, &x, &y);
+      z = 1.0f;
+    }
+
+    if (t.resets()[i] != RL_RESET_NONE)
+      ok = sceneFailed(n, "reset request not cleared");
+    else if (t.dones()[i] != 0)
+      ok = sceneFailed(n, "episode not restarted");
+    else if (row[RL_OBS_POSE + 3] != x || row[RL_OBS_POSE + 7] != y ||
+             row[RL_OBS_POSE + 11] != z)
+      ok = sceneFailed(n, "quadcopter not moved back");
+    else if (fabsf(row[RL_OBS_TARGET + 2] - 1.0f) > 1e-4f)
+      ok = sceneFailed(n, "target not moved with the quadcopter");
+  }
+
+  snprintf(name, sizeof(name), "resetEpisodes/%d", n);
+  double resetNs = 0.0;
+  if (ok) {
+    resetNs = suite.run(name, [&] {
+      Quadcopter::resetEpisodes(models.data(), models.size(), NULL);
+    }).mean;
+  }
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+  munmap(t.base, t.size);
+
+  if (ok) {
+    printf("rl_bench: %d quadcopters: step %.1f us, observations and "
+           "rewards %.1f ns per quadcopter, reset %.1f ns per quadcopter\n",
+           n, stepNs / 1e3, rlNs / n, resetNs / n);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "rl_bench.json";
+
+  if (out[0] != '/') {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+      out = std::string(cwd) + "/" + out;
+  }
+
+  char shmName[64], steps[16];
+  snprintf(shmName, sizeof(shmName), "/quadcopter_rl_bench_%d", (int)getpid());
+  snprintf(steps, sizeof(steps), "%d", EPISODE_STEPS);
+  setenv("QUADCOPTER_RL_SHM", shmName, 1);
+  setenv("QUADCOPTER_RL_EPISODE_STEPS", steps, 1);
+
+  MockPlugin plugin("rl_bench");
+
+  BenchSuite suite("rl_bench", 7, 0.01);
+  bool ok = true;
+  for (int n : g_sizes) {
+    if (!runScene(suite, shmName, n)) {
+      ok = false;
+      break;
+    }
+  }
+
+  plugin.stop();
+
+  if (!suite.writeJSON(out.c_str()) || !ok)
+    return 1;
+
+  printf("rl_bench: wrote %s\n", out.c_str());
+  return 0;
+}
@@ -0,0 +1,174 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SignalBench.cpp --- Cost of publishing the packed swarm signal.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// With "QUADCOPTER_SWARM_SIGNAL" set, the plug-in packs the whole
+// swarm into one string signal every step.  This times that packing on
+// the simulator thread, and a client decoding the signal with
+// "SwarmSignal.h", for swarms of 1 to 1,000 quadcopters, checking the
+// decoded records against the scene.  Results go to a JSON file
+// (default "signal_bench.json", or the first argument); the signal of
+// the largest swarm is saved to the second argument, if given, for
+// trying the Python decoder.  Exits with status 1 if any check fails.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Profile.h"
+#include "Quadcopter.h"
+#include "SwarmSignal.h"
+
+// Steps timed per scene size.
+#define STEPS  200
+
+// Name of the signal.
+#define SIGNAL_NAME  "quadcopter_swarm"
+
+// Return true if "signal" describes the quadcopters "models" as they
+// are in the mock scene, where targets sit 1 m above the bodies.
+static bool checkSignal(const std::string& signal,
+                        const std::vector<int>& models)
+{
+  int n = (int)models.size();
+  SwarmSignalHeader h;
+
+  if (swarmSignalCheck(signal.data(), signal.size(), &h) != n)
+    return sceneFailed(n, "signal malformed or of the wrong size");
+  if (h.version != SWARM_SIGNAL_VERSION ||
+      h.recordSize != sizeof(SwarmRecord))
+    return sceneFailed(n, "wrong layout version");
+  if (h.step + 1 != Quadcopter::frame().step)
+    return sceneFailed(n, "signal not from the previous step");
+
+  for (int i = 0; i < n; ++i) {
+    SwarmRecord r;
+    swarmSignalRecord(signal.data(), &h, i, &r);
+
+    const float *body = g_mockScene.object(models[i] + 1).matrix;
+    if (r.obj != models[i])
+      return sceneFailed(n, "quadcopters out of order");
+    if (memcmp(r.pose, body, sizeof(r.pose)) != 0)
+      return sceneFailed(n, "pose does not match the scene");
+    if (r.target[0] != body[3] || r.target[1] != body[7] ||
+        r.target[2] != body[11] + 1.0f || r.target[3] != 0.0f)
+      return sceneFailed(n, "target does not match the scene");
+  }
+
+  // Older decoders read the fields they know from a longer record.
+  SwarmSignalHeader older = h;
+  older.recordSize = offsetof(SwarmRecord, accel);
+  SwarmRecord r;
+  swarmSignalRecord(signal.data(), &older, 0, &r);
+  if (r.obj != models[0] || r.accel[0] != 0.0f || r.rangeDown != 0.0f)
+    return sceneFailed(n, "short records not padded with zeros");
+
+  return true;
+}
+
+// Measure one scene size.  Returns false if a check failed.
+static bool runScene(BenchSuite& suite, int n, const char *save)
+{
+  g_mockScene.clear();
+  std::vector<int> models = g_mockScene.addGrid(n);
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+  stepScene();
+  stepScene();
+
+  const std::string& signal = g_mockScene.signals[SIGNAL_NAME];
+  bool ok = checkSignal(signal, models);
+
+  const TimeHistogram& st = Profile::section(PROF_SIGNAL);
+  uint64_t count0 = st.count();
+  double   sum0   = st.mean() * count0;
+  for (int s = 0; ok && s < STEPS; ++s)
+    stepScene();
+  double packNs = Profile::toNanos(st.mean() * st.count() - sum0) /
+                  (st.count() > count0 ? st.count() - count0 : 1);
+
+  char name[64];
+  snprintf(name, sizeof(name), "decode/%d", n);
+  double decodeNs = 0.0;
+  if (ok) {
+    decodeNs = suite.run(name, [&] {
+      SwarmSignalHeader h;
+      int count = swarmSignalCheck(signal.data(), signal.size(), &h);
+      float sum = 0.0f;
+      for (int i = 0; i < count; ++i) {
+        SwarmRecord r;
+        swarmSignalRecord(signal.data(), &h, i, &r);
+        sum += r.pose[3];
+      }
+      benchKeep(sum);
+    }).mean;
+  }
+
+  if (ok && save != NULL) {
+    FILE *f = fopen(save, "wb");
+    if (f == NULL || fwrite(signal.data(), 1, signal.size(), f) !=
+        signal.size())
+      ok = sceneFailed(n, "could not save the signal");
+    if (f != NULL)
+      fclose(f);
+  }
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+
+  if (ok) {
+    printf("signal_bench: %d quadcopters: %zu bytes, packing %.1f ns and "
+           "decoding %.1f ns per quadcopter\n",
+           n, signal.size(), packNs / n, decodeNs / n);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out  = argc > 1 ? argv[1] : "signal_bench.json";
+  std::string save = argc > 2 ? argv[2] : "";
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) != NULL) {
+    if (out[0] != '/')
+      out = std::string(cwd) + "/" + out;
+    if (!save.empty() && save[0] != '/')
+      save = std::string(cwd) + "/" + save;
+  }
+
+  setenv("QUADCOPTER_SWARM_SIGNAL", SIGNAL_NAME, 1);
+
+  MockPlugin plugin("signal_bench");
+
+  BenchSuite suite("signal_bench");
+  bool ok = true;
+  size_t sizes = sizeof(g_sceneSizes) / sizeof(g_sceneSizes[0]);
+  for (size_t i = 0; i < sizes; ++i) {
+    bool last = i + 1 == sizes;
+    if (!runScene(suite, g_sceneSizes[i],
+                  last && !save.empty() ? save.c_str() : NULL)) {
+      ok = false;
+      break;
+    }
+  }
+
+  plugin.stop();
+
+  if (!suite.writeJSON(out.c_str()) || !ok)
+    return 1;
+
+  printf("signal_bench: wrote %s\n", out.c_str());
+  return 0;
+}
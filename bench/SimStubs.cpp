@@ -0,0 +1,712 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimStubs.cpp --- Mock V-REP scene for running the plug-in in benchmarks.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AllocStats.h"
+#include "CustomData.h"
+#include "Profile.h"
+#include "Quadcopter.h"
+#include "SimStubs.h"
+#include "v_repExtQuadcopter.h"
+
+MockScene g_mockScene;
+
+// Name of the benchmark running the plug-in.
+static const char *g_benchName = "bench";
+
+//////////////////////////////////////////////////////////////////////
+// Scene
+
+void MockScene::clear()
+{
+  m_objects.clear();
+  time        = 0.0f;
+  dt          = 0.05f;
+  liveBuffers = 0;
+  buffersCreated = 0;
+  lastError[0] = '\0';
+  errors      = 0;
+  signals.clear();
+}
+
+int MockScene::add(const char *name, int parent, float x, float y, float z)
+{
+  MockObject o;
+  o.parent = parent;
+  o.name   = name;
+
+  static const float identity[12] = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f,
+  };
+  memcpy(o.matrix, identity, sizeof(identity));
+  o.matrix[3]  = x;
+  o.matrix[7]  = y;
+  o.matrix[11] = z;
+
+  memset(o.linVel, 0, sizeof(o.linVel));
+  memset(o.angVel, 0, sizeof(o.angVel));
+
+  int obj = (int)m_objects.size();
+  m_objects.push_back(o);
+  if (parent != -1)
+    m_objects[parent].children.push_back(obj);
+
+  return obj;
+}
+
+static void appendUint32(std::vector<uint8_t>& out, uint32_t x)
+{
+  out.push_back((uint8_t)(x >> 0));
+  out.push_back((uint8_t)(x >> 8));
+  out.push_back((uint8_t)(x >> 16));
+  out.push_back((uint8_t)(x >> 24));
+}
+
+void MockScene::addField(int obj, uint32_t field,
+                         const std::vector<uint8_t>& data)
+{
+  std::vector<uint8_t>& cd = m_objects[obj].customData;
+  appendUint32(cd, field);
+  appendUint32(cd, (uint32_t)data.size());
+  cd.insert(cd.end(), data.begin(), data.end());
+}
+
+int MockScene::addQuadcopter(float x, float y, float z)
+{
+  int model  = add("Quadricopter", -1, x, y, z);
+  int body   = add("Quadricopter_base", model, x, y, z);
+  int target = add("Quadricopter_target", model, x, y, z + 1.0f);
+
+  addField(model,  FIELD_QUADCOPTER);
+  addField(body,   FIELD_BODY);
+  addField(target, FIELD_TARGET);
+
+  static const uint32_t motors[4] = {
+    FIELD_MOTOR_0, FIELD_MOTOR_1, FIELD_MOTOR_2, FIELD_MOTOR_3
+  };
+  for (int i = 0; i < 4; ++i) {
+    int m = add("Quadricopter_propeller", body,
+                x + ((i & 1) ? 0.2f : -0.2f), y + ((i & 2) ? 0.2f : -0.2f), z);
+    addField(m, motors[i]);
+  }
+
+  return model;
+}
+
+std::vector<int> MockScene::addGrid(int n)
+{
+  std::vector<int> models;
+  for (int i = 0; i < n; ++i) {
+    float x, y;
+    gridPosition(i, n, &x, &y);
+    models.push_back(addQuadcopter(x, y, 1.0f));
+  }
+  return models;
+}
+
+void MockScene::gridPosition(int i, int n, float *x, float *y)
+{
+  int side = 1;
+  while (side * side < n)
+    ++side;
+
+  *x = (i % side) * GRID_SPACING;
+  *y = (i / side) * GRID_SPACING;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Transforms
+
+// Apply the inverse of the rigid transform "m" to a point.
+static void inverseTransformPoint(const float *m, const float *p, float *out)
+{
+  float d[3] = { p[0] - m[3], p[1] - m[7], p[2] - m[11] };
+
+  for (int i = 0; i < 3; ++i)
+    out[i] = m[i] * d[0] + m[4 + i] * d[1] + m[8 + i] * d[2];
+}
+
+// Return the rigid transform "a" relative to "b": inverse(b) * a.
+static void relativeTransform(const float *a, const float *b, float *out)
+{
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c)
+      out[r * 4 + c] = b[r] * a[c] + b[4 + r] * a[4 + c] + b[8 + r] * a[8 + c];
+  }
+
+  float t[3] = { a[3], a[7], a[11] }, lt[3];
+  inverseTransformPoint(b, t, lt);
+  out[3]  = lt[0];
+  out[7]  = lt[1];
+  out[11] = lt[2];
+}
+
+// Return the transform of "obj" relative to "rel" (-1 for the world).
+static void relativeMatrix(int obj, int rel, float *out)
+{
+  const float *a = g_mockScene.object(obj).matrix;
+
+  if (rel == -1)
+    memcpy(out, a, 12 * sizeof(float));
+  else
+    relativeTransform(a, g_mockScene.object(rel).matrix, out);
+}
+
+// Give "obj" the world transform "m", carrying its descendants along
+// as V-REP does.
+static void moveObject(int obj, const float *m)
+{
+  MockObject& o = g_mockScene.object(obj);
+  float old[12];
+  memcpy(old, o.matrix, sizeof(old));
+  memcpy(o.matrix, m, sizeof(old));
+
+  for (int c : o.children) {
+    float rel[12], world[12];
+    relativeTransform(g_mockScene.object(c).matrix, old, rel);
+
+    for (int r = 0; r < 3; ++r) {
+      for (int k = 0; k < 4; ++k) {
+        world[r * 4 + k] = m[r * 4] * rel[k] + m[r * 4 + 1] * rel[4 + k] +
+                           m[r * 4 + 2] * rel[8 + k] +
+                           (k == 3 ? m[r * 4 + 3] : 0.0f);
+      }
+    }
+    moveObject(c, world);
+  }
+}
+
+static bool validObject(int obj)
+{
+  return obj >= 0 && obj < g_mockScene.size();
+}
+
+//////////////////////////////////////////////////////////////////////
+// API Stubs
+
+static simInt mockGetObjects(simInt index, simInt type)
+{
+  return index >= 0 && index < g_mockScene.size() ? index : -1;
+}
+
+static simInt mockGetObjectCustomDataLength(simInt obj, simInt header)
+{
+  if (!validObject(obj) || header != DATA_ID)
+    return -1;
+  return (simInt)g_mockScene.object(obj).customData.size();
+}
+
+static simInt mockGetObjectCustomData(simInt obj, simInt header, simChar *data)
+{
+  if (!validObject(obj) || header != DATA_ID)
+    return -1;
+
+  const std::vector<uint8_t>& cd = g_mockScene.object(obj).customData;
+  if (!cd.empty())
+    memcpy(data, &cd[0], cd.size());
+  return 1;
+}
+
+static simInt mockGetObjectChild(simInt obj, simInt index)
+{
+  if (!validObject(obj))
+    return -1;
+
+  const std::vector<int>& c = g_mockScene.object(obj).children;
+  return index >= 0 && index < (int)c.size() ? c[index] : -1;
+}
+
+// Buffers are preceded by their size so callers can be checked for
+// overruns.
+#define BUFFER_HEADER 16
+
+// V-REP allocates buffers itself, so they are not charged to the
+// plug-in.
+static simChar *mockCreateBuffer(simInt size)
+{
+  ++g_mockScene.liveBuffers;
+  ++g_mockScene.buffersCreated;
+
+  bool tracked = AllocStats::tracked();
+  AllocStats::trackThread(false);
+  char *p = (char *)malloc(BUFFER_HEADER + (size > 0 ? size : 0));
+  AllocStats::trackThread(tracked);
+  *(size_t *)p = size > 0 ? size : 0;
+  return p + BUFFER_HEADER;
+}
+
+static simInt mockReleaseBuffer(simChar *buffer)
+{
+  --g_mockScene.liveBuffers;
+  free(buffer - BUFFER_HEADER);
+  return 1;
+}
+
+size_t mockBufferSize(const void *buffer)
+{
+  return *(const size_t *)((const char *)buffer - BUFFER_HEADER);
+}
+
+static simChar *mockGetObjectName(simInt obj)
+{
+  if (!validObject(obj))
+    return NULL;
+
+  const std::string& name = g_mockScene.object(obj).name;
+  simChar *buf = mockCreateBuffer((simInt)name.size() + 1);
+  memcpy(buf, name.c_str(), name.size() + 1);
+  return buf;
+}
+
+static simInt mockLockInterface(simBool locked)
+{
+  return 1;
+}
+
+static simInt mockSetLastError(const simChar *func, const simChar *msg)
+{
+  snprintf(g_mockScene.lastError, sizeof(g_mockScene.lastError), "%s", msg);
+  ++g_mockScene.errors;
+  return 1;
+}
+
+static simInt mockRegisterCustomLuaFunction(const simChar *name,
+                                            const simChar *tip,
+                                            const simInt *args,
+                                            simVoid (*callback)(SLuaCallBack *))
+{
+  MockLuaFunction f;
+  f.name     = name;
+  f.tip      = tip;
+  f.callback = callback;
+  if (args != NULL)
+    f.args.assign(args + 1, args + 1 + args[0]);
+
+  g_mockScene.luaFunctions[name] = f;
+  return 1;
+}
+
+static simInt mockGetObjectUniqueIdentifier(simInt obj, simInt *id)
+{
+  if (!validObject(obj))
+    return -1;
+  *id = obj + 1000;
+  return 1;
+}
+
+static simFloat mockGetSimulationTime()
+{
+  return g_mockScene.time;
+}
+
+static simFloat mockGetSimulationTimeStep()
+{
+  return g_mockScene.dt;
+}
+
+static simInt mockGetObjectPosition(simInt obj, simInt rel, simFloat *pos)
+{
+  if (!validObject(obj) || (rel != -1 && !validObject(rel)))
+    return -1;
+
+  float m[12];
+  relativeMatrix(obj, rel, m);
+  pos[0] = m[3];
+  pos[1] = m[7];
+  pos[2] = m[11];
+  return 1;
+}
+
+static simInt mockGetObjectMatrix(simInt obj, simInt rel, simFloat *matrix)
+{
+  if (!validObject(obj) || (rel != -1 && !validObject(rel)))
+    return -1;
+
+  relativeMatrix(obj, rel, matrix);
+  return 1;
+}
+
+static simInt mockGetObjectOrientation(simInt obj, simInt rel, simFloat *euler)
+{
+  if (!validObject(obj) || (rel != -1 && !validObject(rel)))
+    return -1;
+
+  // V-REP's Euler angles: R = Rx(alpha) * Ry(beta) * Rz(gamma).
+  float m[12];
+  relativeMatrix(obj, rel, m);
+  euler[0] = atan2f(-m[6], m[10]);
+  euler[1] = asinf(fmaxf(-1.0f, fminf(1.0f, m[2])));
+  euler[2] = atan2f(-m[1], m[0]);
+  return 1;
+}
+
+// Only world coordinates are supported when moving objects.  Children
+// move with their parents.
+static simInt mockSetObjectPosition(simInt obj, simInt rel,
+                                    const simFloat *pos)
+{
+  if (!validObject(obj) || rel != -1)
+    return -1;
+
+  float m[12];
+  memcpy(m, g_mockScene.object(obj).matrix, sizeof(m));
+  m[3]  = pos[0];
+  m[7]  = pos[1];
+  m[11] = pos[2];
+  moveObject(obj, m);
+  return 1;
+}
+
+static simInt mockSetObjectOrientation(simInt obj, simInt rel,
+                                       const simFloat *euler)
+{
+  if (!validObject(obj) || rel != -1)
+    return -1;
+
+  float sa = sinf(euler[0]), ca = cosf(euler[0]);
+  float sb = sinf(euler[1]), cb = cosf(euler[1]);
+  float sg = sinf(euler[2]), cg = cosf(euler[2]);
+  float m[12];
+  memcpy(m, g_mockScene.object(obj).matrix, sizeof(m));
+
+  m[0]  = cb * cg;
+  m[1]  = -cb * sg;
+  m[2]  = sb;
+  m[4]  = sa * sb * cg + ca * sg;
+  m[5]  = -sa * sb * sg + ca * cg;
+  m[6]  = -sa * cb;
+  m[8]  = -ca * sb * cg + sa * sg;
+  m[9]  = ca * sb * sg + sa * cg;
+  m[10] = ca * cb;
+  moveObject(obj, m);
+  return 1;
+}
+
+static simInt mockSetStringSignal(const simChar *name, const simChar *value,
+                                  simInt length)
+{
+  if (name == NULL || value == NULL || length < 0)
+    return -1;
+
+  g_mockScene.signals[name].assign(value, length);
+  return 1;
+}
+
+static simInt mockResetDynamicObject(simInt obj)
+{
+  if (!validObject(obj))
+    return -1;
+
+  MockObject& o = g_mockScene.object(obj);
+  memset(o.linVel, 0, sizeof(o.linVel));
+  memset(o.angVel, 0, sizeof(o.angVel));
+  return 1;
+}
+
+static simInt mockGetObjectVelocity(simInt obj, simFloat *lin, simFloat *ang)
+{
+  if (!validObject(obj))
+    return -1;
+
+  const MockObject& o = g_mockScene.object(obj);
+  if (lin != NULL)
+    memcpy(lin, o.linVel, sizeof(o.linVel));
+  if (ang != NULL)
+    memcpy(ang, o.angVel, sizeof(o.angVel));
+  return 1;
+}
+
+static simInt mockTransformVector(const simFloat *m, simFloat *v)
+{
+  float x = m[0] * v[0] + m[1] * v[1] + m[2]  * v[2] + m[3];
+  float y = m[4] * v[0] + m[5] * v[1] + m[6]  * v[2] + m[7];
+  float z = m[8] * v[0] + m[9] * v[1] + m[10] * v[2] + m[11];
+  v[0] = x;
+  v[1] = y;
+  v[2] = z;
+  return 1;
+}
+
+static simInt mockGetIntegerParameter(simInt param, simInt *value)
+{
+  *value = 0;
+  return 1;
+}
+
+static simInt mockSetIntegerParameter(simInt param, simInt value)
+{
+  return 1;
+}
+
+static simInt mockGetVisionSensorResolution(simInt obj, simInt *res)
+{
+  return -1;
+}
+
+static simInt mockGetObjectFloatParameter(simInt obj, simInt param,
+                                          simFloat *value)
+{
+  return -1;
+}
+
+static simFloat *mockGetVisionSensorImage(simInt obj)
+{
+  return NULL;
+}
+
+static simFloat *mockGetVisionSensorDepthBuffer(simInt obj)
+{
+  return NULL;
+}
+
+void installSimStubs()
+{
+  simGetObjects                 = mockGetObjects;
+  simGetObjectCustomDataLength  = mockGetObjectCustomDataLength;
+  simGetObjectCustomData        = mockGetObjectCustomData;
+  simGetObjectChild             = mockGetObjectChild;
+  simGetObjectName              = mockGetObjectName;
+  simCreateBuffer               = mockCreateBuffer;
+  simReleaseBuffer              = mockReleaseBuffer;
+  simLockInterface              = mockLockInterface;
+  simSetLastError               = mockSetLastError;
+  simRegisterCustomLuaFunction  = mockRegisterCustomLuaFunction;
+  simGetObjectUniqueIdentifier  = mockGetObjectUniqueIdentifier;
+  simGetSimulationTime          = mockGetSimulationTime;
+  simGetSimulationTimeStep      = mockGetSimulationTimeStep;
+  simGetObjectPosition          = mockGetObjectPosition;
+  simGetObjectMatrix            = mockGetObjectMatrix;
+  simGetObjectOrientation       = mockGetObjectOrientation;
+  simGetObjectVelocity          = mockGetObjectVelocity;
+  simSetObjectPosition          = mockSetObjectPosition;
+  simSetObjectOrientation       = mockSetObjectOrientation;
+  simTransformVector            = mockTransformVector;
+  simResetDynamicObject         = mockResetDynamicObject;
+  simSetStringSignal            = mockSetStringSignal;
+  simGetIntegerParameter        = mockGetIntegerParameter;
+  simSetIntegerParameter        = mockSetIntegerParameter;
+  simGetVisionSensorResolution  = mockGetVisionSensorResolution;
+  simGetObjectFloatParameter    = mockGetObjectFloatParameter;
+  simGetVisionSensorImage       = mockGetVisionSensorImage;
+  simGetVisionSensorDepthBuffer = mockGetVisionSensorDepthBuffer;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Environment
+
+std::string enterTempDir(const char *prefix)
+{
+  std::string dir = std::string("/tmp/") + prefix + "XXXXXX";
+
+  if (mkdtemp(&dir[0]) == NULL || chdir(dir.c_str()) != 0) {
+    perror(prefix);
+    exit(1);
+  }
+
+  return dir;
+}
+
+void leaveTempDir(const std::string& dir)
+{
+  std::string cmd = "rm -rf '" + dir + "'";
+
+  if (chdir("/") != 0 || system(cmd.c_str()) != 0)
+    fprintf(stderr, "cannot remove '%s'\n", dir.c_str());
+}
+
+int silenceStderr()
+{
+  int saved   = dup(2);
+  int devNull = open("/dev/null", O_WRONLY);
+
+  dup2(devNull, 2);
+  close(devNull);
+  return saved;
+}
+
+void restoreStderr(int saved)
+{
+  dup2(saved, 2);
+  close(saved);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Plug-in
+
+void sendMessage(int msg, int flags)
+{
+  int adata[4] = { flags, 0, 0, 0 };
+  int reply[4] = { 0, 0, 0, 0 };
+  v_repMessage(msg, adata, NULL, reply);
+}
+
+void stepScene()
+{
+  g_mockScene.step();
+  sendMessage(sim_message_eventcallback_modulehandle);
+}
+
+MockPlugin::MockPlugin(const char *name)
+{
+  g_benchName   = name;
+  m_dir         = enterTempDir(name);
+  m_savedStderr = silenceStderr();
+
+  installSimStubs();
+  Profile::init();
+  simLockInterface(1);
+  Quadcopter::init();
+  simLockInterface(0);
+}
+
+void MockPlugin::stop()
+{
+  if (m_savedStderr < 0)
+    return;
+
+  Quadcopter::all.clear();
+  Quadcopter::shutdown();
+  restoreStderr(m_savedStderr);
+  leaveTempDir(m_dir);
+  m_savedStderr = -1;
+}
+
+bool sceneFailed(int n, const char *what)
+{
+  printf("%s: %d quadcopters: FAILED: %s\n", g_benchName, n, what);
+  return false;
+}
+
+bool checkMotors(const std::vector<int>& models,
+                 float (*expected)(int obj, int motor), const char *what)
+{
+  MockLuaCallback getMotors =
+    g_mockScene.luaFunction("simExtQuadcopterGetMotorVelocities");
+  MockLuaCall call;
+
+  for (int obj : models) {
+    call.clear().addInt(obj);
+    call.call(getMotors);
+    const SLuaCallBack& p = call.frame();
+
+    bool ok = p.outputArgCount == 1 && p.outputFloat != NULL;
+    for (int m = 0; ok && m < 4; ++m)
+      ok = p.outputFloat[m] == expected(obj, m);
+    call.releaseOutput();
+
+    if (!ok)
+      return sceneFailed((int)models.size(), what);
+  }
+
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Lua Calls
+
+MockLuaCall& MockLuaCall::clear()
+{
+  m_types.clear();
+  m_ints.clear();
+  m_floats.clear();
+  m_chars.clear();
+  m_charBuffs.clear();
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addInt(int x)
+{
+  m_types.push_back(sim_lua_arg_int);
+  m_types.push_back(1);
+  m_ints.push_back(x);
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addIntTable(const int *x, int n)
+{
+  m_types.push_back(sim_lua_arg_int | sim_lua_arg_table);
+  m_types.push_back(n);
+  m_ints.insert(m_ints.end(), x, x + n);
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addFloat(float x)
+{
+  m_types.push_back(sim_lua_arg_float);
+  m_types.push_back(1);
+  m_floats.push_back(x);
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addFloatTable(const float *x, int n)
+{
+  m_types.push_back(sim_lua_arg_float | sim_lua_arg_table);
+  m_types.push_back(n);
+  m_floats.insert(m_floats.end(), x, x + n);
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addString(const char *s)
+{
+  m_types.push_back(sim_lua_arg_string);
+  m_types.push_back(1);
+  m_chars.insert(m_chars.end(), s, s + strlen(s) + 1);
+  return *this;
+}
+
+MockLuaCall& MockLuaCall::addCharBuff(const void *data, int n)
+{
+  m_types.push_back(sim_lua_arg_charbuff);
+  m_types.push_back(n);
+  m_charBuffs.insert(m_charBuffs.end(), (const char *)data,
+                     (const char *)data + n);
+  return *this;
+}
+
+void MockLuaCall::call(MockLuaCallback fn)
+{
+  releaseOutput();
+
+  SLuaCallBack& p = m_frame;
+  p.inputArgCount       = (simInt)(m_types.size() / 2);
+  p.inputArgTypeAndSize = m_types.empty()  ? NULL : &m_types[0];
+  p.inputInt            = m_ints.empty()   ? NULL : &m_ints[0];
+  p.inputFloat          = m_floats.empty() ? NULL : &m_floats[0];
+  p.inputChar           = m_chars.empty()  ? NULL : &m_chars[0];
+  p.inputCharBuff       = m_charBuffs.empty() ? NULL : &m_charBuffs[0];
+
+  fn(&p);
+}
+
+void MockLuaCall::releaseOutput()
+{
+  SLuaCallBack& p = m_frame;
+
+  simChar **buffers[] = {
+    (simChar **)&p.outputArgTypeAndSize, (simChar **)&p.outputInt,
+    (simChar **)&p.outputFloat,          (simChar **)&p.outputChar,
+    (simChar **)&p.outputBool,           &p.outputCharBuff,
+  };
+
+  for (simChar **b : buffers) {
+    if (*b != NULL) {
+      simReleaseBuffer(*b);
+      *b = NULL;
+    }
+  }
+
+  p.outputArgCount = 0;
+}
@@ -0,0 +1,216 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SimStubs.h --- Mock V-REP scene for running the plug-in in benchmarks.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+
+#ifndef V_REP_EXT_QUADCOPTER_SIM_STUBS_H_INCLUDED
+#define V_REP_EXT_QUADCOPTER_SIM_STUBS_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "v_repLib.h"
+
+// Scene sizes the plug-in benchmarks measure.
+static const int g_sceneSizes[] = { 1, 10, 100, 1000 };
+
+// Bit fields V-REP sets when the scene changes.
+#define SCENE_CHANGED  0x17f
+
+// Spacing of quadcopters on the ground grid (m).
+#define GRID_SPACING  5.0f
+
+// An object in the mock scene.
+struct MockObject
+{
+  int                  parent;
+  std::vector<int>     children;
+  std::string          name;
+  std::vector<uint8_t> customData;  // under header DATA_ID
+  float                matrix[12];  // 3x4 world transform
+  float                linVel[3];
+  float                angVel[3];
+};
+
+typedef void (*MockLuaCallback)(SLuaCallBack *);
+
+// A registered Lua function.
+struct MockLuaFunction
+{
+  std::string      name;
+  std::string      tip;         // calling syntax
+  std::vector<int> args;
+  MockLuaCallback  callback;
+};
+
+// A scene of mock objects standing in for V-REP.  Object handles are
+// indices into the scene.
+class MockScene
+{
+public:
+  MockScene() { clear(); }
+
+  // Remove every object and signal and reset the clock and counters.
+  // Lua functions stay registered.
+  void clear();
+
+  // Add an object at a world position, returning its handle.
+  int add(const char *name, int parent, float x, float y, float z);
+
+  // Append a field in the plug-in's custom data format.
+  void addField(int obj, uint32_t field, const std::vector<uint8_t>& data);
+  void addField(int obj, uint32_t field) { addField(obj, field, {}); }
+
+  // Add a quadcopter model in the layout the plug-in expects: a model
+  // object with the quadcopter field, a body, a target and four
+  // motors.  Returns the model handle.
+  int addQuadcopter(float x, float y, float z);
+
+  // Add "n" quadcopters 1 m up on a square grid, GRID_SPACING apart,
+  // returning their model handles.
+  std::vector<int> addGrid(int n);
+
+  // Return the grid position of the "i"th of "n" quadcopters.
+  static void gridPosition(int i, int n, float *x, float *y);
+
+  MockObject& object(int obj) { return m_objects[obj]; }
+  int size() const { return (int)m_objects.size(); }
+
+  // Advance the clock by one step.
+  void step() { time += dt; }
+
+  float time;
+  float dt;
+
+  // Number of "simCreateBuffer" calls not yet released, and in total.
+  int      liveBuffers;
+  uint64_t buffersCreated;
+
+  // Message from the last "simSetLastError", and the number of calls.
+  char lastError[256];
+  int  errors;
+
+  // Values set through "simSetStringSignal", by signal name.
+  std::map<std::string, std::string> signals;
+
+  // Lua functions registered through "simRegisterCustomLuaFunction".
+  std::map<std::string, MockLuaFunction> luaFunctions;
+
+  // Return the callback of a registered Lua function, or NULL.
+  MockLuaCallback luaFunction(const char *name) const
+  {
+    auto i = luaFunctions.find(name);
+    return i == luaFunctions.end() ? NULL : i->second.callback;
+  }
+
+private:
+  std::vector<MockObject> m_objects;
+};
+
+// A synthetic call frame for a custom Lua function, laid out the way
+// V-REP passes arguments to plug-ins.  Arguments are added in order
+// and kept between calls, so the same frame can be called repeatedly.
+class MockLuaCall
+{
+public:
+  MockLuaCall() { memset(&m_frame, 0, sizeof(m_frame)); }
+  ~MockLuaCall() { releaseOutput(); }
+
+  MockLuaCall(const MockLuaCall&) = delete;
+  MockLuaCall& operator=(const MockLuaCall&) = delete;
+
+  // Remove all arguments.
+  MockLuaCall& clear();
+
+  MockLuaCall& addInt(int x);
+  MockLuaCall& addIntTable(const int *x, int n);
+  MockLuaCall& addFloat(float x);
+  MockLuaCall& addFloatTable(const float *x, int n);
+  MockLuaCall& addString(const char *s);
+  MockLuaCall& addCharBuff(const void *data, int n);
+
+  // Call "fn" with the arguments, releasing the outputs of the
+  // previous call first.
+  void call(MockLuaCallback fn);
+
+  // Return the frame, holding the outputs of the last call.
+  const SLuaCallBack& frame() const { return m_frame; }
+
+  // Release the output buffers of the last call, as V-REP does once
+  // it has copied them to Lua.
+  void releaseOutput();
+
+private:
+  SLuaCallBack       m_frame;
+  std::vector<int>   m_types;         // (type, table size) pairs
+  std::vector<int>   m_ints;
+  std::vector<float> m_floats;
+  std::vector<char>  m_chars;
+  std::vector<char>  m_charBuffs;
+};
+
+// The scene used by the stubs.
+extern MockScene g_mockScene;
+
+// Return the size requested for a buffer from "simCreateBuffer".
+size_t mockBufferSize(const void *buffer);
+
+// Move into a new temporary directory for files the plug-in writes,
+// returning its name, and remove it again.
+std::string enterTempDir(const char *prefix);
+void leaveTempDir(const std::string& dir);
+
+// Send stderr to /dev/null, returning a descriptor that restores it.
+int silenceStderr();
+void restoreStderr(int saved);
+
+// Point the V-REP API function pointers at implementations that use
+// "g_mockScene".  API functions the plug-in does not use are left
+// unset.
+void installSimStubs();
+
+// Send the plug-in a message as V-REP does.
+void sendMessage(int msg, int flags = 0);
+
+// Advance the scene clock and send the plug-in the message V-REP sends
+// each simulation step.
+void stepScene();
+
+// Runs the plug-in against "g_mockScene" for a benchmark named
+// "name": moves into a temporary directory for the files it writes,
+// silences stderr, where it reports every quadcopter it finds, and
+// initializes it.  "stop" shuts the plug-in down and undoes the rest.
+class MockPlugin
+{
+public:
+  explicit MockPlugin(const char *name);
+  ~MockPlugin() { stop(); }
+
+  MockPlugin(const MockPlugin&) = delete;
+  MockPlugin& operator=(const MockPlugin&) = delete;
+
+  void stop();
+
+private:
+  std::string m_dir;
+  int         m_savedStderr;    // -1 once stopped
+};
+
+// Print a failed check in a scene of "n" quadcopters under the name of
+// the running benchmark, and return false.
+bool sceneFailed(int n, const char *what);
+
+// Return true if the script of each quadcopter in "models" gets motor
+// velocities "expected(obj, motor)" from the plug-in.  Otherwise
+// report "what" through "sceneFailed" and return false.
+bool checkMotors(const std::vector<int>& models,
+                 float (*expected)(int obj, int motor), const char *what);
+
+#endif   // !defined V_REP_EXT_QUADCOPTER_SIM_STUBS_H_INCLUDED
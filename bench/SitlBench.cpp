@@ -0,0 +1,207 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SitlBench.cpp --- Round trip through the SITL bridge.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// A stand-in flight stack in a separate process maps the SITL bridge,
+// attaches every vehicle and answers each sensor packet with fixed
+// motor commands.  For swarms of 1 to 1,000 quadcopters this reports
+// the time per step from sending the packets to having every
+// vehicle's motor commands, and checks that the commands reach the
+// quadcopter scripts.  Results go to a JSON file (default
+// "sitl_bench.json", or the first argument).
+//
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Profile.h"
+#include "SitlBridge.h"
+
+// Samples per scene size and minimum time per sample (s).
+#define SAMPLES         15
+#define SAMPLE_SECONDS  0.02
+
+// The motor command the flight stack sends for a vehicle.
+static float stackMotor(int obj, int motor)
+{
+  return (float)obj + 0.25f * motor;
+}
+
+// The stand-in flight stack.  Attaches every vehicle in the bridge
+// named "name", writes a byte to "readyFd", then answers every step
+// until the bridge goes away.
+static void flightStack(const char *name, int readyFd)
+{
+  int fd = shm_open(name, O_RDWR, 0);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+    _exit(1);
+
+  void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    _exit(1);
+
+  SitlHeader *h = (SitlHeader *)p;
+  if (h->magic.load(std::memory_order_acquire) != SITL_MAGIC)
+    _exit(1);
+
+  SitlSlot *slots = (SitlSlot *)((uint8_t *)p + h->slotsOffset);
+  for (uint32_t i = 0; i < h->count; ++i)
+    slots[i].attached.store(1, std::memory_order_release);
+
+  uint32_t last = h->step.load(std::memory_order_acquire);
+  bool     spin = std::thread::hardware_concurrency() > 1;
+
+  if (write(readyFd, "r", 1) != 1)
+    _exit(1);
+
+  for (;;) {
+    uint32_t step;
+    for (unsigned n = 0;
+         (step = h->step.load(std::memory_order_acquire)) == last; ++n) {
+      if (!spin || n > 10000)
+        sitlWait(&h->step, last, NULL);
+    }
+
+    if (h->magic.load(std::memory_order_acquire) != SITL_MAGIC)
+      _exit(0);
+    last = step;
+
+    uint32_t answered = 0;
+    for (uint32_t i = 0; i < h->count; ++i) {
+      SitlSlot& s = slots[i];
+      if (s.request.load(std::memory_order_acquire) != step)
+        continue;
+
+      for (int m = 0; m < 4; ++m)
+        s.motors[m] = stackMotor(s.obj, m);
+      s.ack.store(step, std::memory_order_release);
+      ++answered;
+    }
+
+    if (answered > 0) {
+      h->answers.fetch_add(answered, std::memory_order_release);
+      sitlWake(&h->answers);
+    }
+  }
+}
+
+// Measure one scene size.  Returns false if the bridge failed.
+static bool runScene(BenchSuite& suite, const char *shmName, int n)
+{
+  g_mockScene.clear();
+  std::vector<int> models = g_mockScene.addGrid(n);
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  int ready[2];
+  if (pipe(ready) != 0)
+    return false;
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(ready[0]);
+    flightStack(shmName, ready[1]);
+  }
+
+  char c;
+  close(ready[1]);
+  bool ok = pid > 0 && read(ready[0], &c, 1) == 1;
+  close(ready[0]);
+
+  // Time the bridge's profile section over enough steps to fill each
+  // sample.
+  const TimeHistogram& rt = Profile::section(PROF_SITL);
+  std::vector<double> ns;
+  uint64_t steps = 0;
+
+  for (int s = 0; ok && s < SAMPLES; ++s) {
+    uint64_t count0 = rt.count();
+    double   sum0   = rt.mean() * count0;
+    double   t0     = benchNow();
+
+    do {
+      stepScene();
+    } while (benchNow() - t0 < SAMPLE_SECONDS);
+
+    uint64_t k = rt.count() - count0;
+    ns.push_back(Profile::toNanos(rt.mean() * rt.count() - sum0) / k);
+    steps += k;
+  }
+
+  double p99 = Profile::toNanos(rt.percentile(0.99));
+  double max = Profile::toNanos((double)rt.max());
+
+  if (ok)
+    ok = checkMotors(models, stackMotor,
+                     "motors do not follow the flight stack");
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+
+  if (pid > 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+  }
+
+  if (!ok)
+    return sceneFailed(n, "bridge failed");
+
+  char name[64];
+  snprintf(name, sizeof(name), "roundTrip/%d", n);
+  const BenchResult& r = suite.add(name, ns, steps / SAMPLES);
+  printf("sitl_bench: %d quadcopters: %.1f us per step, p99 %.1f us, "
+         "max %.1f us\n", n, r.mean / 1e3, p99 / 1e3, max / 1e3);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "sitl_bench.json";
+
+  if (out[0] != '/') {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+      out = std::string(cwd) + "/" + out;
+  }
+
+  char shmName[64];
+  snprintf(shmName, sizeof(shmName), "/quadcopter_sitl_bench_%d",
+           (int)getpid());
+  setenv("QUADCOPTER_SITL_SHM", shmName, 1);
+  setenv("QUADCOPTER_SITL_TIMEOUT_MS", "1000", 1);
+
+  MockPlugin plugin("sitl_bench");
+  BenchSuite suite("sitl_bench", SAMPLES);
+  bool ok = true;
+  for (int n : g_sceneSizes) {
+    if (!runScene(suite, shmName, n)) {
+      ok = false;
+      break;
+    }
+  }
+
+  plugin.stop();
+
+  if (!suite.writeJSON(out.c_str()) || !ok)
+    return 1;
+
+  printf("sitl_bench: wrote %s\n", out.c_str());
+  return 0;
+}
@@ -0,0 +1,253 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SnapshotBench.cpp --- Cost and fidelity of plug-in state snapshots.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Takes a snapshot part way through a run of 1 to 1,000 quadcopters
+// whose bodies bob up and down with the clock, records the sensor
+// readings and motor outputs of the steps that follow, then restores
+// the snapshot, winds the mock clock back and checks that the same
+// steps give the same values bit for bit and the same sensor log.  It also checks
+// that malformed snapshots are turned away without changing anything.
+// Results go to a JSON file (default "snapshot_bench.json", or the
+// first argument).  Exits with status 1 if any check fails.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+#include "Profile.h"
+#include "Quadcopter.h"
+#include "Snapshot.h"
+
+// Steps before the snapshot, and steps replayed after it.
+#define WARMUP_STEPS  20
+#define REPLAY_STEPS  20
+
+// Return the contents of a file, or the empty string.
+static std::string readFile(const char *name)
+{
+  std::string data;
+  FILE *f = fopen(name, "rb");
+  if (f == NULL)
+    return data;
+
+  char buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.append(buf, n);
+  fclose(f);
+  return data;
+}
+
+// A scene of quadcopters and the script calls made on every step.
+class Scene
+{
+public:
+  explicit Scene(int n)
+    : m_setAccel(g_mockScene.luaFunction("simExtQuadcopterSetAccelData")),
+      m_readSensors(g_mockScene.luaFunction("simExtQuadcopterReadSensors")),
+      m_getMotors(
+        g_mockScene.luaFunction("simExtQuadcopterGetMotorVelocities"))
+  {
+    g_mockScene.clear();
+    m_models = g_mockScene.addGrid(n);
+  }
+
+  const std::vector<int>& models() const { return m_models; }
+
+  // Run one step: move the bodies for the new time, let the plug-in
+  // step, and make every quadcopter's script calls.  The readings and
+  // motor outputs are appended to "trace".
+  void step(std::vector<double>& trace)
+  {
+    float t = g_mockScene.time + g_mockScene.dt;
+    for (size_t i = 0; i < m_models.size(); ++i) {
+      MockObject& body = g_mockScene.object(m_models[i] + 1);
+      body.matrix[11] = 1.0f + 0.2f * sinf(3.0f * t + (float)i);
+    }
+
+    stepScene();
+
+    for (int obj : m_models) {
+      float a[3] = { 0.0f, 0.0f, 9.81f + 0.1f * sinf(t) };
+      m_call.clear().addInt(obj).addFloatTable(a, 3);
+      m_call.call(m_setAccel);
+      m_call.clear().addInt(obj);
+      m_call.call(m_readSensors);
+      m_call.call(m_getMotors);
+
+      const SLuaCallBack& p = m_call.frame();
+      for (int k = 0; k < 4; ++k)
+        trace.push_back(p.outputFloat[k]);
+
+      QuadcopterSnapshot s = Quadcopter::published(obj)->load();
+      trace.push_back(s.gpsPosition.lat);
+      trace.push_back(s.gpsPosition.lon);
+      trace.push_back(s.gpsPosition.altitude);
+      trace.push_back(s.pressure);
+      trace.push_back(s.agl);
+      for (int k = 0; k < 3; ++k) {
+        trace.push_back(s.accel[k]);
+        trace.push_back(s.magField[k]);
+      }
+    }
+  }
+
+private:
+  std::vector<int> m_models;
+  MockLuaCallback  m_setAccel;
+  MockLuaCallback  m_readSensors;
+  MockLuaCallback  m_getMotors;
+  MockLuaCall      m_call;
+};
+
+// Return true if a malformed copy of "snap" is turned away and leaves
+// the plug-in's state as it was.
+static bool checkRejected(int n, const std::vector<uint8_t>& snap,
+                          const char *what)
+{
+  std::vector<uint8_t> before, after;
+  Quadcopter::snapshot(before);
+
+  std::vector<uint8_t> bad = snap;
+  if (strcmp(what, "truncated") == 0) {
+    bad.pop_back();
+  } else if (strcmp(what, "wrong version") == 0) {
+    SnapshotHeader h;
+    memcpy(&h, &bad[0], sizeof(h));
+    ++h.version;
+    memcpy(&bad[0], &h, sizeof(h));
+  } else {
+    // A record that claims to be longer than it is.
+    SnapshotRecord rec;
+    size_t last = sizeof(SnapshotHeader);
+    memcpy(&rec, &bad[last], sizeof(rec));
+    rec.size += 4;
+    memcpy(&bad[last], &rec, sizeof(rec));
+    bad.insert(bad.end(), 4, 0);
+    SnapshotHeader h;
+    memcpy(&h, &bad[0], sizeof(h));
+    h.size = bad.size();
+    memcpy(&bad[0], &h, sizeof(h));
+  }
+
+  if (Quadcopter::restore(bad.data(), bad.size()) != -1)
+    return sceneFailed(n, what);
+
+  Quadcopter::snapshot(after);
+  if (before != after)
+    return sceneFailed(n, "rejected snapshot changed the state");
+  return true;
+}
+
+// Measure one scene size.  Returns false if a check failed.
+static bool runScene(BenchSuite& suite, int n)
+{
+  Scene scene(n);
+  std::vector<double> trace, replay;
+  trace.reserve((size_t)n * REPLAY_STEPS * 15);
+
+  sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  for (int s = 0; s < WARMUP_STEPS; ++s)
+    scene.step(trace);
+  trace.clear();
+
+  std::vector<uint8_t> snap;
+  Quadcopter::snapshot(snap);
+  float    time = g_mockScene.time;
+  uint64_t step = Quadcopter::frame().step;
+
+  char log[64];
+  snprintf(log, sizeof(log), "quadrotor_%d_log.csv", scene.models()[0]);
+
+  for (int s = 0; s < REPLAY_STEPS; ++s)
+    scene.step(trace);
+  std::vector<uint8_t> end;
+  Quadcopter::snapshot(end);          // flushes the logs
+  std::string logA = readFile(log);
+
+  char name[64];
+  snprintf(name, sizeof(name), "snapshot/%d", n);
+  double saveNs = suite.run(name, [&] {
+    Quadcopter::snapshot(end);
+    benchKeep(end.size());
+  }).mean;
+
+  // Restoring the same snapshot over and over ends where one does.
+  bool ok = true;
+  snprintf(name, sizeof(name), "restore/%d", n);
+  double restoreNs = suite.run(name, [&] {
+    if (Quadcopter::restore(snap.data(), snap.size()) != n)
+      ok = false;
+  }).mean;
+  if (!ok)
+    return sceneFailed(n, "not every quadcopter restored");
+  if (Quadcopter::frame().step != step)
+    return sceneFailed(n, "step counter not restored");
+
+  g_mockScene.time = time;
+  for (int s = 0; s < REPLAY_STEPS; ++s)
+    scene.step(replay);
+  Quadcopter::snapshot(end);
+  std::string logB = readFile(log);
+
+  if (replay.size() != trace.size() ||
+      memcmp(replay.data(), trace.data(), trace.size() * sizeof(double)) != 0)
+    ok = sceneFailed(n, "replayed steps differ");
+  if (logA.empty() || logA != logB)
+    ok = sceneFailed(n, "sensor log differs after replay");
+
+  ok = ok && checkRejected(n, snap, "truncated") &&
+       checkRejected(n, snap, "wrong version") &&
+       checkRejected(n, snap, "overlong record");
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+
+  if (ok) {
+    printf("snapshot_bench: %d quadcopters: %zu bytes, snapshot %.3f ms, "
+           "restore %.3f ms\n", n, snap.size(), saveNs / 1e6,
+           restoreNs / 1e6);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "snapshot_bench.json";
+  char cwd[4096];
+
+  if (out[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+    out = std::string(cwd) + "/" + out;
+
+  MockPlugin plugin("snapshot_bench");
+
+  BenchSuite suite("snapshot_bench");
+  bool ok = true;
+  for (int n : g_sceneSizes) {
+    if (!runScene(suite, n)) {
+      ok = false;
+      break;
+    }
+  }
+
+  plugin.stop();
+
+  if (!suite.writeJSON(out.c_str()) || !ok)
+    return 1;
+
+  printf("snapshot_bench: wrote %s\n", out.c_str());
+  return 0;
+}
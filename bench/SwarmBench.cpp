@@ -0,0 +1,207 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// SwarmBench.cpp --- Plug-in cost as the number of quadcopters grows.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Builds mock scenes of 1 to 10,000 quadcopter models and drives the
+// plug-in through "v_repMessage" and its Lua functions the way V-REP
+// and the quadcopter child scripts do, timing for each scene size:
+//
+// - a scene rebuild (the "scene content changed" message),
+// - one Lua callback dispatch ("simExtQuadcopterSetAccelData"),
+// - a full control step: the module handle message followed by each
+//   quadcopter's script setting its IMU data, reading its sensors
+//   and getting its motor velocities.
+//
+// Results go to stdout and to a CSV file (default "swarm_bench.csv",
+// or the first argument) along with the peak resident set size.  The
+// largest scene can be limited with a second argument.  Sensor logs
+// are written to a temporary directory that is removed afterwards.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+
+#include "bench/Bench.h"
+#include "bench/SimStubs.h"
+
+// Scene sizes to measure.
+static const int g_sizes[] = { 1, 10, 100, 1000, 10000 };
+
+// Minimum time spent measuring each quantity, and minimum samples.
+#define MIN_SECONDS  0.5
+#define MIN_SAMPLES  3
+
+// Results for one scene size.
+struct SwarmResult
+{
+  int    vehicles;
+  double rebuildUs;
+  double dispatchNs;
+  double stepUs;
+  long   peakRSSKb;
+};
+
+// Lua functions called by every quadcopter script each step.
+struct ScriptFunctions
+{
+  MockLuaCallback setAccel;
+  MockLuaCallback setGyro;
+  MockLuaCallback readSensors;
+  MockLuaCallback getMotors;
+};
+
+static bool lookupScriptFunctions(ScriptFunctions& fns)
+{
+  fns.setAccel    = g_mockScene.luaFunction("simExtQuadcopterSetAccelData");
+  fns.setGyro     = g_mockScene.luaFunction("simExtQuadcopterSetGyroData");
+  fns.readSensors = g_mockScene.luaFunction("simExtQuadcopterReadSensors");
+  fns.getMotors   = g_mockScene.luaFunction(
+    "simExtQuadcopterGetMotorVelocities");
+
+  return fns.setAccel != NULL && fns.setGyro != NULL &&
+         fns.readSensors != NULL && fns.getMotors != NULL;
+}
+
+// Time "op" repeatedly for at least MIN_SECONDS, returning the time
+// per call of each sample in nanoseconds.
+template <class F>
+static std::vector<double> sample(F op)
+{
+  std::vector<double> ns;
+  double start = benchNow();
+
+  while ((int)ns.size() < MIN_SAMPLES || benchNow() - start < MIN_SECONDS) {
+    double t0 = benchNow();
+    op();
+    ns.push_back((benchNow() - t0) * 1e9);
+  }
+
+  return ns;
+}
+
+static long peakRSSKb()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static SwarmResult runScene(BenchSuite& suite, const ScriptFunctions& fns,
+                            int n)
+{
+  SwarmResult r;
+  char name[64];
+
+  r.vehicles = n;
+
+  g_mockScene.clear();
+  std::vector<int> models = g_mockScene.addGrid(n);
+
+  snprintf(name, sizeof(name), "rebuild/%d", n);
+  r.rebuildUs = suite.add(name, sample([] {
+    sendMessage(sim_message_eventcallback_instancepass, SCENE_CHANGED);
+  }), 1).mean / 1e3;
+
+  MockLuaCall accel, gyro, id;
+  static const float a[3] = { 0.0f, 0.0f, 9.81f };
+  static const float g[3] = { 0.0f, 0.0f, 0.0f };
+
+  sendMessage(sim_message_eventcallback_moduleopen);
+
+  size_t next = 0;
+  snprintf(name, sizeof(name), "dispatch/%d", n);
+  r.dispatchNs = suite.run(name, [&] {
+    accel.clear().addInt(models[next]).addFloatTable(a, 3);
+    accel.call(fns.setAccel);
+    next = next + 1 < models.size() ? next + 1 : 0;
+  }).mean;
+
+  snprintf(name, sizeof(name), "step/%d", n);
+  r.stepUs = suite.add(name, sample([&] {
+    stepScene();
+
+    for (int obj : models) {
+      accel.clear().addInt(obj).addFloatTable(a, 3);
+      accel.call(fns.setAccel);
+      gyro.clear().addInt(obj).addFloatTable(g, 3);
+      gyro.call(fns.setGyro);
+      id.clear().addInt(obj);
+      id.call(fns.readSensors);
+      id.call(fns.getMotors);
+    }
+  }), 1).mean / 1e3;
+
+  sendMessage(sim_message_eventcallback_moduleclose);
+
+  r.peakRSSKb = peakRSSKb();
+  return r;
+}
+
+int main(int argc, char **argv)
+{
+  std::string out = argc > 1 ? argv[1] : "swarm_bench.csv";
+  int maxVehicles = argc > 2 ? atoi(argv[2]) : 10000;
+
+  if (out[0] != '/') {
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+      out = std::string(cwd) + "/" + out;
+  }
+
+  // Every quadcopter keeps its sensor log open.
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  MockPlugin plugin("swarm_bench");
+
+  ScriptFunctions fns;
+  if (!lookupScriptFunctions(fns)) {
+    plugin.stop();
+    fprintf(stderr, "swarm_bench: Lua functions not registered\n");
+    return 1;
+  }
+
+  BenchSuite suite("swarm_bench", 5);
+  std::vector<SwarmResult> results;
+  for (int n : g_sizes) {
+    if (n <= maxVehicles)
+      results.push_back(runScene(suite, fns, n));
+  }
+
+  plugin.stop();
+
+  FILE *f = fopen(out.c_str(), "w");
+  if (f == NULL) {
+    fprintf(stderr, "swarm_bench: cannot write '%s'\n", out.c_str());
+    return 1;
+  }
+
+  fprintf(f, "vehicles,rebuild_us,dispatch_ns,step_us,step_per_vehicle_us,"
+          "peak_rss_kb\n");
+  printf("\n%8s %12s %12s %12s %14s %12s\n", "vehicles", "rebuild us",
+         "dispatch ns", "step us", "step/vehicle", "peak RSS kB");
+
+  for (const SwarmResult& r : results) {
+    fprintf(f, "%d,%.3f,%.3f,%.3f,%.3f,%ld\n", r.vehicles, r.rebuildUs,
+            r.dispatchNs, r.stepUs, r.stepUs / r.vehicles, r.peakRSSKb);
+    printf("%8d %12.1f %12.1f %12.1f %14.2f %12ld\n", r.vehicles,
+           r.rebuildUs, r.dispatchNs, r.stepUs, r.stepUs / r.vehicles,
+           r.peakRSSKb);
+  }
+
+  fclose(f);
+  printf("swarm_bench: wrote %s\n", out.c_str());
+  return 0;
+}
@@ -0,0 +1,158 @@
+// -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 2 -*-
+//
+// TerrainBench.cpp --- Terrain height query benchmark.
+//
+// Copyright (C) 2013, Galois, Inc.
+// All Rights Reserved.
+//
+// Writes a few synthetic tiles to a temporary directory and times
+// one million height queries through "TerrainMap".  Runs without
+// V-REP.
+//
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Terrain.h"
+
+#define QUERIES  1000000
+#define SAMPLES  1025
+#define SPAN     1000.0
+
+static const GPSSimConfig g_config = {
+  10, true, 525187, 5040862, 10, 0.0, 0.1, 0.0, 0.0, 0.0, 0.0, 0.0,
+};
+
+static double nowSec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Write a float tile of rolling hills for tile index (tx, ty).
+static bool writeTile(const std::string& dir, long tx, long ty)
+{
+  TerrainTileHeader hdr;
+  memcpy(hdr.magic, "QDEM", 4);
+  hdr.version    = TERRAIN_TILE_VERSION;
+  hdr.sampleType = TERRAIN_SAMPLE_FLOAT32;
+  hdr.samples    = SAMPLES;
+  hdr.easting    = tx * SPAN;
+  hdr.northing   = ty * SPAN;
+  hdr.spacing    = SPAN / (SAMPLES - 1);
+  hdr.scale      = 1.0f;
+  hdr.offset     = 0.0f;
+
+  std::vector<float> data((size_t)SAMPLES * SAMPLES);
+  for (int y = 0; y < SAMPLES; ++y) {
+    for (int x = 0; x < SAMPLES; ++x) {
+      double e = hdr.easting  + x * hdr.spacing;
+      double n = hdr.northing + y * hdr.spacing;
+      data[(size_t)y * SAMPLES + x] =
+        (float)(50.0 + 20.0 * sin(e * 0.003) * cos(n * 0.002));
+    }
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "/%ld_%ld.qdem", tx, ty);
+  FILE *f = fopen((dir + name).c_str(), "wb");
+  if (f == NULL)
+    return false;
+
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  fwrite(&data[0], sizeof(float), data.size(), f);
+  fclose(f);
+  return true;
+}
+
+int main()
+{
+  char tmpl[] = "/tmp/terrain_bench_XXXXXX";
+  if (mkdtemp(tmpl) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  std::string dir(tmpl);
+  long tx0 = (long)floor(g_config.originX / SPAN);
+  long ty0 = (long)floor(g_config.originY / SPAN);
+
+  // A 3x3 block of tiles around the origin.
+  std::vector<std::string> files;
+  for (long ty = ty0 - 1; ty <= ty0 + 1; ++ty) {
+    for (long tx = tx0 - 1; tx <= tx0 + 1; ++tx) {
+      if (!writeTile(dir, tx, ty)) {
+        fprintf(stderr, "writing tiles failed\n");
+        return 1;
+      }
+      char name[64];
+      snprintf(name, sizeof(name), "/%ld_%ld.qdem", tx, ty);
+      files.push_back(dir + name);
+    }
+  }
+
+  TerrainMap terrain(dir, g_config, SPAN);
+
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> near(-400.0f, 400.0f);
+  std::vector<float> xs(QUERIES), ys(QUERIES);
+
+  // Vehicles move slowly, so successive queries are mostly within one
+  // tile; the "walk" pattern reflects that and "scatter" does not.
+  float x = 0.0f, y = 0.0f;
+  for (int i = 0; i < QUERIES; ++i) {
+    x += near(gen) * 0.001f;
+    y += near(gen) * 0.001f;
+    xs[i] = x;
+    ys[i] = y;
+  }
+
+  volatile float sink = 0.0f;
+  double t0 = nowSec();
+  for (int i = 0; i < QUERIES; ++i)
+    sink = sink + terrain.groundLocal(xs[i], ys[i]);
+  double walk = nowSec() - t0;
+
+  for (int i = 0; i < QUERIES; ++i) {
+    xs[i] = near(gen) * 3.0f;
+    ys[i] = near(gen) * 3.0f;
+  }
+
+  t0 = nowSec();
+  for (int i = 0; i < QUERIES; ++i)
+    sink = sink + terrain.groundLocal(xs[i], ys[i]);
+  double scatter = nowSec() - t0;
+
+  int latlonQueries = QUERIES / 10;
+  t0 = nowSec();
+  for (int i = 0; i < latlonQueries; ++i) {
+    float h = 0.0f;
+    terrain.heightAtLatLon(45.52 + xs[i] * 1e-6, -122.68 + ys[i] * 1e-6, &h);
+    sink = sink + h;
+  }
+  double latlon = nowSec() - t0;
+
+  printf("terrain walk:    %8.2f ns/query (%d queries)\n",
+         walk * 1e9 / QUERIES, QUERIES);
+  printf("terrain scatter: %8.2f ns/query (%d queries)\n",
+         scatter * 1e9 / QUERIES, QUERIES);
+  printf("terrain lat/lon: %8.2f ns/query (%d queries)\n",
+         latlon * 1e9 / latlonQueries, latlonQueries);
+  printf("tiles loaded:    %zu\n", terrain.tilesLoaded());
+
+  terrain.clear();
+  for (auto& f : files)
+    unlink(f.c_str());
+  rmdir(dir.c_str());
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+# -*- Mode: Python; indent-tabs-mode: nil; python-indent-offset: 4 -*-
+#
+# swarm_signal.py --- Decoder for the packed swarm state signal.
+#
+# Copyright (C) 2013, Galois, Inc.
+# All Rights Reserved.
+#
+# The plug-in publishes the state of every quadcopter as one string
+# signal each step, in the layout described in "SwarmSignal.h".  A
+# remote API client can fetch the whole swarm with one call:
+#
+#   import vrep, swarm_signal
+#
+#   vrep.simxGetStringSignal(client, 'quadcopter_swarm',
+#                            vrep.simx_opmode_streaming)
+#   ...
+#   err, data = vrep.simxGetStringSignal(client, 'quadcopter_swarm',
+#                                        vrep.simx_opmode_buffer)
+#   if err == vrep.simx_return_ok:
+#       swarm = swarm_signal.decode(data)
+#       for q in swarm.quadcopters:
+#           print(q.obj, q.pose[3], q.pose[7], q.pose[11])
+#
+# Running this file decodes a signal saved to a file and prints it.
+#
+
+import collections
+import struct
+import sys
+
+SWARM_SIGNAL_MAGIC = 0x5153574d         # "QSWM"
+SWARM_SIGNAL_VERSION = 1
+
+# SwarmSignalHeader and SwarmRecord, little-endian.
+_HEADER = struct.Struct('<IHHIIQd')
+_RECORD = struct.Struct('<iI3d12f3f3f4f3f3ff3fff')
+
+Swarm = collections.namedtuple('Swarm', 'version step time quadcopters')
+
+Quadcopter = collections.namedtuple(
+    'Quadcopter',
+    'obj mode lat lon altitude pose velocity ang_vel target accel gyro '
+    'pressure mag_field agl range_down')
+
+
+class SwarmSignalError(ValueError):
+    pass
+
+
+def _record(fields):
+    f = list(fields)
+    return Quadcopter(obj=f[0], mode=f[1], lat=f[2], lon=f[3],
+                      altitude=f[4], pose=tuple(f[5:17]),
+                      velocity=tuple(f[17:20]), ang_vel=tuple(f[20:23]),
+                      target=tuple(f[23:27]), accel=tuple(f[27:30]),
+                      gyro=tuple(f[30:33]), pressure=f[33],
+                      mag_field=tuple(f[34:37]), agl=f[37],
+                      range_down=f[38])
+
+
+def decode(data):
+    """Decode a swarm signal (bytes or str) into a Swarm.
+
+    Raises SwarmSignalError if the data is not a complete signal.
+    Fields added by later versions of the layout are ignored, and
+    fields an earlier version does not have read as zero."""
+    if isinstance(data, str):
+        data = data.encode('latin-1')
+    if len(data) < _HEADER.size:
+        raise SwarmSignalError('signal too short')
+
+    (magic, version, header_size, record_size, count,
+     step, time) = _HEADER.unpack_from(data, 0)
+    if magic != SWARM_SIGNAL_MAGIC:
+        raise SwarmSignalError('bad magic number 0x%08x' % magic)
+    if header_size < _HEADER.size or \
+       header_size + count * record_size > len(data):
+        raise SwarmSignalError('signal truncated')
+
+    quadcopters = []
+    if record_size == _RECORD.size:
+        end = header_size + count * record_size
+        for fields in _RECORD.iter_unpack(data[header_size:end]):
+            quadcopters.append(_record(fields))
+    else:
+        pad = bytes(max(0, _RECORD.size - record_size))
+        for i in range(count):
+            start = header_size + i * record_size
+            raw = data[start:start + min(record_size, _RECORD.size)] + pad
+            quadcopters.append(_record(_RECORD.unpack(raw)))
+
+    return Swarm(version, step, time, quadcopters)
+
+
+def main(argv):
+    if len(argv) != 2:
+        sys.stderr.write('usage: %s SIGNAL-FILE\n' % argv[0])
+        return 2
+
+    with open(argv[1], 'rb') as f:
+        swarm = decode(f.read())
+
+    print('version %d, step %d, time %.3f s, %d quadcopters' %
+          (swarm.version, swarm.step, swarm.time, len(swarm.quadcopters)))
+    for q in swarm.quadcopters:
+        print('%6d mode %d position (%.3f, %.3f, %.3f) '
+              'target (%.3f, %.3f, %.3f) heading %.3f' %
+              ((q.obj, q.mode, q.pose[3], q.pose[7], q.pose[11]) +
+               q.target))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -19,8 +19,13 @@
 #include "v_repLib.h"
 #include "v_repExtQuadcopter.h"
 
+#include "AllocStats.h"
+#include "ApiStats.h"
 #include "Container.h"
+#include "FlightRecorder.h"
+#include "Profile.h"
 #include "Quadcopter.h"
+#include "Trace.h"
 
 #define PLUGIN_VERSION 1
 
@@ -103,6 +108,12 @@ unsigned char v_repStart(void *p_arg, int i_arg)
 {
   vrep_init();
   srand48(time(NULL));
+  Profile::init();
+  AllocStats::trackThread();
+  PerfCounters::init();
+  FlightRecorder::init();
+  Trace::init();
+  Trace::setThreadName("simulator");
 
   simLockInterface(1);
   Quadcopter::init();
@@ -115,6 +126,9 @@ unsigned char v_repStart(void *p_arg, int i_arg)
 void v_repEnd(void)
 {
   Quadcopter::all.clear();
+  Quadcopter::shutdown();
+  FlightRecorder::shutdown();
+  PerfCounters::shutdown();
   unloadVrepLibrary(g_vrepLib);
 }
 
@@ -125,6 +139,10 @@ void v_repEnd(void)
 // Handle a message from the V-REP simulator.
 void *v_repMessage(int msg, int *adata, void *data, int *reply)
 {
+  PROFILE_SCOPE(PROF_MESSAGE);
+  TRACE_SCOPE_ARG("message", "msg", msg);
+  ProfileTicks start = profileNow();
+
   void *result = NULL;
   int error_mode;
 
@@ -139,31 +157,41 @@ void *v_repMessage(int msg, int *adata, void *data, int *reply)
 
     if (scene_changed) {
       fprintf(stderr, "quadcopter: scene content changed\n");
-      Quadcopter::all.rebuild();
+      PROFILE_SCOPE(PROF_REBUILD);
+      TRACE_SCOPE("rebuild");
+      ProfileTicks t0 = profileNow();
+      Quadcopter::rebuildAll();
+      FlightRecorder::record(REC_REBUILD, (int)Quadcopter::all.size(),
+                             (int64_t)(profileNow() - t0));
+      FlightRecorder::reserve(Quadcopter::all.size(),
+                              simGetSimulationTimeStep());
     }
   }
 
   if (msg == sim_message_eventcallback_moduleopen) {
     if (data == NULL || !strcasecmp("quadcopter", (char *)data)) {
       fprintf(stderr, "quadcopter: simulation started\n");
-      Quadcopter::all.call(&Quadcopter::simulationStarted);
+      FlightRecorder::reserve(Quadcopter::all.size(),
+                              simGetSimulationTimeStep());
+      Quadcopter::startAll(error_mode);
     }
   }
 
   if (msg == sim_message_eventcallback_modulehandle) {
     if (data == NULL || !strcasecmp("quadcopter", (char *)data)) {
-      Quadcopter::all.call(&Quadcopter::simulationStepped);
+      Quadcopter::stepAll(error_mode);
     }
   }
 
   if (msg == sim_message_eventcallback_moduleclose) {
     if (data == NULL || !strcasecmp("quadcopter", (char *)data)) {
       fprintf(stderr, "quadcopter: simulation stopped\n");
-      Quadcopter::all.call(&Quadcopter::simulationStopped);
+      Quadcopter::stopAll();
     }
   }
 
   simSetIntegerParameter(sim_intparam_error_report_mode, error_mode);
+  FlightRecorder::message(msg, start);
   simLockInterface(0);
   return result;
 }